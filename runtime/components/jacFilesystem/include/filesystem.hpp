@@ -155,10 +155,69 @@ void listDirectory( const std::string& path, Yield yield, Error yieldError ) {
     ::closedir( dir );
 }
 
+// Sequential reader of a file. The file is closed when the reader is
+// destroyed. All the methods throw std::runtime_error on failure.
+class FileReader {
+public:
+    FileReader() = default;
+    explicit FileReader( const std::string& path );
+    FileReader( FileReader&& o ) { swap( o ); }
+    FileReader& operator=( FileReader&& o ) { swap( o ); return *this; }
+    ~FileReader() { close(); }
+
+    // Read up to size bytes into buffer and return the number of bytes read.
+    // Return 0 at the end of the file.
+    int read( void *buffer, int size );
+    // Return the size of the file
+    size_t size() const;
+    bool isOpen() const { return _fd >= 0; }
+    void close();
+
+private:
+    void swap( FileReader& o ) {
+        std::swap( _path, o._path );
+        std::swap( _fd, o._fd );
+    }
+
+    std::string _path;
+    int _fd = -1;
+};
+
+// Sequential writer of a file. Directories on the path are created when
+// needed. The file is closed when the writer is destroyed. All the methods
+// throw std::runtime_error on failure.
+class FileWriter {
+public:
+    FileWriter() = default;
+    explicit FileWriter( const std::string& path, bool append = false );
+    FileWriter( FileWriter&& o ) { swap( o ); }
+    FileWriter& operator=( FileWriter&& o ) { swap( o ); return *this; }
+    ~FileWriter() { close(); }
+
+    // Write the whole buffer
+    void write( const void *data, int size );
+    // Ensure the written data are persisted
+    void sync();
+    bool isOpen() const { return _fd >= 0; }
+    void close();
+
+private:
+    void swap( FileWriter& o ) {
+        std::swap( _path, o._path );
+        std::swap( _fd, o._fd );
+    }
+
+    std::string _path;
+    int _fd = -1;
+};
+
 // Ensure that directory path to a file exists. Return true if successfull.
 bool ensurePath( const std::string& path );
 std::string concatPath( std::string a, const std::string& b );
 std::string readFile( const std::string& path );
 bool fileExists( const std::string& path );
+bool directoryExists( const std::string& path );
+// Remove a file or a directory including its content. Return true if successful.
+bool removeRecursive( const std::string& path );
 
 } // namespace jac::fs
\ No newline at end of file
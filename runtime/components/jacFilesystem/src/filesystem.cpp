@@ -24,28 +24,113 @@ std::string jac::fs::concatPath( std::string a, const std::string& b ) {
 }
 
 std::string jac::fs::readFile( const std::string& path ) {
-    int fileFd = open( path.c_str(), O_RDONLY );
-    if ( fileFd < 0 )
-        throw std::runtime_error( "Cannot open " + path + ": " + std::strerror( errno ) );
-    int bytesRead;
-    std::string fContent;
-    do {
-        const int CHUNK_SIZE = 64;
-        char buffer[ CHUNK_SIZE ];
-        bytesRead = read( fileFd, buffer, CHUNK_SIZE );
-        if ( bytesRead < 0 ) {
-            close( fileFd );
-            throw std::runtime_error( "Cannot read " + path + ": " + std::strerror( errno ) );
+    FileReader file( path );
+    // Read directly into the result; the size is known upfront so there is
+    // a single allocation in the common case
+    std::string fContent( file.size(), '\0' );
+    size_t total = 0;
+    while ( true ) {
+        if ( total == fContent.size() ) {
+            // The file might have grown since we asked for its size
+            const int CHUNK_SIZE = 512;
+            fContent.resize( total + CHUNK_SIZE );
         }
-        std::copy_n( buffer, bytesRead, std::back_inserter( fContent ) );
-    } while ( bytesRead != 0 );
-    close( fileFd );
+        int bytesRead = file.read( &fContent[ total ], fContent.size() - total );
+        if ( bytesRead == 0 )
+            break;
+        total += bytesRead;
+    }
+    fContent.resize( total );
     return fContent;
 }
 
+jac::fs::FileReader::FileReader( const std::string& path )
+    : _path( path ), _fd( open( path.c_str(), O_RDONLY ) )
+{
+    if ( _fd < 0 )
+        throw std::runtime_error( "Cannot open " + path + ": " + std::strerror( errno ) );
+}
+
+int jac::fs::FileReader::read( void *buffer, int size ) {
+    int bytesRead = ::read( _fd, buffer, size );
+    if ( bytesRead < 0 )
+        throw std::runtime_error( "Cannot read " + _path + ": " + std::strerror( errno ) );
+    return bytesRead;
+}
+
+size_t jac::fs::FileReader::size() const {
+    struct stat fileStat;
+    if ( fstat( _fd, &fileStat ) < 0 )
+        throw std::runtime_error( "Cannot stat " + _path + ": " + std::strerror( errno ) );
+    return fileStat.st_size;
+}
+
+void jac::fs::FileReader::close() {
+    if ( _fd < 0 )
+        return;
+    ::close( _fd );
+    _fd = -1;
+}
+
+jac::fs::FileWriter::FileWriter( const std::string& path, bool append )
+    : _path( path )
+{
+    if ( !ensurePath( path ) )
+        throw std::runtime_error( "Cannot create path " + path + ": " + std::strerror( errno ) );
+    _fd = open( path.c_str(), O_WRONLY | O_CREAT | ( append ? O_APPEND : O_TRUNC ) );
+    if ( _fd < 0 )
+        throw std::runtime_error( "Cannot open " + path + ": " + std::strerror( errno ) );
+}
+
+void jac::fs::FileWriter::write( const void *data, int size ) {
+    const char *ptr = static_cast< const char * >( data );
+    while ( size > 0 ) {
+        int written = ::write( _fd, ptr, size );
+        if ( written < 0 )
+            throw std::runtime_error( "Cannot write " + _path + ": " + std::strerror( errno ) );
+        ptr += written;
+        size -= written;
+    }
+}
+
+void jac::fs::FileWriter::sync() {
+    if ( fsync( _fd ) < 0 )
+        throw std::runtime_error( "Cannot sync " + _path + ": " + std::strerror( errno ) );
+}
+
+void jac::fs::FileWriter::close() {
+    if ( _fd < 0 )
+        return;
+    ::close( _fd );
+    _fd = -1;
+}
+
 bool jac::fs::fileExists( const std::string& path ) {
     int fileFd = open( path.c_str(), O_RDONLY );
     bool exists = fileFd >= 0;
     close( fileFd );
     return exists;
-}
\ No newline at end of file
+}
+bool jac::fs::directoryExists( const std::string& path ) {
+    struct stat pathStat;
+    if ( stat( path.c_str(), &pathStat ) < 0 )
+        return false;
+    return S_ISDIR( pathStat.st_mode );
+}
+
+bool jac::fs::removeRecursive( const std::string& path ) {
+    if ( !directoryExists( path ) )
+        return remove( path.c_str() ) == 0 || errno == ENOENT;
+    bool success = true;
+    // listDirectory yields directories after their content, so we can remove
+    // the entities in the order they come
+    listDirectory( path,
+        [&]( FileType, const std::string& dir, const std::string& entityName ) {
+            if ( remove( concatPath( dir, entityName ).c_str() ) < 0 )
+                success = false;
+        },
+        [&]( const std::string& ) {
+            success = false;
+        } );
+    return rmdir( path.c_str() ) == 0 && success;
+}
@@ -32,6 +32,22 @@ function clearInterval(timerId) {
     deleteTimer(timerId);
 }
 
+function setImmediate(callback) {
+    if(arguments.length > 1) {
+        var argsArray = Array.prototype.slice.call(arguments);
+        argsArray.splice(0, 1);
+        return createTimer(0, true, function() {
+            callback.apply(null, argsArray);
+        });
+    } else {
+        return createTimer(0, true, callback);
+    }
+}
+
+function clearImmediate(immediateId) {
+    deleteTimer(immediateId);
+}
+
 function delay(delayMs) {
     return new Promise(function(resolve) {
         setTimeout(resolve, delayMs);
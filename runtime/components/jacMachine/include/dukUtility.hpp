@@ -1,8 +1,14 @@
 #pragma once
 
 #include <duktape.h>
+#include <array>
+#include <stdexcept>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 using DukCFunction = duk_ret_t (*)( duk_context * );
 
@@ -86,6 +92,22 @@ inline void dukAppendArray( duk_context* ctx, int arrayOffset ) {
 }
 
 
+// Put functions from the list to the object on given offset. The functions are
+// registered as lightfuncs where possible, as they are cheaper to create and
+// call. Lightfuncs cannot hold properties and accept at most 14 arguments.
+inline void dukPutLightFunctionList( duk_context* ctx, duk_idx_t objOffset,
+    const duk_function_list_entry* functions )
+{
+    objOffset = duk_normalize_index( ctx, objOffset );
+    for ( auto* f = functions; f->key; f++ ) {
+        if ( f->nargs == DUK_VARARGS || ( f->nargs >= 0 && f->nargs <= 14 ) )
+            duk_push_c_lightfunc( ctx, f->value, f->nargs, f->nargs == DUK_VARARGS ? 0 : f->nargs, 0 );
+        else
+            duk_push_c_function( ctx, f->value, f->nargs );
+        duk_put_prop_string( ctx, objOffset, f->key );
+    }
+}
+
 // Pushes class with a given name and methods to the stack
 template < int MethodCount, int StaticMethodCount >
 inline void dukPushClass( duk_context* ctx, const std::string& name,
@@ -101,10 +123,10 @@ inline void dukPushClass( duk_context* ctx, const std::string& name,
     duk_push_string( ctx, name.c_str() );
     duk_def_prop( ctx, constructorOffset, DUK_DEFPROP_HAVE_VALUE );
 
-    duk_put_function_list( ctx, constructorOffset, staticMethods );
+    dukPutLightFunctionList( ctx, constructorOffset, staticMethods );
 
     duk_push_bare_object( ctx );
-    duk_put_function_list( ctx, -1, methods );
+    dukPutLightFunctionList( ctx, -1, methods );
     duk_put_prop_string( ctx, constructorOffset, "prototype" );
 }
 
@@ -112,3 +134,327 @@ inline void dukRaiseError( duk_context* ctx, const std::string& error ) {
     duk_error( ctx, DUK_ERR_TYPE_ERROR, error.c_str() );
     __builtin_unreachable(); // duk_error never returns
 }
+
+namespace jac {
+
+// Hidden property of an object that holds a pointer to its native counterpart.
+// Bound member functions are invoked on the pointer found in this.
+inline constexpr const char* DUK_NATIVE_POINTER = DUK_HIDDEN_SYMBOL( "native" );
+
+namespace detail {
+
+// The address identifies the type of a native state
+template < typename T >
+inline const char nativeTypeTag = 0;
+
+// Native states are allocated with a header identifying their type, so a
+// method invoked on an object of another class is detected
+struct NativeHeader {
+    const void* type;
+};
+
+template < typename T >
+struct NativeBox: NativeHeader {
+    template < typename... Args >
+    NativeBox( Args&&... args )
+        : NativeHeader{ &nativeTypeTag< T > }, value( std::forward< Args >( args )... )
+    {}
+
+    T value;
+};
+
+template < typename T, typename = void >
+struct HasFinalize: std::false_type {};
+
+template < typename T >
+struct HasFinalize< T, std::void_t< decltype( std::declval< T& >().finalize( std::declval< duk_context* >() ) ) > >:
+    std::true_type {};
+
+template < typename T >
+struct IsOptional: std::false_type {};
+
+template < typename T >
+struct IsOptional< std::optional< T > >: std::true_type {};
+
+template < typename T >
+inline constexpr bool alwaysFalse = false;
+
+// Parameters of type duk_context* receive the context and they do not consume
+// a JavaScript argument
+template < typename T >
+inline constexpr bool consumesArgument = !std::is_same_v< std::decay_t< T >, duk_context* >;
+
+// Convert the value on the given index to T. Strings are passed as views into
+// the Duktape heap, so they are valid only during the call.
+template < typename T, typename U = std::remove_cv_t< std::remove_reference_t< T > > >
+U dukGet( duk_context* ctx, duk_idx_t idx ) {
+    if constexpr ( std::is_same_v< U, duk_context* > ) {
+        return ctx;
+    }
+    else if constexpr ( std::is_same_v< U, bool > ) {
+        return duk_to_boolean( ctx, idx );
+    }
+    else if constexpr ( std::is_enum_v< U > ) {
+        return static_cast< U >( duk_require_int( ctx, idx ) );
+    }
+    else if constexpr ( std::is_integral_v< U > && std::is_signed_v< U > && sizeof( U ) <= sizeof( duk_int_t ) ) {
+        return duk_require_int( ctx, idx );
+    }
+    else if constexpr ( std::is_integral_v< U > && sizeof( U ) <= sizeof( duk_uint_t ) ) {
+        return duk_require_uint( ctx, idx );
+    }
+    else if constexpr ( std::is_arithmetic_v< U > ) {
+        return static_cast< U >( duk_require_number( ctx, idx ) );
+    }
+    else if constexpr ( std::is_same_v< U, std::string_view > ) {
+        duk_size_t length;
+        const char* data = duk_require_lstring( ctx, idx, &length );
+        return { data, length };
+    }
+    else if constexpr ( std::is_same_v< U, const char* > ) {
+        return duk_require_string( ctx, idx );
+    }
+    else if constexpr ( std::is_same_v< U, std::string > ) {
+        duk_size_t length;
+        const char* data = duk_require_lstring( ctx, idx, &length );
+        return std::string( data, length );
+    }
+    else if constexpr ( IsOptional< U >::value ) {
+        if ( duk_is_undefined( ctx, idx ) )
+            return std::nullopt;
+        return dukGet< typename U::value_type >( ctx, idx );
+    }
+    else {
+        static_assert( alwaysFalse< U >, "Unsupported argument type" );
+    }
+}
+
+// Push the value to the stack
+template < typename T >
+void dukPush( duk_context* ctx, const T& value ) {
+    if constexpr ( std::is_same_v< T, bool > ) {
+        duk_push_boolean( ctx, value );
+    }
+    else if constexpr ( std::is_enum_v< T > ) {
+        duk_push_int( ctx, static_cast< duk_int_t >( value ) );
+    }
+    else if constexpr ( std::is_integral_v< T > && std::is_signed_v< T > && sizeof( T ) <= sizeof( duk_int_t ) ) {
+        duk_push_int( ctx, value );
+    }
+    else if constexpr ( std::is_integral_v< T > && sizeof( T ) <= sizeof( duk_uint_t ) ) {
+        duk_push_uint( ctx, value );
+    }
+    else if constexpr ( std::is_arithmetic_v< T > ) {
+        duk_push_number( ctx, static_cast< duk_double_t >( value ) );
+    }
+    else if constexpr ( std::is_same_v< T, std::string_view > || std::is_same_v< T, std::string > ) {
+        duk_push_lstring( ctx, value.data(), value.size() );
+    }
+    else if constexpr ( std::is_same_v< T, const char* > ) {
+        duk_push_string( ctx, value );
+    }
+    else if constexpr ( IsOptional< T >::value ) {
+        if ( value )
+            dukPush( ctx, *value );
+        else
+            duk_push_undefined( ctx );
+    }
+    else {
+        static_assert( alwaysFalse< T >, "Unsupported return type" );
+    }
+}
+
+// Stack index of each parameter; parameters not consuming an argument get -1
+template < typename... Args >
+constexpr std::array< int, sizeof...( Args ) > argumentIndices() {
+    std::array< int, sizeof...( Args ) > indices{};
+    constexpr bool consumes[] = { consumesArgument< Args >..., false };
+    int next = 0;
+    for ( size_t i = 0; i != sizeof...( Args ); i++ )
+        indices[ i ] = consumes[ i ] ? next++ : -1;
+    return indices;
+}
+
+template < typename T >
+T* dukThisPointer( duk_context* ctx ) {
+    using U = std::remove_cv_t< T >;
+    duk_push_this( ctx );
+    duk_get_prop_string( ctx, -1, DUK_NATIVE_POINTER );
+    auto* header = static_cast< NativeHeader* >( duk_get_pointer( ctx, -1 ) );
+    duk_pop_2( ctx );
+    if ( !header || header->type != &nativeTypeTag< U > )
+        duk_error( ctx, DUK_ERR_TYPE_ERROR, "Invalid this" );
+    return &static_cast< NativeBox< U >* >( header )->value;
+}
+
+template < typename State, typename... Args >
+struct NativeClass {
+    static constexpr int argCount = ( 0 + ... + ( consumesArgument< Args > ? 1 : 0 ) );
+
+    static duk_ret_t construct( duk_context* ctx ) {
+        if ( !duk_is_constructor_call( ctx ) )
+            return DUK_RET_TYPE_ERROR;
+        NativeBox< State >* box = nullptr;
+        try {
+            box = create( ctx, std::index_sequence_for< Args... >() );
+        }
+        catch ( std::runtime_error& e ) {
+            duk_error( ctx, DUK_ERR_TYPE_ERROR, "%s", e.what() );
+        }
+        duk_push_this( ctx );
+        duk_push_pointer( ctx, static_cast< NativeHeader* >( box ) );
+        duk_put_prop_string( ctx, -2, DUK_NATIVE_POINTER );
+        return 0;
+    }
+
+    // Convert all the arguments before allocating the state, so a conversion
+    // error cannot leak it
+    template < size_t... I >
+    static NativeBox< State >* create( duk_context* ctx, std::index_sequence< I... > ) {
+        constexpr auto indices = argumentIndices< Args... >();
+        std::tuple< decltype( dukGet< Args >( ctx, 0 ) )... > args{ dukGet< Args >( ctx, indices[ I ] )... };
+        return new NativeBox< State >( std::get< I >( std::move( args ) )... );
+    }
+
+    // Finalizer of the prototype, it is inherited by all instances
+    static duk_ret_t finalize( duk_context* ctx ) {
+        duk_get_prop_string( ctx, 0, DUK_NATIVE_POINTER );
+        auto* header = static_cast< NativeHeader* >( duk_get_pointer( ctx, -1 ) );
+        duk_pop( ctx );
+        if ( !header || header->type != &nativeTypeTag< State > )
+            return 0;
+        // A finalizer can be invoked again if the object is rescued
+        duk_del_prop_string( ctx, 0, DUK_NATIVE_POINTER );
+        auto* box = static_cast< NativeBox< State >* >( header );
+        if constexpr ( HasFinalize< State >::value )
+            box->value.finalize( ctx );
+        delete box;
+        return 0;
+    }
+};
+
+template < typename Fn, Fn F >
+struct Binding;
+
+template < typename R, typename... Args, R ( *F )( Args... ) >
+struct Binding< R ( * )( Args... ), F > {
+    static constexpr int argCount = ( 0 + ... + ( consumesArgument< Args > ? 1 : 0 ) );
+
+    static duk_ret_t call( duk_context* ctx ) {
+        return invoke( ctx, std::index_sequence_for< Args... >() );
+    }
+
+    template < size_t... I >
+    static duk_ret_t invoke( duk_context* ctx, std::index_sequence< I... > ) {
+        constexpr auto indices = argumentIndices< Args... >();
+        if constexpr ( std::is_void_v< R > ) {
+            F( dukGet< Args >( ctx, indices[ I ] )... );
+            return 0;
+        }
+        else {
+            dukPush( ctx, F( dukGet< Args >( ctx, indices[ I ] )... ) );
+            return 1;
+        }
+    }
+};
+
+template < typename C, typename R, typename... Args >
+struct MemberBinding {
+    static constexpr int argCount = ( 0 + ... + ( consumesArgument< Args > ? 1 : 0 ) );
+
+    template < typename Fn, size_t... I >
+    static duk_ret_t invoke( duk_context* ctx, Fn f, std::index_sequence< I... > ) {
+        constexpr auto indices = argumentIndices< Args... >();
+        C* self = dukThisPointer< C >( ctx );
+        if constexpr ( std::is_void_v< R > ) {
+            ( self->*f )( dukGet< Args >( ctx, indices[ I ] )... );
+            return 0;
+        }
+        else {
+            dukPush( ctx, ( self->*f )( dukGet< Args >( ctx, indices[ I ] )... ) );
+            return 1;
+        }
+    }
+};
+
+template < typename C, typename R, typename... Args, R ( C::*F )( Args... ) >
+struct Binding< R ( C::* )( Args... ), F >: MemberBinding< C, R, Args... > {
+    static duk_ret_t call( duk_context* ctx ) {
+        return MemberBinding< C, R, Args... >::invoke( ctx, F, std::index_sequence_for< Args... >() );
+    }
+};
+
+template < typename C, typename R, typename... Args, R ( C::*F )( Args... ) const >
+struct Binding< R ( C::* )( Args... ) const, F >: MemberBinding< const C, R, Args... > {
+    static duk_ret_t call( duk_context* ctx ) {
+        return MemberBinding< const C, R, Args... >::invoke( ctx, F, std::index_sequence_for< Args... >() );
+    }
+};
+
+} // namespace detail
+
+// Duktape/C function generated from the signature of a C++ function, e.g.,
+// jac::dukBind< &Gpio::write >. The arguments are converted according to the
+// parameter types and the result is pushed to the stack. A parameter of type
+// duk_context* receives the context. A member function is invoked on the
+// object pointed to by DUK_NATIVE_POINTER of this.
+template < auto F >
+inline constexpr DukCFunction dukBind = detail::Binding< decltype( F ), F >::call;
+
+// Number of JavaScript arguments of the bound function
+template < auto F >
+inline constexpr int dukBindArgCount = detail::Binding< decltype( F ), F >::argCount;
+
+// Function list entry for a bound function
+template < auto F >
+constexpr duk_function_list_entry dukBindEntry( const char* name ) {
+    return { name, dukBind< F >, dukBindArgCount< F > };
+}
+
+// Return the native state of this; raise an error if this is not an instance
+// of a native class with the given state
+template < typename State >
+State& dukNativeThis( duk_context* ctx ) {
+    return *detail::dukThisPointer< State >( ctx );
+}
+
+// Pushes class with a given name and methods to the stack. Each instance owns
+// a State constructed from the constructor arguments converted to types Args
+// (like for dukBind). The state is attached via a type-tagged pointer in the
+// hidden property DUK_NATIVE_POINTER; methods bound via
+// dukBind< &State::method > receive it after a single lookup of the property
+// and a check of the tag. The state is destroyed by a finalizer; if it has a
+// method finalize( duk_context* ), it is invoked first, so the state can
+// release resources tied to the heap. The constructor of the state signals an error by
+// throwing std::runtime_error.
+template < typename State, typename... Args, int MethodCount, int StaticMethodCount >
+void dukPushNativeClass( duk_context* ctx, const std::string& name,
+    const duk_function_list_entry ( &methods )[ MethodCount ],
+    const duk_function_list_entry ( &staticMethods )[ StaticMethodCount ] )
+{
+    using Class = detail::NativeClass< State, Args... >;
+    duk_push_c_function( ctx, Class::construct, Class::argCount );
+    auto constructorOffset = duk_get_top_index( ctx );
+
+    // Add pretty name to the constructor
+    duk_push_string( ctx, "name" );
+    duk_push_string( ctx, name.c_str() );
+    duk_def_prop( ctx, constructorOffset, DUK_DEFPROP_HAVE_VALUE );
+
+    dukPutLightFunctionList( ctx, constructorOffset, staticMethods );
+
+    duk_push_bare_object( ctx );
+    dukPutLightFunctionList( ctx, -1, methods );
+    duk_push_c_function( ctx, Class::finalize, 2 );
+    duk_set_finalizer( ctx, -2 );
+    duk_put_prop_string( ctx, constructorOffset, "prototype" );
+}
+
+// Push the bound function as a lightfunc
+template < auto F >
+void dukPushBound( duk_context* ctx ) {
+    static_assert( dukBindArgCount< F > <= 14, "Too many arguments for a lightfunc" );
+    duk_push_c_lightfunc( ctx, dukBind< F >, dukBindArgCount< F >, dukBindArgCount< F >, 0 );
+}
+
+} // namespace jac
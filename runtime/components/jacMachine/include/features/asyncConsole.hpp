@@ -0,0 +1,243 @@
+#pragma once
+
+#include <jsmachine.hpp>
+#include <log.hpp>
+
+#include <vector>
+#include <string>
+
+namespace jac {
+
+// Implement global object console and module "log" on top of jac::log
+//
+// The console has methods debug, log, info, warn and error that accept any
+// number of arguments. The arguments are formatted natively: strings, numbers,
+// booleans, null and undefined directly, errors and functions by their string
+// value and other objects as JSON. The line is stored in the log ring, so the
+// call does not wait for the UART. Calls below consoleLevel return before the
+// arguments are formatted.
+//
+// Module "log" has the following functions:
+// - logger(name): return a logger with methods debug, info, warn and error.
+//   Its lines are prefixed by the level and the name. A new logger has the
+//   level consoleLevel.
+// - setLevel(name, level): set the level of the logger name; "console" is the
+//   level of the console
+// - stats(): return { written, dropped } line counts
+// - flush(): write all pending lines synchronously
+// and constants DEBUG, INFO, WARN, ERROR and OFF.
+template < typename Self >
+class AsyncConsole {
+    static inline constexpr const char* LOGGER_SLOT = "logLoggerSlot";
+    static inline constexpr const char* MODULE_PROP = DUK_HIDDEN_SYMBOL( "logModule" );
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {
+        log::Level consoleLevel = log::Level::Debug;
+    };
+
+    void initialize() {
+        duk_context *ctx = self()._context;
+        moduleIndex( "console" );
+
+        duk_push_object( ctx );
+        pushLevelMethods( ctx, consoleWrite, true );
+        duk_put_global_string( ctx, "console" );
+
+        duk_push_heap_stash( ctx );
+        duk_push_object( ctx );
+        pushLevelMethods( ctx, loggerWrite, false );
+        duk_put_prop_string( ctx, -2, LOGGER_SLOT );
+        duk_pop( ctx );
+
+        self().registerNativeModule( "log", [this]( duk_context *ctx ) {
+            return self().initializeLogModule( ctx );
+        });
+    }
+
+    void onEventLoop() {}
+
+private:
+    struct LogModule {
+        std::string name;
+        log::Level level;
+    };
+
+    // Put methods of all levels to the object on the top of the stack; the
+    // level is passed as the magic
+    static void pushLevelMethods( duk_context *ctx, duk_c_function f, bool console ) {
+        auto put = [&]( const char *name, log::Level level ) {
+            duk_push_c_lightfunc( ctx, f, DUK_VARARGS, 0, static_cast< int >( level ) );
+            duk_put_prop_string( ctx, -2, name );
+        };
+        put( "debug", log::Level::Debug );
+        put( "info", log::Level::Info );
+        put( "warn", log::Level::Warn );
+        put( "error", log::Level::Error );
+        if ( console )
+            put( "log", log::Level::Info );
+    }
+
+    // Initializes the module; there are the following arguments on the
+    // Duktape stack:
+    // - 0 requested module ID
+    // - 1 exports object
+    // - 2 module object
+    duk_ret_t initializeLogModule( duk_context *ctx ) {
+        const int exportOffset = 1;
+        duk_function_list_entry functions[] = {
+            { "logger", dukLogger, 1 },
+            { "setLevel", dukSetLevel, 2 },
+            { "stats", dukStats, 0 },
+            { "flush", dukFlush, 0 },
+            { nullptr, nullptr, 0 }
+        };
+        dukPutLightFunctionList( ctx, exportOffset, functions );
+        duk_number_list_entry levels[] = {
+            { "DEBUG", double( log::Level::Debug ) },
+            { "INFO", double( log::Level::Info ) },
+            { "WARN", double( log::Level::Warn ) },
+            { "ERROR", double( log::Level::Error ) },
+            { "OFF", double( log::Level::Off ) },
+            { nullptr, 0 }
+        };
+        duk_put_number_list( ctx, exportOffset, levels );
+        return dukReturn( ctx );
+    }
+
+    int moduleIndex( const std::string& name ) {
+        for ( size_t i = 0; i != _logModules.size(); i++ ) {
+            if ( _logModules[ i ].name == name )
+                return i;
+        }
+        _logModules.push_back( { name, self()._cfg.consoleLevel } );
+        return _logModules.size() - 1;
+    }
+
+    static duk_ret_t encodeJson( duk_context *ctx, void * ) {
+        duk_json_encode( ctx, -1 );
+        return 1;
+    }
+
+    // Append the arguments from the given index separated by spaces
+    static void formatArguments( duk_context *ctx, duk_idx_t from, log::Line& line ) {
+        duk_idx_t top = duk_get_top( ctx );
+        for ( duk_idx_t i = from; i < top; i++ ) {
+            if ( i != from )
+                line.append( ' ' );
+            duk_size_t size;
+            switch ( duk_get_type( ctx, i ) ) {
+            case DUK_TYPE_STRING: {
+                const char *s = duk_get_lstring( ctx, i, &size );
+                line.append( std::string_view( s, size ) );
+                break;
+            }
+            case DUK_TYPE_NUMBER:
+                line.append( double( duk_get_number( ctx, i ) ) );
+                break;
+            case DUK_TYPE_BOOLEAN:
+                line.append( bool( duk_get_boolean( ctx, i ) ) );
+                break;
+            case DUK_TYPE_UNDEFINED:
+                line.append( "undefined" );
+                break;
+            case DUK_TYPE_NULL:
+                line.append( "null" );
+                break;
+            case DUK_TYPE_OBJECT:
+                if ( !duk_is_error( ctx, i ) && !duk_is_function( ctx, i ) ) {
+                    duk_dup( ctx, i );
+                    if ( duk_safe_call( ctx, encodeJson, nullptr, 1, 1 ) == DUK_EXEC_SUCCESS
+                        && duk_is_string( ctx, -1 ) )
+                    {
+                        const char *s = duk_get_lstring( ctx, -1, &size );
+                        line.append( std::string_view( s, size ) );
+                        duk_pop( ctx );
+                        break;
+                    }
+                    duk_pop( ctx );
+                }
+                line.append( duk_safe_to_string( ctx, i ) );
+                break;
+            default:
+                line.append( duk_safe_to_string( ctx, i ) );
+            }
+        }
+    }
+
+    static duk_ret_t consoleWrite( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        auto level = static_cast< log::Level >( duk_get_current_magic( ctx ) );
+        if ( level < self._logModules.front().level )
+            return 0;
+        log::Line line;
+        formatArguments( ctx, 0, line );
+        log::writeLine( level, line );
+        return 0;
+    }
+
+    static duk_ret_t loggerWrite( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        auto level = static_cast< log::Level >( duk_get_current_magic( ctx ) );
+        duk_push_this( ctx );
+        duk_get_prop_string( ctx, -1, MODULE_PROP );
+        auto& module = self._logModules.at( duk_require_uint( ctx, -1 ) );
+        duk_pop_2( ctx );
+        if ( level < module.level )
+            return 0;
+        log::Line line;
+        line.append( '[' ).append( log::levelMark( level ) ).append( ' ' )
+            .append( module.name ).append( "] " );
+        formatArguments( ctx, 0, line );
+        log::writeLine( level, line );
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - name: string
+    static duk_ret_t dukLogger( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        int index = self.moduleIndex( duk_require_string( ctx, 0 ) );
+        duk_push_object( ctx );
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, LOGGER_SLOT );
+        duk_set_prototype( ctx, -3 );
+        duk_pop( ctx );
+        duk_push_uint( ctx, index );
+        duk_put_prop_string( ctx, -2, MODULE_PROP );
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - name: string
+    // - level: number
+    static duk_ret_t dukSetLevel( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        int index = self.moduleIndex( duk_require_string( ctx, 0 ) );
+        int level = duk_require_int( ctx, 1 );
+        if ( level < int( log::Level::Debug ) || level > int( log::Level::Off ) )
+            dukRaiseError( ctx, "Invalid level" );
+        self._logModules[ index ].level = static_cast< log::Level >( level );
+        return 0;
+    }
+
+    static duk_ret_t dukStats( duk_context *ctx ) {
+        auto stats = log::statistics();
+        duk_push_object( ctx );
+        duk_push_uint( ctx, stats.written );
+        duk_put_prop_string( ctx, -2, "written" );
+        duk_push_uint( ctx, stats.dropped );
+        duk_put_prop_string( ctx, -2, "dropped" );
+        return 1;
+    }
+
+    static duk_ret_t dukFlush( duk_context * ) {
+        log::flush();
+        return 0;
+    }
+
+    std::vector< LogModule > _logModules; // Loggers refer to the index
+};
+
+} // namespace jac
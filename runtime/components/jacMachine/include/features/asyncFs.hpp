@@ -0,0 +1,940 @@
+#pragma once
+
+#include <jsmachine.hpp>
+#include <filesystem.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace jac {
+
+// Implement asynchronous filesystem module "fs"
+//
+// All blocking operations run on a dedicated I/O task, so a slow flash access
+// never stalls the event loop. The results are passed back to the event loop
+// via schedule() and all functions return promises. Paths are relative to the
+// machine base path.
+//
+// The module has the following functions:
+// - readFile(path[, encoding]): resolve with ArrayBuffer, or a string if an
+//   encoding is given
+// - writeFile(path, data): data is a string or a buffer
+// - appendFile(path, data): data is a string or a buffer
+// - readdir(path): resolve with an array of entity names
+// - stat(path): resolve with an object { size, isFile, isDirectory }
+// - unlink(path): remove the file
+// - createReadStream(path[, options]): return a readable stream
+// - createWriteStream(path[, options]): return a writable stream
+//
+// The file content is read directly into an ArrayBuffer and written directly
+// from the passed value; there are no intermediate copies. The values are
+// kept alive in <stash>.fsSlot[promiseId] while the operation is in progress.
+//
+// Streams process files of arbitrary size in constant memory. Each stream owns
+// a fixed number of fixed-size chunks that are recycled. A readable stream has
+// the following methods:
+// - on(event, cb): set the listener for the event "data", "end", "error" or
+//   "close". Setting the "data" listener starts the stream.
+// - pause(), resume(): stop and restart emitting "data" events. A paused
+//   stream holds its chunks, so no more data are read until it is resumed.
+// - close(): stop reading and close the file
+// The "data" listener receives an Uint8Array that is valid only during the
+// invocation of the listener, as the underlying chunk is reused for further
+// reads. Options: highWaterMark (chunk size), chunks (number of chunks).
+//
+// A writable stream has the following methods:
+// - on(event, cb): set the listener for the event "drain", "finish" or
+//   "error"
+// - write(data): queue a string or a buffer for writing. Return false if the
+//   caller should wait for the "drain" event before writing more data.
+// - end([data]): optionally write the data and then close the file. "finish"
+//   is emitted once all data are persisted.
+// Options: highWaterMark (chunk size), chunks (number of chunks that can be
+// queued before write returns false), flags ("w" or "a").
+//
+// Active streams are kept alive in <stash>.fsStreamSlot[streamId].
+template < typename Self >
+class AsyncFilesystem {
+    static inline constexpr const char* SLOT = "fsSlot";
+    static inline constexpr const char* STREAM_SLOT = "fsStreamSlot";
+    static inline constexpr int DEFAULT_CHUNK_SIZE = 1024;
+    static inline constexpr int DEFAULT_CHUNK_COUNT = 2;
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {};
+
+    void initialize() {
+        setupSlot();
+
+        _ioWorker = std::make_unique< freertos::Worker >( "fsWorker", 3072, 2 );
+
+        self().registerNativeModule( "fs", [this]( duk_context *ctx ) {
+            return self().initializeFsModule( ctx );
+        });
+    }
+
+    void onEventLoop() {}
+
+protected:
+    // Post a blocking job to the I/O task
+    void postIoJob( freertos::Worker::Job job ) {
+        _ioWorker->post( std::move( job ) );
+    }
+
+private:
+    // State of a single operation. It is allocated when the operation starts
+    // and it is passed between the event loop and the I/O task. Only one of
+    // them owns it at a time.
+    struct Operation {
+        Self *machine;
+        int promiseId;
+        std::string path;
+        int fd = -1;
+        const void *data = nullptr;
+        size_t size = 0;
+        void *buffer = nullptr;
+        bool asString = false;
+        std::string error;
+        struct stat info;
+        std::vector< std::string > entries;
+
+        void fail( const std::string& what ) {
+            error = what + " " + path + ": " + std::strerror( errno );
+        }
+    };
+
+    // State of a readable stream. The file is accessed only from the I/O
+    // task, everything else only from the event loop. The chunk buffers are
+    // owned by the stream object.
+    struct ReadStream {
+        struct Chunk {
+            unsigned char *data;
+            int length = 0; // Negative on error
+            std::string error;
+            unsigned seq = 0;
+            bool busy = false;
+            bool ready = false;
+        };
+
+        Self *machine;
+        int id;
+        std::string path;
+        int chunkSize;
+        fs::FileReader file;
+        std::vector< Chunk > chunks;
+        unsigned nextRead = 0;
+        unsigned nextDelivery = 0;
+        int inFlight = 0;
+        bool paused = true;
+        bool finished = false;
+        bool delivering = false;
+    };
+
+    // State of a writable stream. The file and ioFailed are accessed only
+    // from the I/O task, everything else only from the event loop.
+    struct WriteStream {
+        using Buffer = std::unique_ptr< unsigned char[] >;
+
+        Self *machine;
+        int id;
+        std::string path;
+        bool append;
+        int chunkSize;
+        int chunkCount;
+        fs::FileWriter file;
+        bool ioFailed = false;
+        std::vector< Buffer > pool;
+        Buffer current;
+        int currentLength = 0;
+        int queued = 0; // Jobs posted to the I/O task
+        bool needDrain = false;
+        bool ending = false;
+        bool errored = false;
+    };
+
+    void setupSlot() {
+        duk_push_heap_stash( self()._context );
+        duk_push_object( self()._context );
+        duk_put_prop_string( self()._context, -2, SLOT );
+        duk_push_object( self()._context );
+        duk_put_prop_string( self()._context, -2, STREAM_SLOT );
+        duk_pop( self()._context );
+    }
+
+    // Initializes the module; there are the following arguments on the
+    // Duktape stack:
+    // - 0 requested module ID
+    // - 1 exports object
+    // - 2 module object
+    duk_ret_t initializeFsModule( duk_context *ctx ) {
+        const int exportOffset = 1;
+        duk_function_list_entry functions[] = {
+            { "readFile", dukReadFile, DUK_VARARGS },
+            { "writeFile", dukWriteFile, 2 },
+            { "appendFile", dukAppendFile, 2 },
+            { "readdir", dukReaddir, 1 },
+            { "stat", dukStat, 1 },
+            { "unlink", dukUnlink, 1 },
+            { "createReadStream", dukCreateReadStream, DUK_VARARGS },
+            { "createWriteStream", dukCreateWriteStream, DUK_VARARGS },
+            { nullptr, nullptr, 0 }
+        };
+        duk_put_function_list( ctx, exportOffset, functions );
+        return dukReturn( ctx );
+    }
+
+    // Start a new operation on the path given as the first argument. Pushes
+    // the promise for the operation to the stack.
+    static Operation *startOperation( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        auto op = std::make_unique< Operation >();
+        op->machine = &self;
+        op->path = fs::concatPath( self._cfg.basePath, duk_require_string( ctx, 0 ) );
+        op->promiseId = self.createPromise( ctx );
+        return op.release();
+    }
+
+    // Keep the value on the given index alive till the operation finishes
+    static void keepAlive( duk_context *ctx, Operation *op, int index ) {
+        index = duk_normalize_index( ctx, index );
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        duk_dup( ctx, index );
+        duk_put_prop_index( ctx, -2, op->promiseId );
+        duk_pop_2( ctx );
+    }
+
+    // Pass the operation back to the event loop, where settle is invoked
+    // with the operation pointer as the argument
+    static void finishOperation( Operation *op, DukCFunction settle ) {
+        op->machine->schedule( [&]( duk_context *ctx ) {
+            duk_push_c_function( ctx, settle, 1 );
+            duk_push_pointer( ctx, op );
+        }, "fs", JobClass::Io );
+    }
+
+    // Takes the ownership of the operation pointer passed as argument 0.
+    // Settles the promise with the value on the top of the stack.
+    static duk_ret_t settle( duk_context *ctx, Operation *op ) {
+        std::unique_ptr< Operation > guard( op );
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        duk_del_prop_index( ctx, -1, op->promiseId );
+        duk_pop_2( ctx );
+
+        if ( !op->error.empty() ) {
+            duk_pop( ctx );
+            duk_push_error_object( ctx, DUK_ERR_ERROR, "%s", op->error.c_str() );
+            Self::settlePromise( ctx, op->promiseId, false );
+        }
+        else {
+            Self::settlePromise( ctx, op->promiseId, true );
+        }
+        return 0;
+    }
+
+    static Operation *operationArg( duk_context *ctx ) {
+        return reinterpret_cast< Operation * >( duk_require_pointer( ctx, 0 ) );
+    }
+
+    static duk_ret_t settleUndefined( duk_context *ctx ) {
+        Operation *op = operationArg( ctx );
+        duk_push_undefined( ctx );
+        return settle( ctx, op );
+    }
+
+    // Accepts the following duk arguments:
+    // - path: string
+    // - encoding: string, optional. If specified, the content is returned
+    //   as a string
+    static duk_ret_t dukReadFile( duk_context *ctx ) {
+        bool asString = duk_is_string( ctx, 1 );
+        Operation *op = startOperation( ctx );
+        op->asString = asString;
+        op->machine->postIoJob( [op] {
+            op->fd = open( op->path.c_str(), O_RDONLY );
+            if ( op->fd < 0 ) {
+                op->fail( "Cannot open" );
+                return finishOperation( op, settleUndefined );
+            }
+            if ( fstat( op->fd, &op->info ) < 0 ) {
+                op->fail( "Cannot stat" );
+                close( op->fd );
+                return finishOperation( op, settleUndefined );
+            }
+            op->size = op->info.st_size;
+            // The buffer has to be allocated in the event loop
+            finishOperation( op, readFileAllocate );
+        } );
+        return 1;
+    }
+
+    // Allocate the buffer for the file content and pass the operation to the
+    // I/O task again to read the content directly into the buffer
+    static duk_ret_t readFileAllocate( duk_context *ctx ) {
+        Operation *op = operationArg( ctx );
+        op->buffer = duk_push_fixed_buffer( ctx, op->size );
+        keepAlive( ctx, op, -1 );
+        op->machine->postIoJob( [op] {
+            size_t total = 0;
+            while ( total < op->size ) {
+                int bytesRead = read( op->fd, static_cast< char * >( op->buffer ) + total,
+                    op->size - total );
+                if ( bytesRead < 0 ) {
+                    op->fail( "Cannot read" );
+                    break;
+                }
+                if ( bytesRead == 0 )
+                    break;
+                total += bytesRead;
+            }
+            op->size = total;
+            close( op->fd );
+            finishOperation( op, readFileSettle );
+        } );
+        return 0;
+    }
+
+    static duk_ret_t readFileSettle( duk_context *ctx ) {
+        Operation *op = operationArg( ctx );
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        duk_get_prop_index( ctx, -1, op->promiseId );
+        if ( op->asString )
+            duk_push_lstring( ctx, static_cast< const char * >( op->buffer ), op->size );
+        else
+            duk_push_buffer_object( ctx, -1, 0, op->size, DUK_BUFOBJ_ARRAYBUFFER );
+        return settle( ctx, op );
+    }
+
+    static duk_ret_t startWrite( duk_context *ctx, int flags ) {
+        const void *data;
+        duk_size_t size;
+        if ( duk_is_string( ctx, 1 ) )
+            data = duk_get_lstring( ctx, 1, &size );
+        else if ( duk_is_buffer_data( ctx, 1 ) )
+            data = duk_get_buffer_data( ctx, 1, &size );
+        else
+            dukRaiseError( ctx, "Data has to be a string or a buffer" );
+
+        Operation *op = startOperation( ctx );
+        op->data = data;
+        op->size = size;
+        keepAlive( ctx, op, 1 );
+        op->machine->postIoJob( [op, flags] {
+            if ( !fs::ensurePath( op->path ) ) {
+                op->fail( "Cannot create path" );
+                return finishOperation( op, settleUndefined );
+            }
+            int fd = open( op->path.c_str(), O_WRONLY | O_CREAT | flags );
+            if ( fd < 0 ) {
+                op->fail( "Cannot open" );
+                return finishOperation( op, settleUndefined );
+            }
+            size_t total = 0;
+            while ( total < op->size ) {
+                int written = write( fd, static_cast< const char * >( op->data ) + total,
+                    op->size - total );
+                if ( written < 0 ) {
+                    op->fail( "Cannot write" );
+                    break;
+                }
+                total += written;
+            }
+            close( fd );
+            finishOperation( op, settleUndefined );
+        } );
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - path: string
+    // - data: string or buffer
+    static duk_ret_t dukWriteFile( duk_context *ctx ) {
+        return startWrite( ctx, O_TRUNC );
+    }
+
+    // Accepts the following duk arguments:
+    // - path: string
+    // - data: string or buffer
+    static duk_ret_t dukAppendFile( duk_context *ctx ) {
+        return startWrite( ctx, O_APPEND );
+    }
+
+    // Accepts the following duk arguments:
+    // - path: string
+    static duk_ret_t dukReaddir( duk_context *ctx ) {
+        Operation *op = startOperation( ctx );
+        op->machine->postIoJob( [op] {
+            DIR *dir = ::opendir( op->path.c_str() );
+            if ( !dir ) {
+                op->fail( "Cannot open" );
+                return finishOperation( op, settleUndefined );
+            }
+            while ( struct dirent *entry = ::readdir( dir ) ) {
+                std::string name( entry->d_name );
+                if ( name != "." && name != ".." )
+                    op->entries.push_back( std::move( name ) );
+            }
+            ::closedir( dir );
+            finishOperation( op, readdirSettle );
+        } );
+        return 1;
+    }
+
+    static duk_ret_t readdirSettle( duk_context *ctx ) {
+        Operation *op = operationArg( ctx );
+        duk_push_array( ctx );
+        for ( size_t i = 0; i != op->entries.size(); i++ ) {
+            dukReturn( ctx, op->entries[ i ] );
+            duk_put_prop_index( ctx, -2, i );
+        }
+        return settle( ctx, op );
+    }
+
+    // Accepts the following duk arguments:
+    // - path: string
+    static duk_ret_t dukStat( duk_context *ctx ) {
+        Operation *op = startOperation( ctx );
+        op->machine->postIoJob( [op] {
+            if ( stat( op->path.c_str(), &op->info ) < 0 ) {
+                op->fail( "Cannot stat" );
+                return finishOperation( op, settleUndefined );
+            }
+            finishOperation( op, statSettle );
+        } );
+        return 1;
+    }
+
+    static duk_ret_t statSettle( duk_context *ctx ) {
+        Operation *op = operationArg( ctx );
+        duk_push_object( ctx );
+        duk_push_number( ctx, op->info.st_size );
+        duk_put_prop_string( ctx, -2, "size" );
+        duk_push_boolean( ctx, S_ISREG( op->info.st_mode ) );
+        duk_put_prop_string( ctx, -2, "isFile" );
+        duk_push_boolean( ctx, S_ISDIR( op->info.st_mode ) );
+        duk_put_prop_string( ctx, -2, "isDirectory" );
+        return settle( ctx, op );
+    }
+
+    // Accepts the following duk arguments:
+    // - path: string
+    static duk_ret_t dukUnlink( duk_context *ctx ) {
+        Operation *op = startOperation( ctx );
+        op->machine->postIoJob( [op] {
+            if ( remove( op->path.c_str() ) < 0 )
+                op->fail( "Cannot remove" );
+            finishOperation( op, settleUndefined );
+        } );
+        return 1;
+    }
+
+    static int optionInt( duk_context *ctx, int index, const char *name, int defaultValue ) {
+        if ( !duk_is_object( ctx, index ) )
+            return defaultValue;
+        duk_get_prop_string( ctx, index, name );
+        int value = duk_is_number( ctx, -1 ) ? duk_get_int( ctx, -1 ) : defaultValue;
+        duk_pop( ctx );
+        return value;
+    }
+
+    // Create a stream object with the given methods, register it in the
+    // stream slot and leave it on the top of the stack
+    template < int MethodCount >
+    static void pushStreamObject( duk_context *ctx, void *stream, int id,
+        const duk_function_list_entry ( &methods )[ MethodCount ] )
+    {
+        duk_push_object( ctx );
+        duk_put_function_list( ctx, -1, methods );
+        duk_push_bare_object( ctx );
+        duk_put_prop_string( ctx, -2, "_listeners" );
+        duk_push_pointer( ctx, stream );
+        duk_put_prop_string( ctx, -2, "_stream" );
+
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, STREAM_SLOT );
+        duk_dup( ctx, -3 );
+        duk_put_prop_index( ctx, -2, id );
+        duk_pop_2( ctx );
+    }
+
+    // Detach the native state from the stream object and remove it from the
+    // stream slot
+    static void unregisterStream( duk_context *ctx, int id ) {
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, STREAM_SLOT );
+        duk_get_prop_index( ctx, -1, id );
+        duk_push_null( ctx );
+        duk_put_prop_string( ctx, -2, "_stream" );
+        duk_pop( ctx );
+        duk_del_prop_index( ctx, -1, id );
+        duk_pop_2( ctx );
+    }
+
+    template < typename Stream >
+    static Stream *streamFromThis( duk_context *ctx ) {
+        duk_push_this( ctx );
+        duk_get_prop_string( ctx, -1, "_stream" );
+        auto *stream = reinterpret_cast< Stream * >( duk_get_pointer( ctx, -1 ) );
+        duk_pop_2( ctx );
+        return stream;
+    }
+
+    static void pushStream( duk_context *ctx, int id ) {
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, STREAM_SLOT );
+        duk_get_prop_index( ctx, -1, id );
+        duk_remove( ctx, -2 );
+        duk_remove( ctx, -2 );
+    }
+
+    // Invoke the listener of the event on the stream object on the top of
+    // the stack. The stream object is passed as this, pushArgs( ctx ) pushes
+    // the arguments and returns their count. Return false if there is no
+    // listener.
+    template < typename PushArgs >
+    static bool emitOnTop( duk_context *ctx, const char *event, PushArgs pushArgs ) {
+        duk_get_prop_string( ctx, -1, "_listeners" );
+        duk_get_prop_string( ctx, -1, event );
+        bool hasListener = duk_is_function( ctx, -1 );
+        if ( hasListener ) {
+            duk_dup( ctx, -3 );
+            int argCount = pushArgs( ctx );
+            duk_call_method( ctx, argCount );
+        }
+        duk_pop_2( ctx );
+        return hasListener;
+    }
+
+    static bool emitOnTop( duk_context *ctx, const char *event ) {
+        return emitOnTop( ctx, event, []( duk_context * ) { return 0; } );
+    }
+
+    template < typename PushArgs >
+    static bool emit( duk_context *ctx, int id, const char *event, PushArgs pushArgs ) {
+        pushStream( ctx, id );
+        bool hasListener = emitOnTop( ctx, event, pushArgs );
+        duk_pop( ctx );
+        return hasListener;
+    }
+
+    static bool emit( duk_context *ctx, int id, const char *event ) {
+        return emit( ctx, id, event, []( duk_context * ) { return 0; } );
+    }
+
+    // Emit the error event on the stream object on the top of the stack. If
+    // there is no listener, the error is thrown.
+    static void emitErrorOnTop( duk_context *ctx, const std::string& error ) {
+        bool handled = emitOnTop( ctx, "error", [&]( duk_context *ctx ) {
+            duk_push_error_object( ctx, DUK_ERR_ERROR, "%s", error.c_str() );
+            return 1;
+        } );
+        if ( !handled )
+            duk_error( ctx, DUK_ERR_ERROR, "%s", error.c_str() );
+    }
+
+    // Accepts the following duk arguments:
+    // - event: string
+    // - listener: function
+    static void addListener( duk_context *ctx ) {
+        const char *event = duk_require_string( ctx, 0 );
+        duk_require_function( ctx, 1 );
+        duk_push_this( ctx );
+        duk_get_prop_string( ctx, -1, "_listeners" );
+        duk_dup( ctx, 1 );
+        duk_put_prop_string( ctx, -2, event );
+        duk_pop( ctx );
+    }
+
+    // Accepts the following duk arguments:
+    // - path: string
+    // - options: object, optional
+    static duk_ret_t dukCreateReadStream( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        int chunkSize = optionInt( ctx, 1, "highWaterMark", DEFAULT_CHUNK_SIZE );
+        int chunkCount = optionInt( ctx, 1, "chunks", DEFAULT_CHUNK_COUNT );
+        if ( chunkSize <= 0 || chunkCount <= 0 )
+            dukRaiseError( ctx, "Invalid stream options" );
+
+        auto *stream = new ReadStream();
+        stream->machine = &self;
+        stream->id = self._nextStreamId++;
+        stream->path = fs::concatPath( self._cfg.basePath, duk_require_string( ctx, 0 ) );
+        stream->chunkSize = chunkSize;
+
+        pushStreamObject( ctx, stream, stream->id, {
+            { "on", readStreamOn, 2 },
+            { "pause", readStreamPause, 0 },
+            { "resume", readStreamResume, 0 },
+            { "close", readStreamClose, 0 },
+            { nullptr, nullptr, 0 }
+        } );
+        // The chunks are owned by the stream object, so their data pointers
+        // stay valid for the whole life of the stream
+        duk_push_array( ctx );
+        for ( int i = 0; i != chunkCount; i++ ) {
+            typename ReadStream::Chunk chunk;
+            chunk.data = static_cast< unsigned char * >( duk_push_fixed_buffer( ctx, chunkSize ) );
+            duk_put_prop_index( ctx, -2, i );
+            stream->chunks.push_back( std::move( chunk ) );
+        }
+        duk_put_prop_string( ctx, -2, "_chunks" );
+        return 1;
+    }
+
+    // Post reads for all free chunks
+    static void pumpReadStream( ReadStream *stream ) {
+        if ( stream->paused || stream->finished )
+            return;
+        for ( size_t i = 0; i != stream->chunks.size(); i++ ) {
+            auto& chunk = stream->chunks[ i ];
+            if ( chunk.busy )
+                continue;
+            chunk.busy = true;
+            chunk.ready = false;
+            chunk.seq = stream->nextRead++;
+            stream->inFlight++;
+            stream->machine->postIoJob( [stream, i] {
+                auto& chunk = stream->chunks[ i ];
+                try {
+                    if ( !stream->file.isOpen() )
+                        stream->file = fs::FileReader( stream->path );
+                    chunk.length = stream->file.read( chunk.data, stream->chunkSize );
+                }
+                catch ( std::runtime_error& e ) {
+                    chunk.length = -1;
+                    chunk.error = e.what();
+                }
+                stream->machine->schedule( [&]( duk_context *ctx ) {
+                    duk_push_c_function( ctx, readStreamChunkDone, 2 );
+                    duk_push_pointer( ctx, stream );
+                    duk_push_int( ctx, i );
+                }, "fsReadStream", JobClass::Io );
+            } );
+        }
+    }
+
+    // Emit the ready chunks in the order they were read as the jobs can be
+    // executed in a different order than they were scheduled. Return the
+    // error message if a read failed.
+    static std::string deliverChunks( duk_context *ctx, ReadStream *stream ) {
+        stream->delivering = true;
+        std::string error;
+        while ( !stream->paused && !stream->finished ) {
+            auto chunk = std::find_if( stream->chunks.begin(), stream->chunks.end(),
+                [&]( const auto& c ) { return c.ready && c.seq == stream->nextDelivery; } );
+            if ( chunk == stream->chunks.end() )
+                break;
+            stream->nextDelivery++;
+            int index = chunk - stream->chunks.begin();
+            int length = chunk->length;
+            if ( length > 0 ) {
+                emit( ctx, stream->id, "data", [&]( duk_context *ctx ) {
+                    duk_get_prop_string( ctx, -1, "_chunks" );
+                    duk_get_prop_index( ctx, -1, index );
+                    duk_push_buffer_object( ctx, -1, 0, length, DUK_BUFOBJ_UINT8ARRAY );
+                    duk_remove( ctx, -2 );
+                    duk_remove( ctx, -2 );
+                    return 1;
+                } );
+            }
+            stream->chunks[ index ].busy = false;
+            stream->chunks[ index ].ready = false;
+            if ( length == 0 ) {
+                stream->finished = true;
+                emit( ctx, stream->id, "end" );
+            }
+            else if ( length < 0 ) {
+                stream->finished = true;
+                error = std::move( stream->chunks[ index ].error );
+            }
+        }
+        stream->delivering = false;
+        return error;
+    }
+
+    // Release the stream once it is finished and there is no pending read.
+    // Return true if the stream was released.
+    static bool releaseReadStream( duk_context *ctx, ReadStream *stream ) {
+        if ( !stream->finished || stream->inFlight != 0 || stream->delivering )
+            return false;
+        unregisterStream( ctx, stream->id );
+        // Close the file on the I/O task as closing might block
+        stream->machine->postIoJob( [stream] {
+            delete stream;
+        } );
+        return true;
+    }
+
+    // Deliver ready chunks, read more data and release the stream if it
+    // is finished
+    static void advanceReadStream( duk_context *ctx, ReadStream *stream ) {
+        // When called from a listener, the outer invocation takes care
+        if ( stream->delivering )
+            return;
+        int id = stream->id;
+        std::string error = deliverChunks( ctx, stream );
+        pumpReadStream( stream );
+        // Keep the stream object on the stack, so the events can be emitted
+        // even if the stream is released
+        pushStream( ctx, id );
+        bool released = releaseReadStream( ctx, stream );
+        if ( !error.empty() )
+            emitErrorOnTop( ctx, error );
+        if ( released )
+            emitOnTop( ctx, "close" );
+        duk_pop( ctx );
+    }
+
+    static duk_ret_t readStreamChunkDone( duk_context *ctx ) {
+        auto *stream = reinterpret_cast< ReadStream * >( duk_require_pointer( ctx, 0 ) );
+        stream->inFlight--;
+        stream->chunks[ duk_require_int( ctx, 1 ) ].ready = true;
+        advanceReadStream( ctx, stream );
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - event: string
+    // - listener: function
+    static duk_ret_t readStreamOn( duk_context *ctx ) {
+        addListener( ctx );
+        if ( std::strcmp( duk_get_string( ctx, 0 ), "data" ) == 0 )
+            readStreamResume( ctx );
+        duk_push_this( ctx );
+        return 1;
+    }
+
+    static duk_ret_t readStreamPause( duk_context *ctx ) {
+        if ( auto *stream = streamFromThis< ReadStream >( ctx ) )
+            stream->paused = true;
+        return 0;
+    }
+
+    static duk_ret_t readStreamResume( duk_context *ctx ) {
+        auto *stream = streamFromThis< ReadStream >( ctx );
+        if ( !stream || !stream->paused )
+            return 0;
+        stream->paused = false;
+        advanceReadStream( ctx, stream );
+        return 0;
+    }
+
+    static duk_ret_t readStreamClose( duk_context *ctx ) {
+        auto *stream = streamFromThis< ReadStream >( ctx );
+        if ( !stream )
+            return 0;
+        stream->finished = true;
+        advanceReadStream( ctx, stream );
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - path: string
+    // - options: object, optional
+    static duk_ret_t dukCreateWriteStream( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        int chunkSize = optionInt( ctx, 1, "highWaterMark", DEFAULT_CHUNK_SIZE );
+        int chunkCount = optionInt( ctx, 1, "chunks", DEFAULT_CHUNK_COUNT );
+        if ( chunkSize <= 0 || chunkCount <= 0 )
+            dukRaiseError( ctx, "Invalid stream options" );
+        bool append = false;
+        if ( duk_is_object( ctx, 1 ) ) {
+            duk_get_prop_string( ctx, 1, "flags" );
+            append = duk_is_string( ctx, -1 ) && std::strcmp( duk_get_string( ctx, -1 ), "a" ) == 0;
+            duk_pop( ctx );
+        }
+
+        auto *stream = new WriteStream();
+        stream->machine = &self;
+        stream->id = self._nextStreamId++;
+        stream->path = fs::concatPath( self._cfg.basePath, duk_require_string( ctx, 0 ) );
+        stream->append = append;
+        stream->chunkSize = chunkSize;
+        stream->chunkCount = chunkCount;
+
+        pushStreamObject( ctx, stream, stream->id, {
+            { "on", writeStreamOn, 2 },
+            { "write", writeStreamWrite, 1 },
+            { "end", writeStreamEnd, DUK_VARARGS },
+            { nullptr, nullptr, 0 }
+        } );
+        return 1;
+    }
+
+    // Hand the current chunk over to the I/O task
+    static void flushWriteStream( WriteStream *stream ) {
+        if ( stream->currentLength == 0 )
+            return;
+        unsigned char *data = stream->current.release();
+        int length = stream->currentLength;
+        stream->currentLength = 0;
+        stream->queued++;
+        stream->machine->postIoJob( [stream, data, length] {
+            std::string error;
+            try {
+                if ( !stream->ioFailed ) {
+                    if ( !stream->file.isOpen() )
+                        stream->file = fs::FileWriter( stream->path, stream->append );
+                    stream->file.write( data, length );
+                }
+            }
+            catch ( std::runtime_error& e ) {
+                stream->ioFailed = true;
+                error = e.what();
+            }
+            scheduleWriteDone( stream, data, error );
+        } );
+    }
+
+    // Flush the data and close the file. Posted after all the writes, so
+    // it is the last job of the stream that finishes.
+    static void endWriteStream( WriteStream *stream ) {
+        if ( stream->ending )
+            return;
+        if ( !stream->errored )
+            flushWriteStream( stream );
+        stream->ending = true;
+        stream->queued++;
+        stream->machine->postIoJob( [stream] {
+            std::string error;
+            try {
+                if ( !stream->ioFailed && !stream->file.isOpen() )
+                    stream->file = fs::FileWriter( stream->path, stream->append );
+                if ( stream->file.isOpen() ) {
+                    stream->file.sync();
+                    stream->file.close();
+                }
+            }
+            catch ( std::runtime_error& e ) {
+                error = e.what();
+            }
+            stream->file.close();
+            scheduleWriteDone( stream, nullptr, error );
+        } );
+    }
+
+    static void scheduleWriteDone( WriteStream *stream, unsigned char *data, const std::string& error ) {
+        stream->machine->schedule( [&]( duk_context *ctx ) {
+            duk_push_c_function( ctx, writeStreamChunkDone, 3 );
+            duk_push_pointer( ctx, stream );
+            duk_push_pointer( ctx, data );
+            if ( error.empty() )
+                duk_push_undefined( ctx );
+            else
+                dukReturn( ctx, error );
+        }, "fsWriteStream", JobClass::Io );
+    }
+
+    static duk_ret_t writeStreamChunkDone( duk_context *ctx ) {
+        auto *stream = reinterpret_cast< WriteStream * >( duk_require_pointer( ctx, 0 ) );
+        auto *data = reinterpret_cast< unsigned char * >( duk_get_pointer( ctx, 1 ) );
+        stream->queued--;
+        if ( data && int( stream->pool.size() ) < stream->chunkCount )
+            stream->pool.emplace_back( data );
+        else
+            delete[] data;
+
+        if ( stream->ending && stream->queued == 0 ) {
+            // The last job of the stream has finished
+            bool errored = stream->errored;
+            pushStream( ctx, stream->id );
+            unregisterStream( ctx, stream->id );
+            delete stream;
+            if ( !duk_is_undefined( ctx, 2 ) && !errored )
+                emitErrorOnTop( ctx, duk_get_string( ctx, 2 ) );
+            else if ( !errored )
+                emitOnTop( ctx, "finish" );
+            return 0;
+        }
+
+        if ( !duk_is_undefined( ctx, 2 ) && !stream->errored ) {
+            stream->errored = true;
+            endWriteStream( stream );
+            pushStream( ctx, stream->id );
+            emitErrorOnTop( ctx, duk_get_string( ctx, 2 ) );
+        }
+        else if ( stream->needDrain && stream->queued < stream->chunkCount && !stream->ending ) {
+            stream->needDrain = false;
+            emit( ctx, stream->id, "drain" );
+        }
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - event: string
+    // - listener: function
+    static duk_ret_t writeStreamOn( duk_context *ctx ) {
+        addListener( ctx );
+        duk_push_this( ctx );
+        return 1;
+    }
+
+    // Copy the data into chunks and return true if the queue is not full
+    static bool writeToStream( duk_context *ctx, WriteStream *stream, int index ) {
+        const unsigned char *data;
+        duk_size_t size;
+        if ( duk_is_string( ctx, index ) )
+            data = reinterpret_cast< const unsigned char * >( duk_get_lstring( ctx, index, &size ) );
+        else if ( duk_is_buffer_data( ctx, index ) )
+            data = static_cast< const unsigned char * >( duk_get_buffer_data( ctx, index, &size ) );
+        else
+            dukRaiseError( ctx, "Data has to be a string or a buffer" );
+
+        while ( size > 0 ) {
+            if ( !stream->current ) {
+                if ( stream->pool.empty() ) {
+                    stream->current.reset( new unsigned char[ stream->chunkSize ] );
+                }
+                else {
+                    stream->current = std::move( stream->pool.back() );
+                    stream->pool.pop_back();
+                }
+            }
+            int chunk = std::min< duk_size_t >( size, stream->chunkSize - stream->currentLength );
+            std::memcpy( stream->current.get() + stream->currentLength, data, chunk );
+            stream->currentLength += chunk;
+            data += chunk;
+            size -= chunk;
+            if ( stream->currentLength == stream->chunkSize )
+                flushWriteStream( stream );
+        }
+
+        if ( stream->queued < stream->chunkCount )
+            return true;
+        stream->needDrain = true;
+        return false;
+    }
+
+    // Accepts the following duk arguments:
+    // - data: string or buffer
+    static duk_ret_t writeStreamWrite( duk_context *ctx ) {
+        auto *stream = streamFromThis< WriteStream >( ctx );
+        if ( !stream || stream->ending )
+            dukRaiseError( ctx, "Write after end" );
+        if ( stream->errored )
+            return dukReturn( ctx, false );
+        duk_push_boolean( ctx, writeToStream( ctx, stream, 0 ) );
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - data: string or buffer, optional
+    static duk_ret_t writeStreamEnd( duk_context *ctx ) {
+        auto *stream = streamFromThis< WriteStream >( ctx );
+        if ( !stream || stream->ending )
+            return 0;
+        if ( duk_get_top( ctx ) > 0 && !duk_is_undefined( ctx, 0 ) && !stream->errored )
+            writeToStream( ctx, stream, 0 );
+        endWriteStream( stream );
+        return 0;
+    }
+
+    std::unique_ptr< freertos::Worker > _ioWorker;
+    int _nextStreamId = 0;
+};
+
+} // namespace jac
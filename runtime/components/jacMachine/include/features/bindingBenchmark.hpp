@@ -0,0 +1,97 @@
+#pragma once
+
+#include <jsmachine.hpp>
+
+#include <string>
+#include <string_view>
+
+namespace jac {
+
+// Implement module "bindingBenchmark" for measuring the overhead of native
+// calls
+//
+// Each function is provided in two variants with the same behavior:
+// handwritten Duktape/C functions registered as full function objects (the
+// prefix "hand") and functions generated by dukBind registered as lightfuncs
+// (the prefix "bound"):
+// - noop(): do nothing
+// - add(a, b): return the sum of two numbers
+// - mode(name): return 1 for "output", 2 for "input", 0 otherwise
+//
+// See tests/javascript/binding_benchmark for the measurement.
+template < typename Self >
+class BindingBenchmark {
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {};
+
+    void initialize() {
+        self().registerNativeModule( "bindingBenchmark", [this]( duk_context *ctx ) {
+            return self().initializeBenchmarkModule( ctx );
+        });
+    }
+
+    void onEventLoop() {}
+
+private:
+    // Initializes the module; there are the following arguments on the
+    // Duktape stack:
+    // - 0 requested module ID
+    // - 1 exports object
+    // - 2 module object
+    duk_ret_t initializeBenchmarkModule( duk_context *ctx ) {
+        const int exportOffset = 1;
+        duk_function_list_entry handwritten[] = {
+            { "handNoop", handNoop, 0 },
+            { "handAdd", handAdd, 2 },
+            { "handMode", handMode, 1 },
+            { nullptr, nullptr, 0 }
+        };
+        duk_put_function_list( ctx, exportOffset, handwritten );
+
+        duk_function_list_entry bound[] = {
+            dukBindEntry< &noop >( "boundNoop" ),
+            dukBindEntry< &add >( "boundAdd" ),
+            dukBindEntry< &mode >( "boundMode" ),
+            { nullptr, nullptr, 0 }
+        };
+        dukPutLightFunctionList( ctx, exportOffset, bound );
+        return dukReturn( ctx );
+    }
+
+    static duk_ret_t handNoop( duk_context *ctx ) {
+        return 0;
+    }
+
+    static duk_ret_t handAdd( duk_context *ctx ) {
+        double a = duk_require_number( ctx, 0 );
+        double b = duk_require_number( ctx, 1 );
+        return dukReturn( ctx, a + b );
+    }
+
+    static duk_ret_t handMode( duk_context *ctx ) {
+        const std::string modeString = duk_require_string( ctx, 0 );
+        if ( modeString == "output" )
+            return dukReturn( ctx, 1 );
+        if ( modeString == "input" )
+            return dukReturn( ctx, 2 );
+        return dukReturn( ctx, 0 );
+    }
+
+    static void noop() {}
+
+    static double add( double a, double b ) {
+        return a + b;
+    }
+
+    static int mode( std::string_view name ) {
+        if ( name == "output" )
+            return 1;
+        if ( name == "input" )
+            return 2;
+        return 0;
+    }
+};
+
+} // namespace jac
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+
 namespace jac {
 
+// Allocate the Duktape heap via the C allocator. The allocator counts the
+// requested bytes, so other features can decide when a collection pays off;
+// a reallocation counts its whole new size as the old one is unknown.
 template < typename Self >
 class CMemoryAllocator {
 public:
@@ -13,10 +19,20 @@ public:
 
     void onEventLoop() {}
 
+    // Number of bytes allocated since the last reset
+    size_t allocatedBytes() const {
+        return _allocatedBytes.load( std::memory_order_relaxed );
+    }
+
+    void resetAllocatedBytes() {
+        _allocatedBytes.store( 0, std::memory_order_relaxed );
+    }
+
     static void *allocateMemory( void *udata, duk_size_t size ) {
         // printf("Allocating %d, free: %d bytes, %d bytes\n", size, esp_get_free_heap_size(), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
         void *p = malloc( size );
         // printf("  %p\n", p);
+        Self::fromUdata( udata )._allocatedBytes.fetch_add( size, std::memory_order_relaxed );
         return p;
     }
 
@@ -24,12 +40,16 @@ public:
         // printf("Reallocating %d, free: %d bytes\n", size, esp_get_free_heap_size());
         void *p = realloc( ptr, size );
         // printf("  %p\n", p);
+        Self::fromUdata( udata )._allocatedBytes.fetch_add( size, std::memory_order_relaxed );
         return p;
     }
 
     static void freeMemory( void *udata, void *ptr ) {
         free( ptr );
     }
+
+private:
+    std::atomic< size_t > _allocatedBytes{ 0 };
 };
 
 } // namespace jac
\ No newline at end of file
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <jsmachine.hpp>
+#include <uploader.hpp>
+#include <filesystem.hpp>
+#include <freertos/semphr.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <unordered_set>
+
+namespace jac {
+
+// Implement heap snapshots for leak hunting
+//
+// The snapshot is a breadth-first walk over the values reachable from the
+// global object, the heap stash, the global stash and the pending jobs. For
+// each heap value (object, string or buffer), its size as reported by
+// duk_inspect_value and its references are recorded: own properties including
+// non-enumerable and hidden ones, accessors and the prototype. Values held
+// only by the call stack or by closure scopes are not visible via the Duktape
+// API, so they are missing. The walk does not invoke getters or proxy traps.
+//
+// The snapshot is streamed in a compact binary format; tools/heapsnapshot.py
+// converts it to the Chrome heap snapshot, computes retained sizes and diffs
+// two snapshots. The format is little-endian and starts with "JHS\x01" and
+// u32 uptime in ms followed by records:
+// - 0x01 node: u32 address, u8 kind (0 object, 1 string, 2 buffer), u8 class,
+//   u32 size, u8 length and that many bytes of the string content
+// - 0x02 edge: u32 from, u8 type (0 property, 1 getter, 2 setter,
+//   3 prototype), u32 address of the key string (0 for prototype), u32 to
+// - 0x03 root: u32 address, u8 length, name
+// - 0x00 end: u32 node count, u32 edge count
+//
+// The snapshot is available as the uploader dump source "heap" and via module
+// "heapsnapshot" with function write(path), which stores it to a file and
+// returns { nodes, edges, bytes }. The walk needs a set of visited addresses,
+// i.e., about 16 bytes of RAM per heap value.
+template < typename Self >
+class HeapSnapshot {
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {};
+
+    struct SnapshotStats {
+        uint32_t nodes;
+        uint32_t edges;
+        uint32_t bytes;
+    };
+
+    void initialize() {
+        _snapshotDone = xSemaphoreCreateBinary();
+        if ( !_snapshotDone )
+            throw std::runtime_error( "Cannot allocate semaphore" );
+        storage::registerDumpSource( "heap", [this]( const storage::DumpSink& sink ) {
+            self().dumpHeapSnapshot( sink );
+        });
+        self().registerNativeModule( "heapsnapshot", [this]( duk_context *ctx ) {
+            return self().initializeHeapSnapshotModule( ctx );
+        });
+    }
+
+    ~HeapSnapshot() {
+        storage::unregisterDumpSource( "heap" );
+        if ( _snapshotDone )
+            vSemaphoreDelete( _snapshotDone );
+    }
+
+    void onEventLoop() {}
+
+    // Walk the heap and pass the snapshot to the sink; has to be invoked from
+    // the event loop
+    SnapshotStats writeHeapSnapshot( duk_context *ctx, const storage::DumpSink& sink ) {
+        Walker walker( ctx, sink );
+        walker.header( xTaskGetTickCount() * portTICK_PERIOD_MS );
+        duk_push_global_object( ctx );
+        walker.root( "global" );
+        duk_push_heap_stash( ctx );
+        walker.root( "heapStash" );
+        duk_push_global_stash( ctx );
+        walker.root( "globalStash" );
+        duk_context *jobs = self()._nextJobs;
+        for ( duk_idx_t i = 0; i < duk_get_top( jobs ); i++ ) {
+            duk_dup( jobs, i );
+            duk_xmove_top( ctx, jobs, 1 );
+            walker.root( "jobs" );
+        }
+        return walker.run();
+    }
+
+    // Take the snapshot in the event loop and pass it to the sink; invoked
+    // from other tasks, e.g., the uploader
+    void dumpHeapSnapshot( const storage::DumpSink& sink ) {
+        _snapshotSink = &sink;
+        _snapshotError.clear();
+        self().schedule( []( duk_context *ctx ) {
+            duk_push_c_function( ctx, dukDumpSnapshot, 0 );
+        }, "heapSnapshot", JobClass::Background );
+        xSemaphoreTake( _snapshotDone, portMAX_DELAY );
+        _snapshotSink = nullptr;
+        if ( !_snapshotError.empty() )
+            throw std::runtime_error( _snapshotError );
+    }
+
+private:
+    enum Record : uint8_t { End = 0, Node = 1, Edge = 2, Root = 3 };
+    enum EdgeType : uint8_t { Property = 0, Getter = 1, Setter = 2, Prototype = 3 };
+
+    class Walker {
+    public:
+        Walker( duk_context *ctx, const storage::DumpSink& sink )
+            : _ctx( ctx ), _sink( sink )
+        {}
+
+        void header( uint32_t uptime ) {
+            put( "JHS\x01", 4 );
+            put32( uptime );
+        }
+
+        // Record the value on the top of the stack as a root and pop it
+        void root( const char *name ) {
+            void *ptr = duk_get_heapptr( _ctx, -1 );
+            duk_pop( _ctx );
+            if ( !ptr )
+                return;
+            visit( ptr );
+            size_t size = std::min< size_t >( std::strlen( name ), 255 );
+            put8( Root );
+            put32( address( ptr ) );
+            put8( size );
+            put( name, size );
+        }
+
+        SnapshotStats run() {
+            duk_require_stack( _ctx, 8 );
+            while ( !_queue.empty() ) {
+                void *ptr = _queue.front();
+                _queue.pop_front();
+                duk_push_heapptr( _ctx, ptr );
+                node( ptr );
+                if ( duk_get_type( _ctx, -1 ) == DUK_TYPE_OBJECT )
+                    references( ptr );
+                duk_pop( _ctx );
+            }
+            put8( End );
+            put32( _nodes );
+            put32( _edges );
+            flush();
+            return { _nodes, _edges, _bytes };
+        }
+
+    private:
+        static uint32_t address( void *ptr ) {
+            return uint32_t( reinterpret_cast< uintptr_t >( ptr ) );
+        }
+
+        void visit( void *ptr ) {
+            if ( ptr && _visited.insert( ptr ).second )
+                _queue.push_back( ptr );
+        }
+
+        // The value is on the top of the stack
+        void node( void *ptr ) {
+            uint8_t kind = 0;
+            duk_size_t previewSize = 0;
+            const char *preview = nullptr;
+            switch ( duk_get_type( _ctx, -1 ) ) {
+            case DUK_TYPE_STRING:
+                kind = 1;
+                preview = duk_get_lstring( _ctx, -1, &previewSize );
+                previewSize = std::min< duk_size_t >( previewSize, 255 );
+                break;
+            case DUK_TYPE_BUFFER:
+                kind = 2;
+                break;
+            }
+
+            duk_inspect_value( _ctx, -1 );
+            uint32_t size = 0;
+            for ( const char *field : { "hbytes", "pbytes", "bcbytes", "dbytes" } ) {
+                duk_get_prop_string( _ctx, -1, field );
+                size += duk_get_uint( _ctx, -1 );
+                duk_pop( _ctx );
+            }
+            duk_get_prop_string( _ctx, -1, "class" );
+            uint8_t dukClass = duk_get_uint( _ctx, -1 );
+            duk_pop_2( _ctx );
+
+            put8( Node );
+            put32( address( ptr ) );
+            put8( kind );
+            put8( dukClass );
+            put32( size );
+            put8( previewSize );
+            put( preview, previewSize );
+            _nodes++;
+        }
+
+        // The object is on the top of the stack. The values are read via
+        // property descriptors, so no getter is invoked.
+        void references( void *ptr ) {
+            duk_idx_t object = duk_get_top_index( _ctx );
+            duk_get_prototype( _ctx, object );
+            edge( ptr, Prototype, nullptr, duk_get_heapptr( _ctx, -1 ) );
+            duk_pop( _ctx );
+
+            duk_enum( _ctx, object, DUK_ENUM_OWN_PROPERTIES_ONLY | DUK_ENUM_INCLUDE_NONENUMERABLE
+                | DUK_ENUM_INCLUDE_HIDDEN | DUK_ENUM_INCLUDE_SYMBOLS | DUK_ENUM_NO_PROXY_BEHAVIOR );
+            while ( duk_next( _ctx, -1, 0 ) ) {
+                // The key is kept alive by the object
+                void *key = duk_get_heapptr( _ctx, -1 );
+                duk_get_prop_desc( _ctx, object, 0 );
+                auto reference = [&]( const char *field, EdgeType type ) {
+                    if ( duk_get_prop_string( _ctx, -1, field ) )
+                        edge( ptr, type, key, duk_get_heapptr( _ctx, -1 ) );
+                    duk_pop( _ctx );
+                };
+                reference( "value", Property );
+                reference( "get", Getter );
+                reference( "set", Setter );
+                duk_pop( _ctx );
+            }
+            duk_pop( _ctx );
+        }
+
+        void edge( void *from, EdgeType type, void *name, void *to ) {
+            if ( !to )
+                return; // Not a heap value
+            visit( to );
+            visit( name );
+            put8( Edge );
+            put32( address( from ) );
+            put8( type );
+            put32( address( name ) );
+            put32( address( to ) );
+            _edges++;
+        }
+
+        void put( const void *data, size_t size ) {
+            const auto *bytes = static_cast< const unsigned char * >( data );
+            while ( size > 0 ) {
+                size_t chunk = std::min( size, sizeof( _buffer ) - _size );
+                std::memcpy( _buffer + _size, bytes, chunk );
+                _size += chunk;
+                bytes += chunk;
+                size -= chunk;
+                if ( _size == sizeof( _buffer ) )
+                    flush();
+            }
+        }
+
+        void put8( uint8_t value ) {
+            put( &value, 1 );
+        }
+
+        void put32( uint32_t value ) {
+            unsigned char bytes[] = {
+                uint8_t( value ), uint8_t( value >> 8 ),
+                uint8_t( value >> 16 ), uint8_t( value >> 24 ) };
+            put( bytes, 4 );
+        }
+
+        void flush() {
+            if ( _size == 0 )
+                return;
+            _sink( _buffer, _size );
+            _bytes += _size;
+            _size = 0;
+        }
+
+        duk_context *_ctx;
+        const storage::DumpSink& _sink;
+        std::unordered_set< void * > _visited;
+        std::deque< void * > _queue;
+        unsigned char _buffer[ 256 ];
+        size_t _size = 0;
+        uint32_t _nodes = 0;
+        uint32_t _edges = 0;
+        uint32_t _bytes = 0;
+    };
+
+    // Initializes the module; there are the following arguments on the
+    // Duktape stack:
+    // - 0 requested module ID
+    // - 1 exports object
+    // - 2 module object
+    duk_ret_t initializeHeapSnapshotModule( duk_context *ctx ) {
+        const int exportOffset = 1;
+        duk_function_list_entry functions[] = {
+            { "write", dukWrite, 1 },
+            { nullptr, nullptr, 0 }
+        };
+        dukPutLightFunctionList( ctx, exportOffset, functions );
+        return dukReturn( ctx );
+    }
+
+    static duk_ret_t dukDumpSnapshot( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        try {
+            self.writeHeapSnapshot( ctx, *self._snapshotSink );
+        }
+        catch ( const std::exception& e ) {
+            self._snapshotError = e.what();
+        }
+        xSemaphoreGive( self._snapshotDone );
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - path: string
+    static duk_ret_t dukWrite( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        std::string path = fs::concatPath( self._cfg.basePath, duk_require_string( ctx, 0 ) );
+        FILE *f = std::fopen( path.c_str(), "wb" );
+        if ( !f )
+            dukRaiseError( ctx, "Cannot open " + path + ": " + std::strerror( errno ) );
+        bool failed = false;
+        SnapshotStats stats = self.writeHeapSnapshot( ctx, [&]( const unsigned char *data, int size ) {
+            failed |= std::fwrite( data, 1, size, f ) != size_t( size );
+        } );
+        failed |= std::fclose( f ) != 0;
+        if ( failed )
+            dukRaiseError( ctx, "Cannot write " + path + ": " + std::strerror( errno ) );
+
+        duk_push_object( ctx );
+        duk_push_uint( ctx, stats.nodes );
+        duk_put_prop_string( ctx, -2, "nodes" );
+        duk_push_uint( ctx, stats.edges );
+        duk_put_prop_string( ctx, -2, "edges" );
+        duk_push_uint( ctx, stats.bytes );
+        duk_put_prop_string( ctx, -2, "bytes" );
+        return 1;
+    }
+
+    SemaphoreHandle_t _snapshotDone = nullptr;
+    const storage::DumpSink *_snapshotSink = nullptr;
+    std::string _snapshotError;
+};
+
+} // namespace jac
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <jsmachine.hpp>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+
+namespace jac {
+
+namespace detail {
+
+template < typename Machine, typename = void >
+struct HasHrTimers: std::false_type {};
+
+template < typename Machine >
+struct HasHrTimers< Machine, std::void_t< decltype( std::declval< Machine& >().microsToNextHrTimer() ) > >:
+    std::true_type {};
+
+} // namespace detail
+
+// Run the garbage collection when the event loop is idle
+//
+// Before the event loop goes to sleep, a collection is run if at least
+// gcAllocationThreshold bytes were allocated since the last one and no timer
+// fires within gcMinIdleMs. Therefore, the pause of the collection falls
+// into time nobody waits for instead of into a random allocation in a
+// callback. Duktape's voluntary collection stays enabled as a safety net for
+// programs that are never idle.
+//
+// Requires CMemoryAllocator (allocation counter) and RtosTimers (deadlines of
+// the timers). The deadlines of HrTimers are considered as well if the machine
+// has the feature.
+//
+// Module "gc" has the following functions:
+// - stats(): return { collections, idleCollections, lastPauseUs, maxPauseUs,
+//   totalPauseUs, allocatedSinceGc }
+// - collect(): run the collection now
+template < typename Self >
+class IdleGc {
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {
+        size_t gcAllocationThreshold = 32 * 1024;
+        int gcMinIdleMs = 20;
+        bool gcCompact = false; // Compact objects after the collection
+    };
+
+    void initialize() {
+        self().registerNativeModule( "gc", [this]( duk_context *ctx ) {
+            return self().initializeGcModule( ctx );
+        });
+    }
+
+    void onEventLoop() {}
+
+    void onIdle() {
+        if ( self().allocatedBytes() < self()._cfg.gcAllocationThreshold )
+            return;
+        auto untilTimer = microsToNextTimer();
+        if ( untilTimer && *untilTimer < int64_t( self()._cfg.gcMinIdleMs ) * 1000 )
+            return;
+        collect();
+        _gcStats.idleCollections++;
+    }
+
+    // Run the collection and reset the allocation counter
+    void collect() {
+        JAC_TRACE_SCOPE( "gc" );
+        duk_context *ctx = self()._context;
+        int64_t start = esp_timer_get_time();
+        duk_gc( ctx, 0 );
+        if ( self()._cfg.gcCompact )
+            duk_gc( ctx, DUK_GC_COMPACT );
+        uint32_t pause = esp_timer_get_time() - start;
+        self().resetAllocatedBytes();
+
+        _gcStats.collections++;
+        _gcStats.lastPauseUs = pause;
+        _gcStats.maxPauseUs = std::max( _gcStats.maxPauseUs, pause );
+        _gcStats.totalPauseUs += pause;
+    }
+
+private:
+    // Return the number of microseconds until the nearest timer of any kind
+    // fires or nothing if there are no active timers
+    std::optional< int64_t > microsToNextTimer() {
+        std::optional< int64_t > nearest;
+        if ( auto ticks = self().ticksToNextTimer() )
+            nearest = int64_t( *ticks ) * portTICK_PERIOD_MS * 1000;
+        if constexpr ( detail::HasHrTimers< Self >::value ) {
+            if ( auto micros = self().microsToNextHrTimer() )
+                nearest = nearest ? std::min( *nearest, *micros ) : *micros;
+        }
+        return nearest;
+    }
+
+    struct GcStats {
+        uint32_t collections = 0;
+        uint32_t idleCollections = 0;
+        uint32_t lastPauseUs = 0;
+        uint32_t maxPauseUs = 0;
+        uint64_t totalPauseUs = 0;
+    };
+
+    // Initializes the module; there are the following arguments on the
+    // Duktape stack:
+    // - 0 requested module ID
+    // - 1 exports object
+    // - 2 module object
+    duk_ret_t initializeGcModule( duk_context *ctx ) {
+        const int exportOffset = 1;
+        duk_function_list_entry functions[] = {
+            { "stats", dukStats, 0 },
+            { "collect", dukCollect, 0 },
+            { nullptr, nullptr, 0 }
+        };
+        dukPutLightFunctionList( ctx, exportOffset, functions );
+        return dukReturn( ctx );
+    }
+
+    static duk_ret_t dukStats( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        const GcStats& stats = self._gcStats;
+        auto put = [&]( const char *name, double value ) {
+            duk_push_number( ctx, value );
+            duk_put_prop_string( ctx, -2, name );
+        };
+        duk_push_object( ctx );
+        put( "collections", stats.collections );
+        put( "idleCollections", stats.idleCollections );
+        put( "lastPauseUs", stats.lastPauseUs );
+        put( "maxPauseUs", stats.maxPauseUs );
+        put( "totalPauseUs", stats.totalPauseUs );
+        put( "allocatedSinceGc", self.allocatedBytes() );
+        return 1;
+    }
+
+    static duk_ret_t dukCollect( duk_context *ctx ) {
+        Self::fromContext( ctx ).collect();
+        return 0;
+    }
+
+    GcStats _gcStats;
+};
+
+} // namespace jac
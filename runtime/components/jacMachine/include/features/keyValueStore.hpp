@@ -0,0 +1,223 @@
+#pragma once
+
+#include <jsmachine.hpp>
+#include <kvStore.hpp>
+#include <partitionMedium.hpp>
+#include <filesystem.hpp>
+
+#include <atomic>
+#include <memory>
+
+namespace jac {
+
+// Implement persistent key-value store module "kv"
+//
+// The store lives in a dedicated flash partition (see jac::storage::KvStore
+// for the format). If there is no such partition, a file on the storage is
+// used instead.
+//
+// The module has the following functions:
+// - get(key): return the value or undefined
+// - set(key, value): store the value
+// - delete(key): remove the key
+// - keys(): return an array of all keys
+// - commit(changes): atomically apply all the changes given as an object;
+//   keys with null or undefined value are removed
+//
+// A value is a string, a buffer (returned as ArrayBuffer) or anything that
+// can be serialized to JSON. Every set, delete and commit is persisted before
+// the function returns. Compaction of the store runs in background.
+template < typename Self >
+class KeyValueStore {
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {
+        std::string kvPartition = "kv";
+        // Used when there is no partition; relative to the base path
+        std::string kvFallbackFile = "__kv.bin";
+        int kvFallbackSize = 64 * 1024;
+    };
+
+    void initialize() {
+        self().registerNativeModule( "kv", [this]( duk_context *ctx ) {
+            return self().initializeKvModule( ctx );
+        });
+    }
+
+    void onEventLoop() {}
+
+private:
+    // The store is opened on the first use, so a machine without a program
+    // using it does not pay for loading the index
+    storage::KvStore& store() {
+        if ( _store )
+            return *_store;
+        try {
+            _medium = std::make_unique< storage::PartitionMedium >(
+                self()._cfg.kvPartition.c_str() );
+        }
+        catch ( std::runtime_error& ) {
+            _medium = std::make_unique< storage::FileMedium >(
+                fs::concatPath( self()._cfg.basePath, self()._cfg.kvFallbackFile ),
+                self()._cfg.kvFallbackSize );
+        }
+        _store = std::make_unique< storage::KvStore >( *_medium );
+        _compactionWorker = std::make_unique< freertos::Worker >( "kvCompaction", 3072, 1 );
+        return *_store;
+    }
+
+    // Initializes the module; there are the following arguments on the
+    // Duktape stack:
+    // - 0 requested module ID
+    // - 1 exports object
+    // - 2 module object
+    duk_ret_t initializeKvModule( duk_context *ctx ) {
+        const int exportOffset = 1;
+        duk_function_list_entry functions[] = {
+            { "get", dukGet, 1 },
+            { "set", dukSet, 2 },
+            { "delete", dukDelete, 1 },
+            { "keys", dukKeys, 0 },
+            { "commit", dukCommit, 1 },
+            { nullptr, nullptr, 0 }
+        };
+        duk_put_function_list( ctx, exportOffset, functions );
+        return dukReturn( ctx );
+    }
+
+    // Commit the batch and plan a compaction if needed
+    void commit( duk_context *ctx, const std::vector< storage::KvStore::Change >& batch ) {
+        try {
+            store().commit( batch );
+        }
+        catch ( std::runtime_error& e ) {
+            dukRaiseError( ctx, e.what() );
+        }
+        if ( _store->needsCompaction() && !_compactionPending.exchange( true ) ) {
+            _compactionWorker->post( [this] {
+                try {
+                    _store->compact();
+                }
+                catch ( std::runtime_error& ) {
+                    // The next commit will compact the store in the
+                    // foreground and report the error
+                }
+                _compactionPending = false;
+            } );
+        }
+    }
+
+    static storage::KvStore::Value valueFromStack( duk_context *ctx, int index ) {
+        using Type = storage::KvStore::ValueType;
+        duk_size_t size;
+        if ( duk_is_string( ctx, index ) ) {
+            const char *data = duk_get_lstring( ctx, index, &size );
+            return { Type::String, std::string( data, size ) };
+        }
+        if ( duk_is_buffer_data( ctx, index ) ) {
+            const char *data = static_cast< const char * >( duk_get_buffer_data( ctx, index, &size ) );
+            return { Type::Buffer, std::string( data, size ) };
+        }
+        duk_dup( ctx, index );
+        const char *data = duk_json_encode( ctx, -1 );
+        if ( !data )
+            dukRaiseError( ctx, "The value cannot be stored" );
+        storage::KvStore::Value value{ Type::Json, data };
+        duk_pop( ctx );
+        return value;
+    }
+
+    // Accepts the following duk arguments:
+    // - key: string
+    static duk_ret_t dukGet( duk_context *ctx ) {
+        using Type = storage::KvStore::ValueType;
+        Self& self = Self::fromContext( ctx );
+        std::optional< storage::KvStore::Value > value;
+        try {
+            value = self.store().get( duk_require_string( ctx, 0 ) );
+        }
+        catch ( std::runtime_error& e ) {
+            dukRaiseError( ctx, e.what() );
+        }
+        if ( !value )
+            return 0;
+        switch ( value->type ) {
+        case Type::String:
+            return dukReturn( ctx, value->data );
+        case Type::Buffer: {
+            void *buffer = duk_push_fixed_buffer( ctx, value->data.size() );
+            std::memcpy( buffer, value->data.data(), value->data.size() );
+            duk_push_buffer_object( ctx, -1, 0, value->data.size(), DUK_BUFOBJ_ARRAYBUFFER );
+            return 1;
+        }
+        case Type::Json:
+            dukReturn( ctx, value->data );
+            duk_json_decode( ctx, -1 );
+            return 1;
+        }
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - key: string
+    // - value: any
+    static duk_ret_t dukSet( duk_context *ctx ) {
+        std::string key = duk_require_string( ctx, 0 );
+        if ( duk_is_null_or_undefined( ctx, 1 ) )
+            dukRaiseError( ctx, "Use delete to remove a key" );
+        Self::fromContext( ctx ).commit( ctx, { { key, valueFromStack( ctx, 1 ) } } );
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - key: string
+    static duk_ret_t dukDelete( duk_context *ctx ) {
+        std::string key = duk_require_string( ctx, 0 );
+        Self::fromContext( ctx ).commit( ctx, { { key, std::nullopt } } );
+        return 0;
+    }
+
+    static duk_ret_t dukKeys( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        std::vector< std::string > keys;
+        try {
+            keys = self.store().keys();
+        }
+        catch ( std::runtime_error& e ) {
+            dukRaiseError( ctx, e.what() );
+        }
+        duk_push_array( ctx );
+        for ( size_t i = 0; i != keys.size(); i++ ) {
+            dukReturn( ctx, keys[ i ] );
+            duk_put_prop_index( ctx, -2, i );
+        }
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - changes: object
+    static duk_ret_t dukCommit( duk_context *ctx ) {
+        duk_require_object( ctx, 0 );
+        std::vector< storage::KvStore::Change > batch;
+        duk_enum( ctx, 0, DUK_ENUM_OWN_PROPERTIES_ONLY );
+        while ( duk_next( ctx, -1, 1 ) ) {
+            std::string key = duk_get_string( ctx, -2 );
+            if ( duk_is_null_or_undefined( ctx, -1 ) )
+                batch.push_back( { key, std::nullopt } );
+            else
+                batch.push_back( { key, valueFromStack( ctx, -1 ) } );
+            duk_pop_2( ctx );
+        }
+        duk_pop( ctx );
+        Self::fromContext( ctx ).commit( ctx, batch );
+        return 0;
+    }
+
+    std::unique_ptr< storage::Medium > _medium;
+    std::unique_ptr< storage::KvStore > _store;
+    std::unique_ptr< freertos::Worker > _compactionWorker;
+    std::atomic< bool > _compactionPending = false;
+};
+
+} // namespace jac
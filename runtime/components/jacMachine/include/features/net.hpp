@@ -0,0 +1,832 @@
+#pragma once
+
+#include <jsmachine.hpp>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace jac {
+
+// Implement event-driven socket modules "net" (TCP) and "dgram" (UDP)
+//
+// Module "net" has the following functions:
+// - connect(port, host): return a Socket connecting to the IPv4 address
+// - listen(port[, host]): return a Server accepting connections
+//
+// Module "dgram" has the following function:
+// - createSocket([port[, host]]): return a Socket bound to the address; port 0
+//   or no port binds to an ephemeral port
+//
+// All objects have the following methods:
+// - on(event, listener): set the listener for the event; return this
+// - address(): return the local address as { address, port }
+// - close(): close the socket immediately; pending writes are rejected
+//
+// TCP socket events: "connect", "data" (Uint8Array), "end" (the peer closed
+// the connection), "error" (Error) and "close". A TCP socket has the following
+// additional methods:
+// - write(data): send a string or a buffer; return a promise resolved once
+//   the data are passed to the network stack
+// - end(): close the socket once the pending writes are sent
+// - pause(), resume(): stop and restart the delivery of data
+//
+// Server events: "connection" (Socket), "error" and "close".
+//
+// UDP socket events: "message" (Uint8Array, { address, port }), "error" and
+// "close". A UDP socket has the following additional method:
+// - send(data, port, host): send a datagram; return a promise
+//
+// A socket delivers data only once it has a "data" or "message" listener,
+// till then the data are left in the network stack. The data are passed in
+// buffers from a fixed pool; a buffer is valid only during the invocation of
+// the listener. When the pool is exhausted, the sockets are not read until a
+// buffer is returned. Half-open connections are not supported; "end" is always
+// followed by "close".
+//
+// All sockets are non-blocking and are watched by a single poller task via
+// select(), so the number of connections is not bound by the number of tasks,
+// but only by the number of sockets supported by the network stack. The poller
+// is woken from the event loop via a loopback UDP socket. The poller collects
+// the events into a queue which is delivered to JavaScript by a single job, so
+// the events are delivered in the order they happened.
+//
+// The objects of open sockets are kept in <stash>.netSlot[id], so an open
+// socket is not collected. The data being written are kept alive in
+// <stash>.netWriteSlot[promiseId].
+template < typename Self >
+class NetSockets {
+    static inline constexpr const char* SLOT = "netSlot";
+    static inline constexpr const char* WRITE_SLOT = "netWriteSlot";
+    static inline constexpr const char* CHUNK_SLOT = "netChunkSlot";
+    static inline constexpr const char* PROTO_SLOT = "netProtoSlot";
+    static inline constexpr const char* ID_PROP = DUK_HIDDEN_SYMBOL( "socketId" );
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {
+        int netChunkSize = 1460;
+        int netChunkCount = 8;
+        int netPollerStackSize = 4096;
+        int netPollerPriority = 5;
+    };
+
+    void initialize() {
+        setupSlot();
+
+        self().registerNativeModule( "net", [this]( duk_context *ctx ) {
+            return self().initializeNetModule( ctx );
+        });
+        self().registerNativeModule( "dgram", [this]( duk_context *ctx ) {
+            return self().initializeDgramModule( ctx );
+        });
+    }
+
+    void onEventLoop() {}
+
+private:
+    enum class Kind { Stream, Server, Datagram };
+
+    struct Write {
+        int promiseId;
+        const uint8_t *data;
+        size_t size;
+        size_t offset;
+        sockaddr_in to; // Datagrams only
+    };
+
+    struct Socket {
+        int fd;
+        Kind kind;
+        bool connecting = false;
+        bool reading = false; // There is a data listener and it is not paused
+        bool ending = false;  // Close once the writes are sent
+        bool closing = false; // Close in the next poller iteration
+        std::deque< Write > writes;
+    };
+
+    enum class EventType {
+        Connect, Connection, Data, Message, End, Error, Close, WriteDone
+    };
+
+    struct Event {
+        EventType type;
+        int id;
+        int value;  // Chunk index, accepted socket id, errno or promise id
+        int size;   // Size of data or success of a write
+        sockaddr_in from;
+    };
+
+    void setupSlot() {
+        duk_push_heap_stash( self()._context );
+        duk_push_object( self()._context );
+        duk_put_prop_string( self()._context, -2, SLOT );
+        duk_push_object( self()._context );
+        duk_put_prop_string( self()._context, -2, WRITE_SLOT );
+        duk_pop( self()._context );
+    }
+
+    // Initializes the module; there are the following arguments on the
+    // Duktape stack:
+    // - 0 requested module ID
+    // - 1 exports object
+    // - 2 module object
+    duk_ret_t initializeNetModule( duk_context *ctx ) {
+        const int exportOffset = 1;
+        duk_function_list_entry functions[] = {
+            { "connect", dukConnect, 2 },
+            { "listen", dukListen, 2 },
+            { nullptr, nullptr, 0 }
+        };
+        dukPutLightFunctionList( ctx, exportOffset, functions );
+        return dukReturn( ctx );
+    }
+
+    // See initializeNetModule
+    duk_ret_t initializeDgramModule( duk_context *ctx ) {
+        const int exportOffset = 1;
+        duk_function_list_entry functions[] = {
+            { "createSocket", dukCreateSocket, 2 },
+            { nullptr, nullptr, 0 }
+        };
+        dukPutLightFunctionList( ctx, exportOffset, functions );
+        return dukReturn( ctx );
+    }
+
+    // Allocate the receive buffers, the prototypes and start the poller on
+    // the first use
+    void start( duk_context *ctx ) {
+        if ( _wakeFd >= 0 )
+            return;
+
+        int wakeFd = socket( AF_INET, SOCK_DGRAM, 0 );
+        if ( wakeFd < 0 )
+            dukRaiseError( ctx, std::string( "Cannot open wakeup socket: " ) + std::strerror( errno ) );
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+        socklen_t addrLen = sizeof( addr );
+        if ( ::bind( wakeFd, reinterpret_cast< sockaddr * >( &addr ), sizeof( addr ) ) < 0
+            || getsockname( wakeFd, reinterpret_cast< sockaddr * >( &_wakeAddr ), &addrLen ) < 0 )
+        {
+            ::close( wakeFd );
+            dukRaiseError( ctx, std::string( "Cannot bind wakeup socket: " ) + std::strerror( errno ) );
+        }
+        setNonBlocking( wakeFd );
+
+        duk_push_heap_stash( ctx );
+        duk_push_array( ctx );
+        for ( int i = 0; i != self()._cfg.netChunkCount; i++ ) {
+            _chunks.push_back( static_cast< uint8_t * >(
+                duk_push_fixed_buffer( ctx, self()._cfg.netChunkSize ) ) );
+            duk_put_prop_index( ctx, -2, i );
+            _freeChunks.push_back( i );
+        }
+        duk_put_prop_string( ctx, -2, CHUNK_SLOT );
+
+        duk_push_object( ctx );
+        duk_function_list_entry common[] = {
+            { "on", socketOn, 2 },
+            { "address", socketAddress, 0 },
+            { "close", socketClose, 0 },
+            { nullptr, nullptr, 0 }
+        };
+        duk_function_list_entry stream[] = {
+            { "write", socketWrite, 1 },
+            { "end", socketEnd, 0 },
+            { "pause", socketPause, 0 },
+            { "resume", socketResume, 0 },
+            { nullptr, nullptr, 0 }
+        };
+        duk_function_list_entry datagram[] = {
+            { "send", socketSend, 3 },
+            { nullptr, nullptr, 0 }
+        };
+        for ( Kind kind : { Kind::Stream, Kind::Server, Kind::Datagram } ) {
+            duk_push_object( ctx );
+            dukPutLightFunctionList( ctx, -1, common );
+            if ( kind == Kind::Stream )
+                dukPutLightFunctionList( ctx, -1, stream );
+            if ( kind == Kind::Datagram )
+                dukPutLightFunctionList( ctx, -1, datagram );
+            duk_put_prop_index( ctx, -2, static_cast< int >( kind ) );
+        }
+        duk_put_prop_string( ctx, -2, PROTO_SLOT );
+        duk_pop( ctx );
+
+        _wakeFd = wakeFd;
+        if ( xTaskCreate( pollerTask, "netPoller", self()._cfg.netPollerStackSize,
+                this, self()._cfg.netPollerPriority, nullptr ) != pdPASS )
+        {
+            dukRaiseError( ctx, "Cannot allocate task" );
+        }
+    }
+
+    static void setNonBlocking( int fd ) {
+        fcntl( fd, F_SETFL, fcntl( fd, F_GETFL, 0 ) | O_NONBLOCK );
+    }
+
+    static sockaddr_in parseAddress( duk_context *ctx, int portIndex, int hostIndex,
+        const char *defaultHost )
+    {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons( duk_require_int( ctx, portIndex ) );
+        const char *host = duk_is_null_or_undefined( ctx, hostIndex )
+            ? defaultHost : duk_require_string( ctx, hostIndex );
+        if ( !host || inet_pton( AF_INET, host, &addr.sin_addr ) != 1 )
+            dukRaiseError( ctx, "Host has to be an IPv4 address" );
+        return addr;
+    }
+
+    static void pushAddress( duk_context *ctx, const sockaddr_in& addr ) {
+        char host[ INET_ADDRSTRLEN ];
+        inet_ntop( AF_INET, &addr.sin_addr, host, sizeof( host ) );
+        duk_push_object( ctx );
+        duk_push_string( ctx, host );
+        duk_put_prop_string( ctx, -2, "address" );
+        duk_push_int( ctx, ntohs( addr.sin_port ) );
+        duk_put_prop_string( ctx, -2, "port" );
+    }
+
+    // Register the socket and push its object. Has to be called under
+    // _netLock or before the socket is shared with the poller.
+    int addSocket( duk_context *ctx, int fd, Kind kind, bool connecting ) {
+        int id = _nextSocketId++;
+        Socket socket{ fd, kind };
+        socket.connecting = connecting;
+        _sockets.emplace( id, std::move( socket ) );
+        pushSocketObject( ctx, id, kind );
+        return id;
+    }
+
+    static void pushSocketObject( duk_context *ctx, int id, Kind kind ) {
+        duk_push_object( ctx );
+        auto objOffset = duk_get_top_index( ctx );
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, PROTO_SLOT );
+        duk_get_prop_index( ctx, -1, static_cast< int >( kind ) );
+        duk_set_prototype( ctx, objOffset );
+        duk_pop( ctx );
+        duk_push_int( ctx, id );
+        duk_put_prop_string( ctx, objOffset, ID_PROP );
+
+        duk_get_prop_string( ctx, -1, SLOT );
+        duk_push_object( ctx );
+        duk_dup( ctx, objOffset );
+        duk_put_prop_string( ctx, -2, "object" );
+        duk_push_object( ctx );
+        duk_put_prop_string( ctx, -2, "listeners" );
+        duk_put_prop_index( ctx, -2, id );
+        duk_pop_2( ctx );
+    }
+
+    // Open a non-blocking socket; raise an error on failure
+    static int openSocket( duk_context *ctx, int type ) {
+        int fd = socket( AF_INET, type, 0 );
+        if ( fd < 0 )
+            dukRaiseError( ctx, std::string( "Cannot open socket: " ) + std::strerror( errno ) );
+        setNonBlocking( fd );
+        return fd;
+    }
+
+    static void bindSocket( duk_context *ctx, int fd, const sockaddr_in& addr ) {
+        int reuse = 1;
+        setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
+        if ( ::bind( fd, reinterpret_cast< const sockaddr * >( &addr ), sizeof( addr ) ) < 0 ) {
+            int error = errno;
+            ::close( fd );
+            dukRaiseError( ctx, std::string( "Cannot bind socket: " ) + std::strerror( error ) );
+        }
+    }
+
+    // Accepts the following duk arguments:
+    // - port: number
+    // - host: string
+    static duk_ret_t dukConnect( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        sockaddr_in addr = parseAddress( ctx, 0, 1, nullptr );
+        self.start( ctx );
+        int fd = openSocket( ctx, SOCK_STREAM );
+        int res = ::connect( fd, reinterpret_cast< sockaddr * >( &addr ), sizeof( addr ) );
+        if ( res < 0 && errno != EINPROGRESS ) {
+            int error = errno;
+            ::close( fd );
+            dukRaiseError( ctx, std::string( "Cannot connect: " ) + std::strerror( error ) );
+        }
+        {
+            std::lock_guard< std::mutex > _( self._netLock );
+            self.addSocket( ctx, fd, Kind::Stream, true );
+        }
+        self.wake();
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - port: number
+    // - host: optional string
+    static duk_ret_t dukListen( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        sockaddr_in addr = parseAddress( ctx, 0, 1, "0.0.0.0" );
+        self.start( ctx );
+        int fd = openSocket( ctx, SOCK_STREAM );
+        bindSocket( ctx, fd, addr );
+        if ( ::listen( fd, 4 ) < 0 ) {
+            int error = errno;
+            ::close( fd );
+            dukRaiseError( ctx, std::string( "Cannot listen: " ) + std::strerror( error ) );
+        }
+        {
+            std::lock_guard< std::mutex > _( self._netLock );
+            self.addSocket( ctx, fd, Kind::Server, false );
+        }
+        self.wake();
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - port: optional number
+    // - host: optional string
+    static duk_ret_t dukCreateSocket( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        if ( duk_is_undefined( ctx, 0 ) ) {
+            duk_push_int( ctx, 0 );
+            duk_replace( ctx, 0 );
+        }
+        sockaddr_in addr = parseAddress( ctx, 0, 1, "0.0.0.0" );
+        self.start( ctx );
+        int fd = openSocket( ctx, SOCK_DGRAM );
+        bindSocket( ctx, fd, addr );
+        {
+            std::lock_guard< std::mutex > _( self._netLock );
+            self.addSocket( ctx, fd, Kind::Datagram, false );
+        }
+        self.wake();
+        return 1;
+    }
+
+    // Return the socket id of this; raise an error if the socket is closed
+    static int thisId( duk_context *ctx ) {
+        duk_push_this( ctx );
+        duk_get_prop_string( ctx, -1, ID_PROP );
+        int id = duk_require_int( ctx, -1 );
+        duk_pop_2( ctx );
+        return id;
+    }
+
+    // Call f on the socket under _netLock and wake the poller; raise an error
+    // if the socket is closed
+    template < typename F >
+    static auto withSocket( duk_context *ctx, F f ) {
+        Self& self = Self::fromContext( ctx );
+        int id = thisId( ctx );
+        std::unique_lock< std::mutex > guard( self._netLock );
+        auto it = self._sockets.find( id );
+        if ( it == self._sockets.end() || it->second.closing || it->second.ending ) {
+            guard.unlock();
+            dukRaiseError( ctx, "The socket is closed" );
+        }
+        f( it->second );
+        guard.unlock();
+        self.wake();
+    }
+
+    // Accepts the following duk arguments:
+    // - event: string
+    // - listener: function
+    static duk_ret_t socketOn( duk_context *ctx ) {
+        const char *event = duk_require_string( ctx, 0 );
+        duk_require_function( ctx, 1 );
+        int id = thisId( ctx );
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        if ( !duk_get_prop_index( ctx, -1, id ) )
+            dukRaiseError( ctx, "The socket is closed" );
+        duk_get_prop_string( ctx, -1, "listeners" );
+        duk_dup( ctx, 1 );
+        duk_put_prop_string( ctx, -2, event );
+        if ( std::strcmp( event, "data" ) == 0 || std::strcmp( event, "message" ) == 0 )
+            withSocket( ctx, []( Socket& s ) { s.reading = true; } );
+        duk_push_this( ctx );
+        return 1;
+    }
+
+    static duk_ret_t socketAddress( duk_context *ctx ) {
+        int fd = -1;
+        withSocket( ctx, [&]( Socket& s ) { fd = s.fd; } );
+        sockaddr_in addr{};
+        socklen_t addrLen = sizeof( addr );
+        if ( getsockname( fd, reinterpret_cast< sockaddr * >( &addr ), &addrLen ) < 0 )
+            dukRaiseError( ctx, std::strerror( errno ) );
+        pushAddress( ctx, addr );
+        return 1;
+    }
+
+    static duk_ret_t socketClose( duk_context *ctx ) {
+        withSocket( ctx, []( Socket& s ) { s.closing = true; } );
+        return 0;
+    }
+
+    static duk_ret_t socketEnd( duk_context *ctx ) {
+        withSocket( ctx, []( Socket& s ) { s.ending = true; } );
+        return 0;
+    }
+
+    static duk_ret_t socketPause( duk_context *ctx ) {
+        withSocket( ctx, []( Socket& s ) { s.reading = false; } );
+        return 0;
+    }
+
+    static duk_ret_t socketResume( duk_context *ctx ) {
+        withSocket( ctx, []( Socket& s ) { s.reading = true; } );
+        return 0;
+    }
+
+    // Queue the data on the given index for writing, return a promise
+    static duk_ret_t queueWrite( duk_context *ctx, int dataIndex, const sockaddr_in& to ) {
+        Self& self = Self::fromContext( ctx );
+        const void *data;
+        duk_size_t size;
+        if ( duk_is_string( ctx, dataIndex ) )
+            data = duk_get_lstring( ctx, dataIndex, &size );
+        else if ( duk_is_buffer_data( ctx, dataIndex ) )
+            data = duk_get_buffer_data( ctx, dataIndex, &size );
+        else
+            dukRaiseError( ctx, "Data has to be a string or a buffer" );
+
+        // Check the socket before the promise is created
+        withSocket( ctx, []( Socket& ) {} );
+        int promiseId = self.createPromise( ctx );
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, WRITE_SLOT );
+        duk_dup( ctx, dataIndex );
+        duk_put_prop_index( ctx, -2, promiseId );
+        duk_pop_2( ctx );
+
+        withSocket( ctx, [&]( Socket& s ) {
+            s.writes.push_back( { promiseId, static_cast< const uint8_t * >( data ), size, 0, to } );
+        } );
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - data: string or buffer
+    static duk_ret_t socketWrite( duk_context *ctx ) {
+        return queueWrite( ctx, 0, sockaddr_in{} );
+    }
+
+    // Accepts the following duk arguments:
+    // - data: string or buffer
+    // - port: number
+    // - host: string
+    static duk_ret_t socketSend( duk_context *ctx ) {
+        return queueWrite( ctx, 0, parseAddress( ctx, 1, 2, nullptr ) );
+    }
+
+    void wake() {
+        char byte = 0;
+        sendto( _wakeFd, &byte, 1, 0, reinterpret_cast< sockaddr * >( &_wakeAddr ), sizeof( _wakeAddr ) );
+    }
+
+    static void pollerTask( void *arg ) {
+        reinterpret_cast< NetSockets * >( arg )->poll();
+    }
+
+    void poll() {
+        std::vector< Event > events;
+        while ( true ) {
+            fd_set readSet, writeSet;
+            FD_ZERO( &readSet );
+            FD_ZERO( &writeSet );
+            FD_SET( _wakeFd, &readSet );
+            int maxFd = _wakeFd;
+            {
+                std::lock_guard< std::mutex > _( _netLock );
+                closeSockets( events );
+                for ( auto& [ id, s ] : _sockets ) {
+                    bool read = s.kind == Kind::Server
+                        || ( !s.connecting && s.reading && !_freeChunks.empty() );
+                    bool write = s.connecting || !s.writes.empty();
+                    if ( read )
+                        FD_SET( s.fd, &readSet );
+                    if ( write )
+                        FD_SET( s.fd, &writeSet );
+                    if ( read || write )
+                        maxFd = std::max( maxFd, s.fd );
+                }
+            }
+            flushEvents( events );
+
+            if ( select( maxFd + 1, &readSet, &writeSet, nullptr, nullptr ) < 0 )
+                continue;
+            if ( FD_ISSET( _wakeFd, &readSet ) ) {
+                char buffer[ 16 ];
+                while ( recv( _wakeFd, buffer, sizeof( buffer ), 0 ) > 0 );
+            }
+
+            {
+                std::lock_guard< std::mutex > _( _netLock );
+                std::vector< std::pair< int, Socket > > accepted;
+                for ( auto& [ id, s ] : _sockets ) {
+                    if ( s.closing )
+                        continue;
+                    if ( FD_ISSET( s.fd, &writeSet ) )
+                        handleWritable( id, s, events );
+                    if ( FD_ISSET( s.fd, &readSet ) )
+                        handleReadable( id, s, events, accepted );
+                    if ( s.ending && s.writes.empty() )
+                        s.closing = true;
+                }
+                for ( auto& socket : accepted )
+                    _sockets.emplace( std::move( socket ) );
+            }
+            flushEvents( events );
+        }
+    }
+
+    // Close the sockets marked for closing; has to be called under _netLock
+    void closeSockets( std::vector< Event >& events ) {
+        for ( auto it = _sockets.begin(); it != _sockets.end(); ) {
+            if ( !it->second.closing ) {
+                ++it;
+                continue;
+            }
+            ::close( it->second.fd );
+            for ( auto& write : it->second.writes )
+                events.push_back( { EventType::WriteDone, it->first, write.promiseId, false } );
+            events.push_back( { EventType::Close, it->first } );
+            it = _sockets.erase( it );
+        }
+    }
+
+    void fail( int id, Socket& s, int error, std::vector< Event >& events ) {
+        events.push_back( { EventType::Error, id, error } );
+        s.closing = true;
+    }
+
+    void handleWritable( int id, Socket& s, std::vector< Event >& events ) {
+        if ( s.connecting ) {
+            int error = 0;
+            socklen_t len = sizeof( error );
+            getsockopt( s.fd, SOL_SOCKET, SO_ERROR, &error, &len );
+            if ( error != 0 )
+                return fail( id, s, error, events );
+            s.connecting = false;
+            events.push_back( { EventType::Connect, id } );
+            return;
+        }
+        while ( !s.writes.empty() ) {
+            Write& w = s.writes.front();
+            ssize_t res = s.kind == Kind::Datagram
+                ? sendto( s.fd, w.data, w.size, 0, reinterpret_cast< sockaddr * >( &w.to ), sizeof( w.to ) )
+                : send( s.fd, w.data + w.offset, w.size - w.offset, 0 );
+            if ( res < 0 ) {
+                if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                    return;
+                if ( s.kind == Kind::Datagram ) {
+                    // A datagram error affects only the single datagram
+                    events.push_back( { EventType::WriteDone, id, w.promiseId, false } );
+                    s.writes.pop_front();
+                    continue;
+                }
+                return fail( id, s, errno, events );
+            }
+            w.offset += res;
+            if ( s.kind == Kind::Stream && w.offset < w.size )
+                return;
+            events.push_back( { EventType::WriteDone, id, w.promiseId, true } );
+            s.writes.pop_front();
+        }
+    }
+
+    void handleReadable( int id, Socket& s, std::vector< Event >& events,
+        std::vector< std::pair< int, Socket > >& accepted )
+    {
+        if ( s.kind == Kind::Server ) {
+            int fd;
+            while ( ( fd = accept( s.fd, nullptr, nullptr ) ) >= 0 ) {
+                setNonBlocking( fd );
+                int newId = _nextSocketId++;
+                accepted.emplace_back( newId, Socket{ fd, Kind::Stream } );
+                events.push_back( { EventType::Connection, id, newId } );
+            }
+            if ( errno != EAGAIN && errno != EWOULDBLOCK )
+                fail( id, s, errno, events );
+            return;
+        }
+        // Read a single chunk per round, so a busy socket cannot take the
+        // whole pool
+        if ( s.reading && !_freeChunks.empty() ) {
+            int chunk = _freeChunks.back();
+            Event event{ s.kind == Kind::Datagram ? EventType::Message : EventType::Data, id, chunk };
+            socklen_t fromLen = sizeof( event.from );
+            ssize_t res = recvfrom( s.fd, _chunks[ chunk ], self()._cfg.netChunkSize, 0,
+                reinterpret_cast< sockaddr * >( &event.from ), &fromLen );
+            if ( res < 0 ) {
+                if ( errno != EAGAIN && errno != EWOULDBLOCK )
+                    fail( id, s, errno, events );
+                return;
+            }
+            if ( res == 0 && s.kind == Kind::Stream ) {
+                events.push_back( { EventType::End, id } );
+                s.closing = true;
+                return;
+            }
+            _freeChunks.pop_back();
+            event.size = res;
+            events.push_back( event );
+        }
+    }
+
+    // Pass the events to the event loop; must not be called under _netLock
+    void flushEvents( std::vector< Event >& events ) {
+        if ( events.empty() )
+            return;
+        {
+            std::lock_guard< std::mutex > _( _netLock );
+            _netEvents.insert( _netEvents.end(), events.begin(), events.end() );
+        }
+        events.clear();
+        if ( _dispatchScheduled.exchange( true ) )
+            return;
+        self().schedule( []( duk_context *ctx ) {
+            duk_push_c_function( ctx, dispatchEvents, 0 );
+        }, "net", JobClass::Io );
+    }
+
+    void returnChunk( int chunk ) {
+        bool wasEmpty;
+        {
+            std::lock_guard< std::mutex > _( _netLock );
+            wasEmpty = _freeChunks.empty();
+            _freeChunks.push_back( chunk );
+        }
+        if ( wasEmpty )
+            wake();
+    }
+
+    // Push the listener of the socket for the event; return false and push
+    // nothing if there is no such listener
+    static bool pushListener( duk_context *ctx, int id, const char *event ) {
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        if ( !duk_get_prop_index( ctx, -1, id ) ) {
+            duk_pop_3( ctx );
+            return false;
+        }
+        duk_get_prop_string( ctx, -1, "listeners" );
+        duk_get_prop_string( ctx, -1, event );
+        if ( duk_is_function( ctx, -1 ) ) {
+            duk_replace( ctx, -5 );
+            duk_pop_3( ctx );
+            return true;
+        }
+        duk_pop_n( ctx, 5 );
+        return false;
+    }
+
+    // Push a view of the chunk
+    static void pushChunk( duk_context *ctx, int chunk, int size ) {
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, CHUNK_SLOT );
+        duk_get_prop_index( ctx, -1, chunk );
+        duk_push_buffer_object( ctx, -1, 0, size, DUK_BUFOBJ_UINT8ARRAY );
+        duk_replace( ctx, -4 );
+        duk_pop_2( ctx );
+    }
+
+    // Deliver a single event; return the result of the listener invocation.
+    // On failure, the error is left on the stack.
+    int dispatch( duk_context *ctx, const Event& event ) {
+        int argCount = 0;
+        const char *name = nullptr;
+        switch ( event.type ) {
+        case EventType::Connect:
+            name = "connect";
+            break;
+        case EventType::Connection:
+            name = "connection";
+            break;
+        case EventType::Data:
+            name = "data";
+            break;
+        case EventType::Message:
+            name = "message";
+            break;
+        case EventType::End:
+            name = "end";
+            break;
+        case EventType::Error:
+            name = "error";
+            break;
+        case EventType::Close:
+            name = "close";
+            break;
+        case EventType::WriteDone:
+            duk_push_heap_stash( ctx );
+            duk_get_prop_string( ctx, -1, WRITE_SLOT );
+            duk_del_prop_index( ctx, -1, event.value );
+            duk_pop_2( ctx );
+            if ( event.size )
+                duk_push_undefined( ctx );
+            else
+                duk_push_error_object( ctx, DUK_ERR_ERROR, "Write failed" );
+            Self::settlePromise( ctx, event.value, event.size );
+            return DUK_EXEC_SUCCESS;
+        }
+
+        bool hasListener = pushListener( ctx, event.id, name );
+        if ( event.type == EventType::Connection ) {
+            if ( !hasListener ) {
+                // Nobody accepts the connection
+                {
+                    std::lock_guard< std::mutex > _( _netLock );
+                    auto it = _sockets.find( event.value );
+                    if ( it != _sockets.end() )
+                        it->second.closing = true;
+                }
+                wake();
+                return DUK_EXEC_SUCCESS;
+            }
+            pushSocketObject( ctx, event.value, Kind::Stream );
+            argCount = 1;
+        }
+        if ( event.type == EventType::Data || event.type == EventType::Message ) {
+            if ( hasListener ) {
+                pushChunk( ctx, event.value, event.size );
+                argCount = 1;
+            }
+            if ( hasListener && event.type == EventType::Message ) {
+                pushAddress( ctx, event.from );
+                argCount = 2;
+            }
+        }
+        if ( event.type == EventType::Error && hasListener ) {
+            duk_push_error_object( ctx, DUK_ERR_ERROR, "%s", std::strerror( event.value ) );
+            argCount = 1;
+        }
+        if ( event.type == EventType::Close ) {
+            duk_push_heap_stash( ctx );
+            duk_get_prop_string( ctx, -1, SLOT );
+            duk_del_prop_index( ctx, -1, event.id );
+            duk_pop_2( ctx );
+        }
+
+        int result = DUK_EXEC_SUCCESS;
+        if ( hasListener && ( result = duk_pcall( ctx, argCount ) ) == DUK_EXEC_SUCCESS )
+            duk_pop( ctx );
+        if ( event.type == EventType::Data || event.type == EventType::Message )
+            returnChunk( event.value );
+        return result;
+    }
+
+    // Deliver all pending events in the order they happened. Errors thrown
+    // by the listeners do not stop the delivery, the first one is rethrown at
+    // the end.
+    static duk_ret_t dispatchEvents( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        self._dispatchScheduled = false;
+        std::deque< Event > events;
+        {
+            std::lock_guard< std::mutex > _( self._netLock );
+            std::swap( events, self._netEvents );
+        }
+        bool failed = false;
+        for ( auto& event : events ) {
+            if ( self.dispatch( ctx, event ) == DUK_EXEC_SUCCESS )
+                continue;
+            if ( failed )
+                duk_pop( ctx );
+            failed = true; // Keep the first error on the stack
+        }
+        if ( failed )
+            duk_throw( ctx );
+        return 0;
+    }
+
+    int _wakeFd = -1;
+    sockaddr_in _wakeAddr{};
+    std::mutex _netLock;
+    std::map< int, Socket > _sockets;
+    int _nextSocketId = 0;
+    std::vector< uint8_t * > _chunks;
+    std::vector< int > _freeChunks;
+    std::deque< Event > _netEvents;
+    std::atomic< bool > _dispatchScheduled{ false };
+};
+
+} // namespace jac
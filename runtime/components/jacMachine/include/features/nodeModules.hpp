@@ -35,6 +35,7 @@ public:
     void onEventLoop() {}
 
     void evaluateMain( const std::string& path ) {
+        JAC_TRACE_SCOPE( "evaluateMain" );
         std::string source = fs::readFile( resolvePath( path ) );
         duk_push_string( self()._context, source.c_str() );
         auto ret = duk_module_node_peval_main( self()._context, path.c_str() );
@@ -122,6 +123,7 @@ private:
         /*
          *  Entry stack: [ resolved_id exports module ]
          */
+        JAC_TRACE_SCOPE( "moduleLoad" );
         const std::string requestedId = duk_get_string( ctx, 0 );
         try {
             auto nativeModuleIt = self._availableNativeModules.find( requestedId );
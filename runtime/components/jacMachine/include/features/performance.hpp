@@ -0,0 +1,362 @@
+#pragma once
+
+#include <jsmachine.hpp>
+#include <uploader.hpp>
+#include <esp_timer.h>
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace jac {
+
+// Implement global object performance with user timing
+//
+// The object has the following functions:
+// - now(): return milliseconds since the machine start with microsecond
+//   resolution
+// - mark(name[, options]): record a mark; options.startTime overrides the
+//   time
+// - measure(name[, start[, end]]): record a measure between two marks or
+//   times; start defaults to 0, end to now. Returns the duration instead of
+//   an entry object.
+// - getEntries(), getEntriesByName(name[, type]), getEntriesByType(type):
+//   return arrays of { name, entryType, startTime, duration }
+// - clearMarks([name]), clearMeasures([name])
+//
+// Unlike the standard, the entries live in a native ring of perfEntryCount
+// entries and the oldest ones are overwritten. The names are interned, so
+// mark and measure do not allocate in the JavaScript heap; a name is released
+// once no entry in the ring refers to it, so the table is bounded by the ring
+// size. Marks referenced by measure are looked up in the ring, i.e., an
+// overwritten mark is no longer known. The builtin of Duktape stays disabled.
+//
+// The entries are available as the uploader dump source "perf" as lines
+// "entryType name startTime duration" separated by tabs, times in microseconds.
+template < typename Self >
+class PerformanceTimeline {
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {
+        int perfEntryCount = 256;
+    };
+
+    void initialize() {
+        duk_context *ctx = self()._context;
+        _perfOrigin = esp_timer_get_time();
+        // Each name in use is referred by an entry, so the ids fit uint16_t
+        if ( self()._cfg.perfEntryCount < 1 || self()._cfg.perfEntryCount > 65535 )
+            throw std::runtime_error( "perfEntryCount has to be in range 1-65535" );
+        _perfEntries.resize( self()._cfg.perfEntryCount );
+
+        duk_function_list_entry functions[] = {
+            { "now", dukNow, 0 },
+            { "mark", dukMark, 2 },
+            { "measure", dukMeasure, 3 },
+            { "getEntries", dukGetEntries, 0 },
+            { "getEntriesByName", dukGetEntriesByName, 2 },
+            { "getEntriesByType", dukGetEntriesByType, 1 },
+            { "clearMarks", dukClearMarks, 1 },
+            { "clearMeasures", dukClearMeasures, 1 },
+            { nullptr, nullptr, 0 }
+        };
+        duk_push_object( ctx );
+        dukPutLightFunctionList( ctx, -1, functions );
+        duk_push_number( ctx, 0 );
+        duk_put_prop_string( ctx, -2, "timeOrigin" );
+        duk_put_global_string( ctx, "performance" );
+
+        storage::registerDumpSource( "perf", [this]( const storage::DumpSink& sink ) {
+            self().dumpPerformanceEntries( sink );
+        });
+    }
+
+    ~PerformanceTimeline() {
+        storage::unregisterDumpSource( "perf" );
+    }
+
+    void onEventLoop() {}
+
+    // Microseconds since the machine start
+    int64_t perfNow() const {
+        return esp_timer_get_time() - _perfOrigin;
+    }
+
+    // Write all entries as text lines; can be called from any task
+    void dumpPerformanceEntries( const storage::DumpSink& sink ) {
+        std::vector< Entry > entries;
+        std::deque< std::string > names;
+        {
+            std::lock_guard< std::mutex > _( _perfLock );
+            forEachEntry( [&]( const Entry& e ) { entries.push_back( e ); } );
+            names = _perfNames;
+        }
+        for ( const Entry& e : entries ) {
+            char buffer[ 48 ];
+            int size = std::snprintf( buffer, sizeof( buffer ), "\t%" PRId64 "\t%" PRId64 "\n",
+                e.start, e.duration );
+            std::string line = typeName( e.type );
+            line += '\t';
+            line += names[ e.name ];
+            line.append( buffer, size );
+            sink( reinterpret_cast< const unsigned char * >( line.data() ), line.size() );
+        }
+    }
+
+private:
+    enum class EntryType : uint8_t { None, Mark, Measure };
+
+    struct Entry {
+        int64_t start = 0;
+        int64_t duration = 0;
+        uint16_t name = 0;
+        EntryType type = EntryType::None;
+    };
+
+    static const char *typeName( EntryType type ) {
+        return type == EntryType::Mark ? "mark" : "measure";
+    }
+
+    static EntryType parseType( duk_context *ctx, duk_idx_t idx ) {
+        if ( duk_is_undefined( ctx, idx ) )
+            return EntryType::None;
+        std::string_view type = duk_require_string( ctx, idx );
+        if ( type == "mark" )
+            return EntryType::Mark;
+        if ( type == "measure" )
+            return EntryType::Measure;
+        dukRaiseError( ctx, "Unknown entry type " + std::string( type ) );
+        return EntryType::None;
+    }
+
+    // Invoke f for all valid entries from the oldest; has to be called with
+    // _perfLock
+    template < typename F >
+    void forEachEntry( F f ) {
+        size_t capacity = _perfEntries.size();
+        size_t start = ( _perfHead + capacity - _perfCount ) % capacity;
+        for ( size_t i = 0; i != _perfCount; i++ ) {
+            const Entry& e = _perfEntries[ ( start + i ) % capacity ];
+            if ( e.type != EntryType::None )
+                f( e );
+        }
+    }
+
+    // Return the id of the name if it is in use
+    std::optional< uint16_t > find( duk_context *ctx, duk_idx_t idx ) {
+        duk_size_t size;
+        const char *s = duk_require_lstring( ctx, idx, &size );
+        auto it = _perfNameIds.find( std::string_view( s, size ) );
+        if ( it == _perfNameIds.end() )
+            return std::nullopt;
+        return it->second;
+    }
+
+    // Return the id of the name, add it if needed. The name is released once
+    // no entry refers to it, so the entry has to be recorded right away.
+    uint16_t intern( duk_context *ctx, duk_idx_t idx ) {
+        if ( auto id = find( ctx, idx ) )
+            return *id;
+        duk_size_t size;
+        const char *s = duk_require_lstring( ctx, idx, &size );
+        uint16_t id;
+        {
+            std::lock_guard< std::mutex > _( _perfLock );
+            if ( !_perfFreeNames.empty() ) {
+                id = _perfFreeNames.back();
+                _perfFreeNames.pop_back();
+                _perfNames[ id ].assign( s, size );
+            }
+            else {
+                id = _perfNames.size();
+                _perfNames.emplace_back( s, size );
+                _perfNameRefs.push_back( 0 );
+            }
+        }
+        _perfNameIds.emplace( _perfNames[ id ], id );
+        return id;
+    }
+
+    // Has to be called with _perfLock
+    void release( uint16_t name ) {
+        if ( --_perfNameRefs[ name ] != 0 )
+            return;
+        _perfNameIds.erase( _perfNames[ name ] );
+        _perfFreeNames.push_back( name );
+    }
+
+    void record( const Entry& e ) {
+        std::lock_guard< std::mutex > _( _perfLock );
+        Entry& slot = _perfEntries[ _perfHead ];
+        _perfNameRefs[ e.name ]++; // Before the release, the name can be the same
+        if ( slot.type != EntryType::None )
+            release( slot.name );
+        slot = e;
+        _perfHead = ( _perfHead + 1 ) % _perfEntries.size();
+        if ( _perfCount < _perfEntries.size() )
+            _perfCount++;
+    }
+
+    // Return time in microseconds given by a mark name or by a time in
+    // milliseconds; undefined gives the default
+    int64_t resolveTime( duk_context *ctx, duk_idx_t idx, int64_t defaultTime ) {
+        if ( duk_is_undefined( ctx, idx ) )
+            return defaultTime;
+        if ( duk_is_number( ctx, idx ) )
+            return duk_get_number( ctx, idx ) * 1000;
+        std::optional< int64_t > time;
+        if ( auto name = find( ctx, idx ) ) {
+            std::lock_guard< std::mutex > _( _perfLock );
+            forEachEntry( [&]( const Entry& e ) {
+                if ( e.type == EntryType::Mark && e.name == *name )
+                    time = e.start;
+            } );
+        }
+        if ( !time )
+            dukRaiseError( ctx, std::string( "No mark named " ) + duk_require_string( ctx, idx ) );
+        return *time;
+    }
+
+    void clear( duk_context *ctx, EntryType type ) {
+        bool all = duk_is_undefined( ctx, 0 );
+        std::optional< uint16_t > name;
+        if ( !all ) {
+            name = find( ctx, 0 );
+            if ( !name )
+                return;
+        }
+        std::lock_guard< std::mutex > _( _perfLock );
+        for ( Entry& e : _perfEntries ) {
+            if ( e.type == type && ( all || e.name == *name ) ) {
+                e.type = EntryType::None;
+                release( e.name );
+            }
+        }
+    }
+
+    // Push an array of entries matching the name (if given) and the type (if
+    // not None)
+    void pushEntries( duk_context *ctx, const uint16_t *name, EntryType type ) {
+        std::vector< Entry > entries;
+        {
+            std::lock_guard< std::mutex > _( _perfLock );
+            forEachEntry( [&]( const Entry& e ) {
+                if ( ( !name || e.name == *name ) && ( type == EntryType::None || e.type == type ) )
+                    entries.push_back( e );
+            } );
+        }
+        duk_push_array( ctx );
+        for ( size_t i = 0; i != entries.size(); i++ ) {
+            const Entry& e = entries[ i ];
+            duk_push_object( ctx );
+            duk_push_lstring( ctx, _perfNames[ e.name ].data(), _perfNames[ e.name ].size() );
+            duk_put_prop_string( ctx, -2, "name" );
+            duk_push_string( ctx, typeName( e.type ) );
+            duk_put_prop_string( ctx, -2, "entryType" );
+            duk_push_number( ctx, e.start / 1000.0 );
+            duk_put_prop_string( ctx, -2, "startTime" );
+            duk_push_number( ctx, e.duration / 1000.0 );
+            duk_put_prop_string( ctx, -2, "duration" );
+            duk_put_prop_index( ctx, -2, i );
+        }
+    }
+
+    static duk_ret_t dukNow( duk_context *ctx ) {
+        duk_push_number( ctx, Self::fromContext( ctx ).perfNow() / 1000.0 );
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - name: string
+    // - options: optional object { startTime }
+    static duk_ret_t dukMark( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        int64_t now = self.perfNow();
+        Entry e;
+        e.type = EntryType::Mark;
+        e.start = now;
+        if ( duk_is_object( ctx, 1 ) && duk_get_prop_string( ctx, 1, "startTime" ) )
+            e.start = duk_require_number( ctx, -1 ) * 1000;
+        e.name = self.intern( ctx, 0 );
+        self.record( e );
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - name: string
+    // - start: optional mark name or time in ms
+    // - end: optional mark name or time in ms
+    static duk_ret_t dukMeasure( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        int64_t now = self.perfNow();
+        Entry e;
+        e.type = EntryType::Measure;
+        e.start = self.resolveTime( ctx, 1, 0 );
+        e.duration = self.resolveTime( ctx, 2, now ) - e.start;
+        e.name = self.intern( ctx, 0 );
+        self.record( e );
+        return dukReturn( ctx, e.duration / 1000.0 );
+    }
+
+    static duk_ret_t dukGetEntries( duk_context *ctx ) {
+        Self::fromContext( ctx ).pushEntries( ctx, nullptr, EntryType::None );
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - name: string
+    // - type: optional string
+    static duk_ret_t dukGetEntriesByName( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        EntryType type = parseType( ctx, 1 );
+        auto name = self.find( ctx, 0 );
+        if ( !name ) {
+            duk_push_array( ctx );
+            return 1;
+        }
+        self.pushEntries( ctx, &*name, type );
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - type: string
+    static duk_ret_t dukGetEntriesByType( duk_context *ctx ) {
+        duk_require_string( ctx, 0 );
+        Self::fromContext( ctx ).pushEntries( ctx, nullptr, parseType( ctx, 0 ) );
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - name: optional string
+    static duk_ret_t dukClearMarks( duk_context *ctx ) {
+        Self::fromContext( ctx ).clear( ctx, EntryType::Mark );
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - name: optional string
+    static duk_ret_t dukClearMeasures( duk_context *ctx ) {
+        Self::fromContext( ctx ).clear( ctx, EntryType::Measure );
+        return 0;
+    }
+
+    int64_t _perfOrigin = 0;
+    std::mutex _perfLock; // Guards the entries and the names for the dump
+    std::vector< Entry > _perfEntries;
+    size_t _perfHead = 0;
+    size_t _perfCount = 0;
+    std::deque< std::string > _perfNames; // Stable, so they can be viewed
+    std::map< std::string_view, uint16_t > _perfNameIds; // Names in use
+    std::vector< uint16_t > _perfNameRefs; // Number of entries per name
+    std::vector< uint16_t > _perfFreeNames;
+};
+
+} // namespace jac
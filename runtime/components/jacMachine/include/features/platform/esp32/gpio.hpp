@@ -1,7 +1,20 @@
 #pragma once
 
 #include <jsmachine.hpp>
+#include <ring.hpp>
+#include <pinSequence.hpp>
+#include <freeRtos.hpp>
 #include <driver/gpio.h>
+#include <soc/gpio_struct.h>
+#include <esp_timer.h>
+#include <esp_task.h>
+
+#include <algorithm>
+#include <atomic>
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace jac {
 
@@ -14,11 +27,42 @@ namespace jac {
 // - setMode(mode): change the pin mode
 // - digitalRead(): read the value of the GPIO
 // - digitalWrite(): set the GPIO status
-// - onChange(cb): attach a function on a callback, return handle
+// - onChange(cb[, debounce]): attach a function on a callback, return handle.
+//   The edges within debounce microseconds after an accepted edge are ignored.
 // - clearInterrupt(handle): given a handle, unregister interrupt handler
+//
+// The state of the object lives in a native Pin structure. An object with
+// attached interrupt handlers is kept alive, so the handlers stay attached
+// even if the program drops all references to the object.
+//
+// The edges are recorded in the ISR with a microsecond timestamp into a
+// per-pin ring. The ring is drained in a single job, so a burst of edges
+// results in a single invocation of each callback:
+// cb(pin, level, edges), where edges is an array of { level, time } and
+// edges.dropped is the number of edges lost due to a full ring (if any).
+//
+// The module also provides functions accessing multiple pins at once via GPIO
+// registers (bit n of a mask is pin n):
+// - writePort(mask, value): set the masked pins to the corresponding bits of
+//   value in a single register write per bank
+// - readPort(mask): return the masked levels
+// - compileSequence(program): validate a program for the pin sequence engine
+//   (see jac::utility::PinSequence) given as an array of 32-bit words and
+//   return a sequence object. Its method run() executes the program on a
+//   dedicated high-priority task and returns a promise resolved with an
+//   Uint32Array of the samples. The opcodes are exported as gpio.Op. The pins
+//   have to be configured via setMode before running the sequence. The task
+//   busy-waits, so a sequence is limited to one second (the sum of its delays
+//   and wait timeouts).
+//
+// The sample buffers of running sequences are kept alive in
+// <stash>.gpioSequenceSlot[promiseId].
 template < typename Self >
 class GpioDriver {
     static inline constexpr const char* SLOT = "gpioDriverSlot";
+    static inline constexpr const char* SEQUENCE_SLOT = "gpioSequenceSlot";
+    // Gpio objects owning the callbacks, stored in the callback array of a pin
+    static inline constexpr const char* OWNERS = DUK_HIDDEN_SYMBOL( "owners" );
 public:
     MACHINE_FEATURE_SELF();
 
@@ -36,17 +80,147 @@ public:
 
     void onEventLoop() {}
 private:
-    struct IsrId {
+    // Pin sequence backend accessing the GPIO registers directly
+    struct RegisterBackend {
+        void write( int bank, uint32_t mask, uint32_t value ) {
+            if ( bank == 0 ) {
+                GPIO.out_w1ts = value & mask;
+                GPIO.out_w1tc = ~value & mask;
+            }
+            else {
+                GPIO.out1_w1ts.val = value & mask;
+                GPIO.out1_w1tc.val = ~value & mask;
+            }
+        }
+
+        uint32_t read( int bank ) {
+            return bank == 0 ? GPIO.in : GPIO.in1.val;
+        }
+
+        int64_t now() {
+            return esp_timer_get_time();
+        }
+    };
+
+    struct SequenceRun {
+        Self *machine;
+        int promiseId;
+        std::shared_ptr< utility::PinSequence > sequence;
+        uint32_t *samples;
+    };
+
+    static inline constexpr int EDGE_RING_SIZE = 64;
+
+    struct Edge {
+        int64_t time;
+        bool level;
+    };
+
+    // Interrupt state of a pin. The contexts are pooled and never freed, so a
+    // stale pointer in a deferred job is always safe to dereference.
+    struct PinContext {
         Self *machine;
         gpio_num_t pin;
-        int cbIndex;
+        bool active;
         bool lastLevel;
+        int64_t lastEdge;
+        int64_t debounce;
+        std::atomic< bool > scheduled;
+        std::atomic< uint32_t > dropped;
+        utility::SpscRing< Edge, EDGE_RING_SIZE > edges;
+    };
+
+    PinContext *acquirePinContext( gpio_num_t pin ) {
+        std::unique_ptr< PinContext > context;
+        if ( _freeContexts.empty() ) {
+            context = std::make_unique< PinContext >();
+        }
+        else {
+            context = std::move( _freeContexts.back() );
+            _freeContexts.pop_back();
+        }
+        context->machine = &self();
+        context->pin = pin;
+        context->active = true;
+        context->lastLevel = gpio_get_level( pin );
+        context->lastEdge = 0;
+        context->debounce = 0;
+        context->scheduled = false;
+        context->dropped = 0;
+        context->edges.reset();
+        _pinContexts[ pin ] = std::move( context );
+        return _pinContexts[ pin ].get();
+    }
+
+    void releasePinContext( gpio_num_t pin ) {
+        auto& context = _pinContexts[ pin ];
+        if ( !context )
+            return;
+        gpio_isr_handler_remove( pin );
+        context->active = false;
+        _freeContexts.push_back( std::move( context ) );
+    }
+
+    // State of a Gpio object. The object is referenced from the slot while it
+    // has attached handlers, so it is finalized with handles left only when
+    // the heap is destroyed.
+    struct Pin {
+        Pin( int pinNumber )
+            : pin( static_cast< gpio_num_t >( pinNumber ) )
+        {
+            if ( !GPIO_IS_VALID_GPIO( pin ) )
+                throw std::runtime_error( "Invalid pin " + std::to_string( pinNumber ) );
+        }
+
+        void setMode( duk_context *ctx, std::string_view mode ) {
+            // TBA: Implement proper modes, think about the API
+            gpio_config_t ioConf{};
+            ioConf.pin_bit_mask = 1ULL << pin;
+            ioConf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+            ioConf.pull_up_en = GPIO_PULLUP_DISABLE;
+            if ( mode == "output" ) {
+                ioConf.mode = GPIO_MODE_OUTPUT;
+                gpio_intr_disable( pin );
+            }
+            else if ( mode == "input" ) {
+                ioConf.mode = GPIO_MODE_INPUT;
+                gpio_intr_enable( pin );
+                ioConf.pull_up_en = GPIO_PULLUP_ENABLE; // TBA: Remove, temporary for testing
+            }
+            else {
+                dukRaiseError( ctx, "Unknown pin mode: " + std::string( mode ) );
+            }
+
+            // Check if there is an interrupt handler attached:
+            if ( Self::fromContext( ctx )._pinContexts[ pin ] )
+                ioConf.intr_type = GPIO_INTR_ANYEDGE;
+
+            gpio_config( &ioConf );
+        }
+
+        bool digitalRead() {
+            return gpio_get_level( pin );
+        }
+
+        void digitalWrite( bool level ) {
+            gpio_set_level( pin, level );
+        }
+
+        void finalize( duk_context *ctx ) {
+            for ( int handle : handles )
+                detachCallback( ctx, handle );
+        }
+
+        gpio_num_t pin;
+        std::vector< int > handles; // Handles of callbacks attached via this object
     };
 
     void setupSlot() {
         duk_push_heap_stash( self()._context );
         duk_push_object( self()._context );
         duk_put_prop_string( self()._context, -2, SLOT );
+        duk_push_object( self()._context );
+        duk_put_prop_string( self()._context, -2, SEQUENCE_SLOT );
         duk_pop( self()._context );
     }
 
@@ -59,12 +233,13 @@ private:
         const int exportOffset = 1;
 
         // Register the Gpio class to exports
-        dukPushClass( ctx, "Gpio", gpioConstructor, 1,
+        dukPushNativeClass< Pin, int >( ctx, "Gpio",
             {
-                { "setMode", gpioSetMode, 1 },
-                { "digitalRead", digitalRead, 0 },
-                { "digitalWrite", digitalWrite, 1 },
-                { "onChange", onChange, 1},
+                dukBindEntry< &Pin::setMode >( "setMode" ),
+                dukBindEntry< &Pin::digitalRead >( "digitalRead" ),
+                dukBindEntry< &Pin::digitalWrite >( "digitalWrite" ),
+                { "onChange", onChange, DUK_VARARGS },
+                { "clearInterrupt", clearInterrupt, 1 },
                 { nullptr, nullptr, 0 }
             },
             {
@@ -76,93 +251,169 @@ private:
         duk_push_c_function( ctx, getPin, 1 );
         duk_put_prop_string( ctx, exportOffset, "getPin" );
 
+        duk_function_list_entry functions[] = {
+            dukBindEntry< &writePort >( "writePort" ),
+            dukBindEntry< &readPort >( "readPort" ),
+            { "compileSequence", compileSequence, 1 },
+            { nullptr, nullptr, 0 }
+        };
+        dukPutLightFunctionList( ctx, exportOffset, functions );
+
+        using Op = utility::PinSequence::Op;
+        duk_number_list_entry opcodes[] = {
+            { "SET", Op::SET },
+            { "CLEAR", Op::CLEAR },
+            { "WRITE", Op::WRITE },
+            { "DELAY", Op::DELAY },
+            { "READ", Op::READ },
+            { "READ_PORT", Op::READ_PORT },
+            { "LOOP", Op::LOOP },
+            { "END_LOOP", Op::END_LOOP },
+            { "WAIT", Op::WAIT },
+            { "TIMEOUT", utility::PinSequence::TIMEOUT },
+            { nullptr, 0 }
+        };
+        duk_push_object( ctx );
+        duk_put_number_list( ctx, -1, opcodes );
+        duk_put_prop_string( ctx, exportOffset, "Op" );
+
         return dukReturn( ctx );
     }
 
-    // The constructor takes pin number
-    static duk_ret_t gpioConstructor( duk_context *ctx ) {
-        if ( !duk_is_constructor_call( ctx ) ) {
-            return DUK_RET_TYPE_ERROR;
-        }
-
-        int gpioIndex = duk_require_int( ctx, 0 );
-        // TBA: Validate the index
-
-        duk_push_this( ctx );
-        auto thisOffset = duk_get_top_index( ctx );
-
-        duk_push_int( ctx, gpioIndex );
-        duk_put_prop_string( ctx, thisOffset, "_pin" );
-
-        duk_pop( ctx ); // Pop this
+    static uint64_t checkMask( duk_context *ctx, double mask ) {
+        if ( mask < 0 || mask >= 1ull << GPIO_NUM_MAX )
+            dukRaiseError( ctx, "Invalid pin mask" );
+        return mask;
+    }
 
-        return dukReturn( ctx );
+    static void writePort( duk_context *ctx, double maskArg, double valueArg ) {
+        uint64_t mask = checkMask( ctx, maskArg );
+        uint64_t value = checkMask( ctx, valueArg );
+        RegisterBackend backend;
+        if ( mask & 0xFFFFFFFF )
+            backend.write( 0, mask, value );
+        if ( mask >> 32 )
+            backend.write( 1, mask >> 32, value >> 32 );
     }
 
-    static duk_ret_t gpioSetMode( duk_context *ctx ) {
-        const std::string modeString = duk_require_string( ctx, 0 );
-        gpio_num_t pinNumber = getPinNumberFromThis( ctx );
+    static double readPort( duk_context *ctx, double maskArg ) {
+        uint64_t mask = checkMask( ctx, maskArg );
+        RegisterBackend backend;
+        uint64_t value = backend.read( 0 ) | uint64_t( backend.read( 1 ) ) << 32;
+        return value & mask;
+    }
 
-        // TBA: Implement proper modes, think about the API
-        gpio_config_t ioConf{};
-        ioConf.pin_bit_mask = 1ULL << pinNumber;
-        ioConf.pull_down_en = GPIO_PULLDOWN_DISABLE;
-        ioConf.pull_up_en = GPIO_PULLUP_DISABLE;
-        if ( modeString == "output" ) {
-            ioConf.mode = GPIO_MODE_OUTPUT;
-            gpio_intr_disable( pinNumber );
-        }
-        else if ( modeString == "input" ) {
-            ioConf.mode = GPIO_MODE_INPUT;
-            gpio_intr_enable( pinNumber );
-            ioConf.pull_up_en = GPIO_PULLUP_ENABLE; // TBA: Remove, temporary for testing
+    // Accepts the following duk arguments:
+    // - program: array of numbers or Uint32Array
+    static duk_ret_t compileSequence( duk_context *ctx ) {
+        std::vector< uint32_t > program;
+        if ( duk_is_buffer_data( ctx, 0 ) ) {
+            duk_size_t size;
+            auto *words = static_cast< const uint32_t * >( duk_get_buffer_data( ctx, 0, &size ) );
+            program.assign( words, words + size / sizeof( uint32_t ) );
         }
         else {
-            dukRaiseError( ctx, "Unknown pin mode: " + modeString );
+            duk_require_object( ctx, 0 );
+            int length = duk_get_length( ctx, 0 );
+            program.reserve( length );
+            for ( int i = 0; i != length; i++ ) {
+                duk_get_prop_index( ctx, 0, i );
+                program.push_back( duk_to_uint32( ctx, -1 ) );
+                duk_pop( ctx );
+            }
         }
 
-        // Check if there is an interrupt handler attached:
-        duk_push_heap_stash( ctx );
-        duk_get_prop_string( ctx, -1, SLOT );
-        if ( duk_has_prop_index( ctx, -1, pinNumber ) ) {
-            duk_get_prop_index( ctx, -1,  pinNumber );
-            if ( duk_get_length( ctx, -1 ) ) {
-                ioConf.intr_type = GPIO_INTR_ANYEDGE;
-            }
+        std::shared_ptr< utility::PinSequence > sequence;
+        try {
+            sequence = std::make_shared< utility::PinSequence >( std::move( program ) );
+        }
+        catch ( std::runtime_error& e ) {
+            dukRaiseError( ctx, e.what() );
         }
 
-        gpio_config( &ioConf );
+        duk_push_object( ctx );
+        duk_push_pointer( ctx, new std::shared_ptr< utility::PinSequence >( sequence ) );
+        duk_put_prop_string( ctx, -2, DUK_HIDDEN_SYMBOL( "sequence" ) );
+        duk_push_uint( ctx, sequence->sampleCount() );
+        duk_put_prop_string( ctx, -2, "sampleCount" );
+        duk_push_c_function( ctx, runSequence, 0 );
+        duk_put_prop_string( ctx, -2, "run" );
+        duk_push_c_function( ctx, finalizeSequence, 1 );
+        duk_set_finalizer( ctx, -2 );
+        return 1;
+    }
 
-        return dukReturn( ctx );
+    static duk_ret_t finalizeSequence( duk_context *ctx ) {
+        duk_get_prop_string( ctx, 0, DUK_HIDDEN_SYMBOL( "sequence" ) );
+        delete static_cast< std::shared_ptr< utility::PinSequence > * >( duk_get_pointer( ctx, -1 ) );
+        return 0;
     }
 
-    static duk_ret_t digitalRead( duk_context *ctx ) {
-        gpio_num_t pinNumber = getPinNumberFromThis( ctx );
-        bool level = gpio_get_level( pinNumber );
+    static duk_ret_t runSequence( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        duk_push_this( ctx );
+        duk_get_prop_string( ctx, -1, DUK_HIDDEN_SYMBOL( "sequence" ) );
+        auto *sequence = static_cast< std::shared_ptr< utility::PinSequence > * >(
+            duk_require_pointer( ctx, -1 ) );
+
+        // The sequence busy-waits; keep it off the core of the esp_timer task
+        // and below its priority, so the timer callbacks are not delayed
+        if ( !self._sequenceWorker )
+            self._sequenceWorker = std::make_unique< freertos::Worker >( "gpioSequence", 2048,
+                ESP_TASK_TIMER_PRIO - 1, portNUM_PROCESSORS - 1 );
+
+        auto *run = new SequenceRun{ &self, 0, *sequence, nullptr };
+        size_t size = ( *sequence )->sampleCount() * sizeof( uint32_t );
+        run->samples = static_cast< uint32_t * >( duk_push_fixed_buffer( ctx, size ) );
+        auto bufferOffset = duk_get_top_index( ctx );
+        run->promiseId = self.createPromise( ctx );
+
+        // Keep the samples alive till the sequence finishes
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SEQUENCE_SLOT );
+        duk_dup( ctx, bufferOffset );
+        duk_put_prop_index( ctx, -2, run->promiseId );
+        duk_pop_2( ctx );
 
-        return dukReturn( ctx, level );
+        self._sequenceWorker->post( [run] {
+            RegisterBackend backend;
+            run->sequence->run( backend, run->samples );
+            run->machine->schedule( [&]( duk_context *ctx ) {
+                duk_push_c_function( ctx, settleSequence, 1 );
+                duk_push_pointer( ctx, run );
+            }, "gpioSequence", JobClass::Io );
+        } );
+        return 1;
     }
 
-    static duk_ret_t digitalWrite( duk_context *ctx ) {
-        duk_to_boolean( ctx, 0 );
-        bool level = duk_require_boolean( ctx, -1 );
-        gpio_num_t pinNumber = getPinNumberFromThis( ctx );
-
-        gpio_set_level( pinNumber, level );
-        return dukReturn( ctx );
+    static duk_ret_t settleSequence( duk_context *ctx ) {
+        std::unique_ptr< SequenceRun > run( static_cast< SequenceRun * >( duk_require_pointer( ctx, 0 ) ) );
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SEQUENCE_SLOT );
+        duk_get_prop_index( ctx, -1, run->promiseId );
+        duk_del_prop_index( ctx, -2, run->promiseId );
+        duk_push_buffer_object( ctx, -1, 0, run->sequence->sampleCount() * sizeof( uint32_t ),
+            DUK_BUFOBJ_UINT32ARRAY );
+        Self::settlePromise( ctx, run->promiseId, true );
+        return 0;
     }
 
-    // First argument is the callback
+    // Accepts the following duk arguments:
+    // - cb: function
+    // - debounce: number of microseconds, optional
     static duk_ret_t onChange( duk_context *ctx ) {
         duk_require_function( ctx, 0 );
 
-        gpio_num_t pinNumber = getPinNumberFromThis( ctx );
+        Self& self = Self::fromContext( ctx );
+        Pin& pin = dukNativeThis< Pin >( ctx );
+        gpio_num_t pinNumber = pin.pin;
 
-        // Isr id will be freed when the handler is removed
-        IsrId *isrId = new IsrId;
-        isrId->machine = &Self::fromContext( ctx );
-        isrId->pin = pinNumber;
-        isrId->lastLevel = gpio_get_level( pinNumber );
+        bool attach = !self._pinContexts[ pinNumber ];
+        PinContext *context = attach
+            ? self.acquirePinContext( pinNumber )
+            : self._pinContexts[ pinNumber ].get();
+        if ( duk_is_number( ctx, 1 ) )
+            context->debounce = duk_get_number( ctx, 1 );
 
         // Ensure there is an array with callbacks and ensure the slot array is
         // on top of the stack
@@ -176,55 +427,154 @@ private:
         auto pinArray = duk_get_top_index( ctx );
         int cbArrayLength = duk_get_length( ctx, pinArray );
 
-        // Prepare object
-        duk_push_bare_object( ctx );
+        // Push callback
         duk_dup( ctx, 0 );
-        duk_put_prop_string( ctx, -2, "cb" );
-        isrId->cbIndex = cbArrayLength;
-        duk_push_pointer( ctx, isrId );
-        duk_put_prop_string( ctx, -2, "id" );
-
-        // Push callback info
         duk_put_prop_index( ctx, pinArray, cbArrayLength );
 
-        gpio_isr_handler_add( pinNumber, isrHandler, isrId );
-        gpio_set_intr_type( pinNumber, GPIO_INTR_ANYEDGE );
-        gpio_intr_enable( pinNumber );
+        // Keep the object alive while the callback is attached
+        if ( !duk_get_prop_string( ctx, pinArray, OWNERS ) ) {
+            duk_pop( ctx );
+            duk_push_array( ctx );
+            duk_dup_top( ctx );
+            duk_put_prop_string( ctx, pinArray, OWNERS );
+        }
+        duk_push_this( ctx );
+        duk_put_prop_index( ctx, -2, cbArrayLength );
+        duk_pop( ctx );
+
+        if ( attach ) {
+            gpio_isr_handler_add( pinNumber, isrHandler, context );
+            gpio_set_intr_type( pinNumber, GPIO_INTR_ANYEDGE );
+            gpio_intr_enable( pinNumber );
+        }
 
-        return dukReturn( ctx, pinNumber << 16 | cbArrayLength );
+        int handle = pinNumber << 16 | cbArrayLength;
+        pin.handles.push_back( handle );
+        return dukReturn( ctx, handle );
     }
 
-    static void isrHandler( void *arg ) {
-        IsrId *isrId = reinterpret_cast< IsrId* >( arg );
-        bool level = gpio_get_level( isrId->pin );
-        if ( level == isrId->lastLevel )
+    // Accepts the following duk arguments:
+    // - handle: number returned by onChange
+    static duk_ret_t clearInterrupt( duk_context *ctx ) {
+        int handle = duk_require_int( ctx, 0 );
+        Pin& pin = dukNativeThis< Pin >( ctx );
+        auto it = std::find( pin.handles.begin(), pin.handles.end(), handle );
+        if ( it == pin.handles.end() )
+            dukRaiseError( ctx, "Invalid interrupt handle" );
+        pin.handles.erase( it );
+        detachCallback( ctx, handle );
+        return dukReturn( ctx );
+    }
+
+    static void detachCallback( duk_context *ctx, int handle ) {
+        gpio_num_t pinNumber = static_cast< gpio_num_t >( handle >> 16 );
+        int cbIndex = handle & 0xFFFF;
+
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        auto slotOffset = duk_get_top_index( ctx );
+        if ( !duk_get_prop_index( ctx, slotOffset, pinNumber ) ) {
+            duk_pop_3( ctx );
+            return;
+        }
+        auto pinArray = duk_get_top_index( ctx );
+        duk_push_undefined( ctx );
+        duk_put_prop_index( ctx, pinArray, cbIndex );
+        if ( duk_get_prop_string( ctx, pinArray, OWNERS ) ) {
+            duk_push_undefined( ctx );
+            duk_put_prop_index( ctx, -2, cbIndex );
+        }
+        duk_pop( ctx );
+
+        // Detach the ISR once there is no callback left
+        bool used = false;
+        int length = duk_get_length( ctx, pinArray );
+        for ( int i = 0; i != length && !used; i++ ) {
+            duk_get_prop_index( ctx, pinArray, i );
+            used = duk_is_function( ctx, -1 );
+            duk_pop( ctx );
+        }
+        if ( !used ) {
+            gpio_set_intr_type( pinNumber, GPIO_INTR_DISABLE );
+            Self::fromContext( ctx ).releasePinContext( pinNumber );
+            duk_del_prop_index( ctx, slotOffset, pinNumber );
+        }
+        duk_pop_3( ctx );
+    }
+
+    static void IRAM_ATTR isrHandler( void *arg ) {
+        PinContext *context = reinterpret_cast< PinContext* >( arg );
+        int64_t now = esp_timer_get_time();
+        bool level = gpio_get_level( context->pin );
+        if ( level == context->lastLevel )
+            return;
+        if ( now - context->lastEdge < context->debounce )
+            return;
+        context->lastLevel = level;
+        context->lastEdge = now;
+        if ( !context->edges.push( { now, level } ) )
+            context->dropped++;
+
+        // Only the first edge of a batch defers the drain
+        if ( context->scheduled.exchange( true ) )
             return;
-        isrId->lastLevel = level;
-        isrId->machine->handleInterrupt([]( void *arg ) {
-            IsrId *isrId = reinterpret_cast< IsrId* >( arg );
-            isrId->machine->schedule([&isrId]( duk_context* ctx ) {
-                duk_require_stack( ctx, 4 );
-                duk_push_c_function( ctx, isrHandlerJs, 3 );
-                duk_push_int( ctx, isrId->cbIndex );
-                duk_push_int( ctx, isrId->pin );
-                duk_push_boolean( ctx, isrId->lastLevel );
-            });
-        }, arg );
+        bool deferred = context->machine->handleInterrupt( []( duk_context *ctx, void *arg ) {
+            duk_push_c_function( ctx, isrHandlerJs, 1 );
+            duk_push_pointer( ctx, arg );
+        }, context );
+        if ( !deferred )
+            context->scheduled = false;
     }
 
+    // Drain the edges of the pin and invoke its callbacks
     static duk_ret_t isrHandlerJs( duk_context *ctx ) {
-        int cbIndex = duk_require_int( ctx, 0 );
-        int pinNumber = duk_require_int( ctx, 1 );
-        // Simply obtain callback handler...
+        PinContext *context = reinterpret_cast< PinContext* >( duk_require_pointer( ctx, 0 ) );
+        // Clear the flag first, so edges coming during the drain schedule
+        // another one
+        context->scheduled = false;
+        if ( !context->active )
+            return dukReturn( ctx );
+        int pinNumber = context->pin;
+
+        duk_push_array( ctx );
+        auto edgesOffset = duk_get_top_index( ctx );
+        Edge edge;
+        bool level = false;
+        int count = 0;
+        while ( context->edges.pop( edge ) ) {
+            duk_push_bare_object( ctx );
+            duk_push_boolean( ctx, edge.level );
+            duk_put_prop_string( ctx, -2, "level" );
+            duk_push_number( ctx, edge.time );
+            duk_put_prop_string( ctx, -2, "time" );
+            duk_put_prop_index( ctx, edgesOffset, count++ );
+            level = edge.level;
+        }
+        if ( count == 0 )
+            return dukReturn( ctx );
+        if ( uint32_t dropped = context->dropped.exchange( 0 ) ) {
+            duk_push_uint( ctx, dropped );
+            duk_put_prop_string( ctx, edgesOffset, "dropped" );
+        }
+
+        // Invoke all callbacks with pin number, level and edges
         duk_push_heap_stash( ctx );
         duk_get_prop_string( ctx, -1, SLOT );
         duk_get_prop_index( ctx, -1, pinNumber );
-        duk_get_prop_index( ctx, -1, cbIndex );
-        duk_get_prop_string( ctx, -1, "cb" );
-        // ...and invoke it with pin number (0) and pin level (1)
-        duk_push_int( ctx, pinNumber );
-        duk_dup( ctx, 2 );
-        duk_call( ctx, 2 );
+        auto pinArray = duk_get_top_index( ctx );
+        int length = duk_get_length( ctx, pinArray );
+        for ( int i = 0; i != length; i++ ) {
+            duk_get_prop_index( ctx, pinArray, i );
+            if ( !duk_is_function( ctx, -1 ) ) {
+                duk_pop( ctx );
+                continue;
+            }
+            duk_push_int( ctx, pinNumber );
+            duk_push_boolean( ctx, level );
+            duk_dup( ctx, edgesOffset );
+            duk_call( ctx, 3 );
+            duk_pop( ctx );
+        }
 
         return dukReturn( ctx );
     }
@@ -234,13 +584,9 @@ private:
         return DUK_RET_TYPE_ERROR;
     }
 
-    static gpio_num_t getPinNumberFromThis( duk_context *ctx ) {
-        duk_push_this( ctx );
-        duk_get_prop_string( ctx, -1, "_pin" );
-        int pinNumber = duk_require_int( ctx, -1 );
-        duk_pop_2( ctx );
-        return static_cast< gpio_num_t >( pinNumber );
-    }
+    std::array< std::unique_ptr< PinContext >, GPIO_NUM_MAX > _pinContexts;
+    std::vector< std::unique_ptr< PinContext > > _freeContexts;
+    std::unique_ptr< freertos::Worker > _sequenceWorker;
 };
 
 } // namespace jac
\ No newline at end of file
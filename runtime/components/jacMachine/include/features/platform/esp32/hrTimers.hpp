@@ -0,0 +1,267 @@
+#pragma once
+
+#include <jsmachine.hpp>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace jac {
+
+// Implement microsecond timers on top of esp_timer
+//
+// Adds the following global functions:
+// - hrtime(): return microseconds since the machine start
+// - setTimeoutMicros(callback, us, ...args): invoke the callback once after
+//   the given number of microseconds; return the timer id
+// - setIntervalMicros(callback, us, ...args): invoke the callback periodically
+// - clearTimeoutMicros(id), clearIntervalMicros(id): cancel the timer
+//
+// All timers share a single one-shot esp_timer armed for the nearest
+// deadline; the timers themselves live in the event loop, so creating and
+// cancelling them costs no RTOS calls besides re-arming. Periodic timers are
+// scheduled at absolute times start + n * period, so the latency of a callback
+// does not accumulate. When the event loop falls behind by more than a period,
+// the missed periods are skipped instead of being invoked in a burst.
+//
+// The callbacks are stored in <stash>.hrTimerSlot[id] together with their
+// arguments.
+template < typename Self >
+class HrTimers {
+    static inline constexpr const char* SLOT = "hrTimerSlot";
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {
+        int hrMinPeriodUs = 100; // Shorter periods are prolonged
+    };
+
+    void initialize() {
+        duk_context *ctx = self()._context;
+        _hrStart = esp_timer_get_time();
+
+        esp_timer_create_args_t args = {};
+        args.callback = onHrAlarm;
+        args.arg = this;
+        args.dispatch_method = ESP_TIMER_TASK;
+        args.name = "hrTimers";
+        if ( esp_timer_create( &args, &_hrAlarm ) != ESP_OK )
+            throw std::runtime_error( "Cannot create esp_timer" );
+
+        duk_push_heap_stash( ctx );
+        duk_push_object( ctx );
+        duk_put_prop_string( ctx, -2, SLOT );
+        duk_pop( ctx );
+
+        duk_push_c_lightfunc( ctx, dukHrtime, 0, 0, 0 );
+        duk_put_global_string( ctx, "hrtime" );
+        duk_push_c_lightfunc( ctx, dukSetTimer, DUK_VARARGS, 0, 0 );
+        duk_put_global_string( ctx, "setTimeoutMicros" );
+        duk_push_c_lightfunc( ctx, dukSetTimer, DUK_VARARGS, 0, 1 );
+        duk_put_global_string( ctx, "setIntervalMicros" );
+        duk_push_c_lightfunc( ctx, dukClearTimer, 1, 1, 0 );
+        duk_put_global_string( ctx, "clearTimeoutMicros" );
+        duk_push_c_lightfunc( ctx, dukClearTimer, 1, 1, 0 );
+        duk_put_global_string( ctx, "clearIntervalMicros" );
+    }
+
+    ~HrTimers() {
+        if ( _hrAlarm ) {
+            esp_timer_stop( _hrAlarm );
+            esp_timer_delete( _hrAlarm );
+        }
+    }
+
+    void onEventLoop() {}
+
+    // Microseconds since the machine start
+    int64_t hrtime() const {
+        return esp_timer_get_time() - _hrStart;
+    }
+
+    // Return the number of microseconds until the nearest timer fires (0 if
+    // it is overdue) or nothing if there are no active timers
+    std::optional< int64_t > microsToNextHrTimer() const {
+        if ( _hrQueue.empty() )
+            return std::nullopt;
+        return std::max< int64_t >( 0, _hrQueue.begin()->first - esp_timer_get_time() );
+    }
+
+private:
+    struct HrTimer {
+        int64_t deadline;
+        int64_t period; // 0 for one-shot timers
+    };
+
+    static void onHrAlarm( void *arg ) {
+        static_cast< HrTimers * >( arg )->scheduleDispatch();
+    }
+
+    // Dispatch the due timers in the event loop; at most one dispatch job is
+    // pending at a time
+    void scheduleDispatch() {
+        if ( _hrDispatchScheduled.exchange( true ) )
+            return;
+        self().schedule( []( duk_context *ctx ) {
+            duk_push_c_function( ctx, dispatchHrTimers, 0 );
+        }, "hrTimer", JobClass::Timer );
+    }
+
+    // Arm the esp_timer for the nearest deadline
+    void armHrAlarm() {
+        if ( _hrQueue.empty() ) {
+            if ( _hrArmedAt ) {
+                esp_timer_stop( _hrAlarm );
+                _hrArmedAt = 0;
+            }
+            return;
+        }
+        int64_t deadline = _hrQueue.begin()->first;
+        if ( deadline == _hrArmedAt )
+            return;
+        int64_t delay = deadline - esp_timer_get_time();
+        esp_timer_stop( _hrAlarm );
+        if ( delay <= 0 ) {
+            _hrArmedAt = 0;
+            scheduleDispatch();
+            return;
+        }
+        esp_timer_start_once( _hrAlarm, delay );
+        _hrArmedAt = deadline;
+    }
+
+    void cancel( int id ) {
+        auto timer = _hrTimers.find( id );
+        if ( timer == _hrTimers.end() )
+            return;
+        _hrQueue.erase( { timer->second.deadline, id } );
+        _hrTimers.erase( timer );
+        armHrAlarm();
+    }
+
+    static duk_ret_t dukHrtime( duk_context *ctx ) {
+        duk_push_number( ctx, Self::fromContext( ctx ).hrtime() );
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - callback: function
+    // - us: number
+    // - ...args: passed to the callback
+    // The magic is 1 for periodic timers.
+    static duk_ret_t dukSetTimer( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        duk_require_function( ctx, 0 );
+        int64_t delay = std::max( 0.0, double( duk_require_number( ctx, 1 ) ) );
+        bool periodic = duk_get_current_magic( ctx );
+        if ( periodic )
+            delay = std::max< int64_t >( delay, self._cfg.hrMinPeriodUs );
+
+        int id = self._hrNextId++;
+        duk_idx_t top = duk_get_top( ctx );
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        duk_push_array( ctx );
+        duk_dup( ctx, 0 );
+        duk_put_prop_index( ctx, -2, 0 );
+        for ( duk_idx_t i = 2; i < top; i++ ) {
+            duk_dup( ctx, i );
+            duk_put_prop_index( ctx, -2, i - 1 );
+        }
+        duk_put_prop_index( ctx, -2, id );
+
+        int64_t deadline = esp_timer_get_time() + delay;
+        self._hrTimers[ id ] = { deadline, periodic ? delay : 0 };
+        self._hrQueue.insert( { deadline, id } );
+        self.armHrAlarm();
+        return dukReturn( ctx, id );
+    }
+
+    // Accepts the following duk arguments:
+    // - id: number
+    static duk_ret_t dukClearTimer( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        if ( !duk_is_number( ctx, 0 ) )
+            return 0;
+        int id = duk_get_int( ctx, 0 );
+        self.cancel( id );
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        duk_del_prop_index( ctx, -1, id );
+        return 0;
+    }
+
+    // Invoke the callbacks of the due timers; the first error is rethrown
+    // after all of them are invoked
+    static duk_ret_t dispatchHrTimers( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        self._hrDispatchScheduled = false;
+        self._hrArmedAt = 0;
+        int64_t now = esp_timer_get_time();
+
+        // Timers created by the callbacks wait for the next dispatch
+        std::vector< int > due;
+        while ( !self._hrQueue.empty() && self._hrQueue.begin()->first <= now ) {
+            due.push_back( self._hrQueue.begin()->second );
+            self._hrQueue.erase( self._hrQueue.begin() );
+        }
+
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        duk_idx_t slot = duk_get_top_index( ctx );
+        bool failed = false;
+        for ( int id : due ) {
+            auto timer = self._hrTimers.find( id );
+            if ( timer == self._hrTimers.end() )
+                continue; // Cancelled by a previous callback
+            bool periodic = timer->second.period != 0;
+            if ( periodic ) {
+                HrTimer& t = timer->second;
+                t.deadline += t.period;
+                if ( t.deadline <= now )
+                    t.deadline += ( ( now - t.deadline ) / t.period + 1 ) * t.period;
+                self._hrQueue.insert( { t.deadline, id } );
+            }
+            else {
+                self._hrTimers.erase( timer );
+            }
+
+            duk_get_prop_index( ctx, slot, id );
+            duk_idx_t entry = duk_get_top_index( ctx );
+            duk_size_t count = duk_get_length( ctx, entry );
+            for ( duk_size_t i = 0; i != count; i++ )
+                duk_get_prop_index( ctx, entry, i );
+            if ( !periodic )
+                duk_del_prop_index( ctx, slot, id );
+            duk_int_t res = duk_pcall( ctx, count - 1 );
+            duk_remove( ctx, entry );
+            if ( res == DUK_EXEC_SUCCESS ) {
+                duk_pop( ctx );
+                continue;
+            }
+            if ( failed )
+                duk_pop( ctx );
+            failed = true; // Keep the first error on the stack
+        }
+        self.armHrAlarm();
+        if ( failed )
+            duk_throw( ctx );
+        return 0;
+    }
+
+    esp_timer_handle_t _hrAlarm = nullptr;
+    int64_t _hrStart = 0;
+    int64_t _hrArmedAt = 0; // Deadline the alarm is armed for, 0 if none
+    std::atomic< bool > _hrDispatchScheduled{ false };
+    int _hrNextId = 1;
+    std::map< int, HrTimer > _hrTimers;
+    std::set< std::pair< int64_t, int > > _hrQueue; // Ordered by the deadline
+};
+
+} // namespace jac
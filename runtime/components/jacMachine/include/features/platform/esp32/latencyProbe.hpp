@@ -0,0 +1,257 @@
+#pragma once
+
+#include <jsmachine.hpp>
+#include <driver/gpio.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace jac {
+
+// Implement interrupt latency benchmark module "latencyProbe"
+//
+// The probe generates GPIO edges and measures the time from the edge to the
+// entry into JavaScript, i.e., the whole path GPIO ISR -> handleInterrupt ->
+// event loop -> Duktape call. The edges are generated by a periodic esp_timer
+// and the time of each edge is recorded right before the pin is toggled.
+//
+// The module has the following function:
+// - run(options): run the benchmark and return a promise resolved with an
+//   object { sent, received, lost, lossRate, min, p50, p99, p999, max, mean,
+//   policy } with latencies in microseconds and the name of the scheduling
+//   policy of the machine
+//
+// Options:
+// - pin: the pin to toggle. Without inPin, the pin is configured as input and
+//   output, so it triggers its own interrupt and no wiring is needed.
+// - inPin: optional pin receiving the edges via an external loopback wire
+// - count: number of edges (default 1000)
+// - interval: period of the edges in microseconds (default 1000)
+// - callback: optional function invoked with the latency of each edge; use it
+//   to include the cost of a JavaScript handler
+//
+// Background load is up to the program, so the benchmark can be repeated under
+// different profiles (see tests/javascript/latency_benchmark). Only a single
+// run can be in progress.
+template < typename Self >
+class LatencyProbe {
+    static inline constexpr const char* SLOT = "latencyProbeSlot";
+    // Number of periods to wait for the edges in flight after the last one
+    static inline constexpr int GRACE_PERIODS = 100;
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {};
+
+    void initialize() {
+        self().registerNativeModule( "latencyProbe", [this]( duk_context *ctx ) {
+            return self().initializeProbeModule( ctx );
+        });
+    }
+
+    void onEventLoop() {}
+
+private:
+    struct Run {
+        Self *machine;
+        int promiseId;
+        gpio_num_t outPin;
+        gpio_num_t inPin;
+        int count;
+        bool level = false;
+        int idlePeriods = 0;
+        std::atomic< int > sent{ 0 };
+        std::atomic< uint32_t > overflows{ 0 };
+        std::vector< int64_t > sendTimes;
+        std::vector< uint32_t > latencies;
+        esp_timer_handle_t timer = nullptr;
+    };
+
+    // Initializes the module; there are the following arguments on the
+    // Duktape stack:
+    // - 0 requested module ID
+    // - 1 exports object
+    // - 2 module object
+    duk_ret_t initializeProbeModule( duk_context *ctx ) {
+        const int exportOffset = 1;
+        duk_function_list_entry functions[] = {
+            { "run", dukRun, 1 },
+            { nullptr, nullptr, 0 }
+        };
+        duk_put_function_list( ctx, exportOffset, functions );
+        return dukReturn( ctx );
+    }
+
+    static int optionalInt( duk_context *ctx, const char *name, int defaultValue ) {
+        duk_get_prop_string( ctx, 0, name );
+        int value = duk_is_number( ctx, -1 ) ? duk_get_int( ctx, -1 ) : defaultValue;
+        duk_pop( ctx );
+        return value;
+    }
+
+    // Accepts the following duk arguments:
+    // - options: object
+    static duk_ret_t dukRun( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        duk_require_object( ctx, 0 );
+        if ( self._probeRun )
+            dukRaiseError( ctx, "The probe is already running" );
+
+        auto run = std::make_unique< Run >();
+        run->machine = &self;
+        run->outPin = static_cast< gpio_num_t >( optionalInt( ctx, "pin", -1 ) );
+        run->inPin = static_cast< gpio_num_t >( optionalInt( ctx, "inPin", run->outPin ) );
+        run->count = optionalInt( ctx, "count", 1000 );
+        int interval = optionalInt( ctx, "interval", 1000 );
+        if ( !GPIO_IS_VALID_OUTPUT_GPIO( run->outPin ) || !GPIO_IS_VALID_GPIO( run->inPin ) )
+            dukRaiseError( ctx, "Invalid pin" );
+        if ( run->count <= 0 || interval < 50 )
+            dukRaiseError( ctx, "Invalid count or interval" );
+        run->sendTimes.resize( run->count );
+        run->latencies.reserve( run->count );
+
+        // Keep the callback, if any
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, 0, "callback" );
+        duk_put_prop_string( ctx, -2, SLOT );
+        duk_pop( ctx );
+
+        gpio_config_t ioConf{};
+        ioConf.pin_bit_mask = 1ULL << run->outPin;
+        ioConf.mode = run->inPin == run->outPin ? GPIO_MODE_INPUT_OUTPUT : GPIO_MODE_OUTPUT;
+        gpio_config( &ioConf );
+        gpio_set_level( run->outPin, 0 );
+        if ( run->inPin != run->outPin ) {
+            ioConf.pin_bit_mask = 1ULL << run->inPin;
+            ioConf.mode = GPIO_MODE_INPUT;
+            gpio_config( &ioConf );
+        }
+        gpio_install_isr_service( 0 );
+        gpio_set_intr_type( run->inPin, GPIO_INTR_ANYEDGE );
+        gpio_isr_handler_add( run->inPin, isrHandler, run.get() );
+        gpio_intr_enable( run->inPin );
+
+        esp_timer_create_args_t timerArgs{};
+        timerArgs.callback = generateEdge;
+        timerArgs.arg = run.get();
+        timerArgs.dispatch_method = ESP_TIMER_TASK;
+        timerArgs.name = "latencyProbe";
+        if ( esp_timer_create( &timerArgs, &run->timer ) != ESP_OK ) {
+            gpio_isr_handler_remove( run->inPin );
+            dukRaiseError( ctx, "Cannot create timer" );
+        }
+
+        run->promiseId = self.createPromise( ctx );
+        self._probeRun = std::move( run );
+        esp_timer_start_periodic( self._probeRun->timer, interval );
+        return 1;
+    }
+
+    // Invoked periodically by esp_timer
+    static void generateEdge( void *arg ) {
+        Run *run = reinterpret_cast< Run * >( arg );
+        int seq = run->sent.load( std::memory_order_relaxed );
+        if ( seq < run->count ) {
+            run->level = !run->level;
+            run->sendTimes[ seq ] = esp_timer_get_time();
+            run->sent.store( seq + 1, std::memory_order_release );
+            gpio_set_level( run->outPin, run->level );
+            return;
+        }
+        if ( ++run->idlePeriods < GRACE_PERIODS )
+            return;
+        esp_timer_stop( run->timer );
+        gpio_set_intr_type( run->inPin, GPIO_INTR_DISABLE );
+        gpio_isr_handler_remove( run->inPin );
+        run->machine->schedule( []( duk_context *ctx ) {
+            duk_push_c_function( ctx, finishRun, 0 );
+        }, "latencyProbe" );
+    }
+
+    static void IRAM_ATTR isrHandler( void *arg ) {
+        Run *run = reinterpret_cast< Run * >( arg );
+        int seq = run->sent.load( std::memory_order_acquire ) - 1;
+        if ( seq < 0 )
+            return;
+        bool deferred = run->machine->handleInterrupt( []( duk_context *ctx, void *arg ) {
+            duk_push_c_function( ctx, deliverEdge, 1 );
+            duk_push_int( ctx, reinterpret_cast< intptr_t >( arg ) );
+        }, reinterpret_cast< void * >( intptr_t( seq ) ) );
+        if ( !deferred )
+            run->overflows++;
+    }
+
+    // The entry into JavaScript for an edge; accepts the following duk
+    // arguments:
+    // - seq: number of the edge
+    static duk_ret_t deliverEdge( duk_context *ctx ) {
+        int64_t now = esp_timer_get_time();
+        Run *run = Self::fromContext( ctx )._probeRun.get();
+        int seq = duk_require_int( ctx, 0 );
+        if ( !run || seq >= run->count )
+            return 0;
+        uint32_t latency = now - run->sendTimes[ seq ];
+        run->latencies.push_back( latency );
+
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        if ( duk_is_function( ctx, -1 ) ) {
+            duk_push_uint( ctx, latency );
+            duk_call( ctx, 1 );
+        }
+        return 0;
+    }
+
+    static duk_ret_t finishRun( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        std::unique_ptr< Run > run = std::move( self._probeRun );
+        esp_timer_delete( run->timer );
+
+        auto& latencies = run->latencies;
+        std::sort( latencies.begin(), latencies.end() );
+        auto percentile = [&]( double p ) -> double {
+            if ( latencies.empty() )
+                return 0;
+            size_t rank = p * latencies.size();
+            return latencies[ std::min( rank, latencies.size() - 1 ) ];
+        };
+        double sum = 0;
+        for ( auto latency : latencies )
+            sum += latency;
+        int sent = run->sent;
+        int received = latencies.size();
+
+        duk_push_object( ctx );
+        auto put = [&]( const char *name, double value ) {
+            duk_push_number( ctx, value );
+            duk_put_prop_string( ctx, -2, name );
+        };
+        put( "sent", sent );
+        put( "received", received );
+        put( "lost", sent - received );
+        put( "lossRate", sent ? double( sent - received ) / sent : 0 );
+        put( "overflows", run->overflows );
+        put( "min", latencies.empty() ? 0 : latencies.front() );
+        put( "p50", percentile( 0.5 ) );
+        put( "p99", percentile( 0.99 ) );
+        put( "p999", percentile( 0.999 ) );
+        put( "max", latencies.empty() ? 0 : latencies.back() );
+        put( "mean", received ? sum / received : 0 );
+        duk_push_string( ctx, Self::SchedulingPolicy::name );
+        duk_put_prop_string( ctx, -2, "policy" );
+
+        duk_push_heap_stash( ctx );
+        duk_del_prop_string( ctx, -1, SLOT );
+        duk_pop( ctx );
+
+        Self::settlePromise( ctx, run->promiseId, true );
+        return 0;
+    }
+
+    std::unique_ptr< Run > _probeRun;
+};
+
+} // namespace jac
@@ -0,0 +1,425 @@
+#pragma once
+
+#include <jsmachine.hpp>
+#include <driver/uart.h>
+#include <freertos/queue.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace jac {
+
+// Implement UART module "serial"
+//
+// The module exports class Serial. Its constructor takes the following
+// arguments: port (1 or 2; port 0 is the console), baudRate (default 115200),
+// tx pin and rx pin (default pins of the port). The object has the following
+// methods:
+// - on(event, cb): set the listener for the event "data" or "close"
+// - write(data): send a string or a buffer; return a promise resolved once
+//   the data are transmitted
+// - close(): stop the port; "close" is emitted once it is released
+//
+// The received data are read by a dedicated task into a fixed number of
+// fixed-size chunks that are recycled. Each chunk holds all data available at
+// the time of the read and the chunks ready at the time the event loop wakes
+// are delivered in a single job. The "data" listener receives an Uint8Array
+// over the chunk that is valid only during the invocation of the listener.
+// Without a "data" listener, the chunks are held, so the data queue up in the
+// driver ring buffer.
+//
+// The data being written are not copied; they are kept alive in
+// <stash>.serialWriteSlot[promiseId] until the write finishes. The chunks and
+// the listeners of an open port are kept in <stash>.serialSlot[port]. The port
+// is closed when its object is collected.
+template < typename Self >
+class SerialPort {
+    static inline constexpr const char* SLOT = "serialSlot";
+    static inline constexpr const char* WRITE_SLOT = "serialWriteSlot";
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {
+        int serialChunkSize = 256;
+        int serialChunkCount = 4;
+        int serialRxBufferSize = 2048;
+        int serialTxBufferSize = 1024;
+    };
+
+    void initialize() {
+        setupSlot();
+
+        self().registerNativeModule( "serial", [this]( duk_context *ctx ) {
+            return self().initializeSerialModule( ctx );
+        });
+    }
+
+    void onEventLoop() {}
+
+private:
+    struct Filled {
+        int index;
+        int size;
+    };
+
+    // State of an open port shared by the event loop, the reader task and the
+    // writer task
+    struct Channel {
+        Self *machine;
+        uart_port_t uart;
+        int chunkSize;
+        std::vector< uint8_t * > chunks;
+        QueueHandle_t free;   // Indices of chunks ready for reading
+        QueueHandle_t filled; // Chunks ready for delivery
+        std::atomic< bool > running{ true };
+        std::atomic< int > closeSteps{ 2 }; // The reader and the pending writes
+        std::atomic< bool > deliveryScheduled{ false };
+        bool closing = false;
+
+        ~Channel() {
+            if ( free )
+                vQueueDelete( free );
+            if ( filled )
+                vQueueDelete( filled );
+        }
+    };
+
+    // State of a Serial object
+    struct Port {
+        Port( duk_context *ctx, int uart, std::optional< int > baudRate,
+            std::optional< int > tx, std::optional< int > rx )
+            : uart( uart )
+        {
+            Self::fromContext( ctx ).openChannel( ctx, uart, baudRate.value_or( 115200 ),
+                tx.value_or( UART_PIN_NO_CHANGE ), rx.value_or( UART_PIN_NO_CHANGE ) );
+        }
+
+        void close( duk_context *ctx ) {
+            if ( !open )
+                return;
+            open = false;
+            Self::fromContext( ctx ).closeChannel( uart );
+        }
+
+        void finalize( duk_context *ctx ) {
+            close( ctx );
+        }
+
+        uart_port_t uart;
+        bool open = true;
+    };
+
+    void setupSlot() {
+        duk_push_heap_stash( self()._context );
+        duk_push_object( self()._context );
+        duk_put_prop_string( self()._context, -2, SLOT );
+        duk_push_object( self()._context );
+        duk_put_prop_string( self()._context, -2, WRITE_SLOT );
+        duk_pop( self()._context );
+    }
+
+    // Initializes the module; there are the following arguments on the
+    // Duktape stack:
+    // - 0 requested module ID
+    // - 1 exports object
+    // - 2 module object
+    duk_ret_t initializeSerialModule( duk_context *ctx ) {
+        const int exportOffset = 1;
+        dukPushNativeClass< Port, duk_context *, int, std::optional< int >,
+            std::optional< int >, std::optional< int > >( ctx, "Serial",
+            {
+                { "on", portOn, 2 },
+                { "write", portWrite, 1 },
+                dukBindEntry< &Port::close >( "close" ),
+                { nullptr, nullptr, 0 }
+            },
+            {
+                { nullptr, nullptr, 0 }
+            } );
+        duk_put_prop_string( ctx, exportOffset, "Serial" );
+        return dukReturn( ctx );
+    }
+
+    // Push <stash>.serialSlot[uart]; undefined if the port is not open
+    static void pushPortSlot( duk_context *ctx, uart_port_t uart ) {
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        duk_get_prop_index( ctx, -1, uart );
+        duk_remove( ctx, -2 );
+        duk_remove( ctx, -2 );
+    }
+
+    void openChannel( duk_context *ctx, int uart, int baudRate, int tx, int rx ) {
+        if ( uart <= UART_NUM_0 || uart >= UART_NUM_MAX )
+            throw std::runtime_error( "Invalid port " + std::to_string( uart ) );
+        if ( _channels[ uart ] )
+            throw std::runtime_error( "The port is busy" );
+
+        uart_config_t config{};
+        config.baud_rate = baudRate;
+        config.data_bits = UART_DATA_8_BITS;
+        config.parity = UART_PARITY_DISABLE;
+        config.stop_bits = UART_STOP_BITS_1;
+        config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+        config.source_clk = UART_SCLK_APB;
+        if ( uart_driver_install( uart, self()._cfg.serialRxBufferSize,
+                self()._cfg.serialTxBufferSize, 0, nullptr, 0 ) != ESP_OK )
+            throw std::runtime_error( "Cannot install the UART driver" );
+        if ( uart_param_config( uart, &config ) != ESP_OK
+            || uart_set_pin( uart, tx, rx, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE ) != ESP_OK )
+        {
+            uart_driver_delete( uart );
+            throw std::runtime_error( "Cannot configure the port" );
+        }
+
+        auto channel = std::make_unique< Channel >();
+        channel->machine = &self();
+        channel->uart = uart;
+        channel->chunkSize = self()._cfg.serialChunkSize;
+        int chunkCount = self()._cfg.serialChunkCount;
+        channel->free = xQueueCreate( chunkCount, sizeof( int ) );
+        channel->filled = xQueueCreate( chunkCount, sizeof( Filled ) );
+        if ( !channel->free || !channel->filled ) {
+            uart_driver_delete( uart );
+            throw std::runtime_error( "Cannot allocate queue" );
+        }
+
+        // The chunks are Duktape buffers, so the data can be passed to
+        // JavaScript without copying
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        duk_push_object( ctx );
+        duk_push_array( ctx );
+        for ( int i = 0; i != chunkCount; i++ ) {
+            channel->chunks.push_back( static_cast< uint8_t * >(
+                duk_push_fixed_buffer( ctx, channel->chunkSize ) ) );
+            duk_put_prop_index( ctx, -2, i );
+            xQueueSend( channel->free, &i, 0 );
+        }
+        duk_put_prop_string( ctx, -2, "chunks" );
+        duk_push_object( ctx );
+        duk_put_prop_string( ctx, -2, "listeners" );
+        duk_put_prop_index( ctx, -2, uart );
+        duk_pop_2( ctx );
+
+        if ( xTaskCreate( readerTask, "serialReader", 2048, channel.get(), 10, nullptr ) != pdPASS ) {
+            uart_driver_delete( uart );
+            dropPortSlot( ctx, uart );
+            throw std::runtime_error( "Cannot allocate task" );
+        }
+        if ( !_writer )
+            _writer = std::make_unique< freertos::Worker >( "serialWriter", 2048, 5 );
+        _channels[ uart ] = std::move( channel );
+    }
+
+    static void dropPortSlot( duk_context *ctx, uart_port_t uart ) {
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        duk_del_prop_index( ctx, -1, uart );
+        duk_pop_2( ctx );
+    }
+
+    // Stop the reader and release the driver once both the reader and the
+    // pending writes are finished. Neither of the tasks waits for the other,
+    // so the writes of other ports are not stalled.
+    void closeChannel( uart_port_t uart ) {
+        Channel *channel = _channels[ uart ].get();
+        channel->closing = true;
+        channel->running = false;
+        _writer->post( [channel] {
+            finishClose( channel );
+        } );
+    }
+
+    // Invoked by the reader and by the writer; the last one releases the
+    // driver. The channel must not be touched afterwards.
+    static void finishClose( Channel *channel ) {
+        if ( channel->closeSteps.fetch_sub( 1 ) != 1 )
+            return;
+        uart_driver_delete( channel->uart );
+        channel->machine->schedule( [&]( duk_context *ctx ) {
+            duk_push_c_function( ctx, channelClosed, 1 );
+            duk_push_int( ctx, channel->uart );
+        }, "serialClose", JobClass::Io );
+    }
+
+    static duk_ret_t channelClosed( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        uart_port_t uart = duk_require_int( ctx, 0 );
+        pushPortSlot( ctx, uart );
+        dropPortSlot( ctx, uart );
+        self._channels[ uart ].reset();
+        duk_get_prop_string( ctx, -1, "listeners" );
+        duk_get_prop_string( ctx, -1, "close" );
+        if ( duk_is_function( ctx, -1 ) )
+            duk_call( ctx, 0 );
+        return 0;
+    }
+
+    static void readerTask( void *arg ) {
+        Channel *channel = reinterpret_cast< Channel * >( arg );
+        const TickType_t timeout = pdMS_TO_TICKS( 100 );
+        while ( channel->running ) {
+            int index;
+            if ( xQueueReceive( channel->free, &index, timeout ) != pdTRUE )
+                continue;
+            uint8_t *data = channel->chunks[ index ];
+            // Wait for the first byte, then take everything that is available
+            int size = uart_read_bytes( channel->uart, data, 1, timeout );
+            if ( size <= 0 ) {
+                xQueueSend( channel->free, &index, 0 );
+                continue;
+            }
+            size_t available = 0;
+            uart_get_buffered_data_len( channel->uart, &available );
+            if ( available > 0 ) {
+                int count = std::min< int >( available, channel->chunkSize - 1 );
+                int read = uart_read_bytes( channel->uart, data + 1, count, 0 );
+                if ( read > 0 )
+                    size += read;
+            }
+            Filled filled{ index, size };
+            xQueueSend( channel->filled, &filled, portMAX_DELAY );
+            scheduleDelivery( channel );
+        }
+        finishClose( channel );
+        vTaskDelete( nullptr );
+    }
+
+    static void scheduleDelivery( Channel *channel ) {
+        if ( channel->deliveryScheduled.exchange( true ) )
+            return;
+        channel->machine->schedule( [&]( duk_context *ctx ) {
+            duk_push_c_function( ctx, deliver, 1 );
+            duk_push_int( ctx, channel->uart );
+        }, "serialData", JobClass::Io );
+    }
+
+    // Deliver all filled chunks of the port
+    static duk_ret_t deliver( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        uart_port_t uart = duk_require_int( ctx, 0 );
+        Channel *channel = self._channels[ uart ].get();
+        if ( !channel )
+            return 0;
+        channel->deliveryScheduled = false;
+
+        pushPortSlot( ctx, uart );
+        auto slotOffset = duk_get_top_index( ctx );
+        duk_get_prop_string( ctx, slotOffset, "chunks" );
+        auto chunksOffset = duk_get_top_index( ctx );
+        duk_get_prop_string( ctx, slotOffset, "listeners" );
+        duk_get_prop_string( ctx, -1, "data" );
+        auto listenerOffset = duk_get_top_index( ctx );
+        bool hasListener = duk_is_function( ctx, listenerOffset );
+        if ( !hasListener && !channel->closing )
+            return 0; // Hold the data till there is a listener
+
+        Filled filled;
+        while ( xQueueReceive( channel->filled, &filled, 0 ) == pdTRUE ) {
+            int result = DUK_EXEC_SUCCESS;
+            if ( !channel->closing ) {
+                duk_dup( ctx, listenerOffset );
+                duk_get_prop_index( ctx, chunksOffset, filled.index );
+                duk_push_buffer_object( ctx, -1, 0, filled.size, DUK_BUFOBJ_UINT8ARRAY );
+                duk_remove( ctx, -2 );
+                result = duk_pcall( ctx, 1 );
+            }
+            // The chunk can be reused only once the listener is done with it
+            xQueueSend( channel->free, &filled.index, 0 );
+            if ( result != DUK_EXEC_SUCCESS ) {
+                if ( uxQueueMessagesWaiting( channel->filled ) )
+                    scheduleDelivery( channel );
+                duk_throw( ctx );
+            }
+            duk_pop( ctx );
+        }
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - event: string
+    // - listener: function
+    static duk_ret_t portOn( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        Port& port = dukNativeThis< Port >( ctx );
+        const char *event = duk_require_string( ctx, 0 );
+        duk_require_function( ctx, 1 );
+        if ( !port.open )
+            dukRaiseError( ctx, "The port is closed" );
+        pushPortSlot( ctx, port.uart );
+        duk_get_prop_string( ctx, -1, "listeners" );
+        duk_dup( ctx, 1 );
+        duk_put_prop_string( ctx, -2, event );
+        if ( std::strcmp( event, "data" ) == 0 )
+            scheduleDelivery( self._channels[ port.uart ].get() );
+        duk_push_this( ctx );
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - data: string or buffer
+    static duk_ret_t portWrite( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        Port& port = dukNativeThis< Port >( ctx );
+        if ( !port.open )
+            dukRaiseError( ctx, "The port is closed" );
+        const void *data;
+        duk_size_t size;
+        if ( duk_is_string( ctx, 0 ) )
+            data = duk_get_lstring( ctx, 0, &size );
+        else if ( duk_is_buffer_data( ctx, 0 ) )
+            data = duk_get_buffer_data( ctx, 0, &size );
+        else
+            dukRaiseError( ctx, "Data has to be a string or a buffer" );
+
+        int promiseId = self.createPromise( ctx );
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, WRITE_SLOT );
+        duk_dup( ctx, 0 );
+        duk_put_prop_index( ctx, -2, promiseId );
+        duk_pop_2( ctx );
+
+        uart_port_t uart = port.uart;
+        self._writer->post( [&self, uart, data, size, promiseId] {
+            int written = uart_write_bytes( uart, data, size );
+            bool success = written == int( size )
+                && uart_wait_tx_done( uart, portMAX_DELAY ) == ESP_OK;
+            self.schedule( [&]( duk_context *ctx ) {
+                duk_push_c_function( ctx, settleWrite, 2 );
+                duk_push_int( ctx, promiseId );
+                duk_push_boolean( ctx, success );
+            }, "serialWrite", JobClass::Io );
+        } );
+        return 1;
+    }
+
+    // Accepts the following duk arguments:
+    // - promiseId: number
+    // - success: bool
+    static duk_ret_t settleWrite( duk_context *ctx ) {
+        int promiseId = duk_require_int( ctx, 0 );
+        bool success = duk_require_boolean( ctx, 1 );
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, WRITE_SLOT );
+        duk_del_prop_index( ctx, -1, promiseId );
+        duk_pop_2( ctx );
+        if ( success )
+            duk_push_undefined( ctx );
+        else
+            duk_push_error_object( ctx, DUK_ERR_ERROR, "Write failed" );
+        Self::settlePromise( ctx, promiseId, success );
+        return 0;
+    }
+
+    std::array< std::unique_ptr< Channel >, UART_NUM_MAX > _channels;
+    std::unique_ptr< freertos::Worker > _writer;
+};
+
+} // namespace jac
@@ -34,7 +34,53 @@ public:
 
     void onEventLoop() {}
 
+    // Create a new pending promise, push it to the stack and return its
+    // identifier. The promise is meant to be settled later from native code
+    // via settlePromise. Its resolve and reject callbacks are kept in
+    // <stash>.promiseSlot[id] until then.
+    int createPromise( duk_context *ctx ) {
+        int id = _nextPromiseId++;
+        duk_get_global_string( ctx, "Promise" );
+        duk_push_c_function( ctx, dukStoreSettleCallbacks, 2 );
+        duk_push_int( ctx, id );
+        duk_put_prop_string( ctx, -2, "id" );
+        duk_new( ctx, 1 );
+        return id;
+    }
+
+    // Resolve (success = true) or reject the promise with the given id with
+    // the value on top of the stack. The value is consumed.
+    static void settlePromise( duk_context *ctx, int id, bool success ) {
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        duk_get_prop_index( ctx, -1, id );
+        duk_get_prop_index( ctx, -1, success ? 0 : 1 );
+        duk_dup( ctx, -5 ); // The value
+        duk_call( ctx, 1 );
+        duk_pop_2( ctx ); // Return value and callbacks
+        duk_del_prop_index( ctx, -1, id );
+        duk_pop_3( ctx ); // Slot, stash and the value
+    }
+
 private:
+    // Promise executor used by createPromise. Stores resolve and reject
+    // callbacks to the promise slot.
+    static duk_ret_t dukStoreSettleCallbacks( duk_context *ctx ) {
+        duk_push_current_function( ctx );
+        duk_get_prop_string( ctx, -1, "id" );
+        int id = duk_require_int( ctx, -1 );
+
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        duk_push_bare_array( ctx );
+        duk_dup( ctx, 0 );
+        duk_put_prop_index( ctx, -2, 0 );
+        duk_dup( ctx, 1 );
+        duk_put_prop_index( ctx, -2, 1 );
+        duk_put_prop_index( ctx, -2, id );
+        return 0;
+    }
+
     void _setupSlot() {
         duk_push_heap_stash( self()._context );
         duk_push_object( self()._context );
@@ -474,7 +520,7 @@ private:
                 // There is already the function
                 duk_dup( ctx, 0 ); // resolve value
                 duk_xmove_top( jobContext, ctx, 2 );
-            } );
+            }, "promiseResolve" );
         });
 
         return 0;
@@ -509,11 +555,13 @@ private:
                 // There is already the function
                 duk_dup( ctx, 0 ); // Error value
                 duk_xmove_top( jobContext, ctx, 2 );
-            } );
+            }, "promiseReject" );
         });
 
         return 0;
     }
+
+    int _nextPromiseId = 0;
 };
 
 } // namespace jac
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <jsmachine.hpp>
+#include <log.hpp>
+#include <freertos/semphr.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+JAC_LOG_MODULE( repl, ::jac::log::Level::Info )
+
+namespace jac {
+
+// Implement a remote REPL over TCP
+//
+// After startRemoteRepl() is called, a task accepts a single client at a time
+// on replPort. Each line received is evaluated as global code in the event
+// loop and the result ("= value") or the error ("! error") is sent back
+// followed by a prompt. The lines are evaluated one by one in the order they
+// were received. A line ending with a backslash continues on the next line.
+// The output of console.log is not redirected.
+template < typename Self >
+class RemoteRepl {
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {
+        int replPort = 2323;
+    };
+
+    void initialize() {}
+
+    void onEventLoop() {}
+
+    // Start accepting clients; the network has to be initialized
+    void startRemoteRepl() {
+        if ( _replDone )
+            return;
+        _replDone = xSemaphoreCreateBinary();
+        if ( !_replDone )
+            throw std::runtime_error( "Cannot allocate semaphore" );
+        if ( xTaskCreate( replTask, "remoteRepl", 3072, this, 1, nullptr ) != pdPASS )
+            throw std::runtime_error( "Cannot allocate task" );
+    }
+
+private:
+    static void replTask( void *arg ) {
+        reinterpret_cast< RemoteRepl * >( arg )->serveRepl();
+    }
+
+    static bool sendAll( int socket, const std::string& data ) {
+        size_t sent = 0;
+        while ( sent < data.size() ) {
+            ssize_t res = send( socket, data.data() + sent, data.size() - sent, 0 );
+            if ( res < 0 && errno == EINTR )
+                continue;
+            if ( res <= 0 )
+                return false;
+            sent += res;
+        }
+        return true;
+    }
+
+    void serveRepl() {
+        int server = socket( AF_INET, SOCK_STREAM, 0 );
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons( self()._cfg.replPort );
+        if ( server < 0
+            || bind( server, reinterpret_cast< sockaddr * >( &addr ), sizeof( addr ) ) < 0
+            || listen( server, 1 ) < 0 )
+        {
+            JAC_LOG( log::Level::Error, repl, "Remote REPL failed: ", std::strerror( errno ) );
+            vTaskDelete( nullptr );
+            return;
+        }
+        while ( true ) {
+            int client = accept( server, nullptr, nullptr );
+            if ( client < 0 )
+                continue;
+            serveClient( client );
+            close( client );
+        }
+    }
+
+    void serveClient( int client ) {
+        std::string line, code;
+        char buffer[ 256 ];
+        if ( !sendAll( client, "> " ) )
+            return;
+        while ( true ) {
+            ssize_t res = recv( client, buffer, sizeof( buffer ), 0 );
+            if ( res < 0 && errno == EINTR )
+                continue;
+            if ( res <= 0 )
+                return;
+            for ( ssize_t i = 0; i != res; i++ ) {
+                if ( buffer[ i ] != '\n' ) {
+                    line.push_back( buffer[ i ] );
+                    continue;
+                }
+                if ( !line.empty() && line.back() == '\r' )
+                    line.pop_back();
+                if ( !line.empty() && line.back() == '\\' ) {
+                    line.back() = '\n';
+                    code += line;
+                    line.clear();
+                    if ( !sendAll( client, ". " ) )
+                        return;
+                    continue;
+                }
+                code += line;
+                line.clear();
+                std::string reply = evaluate( code );
+                code.clear();
+                if ( !sendAll( client, reply + "> " ) )
+                    return;
+            }
+        }
+    }
+
+    // Evaluate the code in the event loop and wait for the result
+    std::string evaluate( const std::string& code ) {
+        self().schedule( [&]( duk_context *ctx ) {
+            duk_push_c_function( ctx, evaluateCode, 1 );
+            duk_push_lstring( ctx, code.data(), code.size() );
+        }, "repl" );
+        xSemaphoreTake( _replDone, portMAX_DELAY );
+        return std::move( _replResult );
+    }
+
+    // Accepts the following duk arguments:
+    // - code: string
+    static duk_ret_t evaluateCode( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        duk_size_t size;
+        const char *code = duk_require_lstring( ctx, 0, &size );
+        bool success = duk_peval_lstring( ctx, code, size ) == 0;
+        self._replResult = success ? "= " : "! ";
+        self._replResult += duk_safe_to_string( ctx, -1 );
+        self._replResult += "\n";
+        xSemaphoreGive( self._replDone );
+        return 0;
+    }
+
+    SemaphoreHandle_t _replDone = nullptr;
+    std::string _replResult;
+};
+
+} // namespace jac
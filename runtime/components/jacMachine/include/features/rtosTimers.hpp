@@ -3,6 +3,13 @@
 #include <freertos/task.h>
 #include <freertos/timers.h>
 #include <jsmachine.hpp>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <map>
+#include <optional>
 
 extern "C" {
     extern const uint8_t rtosTimerWrappersStart[]
@@ -17,7 +24,15 @@ namespace jac {
 // Implement timers functionality for the JsMachine.
 //
 // Internally keeps a list of timer structures. The corresponding callback for
-// the timer is stored in <stash>.timerSlot[String(id)].
+// the timer is stored in <stash>.timerSlot[String(id)]. The deadlines of
+// the active timers are mirrored, so other features can find out how long the
+// event loop is going to be idle.
+//
+// One-shot timers with zero delay (setTimeout( f, 0 ), setImmediate) do not
+// create a FreeRTOS timer; the callback is scheduled as a job right away and
+// gets a negative id, so cancelling it only removes the callback from the
+// slot. Nonzero periods shorter than a tick are prolonged to a tick.
+// queueMicrotask schedules the callback directly without any id.
 template < typename Self >
 class RtosTimers {
     static inline constexpr const char* SLOT = "timerSlot";
@@ -31,11 +46,28 @@ public:
         registerFunctions();
         registerRuntime();
 
-        m_startTicks = xTaskGetTickCount();
+        m_startTime = esp_timer_get_time();
     }
 
     void onEventLoop() {}
+
+    // Return the number of ticks until the nearest timer fires (0 if it is
+    // overdue) or nothing if there are no active timers
+    std::optional< TickType_t > ticksToNextTimer() const {
+        if ( m_deadlines.empty() )
+            return std::nullopt;
+        TickType_t now = xTaskGetTickCount();
+        int32_t nearest = INT32_MAX;
+        for ( const auto& [ id, deadline ] : m_deadlines )
+            nearest = std::min( nearest, int32_t( deadline.at - now ) );
+        return nearest < 0 ? 0 : TickType_t( nearest );
+    }
 private:
+    struct Deadline {
+        TickType_t at;
+        TickType_t period;
+    };
+
     void setupSlot() {
         duk_push_heap_stash( self()._context );
         duk_push_object( self()._context );
@@ -47,11 +79,14 @@ private:
         duk_push_c_function( self()._context, dukCreateTimer, 3 );
         duk_put_global_string( self()._context, "createTimer" );
 
-        duk_push_c_function( self()._context, dukDeleteTimer, 1 );
+        dukPushBound< &dukDeleteTimer >( self()._context );
         duk_put_global_string( self()._context, "deleteTimer" );
 
-        duk_push_c_function( self()._context, dukMillis, 0 );
+        dukPushBound< &dukMillis >( self()._context );
         duk_put_global_string( self()._context, "millis" );
+
+        duk_push_c_lightfunc( self()._context, dukQueueMicrotask, 1, 1, 0 );
+        duk_put_global_string( self()._context, "queueMicrotask" );
     }
 
     void registerRuntime() {
@@ -64,18 +99,30 @@ private:
         duk_pop( ctx );
     }
 
-    TimerHandle_t createTimer( int period, bool oneShot ) {
-        if ( period == 0 ) {
-            throw std::runtime_error( "Timers with no period are not implemented yet" );
-        }
+    TimerHandle_t createTimer( TickType_t ticks, bool oneShot ) {
+        TimerHandle_t timer;
         if ( oneShot )
-            return xTimerCreate(
-                nullptr, pdMS_TO_TICKS( period ),
+            timer = xTimerCreate(
+                nullptr, ticks,
                 !oneShot, &self(), timerCallback< false > );
         else
-            return xTimerCreate(
-                nullptr, pdMS_TO_TICKS( period ),
+            timer = xTimerCreate(
+                nullptr, ticks,
                 !oneShot, &self(), timerCallback< true > );
+        if ( !timer )
+            throw std::runtime_error( "Cannot create timer" );
+        return timer;
+    }
+
+    // Schedule the callback of a zero-delay timer; return its id
+    int createImmediate() {
+        int id = m_nextImmediateId;
+        m_nextImmediateId = id == INT_MIN ? -1 : id - 1;
+        self().schedule( [&]( duk_context* ctx ) {
+            duk_push_c_function( ctx, dukInvokeImmediate, 1 );
+            duk_push_int( ctx, id );
+        }, "immediate", JobClass::Timer );
+        return id;
     }
 
     template < bool AutoReload >
@@ -87,7 +134,7 @@ private:
             duk_push_c_function( ctx, dukInvokeTimer, 2 );
             duk_push_int( ctx, timerId );
             duk_push_boolean( ctx, !AutoReload );
-        } );
+        }, "timer", JobClass::Timer );
 
         if ( !AutoReload ) {
             xTimerDelete( timer, portMAX_DELAY );
@@ -102,20 +149,32 @@ private:
         Self& self = Self::fromContext( ctx );
 
         // Validate arguments
-        int period = duk_require_number( ctx, 0 );
+        int period = std::max( 0.0, double( duk_require_number( ctx, 0 ) ) );
         bool oneShot = duk_require_boolean( ctx, 1 );
         duk_require_function( ctx, 2 );
 
-        TimerHandle_t t = self.createTimer( period, oneShot );
-        xTimerStart( t, portMAX_DELAY );
-        int timerId = reinterpret_cast< int >( t );
+        int timerId;
+        if ( period == 0 && oneShot ) {
+            timerId = self.createImmediate();
+        }
+        else {
+            TickType_t ticks = std::max< TickType_t >( pdMS_TO_TICKS( period ), 1 );
+            TimerHandle_t t = self.createTimer( ticks, oneShot );
+            xTimerStart( t, portMAX_DELAY );
+            timerId = reinterpret_cast< int >( t );
+            self.m_deadlines[ timerId ] = { xTaskGetTickCount() + ticks, ticks };
+        }
 
         duk_push_heap_stash( ctx );
         duk_get_prop_string( ctx, -1, SLOT );
         auto slotOffset = duk_get_top_index( ctx );
 
+        // The key has to match the one of duk_dup( ctx, 0 ) in the other
+        // functions; duk_put_prop_index would turn negative ids into
+        // unsigned ones
+        duk_push_int( ctx, timerId );
         duk_dup( ctx, 2 );
-        duk_put_prop_index( ctx, slotOffset, timerId );
+        duk_put_prop( ctx, slotOffset );
 
         return dukReturn( ctx, timerId );
     }
@@ -124,6 +183,15 @@ private:
     // - timer: number - timer identifier
     // - cleanup: bool - declare if the timer callback should be cleaned or not
     static duk_ret_t dukInvokeTimer( duk_context* ctx ) {
+        Self& self = Self::fromContext( ctx );
+        auto deadline = self.m_deadlines.find( duk_require_int( ctx, 0 ) );
+        if ( deadline != self.m_deadlines.end() ) {
+            if ( duk_require_boolean( ctx, 1 ) )
+                self.m_deadlines.erase( deadline );
+            else
+                deadline->second.at = xTaskGetTickCount() + deadline->second.period;
+        }
+
         // Extract time callback
         duk_push_heap_stash( ctx );
         duk_get_prop_string( ctx, -1, SLOT );
@@ -142,36 +210,66 @@ private:
         return 0;
     }
 
+    // Accepts the following duk arguments:
+    // - timer: number - identifier of a zero-delay timer
+    static duk_ret_t dukInvokeImmediate( duk_context* ctx ) {
+        duk_push_heap_stash( ctx );
+        duk_get_prop_string( ctx, -1, SLOT );
+        auto slotOffset = duk_get_top_index( ctx );
+        duk_dup( ctx, 0 );
+        if ( !duk_get_prop( ctx, slotOffset ) )
+            return 0; // Cancelled
+
+        duk_dup( ctx, 0 );
+        duk_del_prop( ctx, slotOffset );
+        duk_require_callable( ctx, -1 );
+        duk_call( ctx, 0 );
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - callback: function
+    static duk_ret_t dukQueueMicrotask( duk_context* ctx ) {
+        duk_require_function( ctx, 0 );
+        Self::fromContext( ctx ).schedule( [&]( duk_context* jobContext ) {
+            duk_dup( ctx, 0 );
+            duk_xmove_top( jobContext, ctx, 1 );
+        }, "microtask" );
+        return 0;
+    }
+
     // Accepts the following duk arguments:
     // - timer: number - timer identifier
     // Returns nothing.
-    static duk_ret_t dukDeleteTimer(duk_context* ctx) {
-        int timerId = duk_require_int(ctx, 0);
+    static void dukDeleteTimer( duk_context* ctx, int timerId ) {
+        Self::fromContext( ctx ).m_deadlines.erase( timerId );
 
         // Delete time callback
         duk_push_heap_stash( ctx );
         duk_get_prop_string( ctx, -1, SLOT );
         auto slotOffset = duk_get_top_index( ctx );
-        duk_dup( ctx, 0 );
+        duk_push_int( ctx, timerId );
         if(duk_has_prop(ctx, slotOffset)) {
-            duk_dup( ctx, 0 );
+            duk_push_int( ctx, timerId );
             duk_del_prop( ctx, slotOffset );
 
-            // Delete FreeRTOS timer
-            xTimerDelete(reinterpret_cast<TimerHandle_t>(timerId), portMAX_DELAY);
+            // Delete FreeRTOS timer; zero-delay timers have none
+            if ( timerId > 0 )
+                xTimerDelete(reinterpret_cast<TimerHandle_t>(timerId), portMAX_DELAY);
         }
-        return 0;
     }
 
     // No arguments.
-    // Returns number of millis since jacMachine start.
-    static duk_ret_t dukMillis(duk_context* ctx) {
+    // Returns number of millis since jacMachine start with microsecond
+    // resolution.
+    static double dukMillis( duk_context* ctx ) {
         Self& self = Self::fromContext( ctx );
-        auto ticks = xTaskGetTickCount() - self.m_startTicks;
-        return dukReturn(ctx, (int)(ticks * portTICK_RATE_MS));
+        return ( esp_timer_get_time() - self.m_startTime ) / 1000.0;
     }
 
-    TickType_t m_startTicks;
+    int64_t m_startTime;
+    int m_nextImmediateId = -1;
+    std::map< int, Deadline > m_deadlines; // Indexed by the timer id
 };
 
 } // namespace jac
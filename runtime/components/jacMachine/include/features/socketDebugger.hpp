@@ -31,9 +31,12 @@ public:
 
     void initialize() {}
 
+    bool hasPendingWork() const {
+        return _debuggingEnabled;
+    }
+
     void onEventLoop() {
-        if ( _debuggingEnabled )
-            duk_debugger_cooperate( self()._context );
+        duk_debugger_cooperate( self()._context );
     }
 
     void waitForDebugger() {
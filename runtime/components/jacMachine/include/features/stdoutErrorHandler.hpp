@@ -1,8 +1,11 @@
 #pragma once
 
-#include <iostream>
+#include <log.hpp>
+
 #include <string>
 
+JAC_LOG_MODULE( machine, ::jac::log::Level::Debug )
+
 namespace jac {
 
 template < typename Self >
@@ -17,12 +20,14 @@ public:
     void onEventLoop() {}
 
     static void fatalErrorHandler( void *udata, const char *msg ) {
-        std::cout << "Fatal error occured: " << msg << "\n";
+        log::writeText( log::Level::Error, log::modules::machine::tag,
+            std::string( "Fatal error occured: " ) + msg );
         throw std::runtime_error( std::string( msg ) );
     }
 
     void reportError( const std::string& msg ) {
-        std::cout << "An error occured: " << msg << "\n";
+        // Stack traces are often longer than a line, do not truncate them
+        log::writeText( log::Level::Error, log::modules::machine::tag, "An error occured: " + msg );
         throw std::runtime_error( msg );
     }
 };
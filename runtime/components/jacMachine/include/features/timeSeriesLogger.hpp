@@ -0,0 +1,204 @@
+#pragma once
+
+#include <jsmachine.hpp>
+#include <timeSeriesLog.hpp>
+#include <partitionMedium.hpp>
+#include <filesystem.hpp>
+
+#include <memory>
+
+namespace jac {
+
+// Implement time series logging module "tslog"
+//
+// The log lives in a dedicated flash partition (see
+// jac::storage::TimeSeriesLog for the format). If there is no such partition,
+// a file on the storage is used instead.
+//
+// The module has the following functions:
+// - open(fieldCount[, batchSize]): open the log with records of the given
+//   number of fields. A log with a different format is discarded.
+// - append(values[, timestamp]): append a record; values is an array of
+//   numbers, the timestamp defaults to Date.now()
+// - flush(): write the batched records to the flash
+// - query(from, to[, limit]): return records with timestamp in [from, to]
+//   as an object { timestamps: Float64Array, values: Float32Array }; values
+//   of a record are consecutive
+// - stats(): return an object { records, capacity, oldest, newest, pending }
+// - clear(): erase the whole log
+//
+// The records are batched in RAM; call flush() to make sure they survive a
+// reset. The oldest records are overwritten when the log is full.
+template < typename Self >
+class TimeSeriesLogger {
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {
+        std::string tslogPartition = "tslog";
+        // Used when there is no partition; relative to the base path
+        std::string tslogFallbackFile = "__tslog.bin";
+        int tslogFallbackSize = 64 * 1024;
+    };
+
+    void initialize() {
+        self().registerNativeModule( "tslog", [this]( duk_context *ctx ) {
+            return self().initializeTslogModule( ctx );
+        });
+    }
+
+    void onEventLoop() {}
+
+private:
+    // Initializes the module; there are the following arguments on the
+    // Duktape stack:
+    // - 0 requested module ID
+    // - 1 exports object
+    // - 2 module object
+    duk_ret_t initializeTslogModule( duk_context *ctx ) {
+        const int exportOffset = 1;
+        duk_function_list_entry functions[] = {
+            { "open", dukOpen, DUK_VARARGS },
+            { "append", dukAppend, DUK_VARARGS },
+            { "flush", dukFlush, 0 },
+            { "query", dukQuery, DUK_VARARGS },
+            { "stats", dukStats, 0 },
+            { "clear", dukClear, 0 },
+            { nullptr, nullptr, 0 }
+        };
+        duk_put_function_list( ctx, exportOffset, functions );
+        return dukReturn( ctx );
+    }
+
+    static storage::TimeSeriesLog& log( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        if ( !self._tslog )
+            dukRaiseError( ctx, "The log is not open" );
+        return *self._tslog;
+    }
+
+    // Run the operation and turn its failure into a JavaScript error
+    template < typename Fn >
+    static void guarded( duk_context *ctx, Fn fn ) {
+        try {
+            fn();
+        }
+        catch ( std::runtime_error& e ) {
+            dukRaiseError( ctx, e.what() );
+        }
+    }
+
+    // Accepts the following duk arguments:
+    // - fieldCount: number
+    // - batchSize: number, optional
+    static duk_ret_t dukOpen( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        int fieldCount = duk_require_int( ctx, 0 );
+        int batchSize = duk_is_number( ctx, 1 ) ? duk_get_int( ctx, 1 ) : 64;
+        guarded( ctx, [&] {
+            if ( self._tslog )
+                self._tslog->flush();
+            self._tslog.reset();
+            if ( !self._tslogMedium ) {
+                try {
+                    self._tslogMedium = std::make_unique< storage::PartitionMedium >(
+                        self._cfg.tslogPartition.c_str() );
+                }
+                catch ( std::runtime_error& ) {
+                    self._tslogMedium = std::make_unique< storage::FileMedium >(
+                        fs::concatPath( self._cfg.basePath, self._cfg.tslogFallbackFile ),
+                        self._cfg.tslogFallbackSize );
+                }
+            }
+            self._tslog = std::make_unique< storage::TimeSeriesLog >(
+                *self._tslogMedium, fieldCount, batchSize );
+            self._tslogFields.reset( new float[ fieldCount ] );
+        } );
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - values: array of numbers
+    // - timestamp: number, optional
+    static duk_ret_t dukAppend( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        auto& tslog = log( ctx );
+        if ( !duk_is_array( ctx, 0 ) || int( duk_get_length( ctx, 0 ) ) != tslog.fieldCount() )
+            dukRaiseError( ctx, "Expected an array of " + std::to_string( tslog.fieldCount() ) + " values" );
+        for ( int i = 0; i != tslog.fieldCount(); i++ ) {
+            duk_get_prop_index( ctx, 0, i );
+            self._tslogFields[ i ] = duk_to_number( ctx, -1 );
+            duk_pop( ctx );
+        }
+        double timestamp = duk_is_number( ctx, 1 ) ? duk_get_number( ctx, 1 ) : duk_get_now( ctx );
+        guarded( ctx, [&] {
+            tslog.append( int64_t( timestamp ), self._tslogFields.get() );
+        } );
+        return 0;
+    }
+
+    static duk_ret_t dukFlush( duk_context *ctx ) {
+        auto& tslog = log( ctx );
+        guarded( ctx, [&] { tslog.flush(); } );
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - from: number
+    // - to: number
+    // - limit: number, optional
+    static duk_ret_t dukQuery( duk_context *ctx ) {
+        auto& tslog = log( ctx );
+        int64_t from = duk_require_number( ctx, 0 );
+        int64_t to = duk_require_number( ctx, 1 );
+        size_t limit = duk_is_number( ctx, 2 ) ? duk_get_uint( ctx, 2 ) : SIZE_MAX;
+        std::vector< int64_t > timestamps;
+        std::vector< float > values;
+        guarded( ctx, [&] {
+            tslog.query( from, to, limit, timestamps, values );
+        } );
+
+        duk_push_object( ctx );
+        auto *times = static_cast< double * >(
+            duk_push_fixed_buffer( ctx, timestamps.size() * sizeof( double ) ) );
+        for ( size_t i = 0; i != timestamps.size(); i++ )
+            times[ i ] = timestamps[ i ];
+        duk_push_buffer_object( ctx, -1, 0, timestamps.size() * sizeof( double ), DUK_BUFOBJ_FLOAT64ARRAY );
+        duk_put_prop_string( ctx, -3, "timestamps" );
+        duk_pop( ctx );
+        void *fields = duk_push_fixed_buffer( ctx, values.size() * sizeof( float ) );
+        std::memcpy( fields, values.data(), values.size() * sizeof( float ) );
+        duk_push_buffer_object( ctx, -1, 0, values.size() * sizeof( float ), DUK_BUFOBJ_FLOAT32ARRAY );
+        duk_put_prop_string( ctx, -3, "values" );
+        duk_pop( ctx );
+        return 1;
+    }
+
+    static duk_ret_t dukStats( duk_context *ctx ) {
+        auto stats = log( ctx ).statistics();
+        duk_push_object( ctx );
+        duk_push_number( ctx, stats.records );
+        duk_put_prop_string( ctx, -2, "records" );
+        duk_push_number( ctx, stats.capacity );
+        duk_put_prop_string( ctx, -2, "capacity" );
+        duk_push_number( ctx, stats.oldest );
+        duk_put_prop_string( ctx, -2, "oldest" );
+        duk_push_number( ctx, stats.newest );
+        duk_put_prop_string( ctx, -2, "newest" );
+        duk_push_number( ctx, stats.pending );
+        duk_put_prop_string( ctx, -2, "pending" );
+        return 1;
+    }
+
+    static duk_ret_t dukClear( duk_context *ctx ) {
+        auto& tslog = log( ctx );
+        guarded( ctx, [&] { tslog.clear(); } );
+        return 0;
+    }
+
+    std::unique_ptr< storage::Medium > _tslogMedium;
+    std::unique_ptr< storage::TimeSeriesLog > _tslog;
+    std::unique_ptr< float[] > _tslogFields;
+};
+
+} // namespace jac
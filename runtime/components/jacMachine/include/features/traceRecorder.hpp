@@ -0,0 +1,100 @@
+#pragma once
+
+#include <jsmachine.hpp>
+#include <uploader.hpp>
+#include <filesystem.hpp>
+#include <trace.hpp>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace jac {
+
+// Control the timeline trace recorder (see trace.hpp)
+//
+// The machine records the event loop iterations, the jobs tagged with their
+// source, deferred interrupts, module loading, garbage collection and the
+// uploader commands. The recorded timeline is available as the uploader dump
+// source "trace" (e.g., `transfer.py dump trace trace.json`) and via module
+// "trace" with the following functions:
+// - start(): start recording
+// - stop(): stop recording; the recorded events are kept
+// - write(path): store the timeline as a Chrome trace-event JSON file
+template < typename Self >
+class TraceRecorder {
+public:
+    MACHINE_FEATURE_SELF();
+
+    struct Configuration {
+        bool traceAtStart = false; // Record the startup, including main
+    };
+
+    void initialize() {
+        if ( self()._cfg.traceAtStart )
+            trace::start();
+        storage::registerDumpSource( "trace", []( const storage::DumpSink& sink ) {
+            trace::writeChromeJson( [&]( const char *data, size_t size ) {
+                sink( reinterpret_cast< const unsigned char * >( data ), size );
+            } );
+        });
+        self().registerNativeModule( "trace", [this]( duk_context *ctx ) {
+            return self().initializeTraceModule( ctx );
+        });
+    }
+
+    ~TraceRecorder() {
+        storage::unregisterDumpSource( "trace" );
+    }
+
+    void onEventLoop() {}
+
+private:
+    // Initializes the module; there are the following arguments on the
+    // Duktape stack:
+    // - 0 requested module ID
+    // - 1 exports object
+    // - 2 module object
+    duk_ret_t initializeTraceModule( duk_context *ctx ) {
+        const int exportOffset = 1;
+        duk_function_list_entry functions[] = {
+            { "start", dukStart, 0 },
+            { "stop", dukStop, 0 },
+            { "write", dukWrite, 1 },
+            { nullptr, nullptr, 0 }
+        };
+        dukPutLightFunctionList( ctx, exportOffset, functions );
+        return dukReturn( ctx );
+    }
+
+    static duk_ret_t dukStart( duk_context *ctx ) {
+        trace::start();
+        return 0;
+    }
+
+    static duk_ret_t dukStop( duk_context *ctx ) {
+        trace::stop();
+        return 0;
+    }
+
+    // Accepts the following duk arguments:
+    // - path: string
+    static duk_ret_t dukWrite( duk_context *ctx ) {
+        Self& self = Self::fromContext( ctx );
+        std::string path = fs::concatPath( self._cfg.basePath, duk_require_string( ctx, 0 ) );
+        FILE *f = std::fopen( path.c_str(), "w" );
+        if ( !f )
+            dukRaiseError( ctx, "Cannot open " + path + ": " + std::strerror( errno ) );
+        bool failed = false;
+        trace::writeChromeJson( [&]( const char *data, size_t size ) {
+            failed |= std::fwrite( data, 1, size, f ) != size;
+        } );
+        failed |= std::fclose( f ) != 0;
+        if ( failed )
+            dukRaiseError( ctx, "Cannot write " + path + ": " + std::strerror( errno ) );
+        return 0;
+    }
+};
+
+} // namespace jac
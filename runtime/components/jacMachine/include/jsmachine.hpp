@@ -1,14 +1,20 @@
 #pragma once
 
 #include <duktape.h>
+#include <algorithm>
 #include <stdexcept>
 #include <mutex>
+#include <type_traits>
 #include <vector>
 
-#include <freertos/semphr.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #include <dukUtility.hpp>
 #include <freeRtos.hpp>
+#include <ring.hpp>
+#include <trace.hpp>
+#include <scheduling.hpp>
 
 // Define this macro to avoid tedious writing of a repetitive code
 // Note that macro is much easire solution than any other "proper C++" solution
@@ -18,20 +24,46 @@
 
 namespace jac {
 
-template< template < typename > typename... Features >
-class JsMachineBase: public Features< JsMachineBase < Features... > >... {
+namespace detail {
+
+template < typename Feature, typename = void >
+struct HasOnIdle: std::false_type {};
+
+template < typename Feature >
+struct HasOnIdle< Feature, std::void_t< decltype( std::declval< Feature& >().onIdle() ) > >:
+    std::true_type {};
+
+template < typename Feature, typename = void >
+struct HasPendingWork: std::false_type {};
+
+template < typename Feature >
+struct HasPendingWork< Feature, std::void_t< decltype( std::declval< Feature& >().hasPendingWork() ) > >:
+    std::true_type {};
+
+} // namespace detail
+
+// The machine is composed of the features; the scheduling policy orders the
+// scheduled jobs (see scheduling.hpp)
+template< typename Scheduling, template < typename > typename... Features >
+class BasicJsMachine: public Features< BasicJsMachine < Scheduling, Features... > >... {
 public:
-    using Self = JsMachineBase< Features... >;
+    using Self = BasicJsMachine< Scheduling, Features... >;
+    using SchedulingPolicy = Scheduling;
 
     struct Configuration:
         public Features< Self >::Configuration...
-    {
-        int eventLoopLimit = 128;
-        int interruptQueueSize = 32;
-    };
+    {};
+
+    // Handler of an interrupt invoked by the event loop. It should push
+    // function and arguments to the context, just like if duk_call should be
+    // called.
+    using InterruptHandler = void (*)( duk_context *, void * );
 
-    JsMachineBase( Configuration cfg = Configuration() )
-        : _cfg( cfg ), _isrService( cfg.interruptQueueSize )
+    static inline constexpr int INTERRUPT_RING_SIZE = 64;
+
+    // The machine has to be constructed by the task that runs the event loop
+    BasicJsMachine( Configuration cfg = Configuration() )
+        : _cfg( cfg ), _loopTask( xTaskGetCurrentTaskHandle() )
     {
         _context = duk_create_heap(
             Self::allocateMemory,
@@ -48,14 +80,12 @@ public:
         duk_put_prop_string( _context, -2, "_nextJobsContext" );
         duk_pop( _context );
 
-        _eventsPending = xSemaphoreCreateCounting( _cfg.eventLoopLimit, 0 );
-
         ( Features< Self >::initialize(), ... );
     }
 
-    JsMachineBase( const JsMachineBase& ) = delete;
+    BasicJsMachine( const BasicJsMachine& ) = delete;
 
-    ~JsMachineBase() {
+    ~BasicJsMachine() {
         duk_destroy_heap( _context );
     }
 
@@ -80,33 +110,56 @@ public:
         duk_pop( _context );
     }
 
-    void finishEvent() {
-        bool ret = xSemaphoreTake( _eventsPending, 0 );
-        assert( ret && "There were no pending events." );
-    }
-
+    // Wake up the event loop
     void addEvent() {
-        xSemaphoreGive( _eventsPending );
+        xTaskNotifyGive( _loopTask );
     }
 
-    void IRAM_ATTR handleInterrupt( freertos::IsrDeferrer::Handler h,
-                                    freertos::IsrDeferrer::Arg a )
-    {
-        _isrService.isr( h, a );
+    // Defer the handler out of the ISR to the event loop. The record is passed
+    // via a lock-free ring and the event loop task is notified directly, so
+    // there is no intermediate task. Return false if the handler cannot be
+    // deferred as the ring is full.
+    bool IRAM_ATTR handleInterrupt( InterruptHandler h, void *arg ) {
+        // Interrupts on both cores might produce records, serialize them
+        portENTER_CRITICAL_ISR( &_interruptLock );
+        bool pushed = _interrupts.push( { h, arg } );
+        portEXIT_CRITICAL_ISR( &_interruptLock );
+        JAC_TRACE_INSTANT( "interruptDeferred", pushed );
+        if ( !pushed )
+            return false;
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR( _loopTask, &higherPriorityTaskWoken );
+        if ( higherPriorityTaskWoken )
+            portYIELD_FROM_ISR();
+        return true;
     }
 
     // Schedule a new job. The function f will be invoked with a _nextJobs
     // context and it should push function and arguments to it. Just like if
-    // duk_call should be called.
+    // duk_call should be called. The source names the job in the trace; it
+    // has to be a string literal. The class tells the scheduling policy the
+    // importance of the job.
     template < typename Fn >
-    void schedule( Fn f ) {
+    void schedule( Fn f, const char *source = "job", JobClass jobClass = JobClass::Normal ) {
         std::scoped_lock _( _globalLock );
         auto stackSize = duk_get_top( _nextJobs );
         f( _nextJobs );
         auto pushedCount = duk_get_top( _nextJobs ) - stackSize;
 
-        // Push number of arguments
-        duk_push_int( _nextJobs, pushedCount - 1 );
+        // The values stay in place till the job runs; the slot remembers them
+        int slot;
+        if ( _freeJobSlots.empty() ) {
+            slot = _jobSlots.size();
+            _jobSlots.emplace_back();
+        }
+        else {
+            slot = _freeJobSlots.back();
+            _freeJobSlots.pop_back();
+        }
+        _jobSlots[ slot ] = { stackSize, pushedCount - 1, source };
+        _jobValues += pushedCount;
+        _scheduling.push( { slot, jobClass, _jobSequence++ } );
+        JAC_TRACE_INSTANT( source, _jobsPending + 1 );
 
         // Mark the event
         _jobsPending++;
@@ -115,28 +168,28 @@ public:
 
     void runEventLoop() {
         while ( !_shouldExit ) {
-            // Wait for some events
-            xSemaphoreTake( _eventsPending, portMAX_DELAY );
-            xSemaphoreGive( _eventsPending );
+            // Wait for some events. If there are none, the loop is about to
+            // sleep and the features can use the idle time.
+            if ( ulTaskNotifyTake( pdTRUE, 0 ) == 0 ) {
+                {
+                    JAC_TRACE_SCOPE( "idle" );
+                    std::scoped_lock _( _globalLock );
+                    ( runOnIdle< Features< Self > >(), ... );
+                }
+                ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+            }
 
-            // Process the events
-            (Features< Self >::onEventLoop(), ...);
+            // Process the events of the features with pending work
+            ( pollFeature< Features< Self > >(), ... );
 
-            // Run scheduled jobs
             std::scoped_lock _( _globalLock );
-            while ( _jobsPending != 0 ) {
-                auto argCount = duk_require_int( _nextJobs, -1 );
-                duk_pop( _nextJobs );
+            runInterrupts();
 
-                duk_require_stack( _context, argCount + 1 );
-                duk_xmove_top( _context, _nextJobs, argCount + 1 );
-                if ( duk_pcall( _context, argCount ) != 0 ) {
-                    this->reportError( duk_safe_to_stacktrace( _context, -1) );
-                }
-                duk_pop( _context );
-
-                _jobsPending--;
-                finishEvent();
+            // Run scheduled jobs in the order given by the policy
+            while ( _jobsPending != 0 ) {
+                if constexpr ( Scheduling::pollInterruptsPerJob )
+                    runInterrupts();
+                runJob( _scheduling.pop() );
             }
         }
     }
@@ -145,12 +198,127 @@ public:
     duk_context *_nextJobs = nullptr;
     Configuration _cfg;
 protected:
+    // Features may optionally implement onIdle(). It is invoked with the
+    // global lock when the event loop has nothing to do and is going to sleep.
+    template < typename Feature >
+    void runOnIdle() {
+        if constexpr ( detail::HasOnIdle< Feature >::value )
+            Feature::onIdle();
+    }
+
+    // Features may optionally implement hasPendingWork(). If they do, their
+    // onEventLoop() is invoked only when it returns true.
+    template < typename Feature >
+    void pollFeature() {
+        if constexpr ( detail::HasPendingWork< Feature >::value ) {
+            if ( !Feature::hasPendingWork() )
+                return;
+        }
+        Feature::onEventLoop();
+    }
+
+    struct InterruptRecord {
+        InterruptHandler handler;
+        void *arg;
+    };
+
+    struct JobSlot {
+        duk_idx_t base; // Index of the function in _nextJobs, -1 if free
+        int argCount;
+        const char *source;
+    };
+
+    // Run deferred interrupt handlers; has to be called with the global lock
+    void runInterrupts() {
+        InterruptRecord record;
+        while ( _interrupts.pop( record ) ) {
+            JAC_TRACE_SCOPE( "interrupt" );
+            auto stackSize = duk_get_top( _context );
+            record.handler( _context, record.arg );
+            auto argCount = duk_get_top( _context ) - stackSize - 1;
+            if ( duk_pcall( _context, argCount ) != 0 ) {
+                this->reportError( duk_safe_to_stacktrace( _context, -1) );
+            }
+            duk_pop( _context );
+        }
+    }
+
+    // Move the values of the job to _context, release the slot and run the
+    // job; has to be called with the global lock
+    void runJob( const Job& job ) {
+        JobSlot slot = _jobSlots[ job.slot ];
+        _jobSlots[ job.slot ].base = -1;
+        _freeJobSlots.push_back( job.slot );
+        _jobsPending--;
+        JAC_TRACE_SCOPE( slot.source );
+
+        int count = slot.argCount + 1;
+        duk_require_stack( _context, count );
+        if ( slot.base + count == duk_get_top( _nextJobs ) ) {
+            duk_xmove_top( _context, _nextJobs, count );
+        }
+        else {
+            duk_require_stack( _nextJobs, count );
+            for ( int i = 0; i != count; i++ )
+                duk_dup( _nextJobs, slot.base + i );
+            duk_xmove_top( _context, _nextJobs, count );
+            for ( int i = 0; i != count; i++ ) {
+                duk_push_undefined( _nextJobs );
+                duk_replace( _nextJobs, slot.base + i );
+            }
+        }
+        _jobValues -= count;
+        if ( _jobsPending == 0 )
+            duk_set_top( _nextJobs, 0 );
+        else if ( duk_get_top( _nextJobs ) > 2 * _jobValues + 32 )
+            compactJobs();
+
+        if ( duk_pcall( _context, slot.argCount ) != 0 ) {
+            this->reportError( duk_safe_to_stacktrace( _context, -1) );
+        }
+        duk_pop( _context );
+    }
+
+    // Jobs that do not run in the order of scheduling leave holes in
+    // _nextJobs; move the pending values down
+    void compactJobs() {
+        std::vector< int > slots;
+        for ( int i = 0; i != int( _jobSlots.size() ); i++ ) {
+            if ( _jobSlots[ i ].base >= 0 )
+                slots.push_back( i );
+        }
+        std::sort( slots.begin(), slots.end(), [&]( int a, int b ) {
+            return _jobSlots[ a ].base < _jobSlots[ b ].base;
+        } );
+        duk_idx_t top = 0;
+        for ( int i : slots ) {
+            JobSlot& slot = _jobSlots[ i ];
+            for ( int j = 0; j != slot.argCount + 1; j++ ) {
+                if ( slot.base + j != top + j )
+                    duk_copy( _nextJobs, slot.base + j, top + j );
+            }
+            slot.base = top;
+            top += slot.argCount + 1;
+        }
+        duk_set_top( _nextJobs, top );
+    }
+
     bool _shouldExit = false;
-    SemaphoreHandle_t _eventsPending;
+    TaskHandle_t _loopTask;
     int _jobsPending = 0;
+    Scheduling _scheduling;
+    std::vector< JobSlot > _jobSlots;
+    std::vector< int > _freeJobSlots;
+    int _jobValues = 0; // Values of the pending jobs in _nextJobs
+    uint32_t _jobSequence = 0;
     std::recursive_mutex _globalLock; // The mutex has to be recursive to properly implement scheduleJob
 
-    freertos::IsrDeferrer _isrService;
+    utility::SpscRing< InterruptRecord, INTERRUPT_RING_SIZE > _interrupts;
+    portMUX_TYPE _interruptLock = portMUX_INITIALIZER_UNLOCKED;
 };
 
+// Machine with the jobs run in the order they were scheduled
+template< template < typename > typename... Features >
+using JsMachineBase = BasicJsMachine< FifoScheduling, Features... >;
+
 } // namespace jac
\ No newline at end of file
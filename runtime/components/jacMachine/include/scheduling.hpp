@@ -0,0 +1,146 @@
+#pragma once
+
+#include <esp_timer.h>
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <queue>
+#include <vector>
+
+// Scheduling policies of the event loop
+//
+// Each scheduled job is tagged with a class. A policy orders the pending jobs;
+// it is a template argument of BasicJsMachine and it provides:
+// - push( job ): enqueue a job
+// - pop(): dequeue the job to run next
+// - empty()
+// - name: a string identifying the policy, e.g., in benchmark results
+// - pollInterruptsPerJob: whether the deferred interrupt handlers are run
+//   before every job or only once per event loop iteration
+//
+// Deferred interrupt handlers (see handleInterrupt) do not pass through the
+// policy, they always run before the jobs. A policy with pollInterruptsPerJob
+// lets them overtake a long batch of jobs.
+
+namespace jac {
+
+enum class JobClass : uint8_t {
+    Interrupt,  // Reactions to hardware events scheduled from tasks
+    Io,         // Completions of I/O operations
+    Normal,     // Promise reactions and other jobs
+    Timer,      // Timer callbacks; below Normal, so the reactions of a
+                // callback run before the next callback
+    Background, // Diagnostics, e.g., heap snapshots
+};
+
+static inline constexpr int JOB_CLASS_COUNT = 5;
+
+struct Job {
+    int slot; // Identifies the job values in the machine
+    JobClass jobClass;
+    uint32_t sequence; // Order of scheduling
+};
+
+// Run the jobs in the order they were scheduled
+class FifoScheduling {
+public:
+    static inline constexpr const char *name = "fifo";
+    static inline constexpr bool pollInterruptsPerJob = false;
+
+    void push( const Job& job ) {
+        _jobs.push_back( job );
+    }
+
+    Job pop() {
+        Job job = _jobs.front();
+        _jobs.pop_front();
+        return job;
+    }
+
+    bool empty() const {
+        return _jobs.empty();
+    }
+
+private:
+    std::deque< Job > _jobs;
+};
+
+// Run the jobs of the most important class first; jobs of the same class run
+// in the order they were scheduled. Lower classes can starve under load.
+class PriorityScheduling {
+public:
+    static inline constexpr const char *name = "priority";
+    static inline constexpr bool pollInterruptsPerJob = true;
+
+    void push( const Job& job ) {
+        _jobs[ int( job.jobClass ) ].push_back( job );
+    }
+
+    Job pop() {
+        for ( auto& queue : _jobs ) {
+            if ( queue.empty() )
+                continue;
+            Job job = queue.front();
+            queue.pop_front();
+            return job;
+        }
+        __builtin_unreachable();
+    }
+
+    bool empty() const {
+        for ( const auto& queue : _jobs ) {
+            if ( !queue.empty() )
+                return false;
+        }
+        return true;
+    }
+
+private:
+    std::array< std::deque< Job >, JOB_CLASS_COUNT > _jobs;
+};
+
+// Earliest deadline first. The deadline of a job is the time of scheduling
+// plus a relative deadline given by its class, so important jobs go first,
+// yet a job of a lower class is not postponed indefinitely.
+class DeadlineScheduling {
+public:
+    static inline constexpr const char *name = "edf";
+    static inline constexpr bool pollInterruptsPerJob = true;
+
+    // Relative deadlines in microseconds indexed by JobClass
+    static inline constexpr std::array< int64_t, JOB_CLASS_COUNT > RELATIVE_DEADLINES = {
+        500, 5'000, 10'000, 20'000, 1'000'000 };
+
+    void push( const Job& job ) {
+        int64_t deadline = esp_timer_get_time() + RELATIVE_DEADLINES[ int( job.jobClass ) ];
+        _jobs.push( { deadline, job } );
+    }
+
+    Job pop() {
+        Job job = _jobs.top().job;
+        _jobs.pop();
+        return job;
+    }
+
+    bool empty() const {
+        return _jobs.empty();
+    }
+
+private:
+    struct Entry {
+        int64_t deadline;
+        Job job;
+
+        // The queue keeps the greatest entry on top
+        bool operator<( const Entry& o ) const {
+            if ( deadline != o.deadline )
+                return deadline > o.deadline;
+            return int32_t( job.sequence - o.job.sequence ) > 0;
+        }
+    };
+
+    std::priority_queue< Entry, std::vector< Entry > > _jobs;
+};
+
+} // namespace jac
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <cstdint>
+
+#include <sectorWriter.hpp>
+
+namespace jac::storage {
+
+// A bundle is a stream of records that describes a whole file tree:
+// - u16 (big-endian) length of the path, 0 marks the end of the bundle
+// - the path relative to the storage root
+// - u32 (big-endian) size of the file
+// - the file content
+//
+// BundleWriter unpacks a bundle into a staging directory. Once the bundle is
+// complete, commit() swaps the staging directory with the current content of
+// the storage. The swap is guided by a journal, so it can be finished by
+// recoverBundle() if the device resets in the middle of it. Entities with names
+// starting with "__" are internal and they are not affected by the swap.
+//
+// All the methods throw std::runtime_error on failure.
+class BundleWriter {
+public:
+    BundleWriter( const std::string& storagePrefix );
+    BundleWriter( const BundleWriter& ) = delete;
+    BundleWriter& operator=( const BundleWriter& ) = delete;
+    ~BundleWriter();
+
+    void feed( const unsigned char *data, int size );
+    void commit();
+
+    bool complete() const {
+        return _state == State::Finished;
+    }
+
+private:
+    enum class State { PathLength, Path, Size, Content, Finished };
+
+    void openFile();
+    void closeFile( bool flush );
+
+    std::string _prefix;
+    State _state = State::PathLength;
+    uint32_t _value = 0;
+    int _valueBytes = 0;
+    std::string _path;
+    uint32_t _remaining = 0;
+    int _fd = -1;
+    SectorWriter _writer;
+};
+
+// Finish or roll back a bundle deploy that was interrupted by a reset
+void recoverBundle( const std::string& storagePrefix );
+
+// Serialize files under the prefix into a bundle. The data are passed to
+// sink( const unsigned char *data, int size ).
+void exportBundle( const std::string& storagePrefix, const std::string& prefix,
+    const std::function< void( const unsigned char *, int ) >& sink );
+
+} // namespace jac::storage
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <ctime>
+
+namespace jac::storage {
+
+// Compute a SHA-256 digest of a file and return it as a hex string. Throws
+// std::runtime_error when the file cannot be read.
+std::string sha256File( const std::string& path );
+
+// Persistent cache of file digests stored in a sidecar file on the storage.
+//
+// Each entry is keyed by the file name relative to the storage root and
+// remembers the size and the modification time of the file the digest was
+// computed for. An entry is considered stale when either of them does not
+// match, so files rewritten by any writer (the fs module, another uploader
+// session) are detected. FAT stores the modification time with a 2-second
+// resolution, so digests of files modified less than 2 seconds ago are not
+// cached. When the clock is not set, FAT stamps the files with a time since
+// 1980 that cannot be compared with the clock and the check is skipped. The
+// uploader still invalidates the files it writes explicitly.
+//
+// Changes are persisted by save() and when the index is destroyed, i.e., at
+// the end of an uploader session.
+class HashIndex {
+public:
+    HashIndex( const std::string& indexPath );
+    HashIndex( const HashIndex& ) = delete;
+    HashIndex& operator=( const HashIndex& ) = delete;
+    ~HashIndex();
+
+    // Return the digest of the given file. Use the cached value if it is
+    // available, otherwise compute it and remember it.
+    std::string digest( const std::string& name, const std::string& path,
+        size_t size, time_t mtime );
+
+    // Forget the digest of the given file
+    void invalidate( const std::string& name );
+
+    // Forget all digests, e.g., when the whole storage content is replaced
+    void clear();
+
+    // Persist cached entries if there was a change since the last save
+    void save();
+
+private:
+    struct Entry {
+        size_t size;
+        time_t mtime;
+        std::string digest;
+    };
+
+    static std::string normalizeName( const std::string& name );
+
+    void load();
+
+    std::string _indexPath;
+    std::map< std::string, Entry > _entries;
+    bool _dirty = false;
+};
+
+} // namespace jac::storage
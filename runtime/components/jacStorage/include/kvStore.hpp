@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+#include <medium.hpp>
+
+namespace jac::storage {
+
+// Persistent key-value store organized as an append-only log.
+//
+// The medium is split into two halves and one of them is active at a time.
+// Every change is appended to the active half as a CRC-protected record and an
+// in-RAM index maps each key to its latest record. Therefore, a write is a
+// single append and a read is a single fetch. When the active half fills up,
+// the live records are copied to the other half which then becomes active
+// (compaction). The halves take turns, so the wear is spread over the whole
+// medium.
+//
+// A batch of changes is written as a sequence of records and only the last one
+// is marked as the end of the batch. A batch without the mark (e.g., due to a
+// reset) is ignored on load, so commits are atomic.
+//
+// Each half starts with a header (magic, generation, CRC). The header is
+// written last during compaction, so an interrupted compaction leaves the
+// previous half in charge. A record is aligned to 4 bytes and consists of:
+// - u8 flags (end of batch, deletion, value type)
+// - u8 key length
+// - u16 (little-endian) value length
+// - u32 (little-endian) CRC-32 of the record with this field zeroed
+// - key and value
+//
+// The store is thread-safe and compaction can run on another task while the
+// store is being used. All the methods throw std::runtime_error on failure.
+class KvStore {
+public:
+    enum class ValueType : uint8_t { String, Buffer, Json };
+
+    struct Value {
+        ValueType type;
+        std::string data;
+    };
+
+    // A change in a batch; a missing value means deletion of the key
+    struct Change {
+        std::string key;
+        std::optional< Value > value;
+    };
+
+    struct Usage {
+        size_t used;     // Bytes used in the active half
+        size_t live;     // Bytes taken by the live records
+        size_t capacity; // Size of a half
+        uint32_t generation;
+    };
+
+    KvStore( Medium& medium );
+    KvStore( const KvStore& ) = delete;
+    KvStore& operator=( const KvStore& ) = delete;
+
+    std::optional< Value > get( const std::string& key );
+    std::vector< std::string > keys();
+    // Atomically apply all the changes. Compact the store when the active
+    // half is full.
+    void commit( const std::vector< Change >& batch );
+    // Return true when compaction would free a significant amount of space
+    bool needsCompaction();
+    void compact();
+    Usage usage();
+
+private:
+    struct Entry {
+        uint32_t offset;
+        uint32_t size;
+    };
+    using Index = std::unordered_map< std::string, Entry >;
+
+    size_t halfStart( int half ) const { return half * _halfSize; }
+    bool readHeader( int half, uint32_t& generation );
+    void writeHeader( int half, uint32_t generation );
+    void format();
+    void load();
+    // Scan records in the given range of the half and apply complete batches
+    // to the index. Return the offset after the last complete batch; clean is
+    // set to false if there is a damaged record or an incomplete batch.
+    size_t replay( int half, size_t from, size_t to, Index& index, size_t& live, bool& clean );
+
+    Medium& _medium;
+    size_t _halfSize;
+    int _active = 0;
+    uint32_t _generation = 0;
+    size_t _writeOffset = 0;
+    size_t _liveBytes = 0;
+    Index _index;
+    std::mutex _mutex;
+    std::mutex _compactionMutex;
+};
+
+} // namespace jac::storage
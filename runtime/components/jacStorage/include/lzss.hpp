@@ -0,0 +1,220 @@
+#pragma once
+
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+// Small-window streaming LZSS codec used by the uploader to transfer files.
+//
+// The stream consists of groups. Each group starts with a flag byte followed
+// by up to 8 tokens. Bit i (LSB first) of the flag byte describes the i-th
+// token:
+// - 1: literal, a single byte follows
+// - 0: back-reference, two bytes follow forming a big-endian word
+//      (offset - 1) << LENGTH_BITS | (length - MIN_MATCH)
+// The stream simply ends after the last token; there is no terminator.
+//
+// Both encoder and decoder work with a bounded memory - the decoder needs only
+// the window, the encoder needs the window and a lookahead buffer. The memory
+// is allocated on the first use, so an unused codec is cheap.
+namespace jac::storage::lzss {
+
+inline constexpr int WINDOW_BITS = 10;
+inline constexpr int LENGTH_BITS = 6;
+inline constexpr int WINDOW_SIZE = 1 << WINDOW_BITS;
+inline constexpr int MIN_MATCH = 3;
+inline constexpr int MAX_MATCH = MIN_MATCH + ( 1 << LENGTH_BITS ) - 1;
+
+// Streaming decoder. Decoded data are passed to sink( unsigned char *data, int
+// size ) in small chunks.
+template < typename Sink >
+class Decoder {
+public:
+    Decoder( Sink sink ): _sink( sink ) {}
+
+    void feed( const unsigned char *data, int size ) {
+        if ( !_window )
+            _window.reset( new unsigned char[ WINDOW_SIZE ] );
+        for ( int i = 0; i != size; i++ )
+            feedByte( data[ i ] );
+    }
+
+    // Flush all pending output. Return false if the stream ended in the
+    // middle of a token.
+    bool finish() {
+        flush();
+        return _state != State::ReferenceLow;
+    }
+
+private:
+    enum class State { Flags, Token, ReferenceLow };
+
+    void feedByte( unsigned char c ) {
+        switch ( _state ) {
+        case State::Flags:
+            _flags = c;
+            _remainingTokens = 8;
+            _state = State::Token;
+            break;
+        case State::Token:
+            if ( _flags & 1 ) {
+                emit( c );
+                nextToken();
+            }
+            else {
+                _referenceHigh = c;
+                _state = State::ReferenceLow;
+            }
+            break;
+        case State::ReferenceLow: {
+            int word = _referenceHigh << 8 | c;
+            int offset = ( word >> LENGTH_BITS ) + 1;
+            int length = ( word & ( ( 1 << LENGTH_BITS ) - 1 ) ) + MIN_MATCH;
+            for ( int i = 0; i != length; i++ )
+                emit( _window[ ( _windowPos - offset ) & ( WINDOW_SIZE - 1 ) ] );
+            _state = State::Token;
+            nextToken();
+            break;
+        }
+        }
+    }
+
+    void nextToken() {
+        _flags >>= 1;
+        if ( --_remainingTokens == 0 )
+            _state = State::Flags;
+    }
+
+    void emit( unsigned char c ) {
+        _window[ _windowPos & ( WINDOW_SIZE - 1 ) ] = c;
+        _windowPos++;
+        _output[ _outputLen++ ] = c;
+        if ( _outputLen == OUTPUT_SIZE )
+            flush();
+    }
+
+    void flush() {
+        if ( _outputLen == 0 )
+            return;
+        _sink( _output, _outputLen );
+        _outputLen = 0;
+    }
+
+    static constexpr int OUTPUT_SIZE = 64;
+
+    Sink _sink;
+    std::unique_ptr< unsigned char[] > _window;
+    unsigned _windowPos = 0;
+    unsigned char _output[ OUTPUT_SIZE ];
+    int _outputLen = 0;
+    State _state = State::Flags;
+    uint8_t _flags = 0;
+    int _remainingTokens = 0;
+    unsigned char _referenceHigh = 0;
+};
+
+// Streaming encoder. Encoded data are passed to sink( const unsigned char
+// *data, int size ) group by group.
+template < typename Sink >
+class Encoder {
+public:
+    Encoder( Sink sink ): _sink( sink ) {}
+
+    void feed( const unsigned char *data, int size ) {
+        if ( !_buffer )
+            _buffer.reset( new unsigned char[ BUFFER_SIZE ] );
+        while ( size > 0 ) {
+            int toCopy = std::min( size, BUFFER_SIZE - _end );
+            std::memcpy( _buffer.get() + _end, data, toCopy );
+            _end += toCopy;
+            data += toCopy;
+            size -= toCopy;
+            if ( _end == BUFFER_SIZE )
+                process( false );
+        }
+    }
+
+    void finish() {
+        if ( _buffer )
+            process( true );
+        flushGroup();
+    }
+
+private:
+    // Encode the buffered data. Unless final, keep MAX_MATCH bytes of
+    // lookahead and then move the window to the beginning of the buffer.
+    void process( bool final ) {
+        while ( _pos < _end && ( final || _end - _pos >= MAX_MATCH ) ) {
+            int bestLength = 0;
+            int bestOffset = 0;
+            int maxLength = std::min( MAX_MATCH, _end - _pos );
+            int limit = std::max( 0, _pos - WINDOW_SIZE );
+            for ( int candidate = _pos - 1; candidate >= limit; candidate-- ) {
+                if ( _buffer[ candidate ] != _buffer[ _pos ] )
+                    continue;
+                int length = 1;
+                while ( length < maxLength && _buffer[ candidate + length ] == _buffer[ _pos + length ] )
+                    length++;
+                if ( length > bestLength ) {
+                    bestLength = length;
+                    bestOffset = _pos - candidate;
+                    if ( length == maxLength )
+                        break;
+                }
+            }
+
+            if ( bestLength >= MIN_MATCH ) {
+                int word = ( bestOffset - 1 ) << LENGTH_BITS | ( bestLength - MIN_MATCH );
+                pushToken( false, word >> 8, word & 0xFF );
+                _pos += bestLength;
+            }
+            else {
+                pushToken( true, _buffer[ _pos ], 0 );
+                _pos++;
+            }
+        }
+
+        int keepFrom = std::max( 0, _pos - WINDOW_SIZE );
+        std::memmove( _buffer.get(), _buffer.get() + keepFrom, _end - keepFrom );
+        _pos -= keepFrom;
+        _end -= keepFrom;
+    }
+
+    void pushToken( bool literal, unsigned char a, unsigned char b ) {
+        if ( _groupTokens == 0 ) {
+            _group[ 0 ] = 0;
+            _groupLen = 1;
+        }
+        if ( literal ) {
+            _group[ 0 ] |= 1 << _groupTokens;
+            _group[ _groupLen++ ] = a;
+        }
+        else {
+            _group[ _groupLen++ ] = a;
+            _group[ _groupLen++ ] = b;
+        }
+        if ( ++_groupTokens == 8 )
+            flushGroup();
+    }
+
+    void flushGroup() {
+        if ( _groupLen == 0 )
+            return;
+        _sink( _group, _groupLen );
+        _groupLen = 0;
+        _groupTokens = 0;
+    }
+
+    static constexpr int BUFFER_SIZE = 2 * WINDOW_SIZE;
+
+    Sink _sink;
+    std::unique_ptr< unsigned char[] > _buffer;
+    int _pos = 0;
+    int _end = 0;
+    unsigned char _group[ 1 + 2 * 8 ];
+    int _groupLen = 0;
+    int _groupTokens = 0;
+};
+
+} // namespace jac::storage::lzss
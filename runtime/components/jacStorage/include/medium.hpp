@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+namespace jac::storage {
+
+// Raw storage with the semantics of a NOR flash: erased bytes read as 0xFF,
+// erase works on whole sectors and a location can be written only once
+// between two erases. All the methods throw std::runtime_error on failure.
+class Medium {
+public:
+    virtual ~Medium() = default;
+
+    virtual size_t size() const = 0;
+    virtual size_t sectorSize() const = 0;
+    virtual void read( size_t offset, void *data, size_t size ) = 0;
+    virtual void write( size_t offset, const void *data, size_t size ) = 0;
+    // Erase whole sectors in the range; offset and size have to be aligned
+    // to the sector size
+    virtual void erase( size_t offset, size_t size ) = 0;
+};
+
+// Medium backed by a regular file. It emulates the flash semantics (a write
+// can only clear bits), so it can stand in for a flash partition on a host or
+// on a FAT volume. The file is created and erased if it does not exist.
+class FileMedium: public Medium {
+public:
+    FileMedium( const std::string& path, size_t size, size_t sectorSize = 4096 );
+    FileMedium( const FileMedium& ) = delete;
+    FileMedium& operator=( const FileMedium& ) = delete;
+    ~FileMedium() override;
+
+    size_t size() const override { return _size; }
+    size_t sectorSize() const override { return _sectorSize; }
+    void read( size_t offset, void *data, size_t size ) override;
+    void write( size_t offset, const void *data, size_t size ) override;
+    void erase( size_t offset, size_t size ) override;
+
+private:
+    void checkRange( size_t offset, size_t size ) const;
+
+    std::string _path;
+    size_t _size;
+    size_t _sectorSize;
+    int _fd = -1;
+};
+
+} // namespace jac::storage
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <medium.hpp>
+
+#include <esp_partition.h>
+
+namespace jac::storage {
+
+// Medium backed by a data partition of the flash
+class PartitionMedium: public Medium {
+public:
+    // Find the data partition with the given label. Throws std::runtime_error
+    // if there is no such partition.
+    PartitionMedium( const char *label );
+
+    size_t size() const override { return _partition->size; }
+    size_t sectorSize() const override { return SPI_FLASH_SEC_SIZE; }
+    void read( size_t offset, void *data, size_t size ) override;
+    void write( size_t offset, const void *data, size_t size ) override;
+    void erase( size_t offset, size_t size ) override;
+
+private:
+    const esp_partition_t *_partition;
+};
+
+} // namespace jac::storage
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <cstdint>
+
+namespace jac::storage {
+
+// Buffered writer for files on the FAT/wear-levelling volume.
+//
+// Writing small chunks directly to the volume is expensive as every write
+// crosses the VFS layer and triggers a partial-sector read-modify-write in the
+// wear-levelling layer. The writer accumulates data into a sector-sized buffer
+// (CONFIG_WL_SECTOR_SIZE) and passes only whole sectors to the filesystem. As
+// the files are written from the beginning, the writes are sector-aligned.
+//
+// The writer does not own the file descriptor. Throws std::runtime_error on
+// failure.
+class SectorWriter {
+public:
+    // Cumulative statistics of all writers, used to measure the flash
+    // performance
+    struct Statistics {
+        uint64_t bytesWritten = 0;
+        uint32_t writeCalls = 0;
+        uint32_t syncCalls = 0;
+        uint64_t timeUs = 0;
+    };
+
+    SectorWriter() = default;
+    SectorWriter( const SectorWriter& ) = delete;
+    SectorWriter& operator=( const SectorWriter& ) = delete;
+
+    // Start writing to a new file. Pending data of the previous file are
+    // discarded.
+    void attach( int fd );
+    void write( const unsigned char *data, int size );
+    // Write all buffered data and sync the file to the flash
+    void finish();
+
+    static const Statistics& statistics();
+
+private:
+    void flush();
+
+    int _fd = -1;
+    std::unique_ptr< unsigned char[] > _buffer;
+    int _size = 0;
+};
+
+} // namespace jac::storage
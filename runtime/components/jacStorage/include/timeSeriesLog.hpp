@@ -0,0 +1,97 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <medium.hpp>
+
+namespace jac::storage {
+
+// Circular log of timestamped records on a Medium.
+//
+// All records have the same format: a timestamp and a fixed number of float
+// fields. The timestamps have to be non-decreasing. The medium is a ring of
+// sectors; when the ring is full, the oldest sector is erased and reused.
+//
+// Each sector starts with a header that holds a sequence number (the order of
+// the sectors in the ring), the record format and the timestamp of the first
+// record in the sector. The headers form a sparse time index, which is kept in
+// RAM. Therefore, a range query finds its start by a binary search over the
+// sectors and then by a binary search over the fixed-size record slots.
+//
+// Appended records are kept in RAM and written in batches. Queries see the
+// records that have not been flushed yet, however, they are lost on reset.
+//
+// Sector layout:
+// - u32 magic, u32 sequence number, u16 record size, u16 field count,
+//   i64 timestamp of the first record, u32 CRC-32 of the header
+// - record slots: i64 timestamp, float fields, u32 CRC-32 of the record
+// All values are little-endian. A torn record is detected by its CRC and the
+// sector is closed, so the following records start in a new sector.
+//
+// The class is not thread-safe. All methods throw std::runtime_error on
+// failure.
+class TimeSeriesLog {
+public:
+    struct Statistics {
+        size_t records;
+        size_t capacity;
+        int64_t oldest;
+        int64_t newest;
+        size_t pending; // Records not flushed yet
+    };
+
+    // Open the log with the given number of fields per record. Sectors with
+    // a different format are considered empty.
+    TimeSeriesLog( Medium& medium, int fieldCount, int batchSize = 64 );
+    TimeSeriesLog( const TimeSeriesLog& ) = delete;
+    TimeSeriesLog& operator=( const TimeSeriesLog& ) = delete;
+
+    int fieldCount() const { return _fieldCount; }
+
+    void append( int64_t timestamp, const float *fields );
+    // Write all pending records to the medium
+    void flush();
+    // Find records with timestamp in [from, to] and append at most limit of
+    // them to timestamps and fields (fieldCount values per record). Return the
+    // number of records found.
+    size_t query( int64_t from, int64_t to, size_t limit,
+        std::vector< int64_t >& timestamps, std::vector< float >& fields );
+    // Erase the whole log
+    void clear();
+    Statistics statistics() const;
+
+private:
+    struct Sector {
+        bool valid = false;
+        bool closed = false;
+        uint32_t seq = 0;
+        int64_t firstTimestamp = 0;
+        uint32_t count = 0;
+    };
+
+    size_t sectorOffset( int sector ) const { return sector * _medium.sectorSize(); }
+    size_t slotOffset( int sector, uint32_t slot ) const;
+    void load();
+    void startSector( int64_t firstTimestamp );
+    int64_t readTimestamp( int sector, uint32_t slot );
+    // Binary search for the first slot with timestamp >= from
+    uint32_t findSlot( int sector, int64_t from );
+    void encodeRecord( unsigned char *record, int64_t timestamp, const float *fields ) const;
+    // Decode the record and return false if it is damaged
+    bool decodeRecord( const unsigned char *record, int64_t& timestamp, float *fields ) const;
+
+    Medium& _medium;
+    int _fieldCount;
+    size_t _recordSize;
+    uint32_t _slotsPerSector;
+    int _batchSize;
+    std::vector< Sector > _sectors;
+    std::vector< int > _order; // Valid sectors from the oldest one
+    uint32_t _nextSeq = 0;
+    int64_t _lastTimestamp = INT64_MIN;
+    std::vector< unsigned char > _batch;
+    int _batchCount = 0;
+};
+
+} // namespace jac::storage
@@ -1,9 +1,26 @@
 #pragma once
 
+#include <functional>
+#include <string>
+
 namespace jac::storage {
 
 void initializeUploader( const char *storagePrefix );
 void enterUploader();
+// Serve the uploader to TCP clients on the given port, one client at a time.
+// A session ends by EXIT or by closing the connection. The network has to be
+// initialized.
+void initializeNetworkUploader( int port );
 const char *getStoragePrefix();
 
+// A named source of diagnostic data pulled by the DUMP command. The source is
+// invoked from the uploader task and writes its data via the sink; it reports
+// a failure by throwing std::runtime_error.
+using DumpSink = std::function< void( const unsigned char *data, int size ) >;
+using DumpSource = std::function< void( const DumpSink& sink ) >;
+void registerDumpSource( const std::string& name, DumpSource source );
+void unregisterDumpSource( const std::string& name );
+// Return an empty function if there is no such source
+DumpSource findDumpSource( const std::string& name );
+
 } // namespace jac::storage
\ No newline at end of file
@@ -17,6 +17,10 @@ extern "C" {
 
 #include <filesystem.hpp>
 #include <jacUtility.hpp>
+#include <hashIndex.hpp>
+#include <bundle.hpp>
+#include <sectorWriter.hpp>
+#include <lzss.hpp>
 
 
 namespace jac::storage {
@@ -46,53 +50,110 @@ public:
                 if ( jac::utility::startswith( entityName, "__" ) )
                     return;
                 if ( type == FileType::Directory )
-                    std::cout << "D";
+                    self().output() << "D";
                 else if ( type == FileType::File )
-                    std::cout << "F";
+                    self().output() << "F";
                 else
-                    std::cout << "?";
+                    self().output() << "?";
 
-                std::cout << " " << std::string_view( path ).substr( prefixLen )
-                          << "/" << entityName << "\n";
+                self().output() << " " << std::string_view( path ).substr( prefixLen )
+                                << "/" << entityName << "\n";
             },
             [&]( const std::string& error ) {
                 self().yieldError( error );
             });
-        std::cout << "\n";
+        self().output() << "\n";
     }
 
-    void doPull( const std::string& filename ) {
+    // List all files under the prefix together with their size and SHA-256
+    // digest. The digests are cached in a sidecar index, so only files changed
+    // since the last manifest are read.
+    void doManifest( const std::string& prefix ) {
+        using namespace jac::fs;
+        const int prefixLen = strlen( getStoragePrefix() ) + 1;
+        listDirectory( getStoragePrefix() + prefix,
+            [&]( FileType type, const std::string& path, const std::string& entityName ) {
+                if ( jac::utility::startswith( entityName, "__" ) )
+                    return;
+                if ( type != FileType::File )
+                    return;
+                std::string name = std::string( std::string_view( path ).substr( prefixLen ) )
+                                 + "/" + entityName;
+                std::string filePath = concatPath( path, entityName );
+                struct stat fileStat;
+                if ( stat( filePath.c_str(), &fileStat ) < 0 ) {
+                    self().yieldError( "Cannot stat " + name + ": " + std::strerror( errno ) );
+                    return;
+                }
+                try {
+                    auto digest = _hashIndex.digest( name, filePath,
+                        fileStat.st_size, fileStat.st_mtime );
+                    self().output() << "F " << fileStat.st_size << " " << digest
+                                    << " " << name << "\n";
+                }
+                catch ( const std::runtime_error& e ) {
+                    self().yieldError( e.what() );
+                }
+            },
+            [&]( const std::string& error ) {
+                self().yieldError( error );
+            });
+        _hashIndex.save();
+        self().output() << "\n";
+    }
+
+    void doHash( const std::string& filename ) {
+        const auto path = fsPath( filename );
+        struct stat fileStat;
+        if ( stat( path.c_str(), &fileStat ) < 0 ) {
+            self().yieldError( std::strerror( errno ) );
+            return;
+        }
+        try {
+            auto digest = _hashIndex.digest( filename, path, fileStat.st_size, fileStat.st_mtime );
+            _hashIndex.save();
+            self().output() << fileStat.st_size << " " << digest << "\n";
+        }
+        catch ( const std::runtime_error& e ) {
+            self().yieldError( e.what() );
+        }
+    }
+
+    void doPull( const std::string& filename, bool compressed ) {
         const std::string path = fsPath( filename );
 
         const int CHUNK_SIZE = 1023;
-        static_assert( CHUNK_SIZE % 3 == 0 );
-        const int ENCODED_SIZE = 4 * ( CHUNK_SIZE + 2 ) / 3 + 1;
         std::unique_ptr< unsigned char[] > fileBuffer( new unsigned char[ CHUNK_SIZE ] );
-        std::unique_ptr< unsigned char[] > encBuffer( new unsigned char[ ENCODED_SIZE ] );
         int fd = open( path.c_str(), O_RDONLY );
         if ( fd < 0 ) {
             self().yieldError( std::strerror( errno ) );
             return;
         }
+        Base64Writer output( self().output() );
+        lzss::Encoder encoder( [&]( const unsigned char *data, int size ) {
+            output.write( data, size );
+        } );
         int bytesRead;
-        while ( ( bytesRead = read( fd, fileBuffer.get(), CHUNK_SIZE ) ) ) {
-            size_t proccessed;
-            int result = mbedtls_base64_encode(
-                encBuffer.get(), ENCODED_SIZE, &proccessed,
-                fileBuffer.get(), bytesRead );
-            assert( result != MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL );
-            std::cout.write( reinterpret_cast< char * >( encBuffer.get() ), proccessed );
+        while ( ( bytesRead = read( fd, fileBuffer.get(), CHUNK_SIZE ) ) > 0 ) {
+            if ( compressed )
+                encoder.feed( fileBuffer.get(), bytesRead );
+            else
+                output.write( fileBuffer.get(), bytesRead );
         }
-        std::cout << "\n";
+        if ( compressed )
+            encoder.finish();
+        output.finish();
+        self().output() << "\n";
 
         close( fd );
     }
 
     void doRemove( const std::string& filename ) {
         const auto filePath = fsPath( filename );
+        _hashIndex.invalidate( filename );
         if ( remove( filePath.c_str() ) < 0 )
             self().yieldError( std::strerror( errno ) );
-        std::cout << "OK\n";
+        self().output() << "OK\n";
     }
 
     void startFilePush() {
@@ -103,20 +164,31 @@ public:
             self().yieldError( std::strerror( errno ) );
             return;
         }
+        _writer.attach( _workingFd );
     }
 
     void addFileChunk( unsigned char* buffer, int size ) {
         assert( _workingFd >= 0 );
-        int written = write( _workingFd, buffer, size );
-        if ( written < 0 )
-            self().yieldError( std::strerror( errno ) );
+        try {
+            _writer.write( buffer, size );
+        }
+        catch ( const std::runtime_error& e ) {
+            self().yieldError( e.what() );
+        }
     }
 
     void commitFilePush( const std::string& filename ) {
+        try {
+            _writer.finish();
+        }
+        catch ( const std::runtime_error& e ) {
+            self().yieldError( e.what() );
+        }
         close( _workingFd );
         _workingFd = -1;
 
         auto path = fsPath( filename );
+        _hashIndex.invalidate( filename );
         if ( !jac::fs::ensurePath( path ) )
             self().yieldError( "Cannot create path " + path + ": " + std::strerror( errno ) );
         remove( path.c_str() );
@@ -128,11 +200,102 @@ public:
         int res = rename( workingFilename().c_str(), path.c_str() );
         if ( res < 0 )
             self().yieldError( "Cannot finalize push: "s + std::strerror( errno ));
-        std::cout << "OK\n";
+        self().output() << "OK\n";
+    }
+
+    void startBundle() {
+        try {
+            _bundle = std::make_unique< BundleWriter >( getStoragePrefix() );
+        }
+        catch ( const std::runtime_error& e ) {
+            self().yieldError( e.what() );
+        }
+    }
+
+    void addBundleChunk( unsigned char* buffer, int size ) {
+        if ( !_bundle )
+            return; // The error was already reported
+        try {
+            _bundle->feed( buffer, size );
+        }
+        catch ( const std::runtime_error& e ) {
+            self().yieldError( e.what() );
+            _bundle.reset();
+        }
+    }
+
+    void commitBundle() {
+        if ( !_bundle )
+            return;
+        try {
+            _hashIndex.clear();
+            _bundle->commit();
+            self().output() << "OK\n";
+        }
+        catch ( const std::runtime_error& e ) {
+            self().yieldError( e.what() );
+        }
+        _bundle.reset();
+    }
+
+    void doExport( const std::string& prefix, bool compressed ) {
+        Base64Writer output( self().output() );
+        lzss::Encoder encoder( [&]( const unsigned char *data, int size ) {
+            output.write( data, size );
+        } );
+        try {
+            exportBundle( getStoragePrefix(), prefix,
+                [&]( const unsigned char *data, int size ) {
+                    if ( compressed )
+                        encoder.feed( data, size );
+                    else
+                        output.write( data, size );
+                } );
+        }
+        catch ( const std::runtime_error& e ) {
+            // The stream is broken now; terminate it so the error is reported
+            // on a separate line
+            self().output() << "\n";
+            self().yieldError( e.what() );
+            return;
+        }
+        if ( compressed )
+            encoder.finish();
+        output.finish();
+        self().output() << "\n";
+    }
+
+    void doDump( const std::string& name, bool compressed ) {
+        DumpSource source = findDumpSource( name );
+        if ( !source ) {
+            self().yieldError( "Unknown dump source '" + name + "'" );
+            return;
+        }
+        Base64Writer output( self().output() );
+        lzss::Encoder encoder( [&]( const unsigned char *data, int size ) {
+            output.write( data, size );
+        } );
+        try {
+            source( [&]( const unsigned char *data, int size ) {
+                if ( compressed )
+                    encoder.feed( data, size );
+                else
+                    output.write( data, size );
+            } );
+        }
+        catch ( const std::runtime_error& e ) {
+            self().output() << "\n";
+            self().yieldError( e.what() );
+            return;
+        }
+        if ( compressed )
+            encoder.finish();
+        output.finish();
+        self().output() << "\n";
     }
 
     void performExit() {
-        std::cout << "OK\n";
+        self().output() << "OK\n";
         _finished = true;
     }
 
@@ -148,15 +311,69 @@ public:
         }
         int totalSectors = (fs->n_fatent - 2) * fs->csize;
         int freeSectors = freeClusters * fs->csize;
-        std::cout << freeSectors * CONFIG_WL_SECTOR_SIZE << " "
-                  << totalSectors * CONFIG_WL_SECTOR_SIZE << "\n";
+        self().output() << freeSectors * CONFIG_WL_SECTOR_SIZE << " "
+                        << totalSectors * CONFIG_WL_SECTOR_SIZE << "\n";
+    }
+
+    // Report cumulative statistics of file writes: bytes written, number of
+    // write calls, number of sync calls and time spent in them
+    void doIoStats() {
+        const auto& stats = SectorWriter::statistics();
+        self().output() << stats.bytesWritten << " " << stats.writeCalls << " "
+                        << stats.syncCalls << " " << stats.timeUs << "\n";
     }
 
 private:
+    // Encode written data into base64 and pass it to the stream in blocks
+    class Base64Writer {
+    public:
+        Base64Writer( std::ostream& stream )
+            : _stream( stream ),
+              _buffer( new unsigned char[ CHUNK_SIZE ] ),
+              _encoded( new unsigned char[ ENCODED_SIZE ] )
+        {}
+
+        void write( const unsigned char *data, int size ) {
+            while ( size > 0 ) {
+                int toCopy = std::min( size, CHUNK_SIZE - _size );
+                std::memcpy( _buffer.get() + _size, data, toCopy );
+                _size += toCopy;
+                data += toCopy;
+                size -= toCopy;
+                if ( _size == CHUNK_SIZE )
+                    finish();
+            }
+        }
+
+        void finish() {
+            size_t proccessed;
+            int result = mbedtls_base64_encode(
+                _encoded.get(), ENCODED_SIZE, &proccessed,
+                _buffer.get(), _size );
+            assert( result != MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL );
+            _stream.write( reinterpret_cast< char * >( _encoded.get() ), proccessed );
+            _size = 0;
+        }
+
+    private:
+        static const int CHUNK_SIZE = 1023;
+        static_assert( CHUNK_SIZE % 3 == 0 );
+        static const int ENCODED_SIZE = 4 * ( CHUNK_SIZE + 2 ) / 3 + 1;
+
+        std::ostream& _stream;
+        std::unique_ptr< unsigned char[] > _buffer;
+        std::unique_ptr< unsigned char[] > _encoded;
+        int _size = 0;
+    };
+
     static std::string workingFilename() {
         return getStoragePrefix() + "/__tmp.txt"s;
     }
 
+    static std::string indexFilename() {
+        return getStoragePrefix() + "/__hashes.txt"s;
+    }
+
     static std::string fsPath( const std::string& filename ) {
         std::string path = getStoragePrefix();
         if ( filename.front() != '/' )
@@ -167,6 +384,9 @@ private:
 
     bool _finished = false;
     int _workingFd = -1;
+    SectorWriter _writer;
+    HashIndex _hashIndex{ indexFilename() };
+    std::unique_ptr< BundleWriter > _bundle;
 };
 
 } // namespace jac::storage
\ No newline at end of file
@@ -4,6 +4,9 @@
 #include <string>
 #include <mbedtls/base64.h>
 
+#include <lzss.hpp>
+#include <trace.hpp>
+
 namespace jac::storage {
 
 template < typename Self >
@@ -33,16 +36,39 @@ public:
             return;
         }
         discardWhitespace();
+        JAC_TRACE_SCOPE( "uploaderCommand" );
         if ( command == "LIST" )
             return interpretList();
         if ( command == "PULL" )
-            return interpretPull();
+            return interpretPull( false );
         if ( command == "PUSH" )
-            return interpretPush();
+            return interpretPush( false );
+        if ( command == "PULLZ" )
+            return interpretPull( true );
+        if ( command == "PUSHZ" )
+            return interpretPush( true );
         if ( command == "REMOVE" )
             return interpretRemove();
+        if ( command == "DEPLOY" )
+            return interpretDeploy( false );
+        if ( command == "DEPLOYZ" )
+            return interpretDeploy( true );
+        if ( command == "EXPORT" )
+            return interpretExport( false );
+        if ( command == "EXPORTZ" )
+            return interpretExport( true );
+        if ( command == "MANIFEST" )
+            return interpretManifest();
+        if ( command == "HASH" )
+            return interpretHash();
         if ( command == "STATS" )
             return interpretStats();
+        if ( command == "IOSTATS" )
+            return interpretIoStats();
+        if ( command == "DUMP" )
+            return interpretDump( false );
+        if ( command == "DUMPZ" )
+            return interpretDump( true );
         if ( command == "EXIT" )
             return interpretExit();
         if ( !command.empty() )
@@ -58,18 +84,40 @@ public:
         discardRest();
     }
 
-    void interpretPull() {
+    void interpretManifest() {
+        std::string prefix = readWord(); // It is OK if it is empty!
+        if ( prefix.front() != '/' )
+            prefix.insert( 0, "/" );
+        self().doManifest( prefix );
+        discardRest();
+    }
+
+    void interpretHash() {
+        std::string filename = readWord();
+        if ( filename.empty() ) {
+            self().yieldError( "Missing name of the file to hash" );
+            discardRest();
+            return;
+        }
+        self().doHash( filename );
+        discardRest();
+    }
+
+    // The compressed variant sends the file as base64-encoded LZSS stream
+    void interpretPull( bool compressed ) {
         std::string filename = readWord();
         if ( filename.empty() ) {
             self().yieldError( "Missing name of the file to pull" );
             discardRest();
             return;
         }
-        self().doPull( filename );
+        self().doPull( filename, compressed );
         discardRest();
     }
 
-    void interpretPush() {
+    // The compressed variant expects base64-encoded LZSS stream, which is
+    // decompressed on the fly
+    void interpretPush( bool compressed ) {
         std::string filename = readWord();
         if ( filename.empty() ) {
             self().yieldError( "Missing name of the file to push" );
@@ -78,6 +126,40 @@ public:
         }
         self().startFilePush();
 
+        bool success = readBase64Stream( compressed, [&]( unsigned char *data, int size ) {
+            self().addFileChunk( data, size );
+        } );
+        if ( success )
+            self().commitFilePush( filename );
+    }
+
+    // Deploy a bundle - a whole file tree in a single stream. See bundle.hpp
+    // for the format. The compressed variant expects base64-encoded LZSS stream.
+    void interpretDeploy( bool compressed ) {
+        self().startBundle();
+        bool success = readBase64Stream( compressed, [&]( unsigned char *data, int size ) {
+            self().addBundleChunk( data, size );
+        } );
+        if ( success )
+            self().commitBundle();
+    }
+
+    void interpretExport( bool compressed ) {
+        std::string prefix = readWord(); // It is OK if it is empty!
+        if ( prefix.front() != '/' )
+            prefix.insert( 0, "/" );
+        self().doExport( prefix, compressed );
+        discardRest();
+    }
+
+    // Read a base64-encoded stream terminated by a newline and pass the decoded
+    // data to sink( unsigned char *data, int size ). If compressed, the data
+    // are also decompressed. Return true if the whole stream was successfully
+    // read; otherwise an error is reported.
+    template < typename Sink >
+    bool readBase64Stream( bool compressed, Sink sink ) {
+        lzss::Decoder decoder( sink );
+
         discardWhitespace();
         const int BLOCK_SIZE = 63;
         std::string chunk;
@@ -94,18 +176,39 @@ public:
             if ( retcode == MBEDTLS_ERR_BASE64_INVALID_CHARACTER ) {
                 self().yieldError( "Invalid characted in base64 encoding specified" );
                 discardRest();
-                return;
+                return false;
             }
-            self().addFileChunk( chunkBuffer.get(), chunklength );
+            if ( compressed )
+                decoder.feed( chunkBuffer.get(), chunklength );
+            else
+                sink( chunkBuffer.get(), chunklength );
         } while ( !chunk.empty() );
+        if ( compressed && !decoder.finish() ) {
+            self().yieldError( "Truncated compressed stream" );
+            discardRest();
+            return false;
+        }
 
         discardWhitespace();
         if ( !shift('\n') ) {
             self().yieldError(" Nothing was expected" );
             discardRest();
+            return false;
+        }
+        return true;
+    }
+
+    // Send the data of a dump source (see registerDumpSource) as a base64
+    // stream; the compressed variant sends LZSS stream
+    void interpretDump( bool compressed ) {
+        std::string name = readWord();
+        if ( name.empty() ) {
+            self().yieldError( "Missing name of the dump source" );
+            discardRest();
             return;
         }
-        self().commitFilePush( filename );
+        self().doDump( name, compressed );
+        discardRest();
     }
 
     void interpretRemove() {
@@ -129,6 +232,11 @@ public:
         discardRest();
     }
 
+    void interpretIoStats() {
+        self().doIoStats();
+        discardRest();
+    }
+
     // Consume rest of the command
     void discardRest() {
         while ( self().read() != '\n' );
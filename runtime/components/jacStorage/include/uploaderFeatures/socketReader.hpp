@@ -0,0 +1,66 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+
+namespace jac::storage {
+
+// Read the commands from a connected socket. When the peer disconnects, the
+// reader yields newlines, so the command being interpreted is finished.
+template < typename Self >
+class SocketReader {
+public:
+    void attachSocket( int socket ) {
+        _socket = socket;
+        _position = _size = 0;
+        _disconnected = false;
+    }
+
+    int socket() const {
+        return _socket;
+    }
+
+    bool disconnected() const {
+        return _disconnected;
+    }
+
+    char read() {
+        char c = peek();
+        if ( _position < _size )
+            _position++;
+        return c;
+    }
+
+    char peek() {
+        if ( _position == _size && !fill() )
+            return '\n';
+        return _buffer[ _position ];
+    }
+
+private:
+    bool fill() {
+        if ( _disconnected )
+            return false;
+        ssize_t res;
+        do {
+            res = recv( _socket, _buffer, sizeof( _buffer ), 0 );
+        } while ( res < 0 && errno == EINTR );
+        if ( res <= 0 ) {
+            _disconnected = true;
+            return false;
+        }
+        _position = 0;
+        _size = res;
+        return true;
+    }
+
+    int _socket = -1;
+    char _buffer[ 512 ];
+    int _position = 0;
+    int _size = 0;
+    bool _disconnected = false;
+};
+
+} // namespace jac::storage
\ No newline at end of file
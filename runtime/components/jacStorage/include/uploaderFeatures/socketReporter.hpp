@@ -0,0 +1,83 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+namespace jac::storage {
+
+// Stream buffer sending the data to a socket in blocks
+class SocketStreamBuf: public std::streambuf {
+public:
+    void attach( int socket ) {
+        _socket = socket;
+        setp( _buffer, _buffer + sizeof( _buffer ) );
+    }
+
+protected:
+    int overflow( int c ) override {
+        if ( sync() < 0 )
+            return traits_type::eof();
+        if ( !traits_type::eq_int_type( c, traits_type::eof() ) ) {
+            *pptr() = traits_type::to_char_type( c );
+            pbump( 1 );
+        }
+        return traits_type::not_eof( c );
+    }
+
+    int sync() override {
+        const char *data = pbase();
+        while ( data < pptr() ) {
+            ssize_t res = send( _socket, data, pptr() - data, 0 );
+            if ( res < 0 && errno == EINTR )
+                continue;
+            if ( res <= 0 ) {
+                setp( _buffer, _buffer + sizeof( _buffer ) );
+                return -1;
+            }
+            data += res;
+        }
+        setp( _buffer, _buffer + sizeof( _buffer ) );
+        return 0;
+    }
+
+private:
+    int _socket = -1;
+    char _buffer[ 1024 ];
+};
+
+// Report the responses to the socket provided by Self::socket()
+template < typename Self >
+class SocketReporter {
+public:
+    Self& self() {
+        return *static_cast< Self* >( this );
+    }
+
+    std::ostream& output() {
+        if ( !_attached ) {
+            _streamBuf.attach( self().socket() );
+            _attached = true;
+        }
+        return _stream;
+    }
+
+    void yieldError( const std::string& s ) {
+        output() << "ERROR " << s << "\n";
+    }
+
+    void yieldWarning( const std::string& s ) {
+        output() << "WARNING " << s << "\n";
+    }
+
+private:
+    SocketStreamBuf _streamBuf;
+    std::ostream _stream{ &_streamBuf };
+    bool _attached = false;
+};
+
+} // namespace jac::storage
\ No newline at end of file
@@ -7,6 +7,10 @@ namespace jac::storage {
 template < typename Self >
 class StdoutReporter {
 public:
+    std::ostream& output() {
+        return std::cout;
+    }
+
     void yieldError( const std::string& s ) {
         std::cout << "ERROR " << s << "\n";
     }
@@ -0,0 +1,286 @@
+#include <bundle.hpp>
+
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+
+#include <filesystem.hpp>
+#include <jacUtility.hpp>
+
+using namespace jac::storage;
+using namespace std::string_literals;
+
+namespace {
+
+const char *STAGING_DIR = "__bundle.new";
+const char *OLD_DIR = "__bundle.old";
+const char *JOURNAL = "__bundle.journal";
+
+std::string inStorage( const std::string& prefix, const std::string& name ) {
+    return jac::fs::concatPath( prefix, name );
+}
+
+std::string errnoMessage( const std::string& what ) {
+    return what + ": " + std::strerror( errno );
+}
+
+// List names of entities directly in the given directory. Names starting
+// with "__" are skipped.
+std::vector< std::string > listEntries( const std::string& path ) {
+    std::vector< std::string > entries;
+    DIR *dir = ::opendir( path.c_str() );
+    if ( !dir )
+        throw std::runtime_error( errnoMessage( "Cannot open " + path ) );
+    while ( struct dirent *entry = ::readdir( dir ) ) {
+        std::string name( entry->d_name );
+        if ( name == "." || name == ".." || jac::utility::startswith( name, "__" ) )
+            continue;
+        entries.push_back( std::move( name ) );
+    }
+    ::closedir( dir );
+    return entries;
+}
+
+void moveEntries( const std::string& from, const std::string& to ) {
+    for ( const auto& name : listEntries( from ) ) {
+        auto source = jac::fs::concatPath( from, name );
+        auto target = jac::fs::concatPath( to, name );
+        if ( rename( source.c_str(), target.c_str() ) < 0 )
+            throw std::runtime_error( errnoMessage( "Cannot move " + source ) );
+    }
+}
+
+void writeJournal( const std::string& prefix, char phase ) {
+    auto path = inStorage( prefix, JOURNAL );
+    int fd = open( path.c_str(), O_TRUNC | O_WRONLY | O_CREAT );
+    if ( fd < 0 )
+        throw std::runtime_error( errnoMessage( "Cannot write bundle journal" ) );
+    bool written = write( fd, &phase, 1 ) == 1;
+    written = fsync( fd ) == 0 && written;
+    close( fd );
+    if ( !written )
+        throw std::runtime_error( errnoMessage( "Cannot write bundle journal" ) );
+}
+
+char readJournal( const std::string& prefix ) {
+    auto path = inStorage( prefix, JOURNAL );
+    int fd = open( path.c_str(), O_RDONLY );
+    if ( fd < 0 )
+        return 0;
+    char phase = 0;
+    if ( read( fd, &phase, 1 ) != 1 )
+        phase = 0;
+    close( fd );
+    return phase;
+}
+
+// Phase 1 moves the current content aside, phase 2 moves the staged content
+// in place. Both phases are idempotent, so they can be repeated after a reset.
+void finishSwap( const std::string& prefix, char phase ) {
+    auto oldDir = inStorage( prefix, OLD_DIR );
+    auto stagingDir = inStorage( prefix, STAGING_DIR );
+    if ( phase == '1' ) {
+        if ( mkdir( oldDir.c_str(), 0777 ) < 0 && errno != EEXIST )
+            throw std::runtime_error( errnoMessage( "Cannot create " + oldDir ) );
+        moveEntries( prefix, oldDir );
+        writeJournal( prefix, '2' );
+    }
+    moveEntries( stagingDir, prefix );
+    // Removing the journal is the commit point of the swap
+    remove( inStorage( prefix, JOURNAL ).c_str() );
+    jac::fs::removeRecursive( oldDir );
+    jac::fs::removeRecursive( stagingDir );
+}
+
+bool isSafePath( const std::string& path ) {
+    if ( path.empty() || path.front() == '/' )
+        return false;
+    jac::fs::Path p( path );
+    for ( size_t i = 0; i != p.size(); i++ ) {
+        const auto& chunk = p[ i ];
+        if ( chunk.empty() || chunk == "." || chunk == ".." || jac::utility::startswith( chunk, "__" ) )
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+BundleWriter::BundleWriter( const std::string& storagePrefix )
+    : _prefix( storagePrefix )
+{
+    auto stagingDir = inStorage( _prefix, STAGING_DIR );
+    if ( !jac::fs::removeRecursive( stagingDir ) )
+        throw std::runtime_error( errnoMessage( "Cannot clean " + stagingDir ) );
+    if ( mkdir( stagingDir.c_str(), 0777 ) < 0 )
+        throw std::runtime_error( errnoMessage( "Cannot create " + stagingDir ) );
+}
+
+BundleWriter::~BundleWriter() {
+    closeFile( false );
+    if ( _state != State::Finished )
+        jac::fs::removeRecursive( inStorage( _prefix, STAGING_DIR ) );
+}
+
+void BundleWriter::feed( const unsigned char *data, int size ) {
+    while ( size > 0 ) {
+        switch ( _state ) {
+        case State::PathLength:
+        case State::Size: {
+            _value = _value << 8 | *data;
+            data++;
+            size--;
+            _valueBytes++;
+            if ( _state == State::PathLength && _valueBytes == 2 ) {
+                _state = _value == 0 ? State::Finished : State::Path;
+                _remaining = _value;
+                _path.clear();
+                _value = _valueBytes = 0;
+            }
+            else if ( _state == State::Size && _valueBytes == 4 ) {
+                _remaining = _value;
+                _value = _valueBytes = 0;
+                openFile();
+                _state = State::Content;
+                if ( _remaining == 0 ) {
+                    closeFile( true );
+                    _state = State::PathLength;
+                }
+            }
+            break;
+        }
+        case State::Path:
+            _path.push_back( *data );
+            data++;
+            size--;
+            if ( --_remaining == 0 ) {
+                if ( !isSafePath( _path ) )
+                    throw std::runtime_error( "Invalid path in bundle: " + _path );
+                _state = State::Size;
+            }
+            break;
+        case State::Content: {
+            int chunk = std::min< uint32_t >( size, _remaining );
+            _writer.write( data, chunk );
+            data += chunk;
+            size -= chunk;
+            _remaining -= chunk;
+            if ( _remaining == 0 ) {
+                closeFile( true );
+                _state = State::PathLength;
+            }
+            break;
+        }
+        case State::Finished:
+            throw std::runtime_error( "Unexpected data after the end of bundle" );
+        }
+    }
+}
+
+void BundleWriter::commit() {
+    if ( _state != State::Finished )
+        throw std::runtime_error( "Incomplete bundle" );
+    writeJournal( _prefix, '1' );
+    finishSwap( _prefix, '1' );
+}
+
+void BundleWriter::openFile() {
+    auto path = jac::fs::concatPath( inStorage( _prefix, STAGING_DIR ), _path );
+    if ( !jac::fs::ensurePath( path ) )
+        throw std::runtime_error( errnoMessage( "Cannot create path " + path ) );
+    _fd = open( path.c_str(), O_TRUNC | O_WRONLY | O_CREAT );
+    if ( _fd < 0 )
+        throw std::runtime_error( errnoMessage( "Cannot open " + path ) );
+    _writer.attach( _fd );
+}
+
+void BundleWriter::closeFile( bool flush ) {
+    if ( _fd < 0 )
+        return;
+    int fd = _fd;
+    _fd = -1;
+    try {
+        if ( flush )
+            _writer.finish();
+    }
+    catch ( ... ) {
+        close( fd );
+        throw;
+    }
+    close( fd );
+}
+
+void jac::storage::recoverBundle( const std::string& storagePrefix ) {
+    char phase = readJournal( storagePrefix );
+    if ( phase == '1' || phase == '2' ) {
+        finishSwap( storagePrefix, phase );
+        return;
+    }
+    // There is no swap in progress; just clean leftovers of an interrupted
+    // upload
+    remove( inStorage( storagePrefix, JOURNAL ).c_str() );
+    jac::fs::removeRecursive( inStorage( storagePrefix, STAGING_DIR ) );
+    jac::fs::removeRecursive( inStorage( storagePrefix, OLD_DIR ) );
+}
+
+void jac::storage::exportBundle( const std::string& storagePrefix, const std::string& prefix,
+    const std::function< void( const unsigned char *, int ) >& sink )
+{
+    using namespace jac::fs;
+
+    const int CHUNK_SIZE = 512;
+    std::unique_ptr< unsigned char[] > buffer( new unsigned char[ CHUNK_SIZE ] );
+    const int prefixLen = storagePrefix.length() + 1;
+    std::string error;
+    listDirectory( concatPath( storagePrefix, prefix ),
+        [&]( FileType type, const std::string& path, const std::string& entityName ) {
+            if ( type != FileType::File || !error.empty() )
+                return;
+            auto filePath = concatPath( path, entityName );
+            std::string name = filePath.substr( std::min< size_t >( prefixLen, filePath.length() ) );
+            while ( !name.empty() && name.front() == '/' )
+                name.erase( 0, 1 );
+            if ( !isSafePath( name ) )
+                return;
+
+            int fd = open( filePath.c_str(), O_RDONLY );
+            struct stat fileStat;
+            if ( fd < 0 || fstat( fd, &fileStat ) < 0 ) {
+                error = errnoMessage( "Cannot open " + filePath );
+                if ( fd >= 0 )
+                    close( fd );
+                return;
+            }
+            uint32_t size = fileStat.st_size;
+            unsigned char header[ 2 ] = {
+                static_cast< unsigned char >( name.length() >> 8 ),
+                static_cast< unsigned char >( name.length() ) };
+            sink( header, 2 );
+            sink( reinterpret_cast< const unsigned char * >( name.data() ), name.length() );
+            unsigned char sizeBytes[ 4 ] = {
+                static_cast< unsigned char >( size >> 24 ),
+                static_cast< unsigned char >( size >> 16 ),
+                static_cast< unsigned char >( size >> 8 ),
+                static_cast< unsigned char >( size ) };
+            sink( sizeBytes, 4 );
+            // We have already promised the size, so the content has to be
+            // complete
+            int bytesRead;
+            while ( size > 0 && ( bytesRead = read( fd, buffer.get(), std::min< uint32_t >( size, CHUNK_SIZE ) ) ) > 0 ) {
+                sink( buffer.get(), bytesRead );
+                size -= bytesRead;
+            }
+            close( fd );
+            if ( size != 0 )
+                error = "Cannot read " + filePath;
+        },
+        [&]( const std::string& e ) {
+            error = e;
+        } );
+    if ( !error.empty() )
+        throw std::runtime_error( error );
+    unsigned char terminator[ 2 ] = { 0, 0 };
+    sink( terminator, 2 );
+}
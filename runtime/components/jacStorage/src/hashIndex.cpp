@@ -0,0 +1,129 @@
+#include <hashIndex.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <mbedtls/sha256.h>
+
+using namespace jac::storage;
+
+std::string jac::storage::sha256File( const std::string& path ) {
+    int fd = open( path.c_str(), O_RDONLY );
+    if ( fd < 0 )
+        throw std::runtime_error( "Cannot open " + path + ": " + std::strerror( errno ) );
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init( &sha );
+    mbedtls_sha256_starts_ret( &sha, 0 );
+
+    const int CHUNK_SIZE = 512;
+    std::unique_ptr< unsigned char[] > buffer( new unsigned char[ CHUNK_SIZE ] );
+    int bytesRead;
+    while ( ( bytesRead = read( fd, buffer.get(), CHUNK_SIZE ) ) > 0 )
+        mbedtls_sha256_update_ret( &sha, buffer.get(), bytesRead );
+    close( fd );
+    if ( bytesRead < 0 ) {
+        mbedtls_sha256_free( &sha );
+        throw std::runtime_error( "Cannot read " + path + ": " + std::strerror( errno ) );
+    }
+
+    unsigned char digest[ 32 ];
+    mbedtls_sha256_finish_ret( &sha, digest );
+    mbedtls_sha256_free( &sha );
+
+    static const char *hexDigits = "0123456789abcdef";
+    std::string result;
+    result.reserve( 64 );
+    for ( unsigned char c : digest ) {
+        result.push_back( hexDigits[ c >> 4 ] );
+        result.push_back( hexDigits[ c & 0xF ] );
+    }
+    return result;
+}
+
+HashIndex::HashIndex( const std::string& indexPath )
+    : _indexPath( indexPath )
+{
+    load();
+}
+
+std::string HashIndex::digest( const std::string& name, const std::string& path,
+    size_t size, time_t mtime )
+{
+    const time_t MTIME_RESOLUTION = 2;
+    // 1980-01-01, the FAT epoch; an earlier time means the clock is not set
+    const time_t CLOCK_SET = 315532800;
+
+    auto key = normalizeName( name );
+    auto it = _entries.find( key );
+    if ( it != _entries.end() && it->second.size == size && it->second.mtime == mtime )
+        return it->second.digest;
+
+    auto digest = sha256File( path );
+    time_t now = time( nullptr );
+    if ( now < CLOCK_SET || mtime + MTIME_RESOLUTION <= now ) {
+        _entries[ key ] = { size, mtime, digest };
+        _dirty = true;
+    }
+    else if ( it != _entries.end() ) {
+        _entries.erase( it );
+        _dirty = true;
+    }
+    return digest;
+}
+
+void HashIndex::invalidate( const std::string& name ) {
+    if ( _entries.erase( normalizeName( name ) ) != 0 )
+        _dirty = true;
+}
+
+HashIndex::~HashIndex() {
+    save();
+}
+
+void HashIndex::clear() {
+    _entries.clear();
+    _dirty = false;
+    remove( _indexPath.c_str() );
+}
+
+void HashIndex::save() {
+    if ( !_dirty )
+        return;
+    FILE *f = fopen( _indexPath.c_str(), "w" );
+    if ( !f ) {
+        // The index is only a cache. If we cannot write it, make sure there
+        // is no stale version left behind.
+        remove( _indexPath.c_str() );
+        return;
+    }
+    for ( const auto& [ name, entry ] : _entries )
+        fprintf( f, "%u %lld %s %s\n", unsigned( entry.size ), static_cast< long long >( entry.mtime ),
+            entry.digest.c_str(), name.c_str() );
+    fclose( f );
+    _dirty = false;
+}
+
+std::string HashIndex::normalizeName( const std::string& name ) {
+    auto start = name.find_first_not_of( '/' );
+    if ( start == std::string::npos )
+        return {};
+    return name.substr( start );
+}
+
+void HashIndex::load() {
+    FILE *f = fopen( _indexPath.c_str(), "r" );
+    if ( !f )
+        return;
+    unsigned size;
+    long long mtime;
+    char digest[ 65 ];
+    char name[ 256 ];
+    while ( fscanf( f, "%u %lld %64s %255[^\n]\n", &size, &mtime, digest, name ) == 4 )
+        _entries[ name ] = { size, time_t( mtime ), digest };
+    fclose( f );
+}
@@ -0,0 +1,347 @@
+#include <kvStore.hpp>
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include <jacUtility.hpp>
+
+using namespace jac::storage;
+
+namespace {
+
+const uint32_t MAGIC = 0x31564B4A; // "JKV1"
+const size_t HEADER_SIZE = 16;
+const size_t RECORD_HEADER_SIZE = 8;
+
+const uint8_t FLAG_END = 1 << 0;
+const uint8_t FLAG_DELETE = 1 << 1;
+const int TYPE_SHIFT = 2;
+const uint8_t TYPE_MASK = 3 << TYPE_SHIFT;
+const uint8_t ERASED = 0xFF;
+
+size_t align4( size_t size ) {
+    return ( size + 3 ) & ~size_t( 3 );
+}
+
+void put32( unsigned char *p, uint32_t v ) {
+    p[ 0 ] = v;
+    p[ 1 ] = v >> 8;
+    p[ 2 ] = v >> 16;
+    p[ 3 ] = v >> 24;
+}
+
+uint32_t get32( const unsigned char *p ) {
+    return p[ 0 ] | p[ 1 ] << 8 | p[ 2 ] << 16 | uint32_t( p[ 3 ] ) << 24;
+}
+
+// Compute the CRC of a record with the CRC field zeroed
+uint32_t recordCrc( const unsigned char *record, size_t size ) {
+    const unsigned char zeros[ 4 ] = {};
+    uint32_t crc = jac::utility::crc32( record, 4 );
+    crc = jac::utility::crc32( zeros, 4, crc );
+    return jac::utility::crc32( record + RECORD_HEADER_SIZE, size - RECORD_HEADER_SIZE, crc );
+}
+
+size_t recordSize( const unsigned char *header ) {
+    return align4( RECORD_HEADER_SIZE + header[ 1 ] + ( header[ 2 ] | header[ 3 ] << 8 ) );
+}
+
+// Append a record to the buffer and return its size
+size_t encodeRecord( std::string& out, uint8_t flags, const std::string& key, const std::string& value ) {
+    size_t start = out.size();
+    size_t size = align4( RECORD_HEADER_SIZE + key.size() + value.size() );
+    out.resize( start + size, '\0' );
+    auto *record = reinterpret_cast< unsigned char * >( &out[ start ] );
+    record[ 0 ] = flags;
+    record[ 1 ] = key.size();
+    record[ 2 ] = value.size();
+    record[ 3 ] = value.size() >> 8;
+    std::memcpy( record + RECORD_HEADER_SIZE, key.data(), key.size() );
+    std::memcpy( record + RECORD_HEADER_SIZE + key.size(), value.data(), value.size() );
+    put32( record + 4, recordCrc( record, RECORD_HEADER_SIZE + key.size() + value.size() ) );
+    return size;
+}
+
+} // namespace
+
+KvStore::KvStore( Medium& medium )
+    : _medium( medium ),
+      _halfSize( medium.size() / medium.sectorSize() / 2 * medium.sectorSize() )
+{
+    if ( _halfSize == 0 )
+        throw std::runtime_error( "The medium is too small for a key-value store" );
+    load();
+}
+
+std::optional< KvStore::Value > KvStore::get( const std::string& key ) {
+    std::scoped_lock _( _mutex );
+    auto it = _index.find( key );
+    if ( it == _index.end() )
+        return std::nullopt;
+
+    std::unique_ptr< unsigned char[] > record( new unsigned char[ it->second.size ] );
+    _medium.read( halfStart( _active ) + it->second.offset, record.get(), it->second.size );
+    size_t keyLength = record[ 1 ];
+    size_t valueLength = record[ 2 ] | record[ 3 ] << 8;
+    Value value;
+    value.type = ValueType( ( record[ 0 ] & TYPE_MASK ) >> TYPE_SHIFT );
+    value.data.assign( reinterpret_cast< char * >( record.get() ) + RECORD_HEADER_SIZE + keyLength,
+        valueLength );
+    return value;
+}
+
+std::vector< std::string > KvStore::keys() {
+    std::scoped_lock _( _mutex );
+    std::vector< std::string > result;
+    result.reserve( _index.size() );
+    for ( const auto& entry : _index )
+        result.push_back( entry.first );
+    return result;
+}
+
+void KvStore::commit( const std::vector< Change >& batch ) {
+    if ( batch.empty() )
+        return;
+
+    // Serialize the whole batch, so it is written at once
+    std::string records;
+    std::vector< size_t > sizes;
+    for ( size_t i = 0; i != batch.size(); i++ ) {
+        const auto& change = batch[ i ];
+        if ( change.key.empty() || change.key.size() > 255 )
+            throw std::runtime_error( "Invalid key length: " + change.key );
+        uint8_t flags = i + 1 == batch.size() ? FLAG_END : 0;
+        if ( !change.value ) {
+            sizes.push_back( encodeRecord( records, flags | FLAG_DELETE, change.key, {} ) );
+            continue;
+        }
+        if ( change.value->data.size() > 0xFFFF )
+            throw std::runtime_error( "Value too long for key " + change.key );
+        flags |= uint8_t( change.value->type ) << TYPE_SHIFT;
+        sizes.push_back( encodeRecord( records, flags, change.key, change.value->data ) );
+    }
+    if ( records.size() > _halfSize - HEADER_SIZE )
+        throw std::runtime_error( "The batch is too large" );
+
+    for ( int attempt = 0; attempt != 2; attempt++ ) {
+        {
+            std::scoped_lock _( _mutex );
+            if ( _writeOffset + records.size() <= _halfSize ) {
+                try {
+                    _medium.write( halfStart( _active ) + _writeOffset, records.data(), records.size() );
+                }
+                catch ( ... ) {
+                    // The space might contain a partial record; we cannot
+                    // append to the half anymore
+                    _writeOffset = _halfSize;
+                    throw;
+                }
+                size_t offset = _writeOffset;
+                for ( size_t i = 0; i != batch.size(); i++ ) {
+                    auto it = _index.find( batch[ i ].key );
+                    if ( it != _index.end() ) {
+                        _liveBytes -= it->second.size;
+                        _index.erase( it );
+                    }
+                    if ( batch[ i ].value ) {
+                        _index[ batch[ i ].key ] = { uint32_t( offset ), uint32_t( sizes[ i ] ) };
+                        _liveBytes += sizes[ i ];
+                    }
+                    offset += sizes[ i ];
+                }
+                _writeOffset = offset;
+                return;
+            }
+        }
+        compact();
+    }
+    throw std::runtime_error( "The key-value store is full" );
+}
+
+bool KvStore::needsCompaction() {
+    std::scoped_lock _( _mutex );
+    size_t garbage = _writeOffset - HEADER_SIZE - _liveBytes;
+    return _writeOffset > _halfSize / 4 * 3 && garbage >= _halfSize / 4;
+}
+
+void KvStore::compact() {
+    std::scoped_lock compactionGuard( _compactionMutex );
+
+    std::unique_lock lock( _mutex );
+    Index snapshot = _index;
+    size_t mark = _writeOffset;
+    int source = _active;
+    int target = 1 - source;
+    lock.unlock();
+
+    // The target half is not used by anyone else and the records in the
+    // source half before the mark do not change, so we can copy them without
+    // blocking the store
+    _medium.erase( halfStart( target ), _halfSize );
+    Index index;
+    size_t live = 0;
+    size_t offset = HEADER_SIZE;
+    std::string buffer;
+    auto flush = [&]() {
+        _medium.write( halfStart( target ) + offset, buffer.data(), buffer.size() );
+        offset += buffer.size();
+        buffer.clear();
+    };
+    for ( const auto& [ key, entry ] : snapshot ) {
+        if ( offset + buffer.size() + entry.size > _halfSize )
+            throw std::runtime_error( "The key-value store is full" );
+        size_t start = buffer.size();
+        buffer.resize( start + entry.size );
+        auto *record = reinterpret_cast< unsigned char * >( &buffer[ start ] );
+        _medium.read( halfStart( source ) + entry.offset, record, entry.size );
+        // The record is now a batch on its own
+        if ( !( record[ 0 ] & FLAG_END ) ) {
+            record[ 0 ] |= FLAG_END;
+            put32( record + 4, recordCrc( record,
+                RECORD_HEADER_SIZE + record[ 1 ] + ( record[ 2 ] | record[ 3 ] << 8 ) ) );
+        }
+        index[ key ] = { uint32_t( offset + start ), entry.size };
+        live += entry.size;
+        if ( buffer.size() >= _medium.sectorSize() )
+            flush();
+    }
+    flush();
+
+    lock.lock();
+    // Bring over the batches committed in the meantime; they are complete
+    // and can be copied verbatim
+    if ( _writeOffset > mark ) {
+        size_t tail = _writeOffset - mark;
+        if ( offset + tail > _halfSize )
+            throw std::runtime_error( "The key-value store is full" );
+        buffer.resize( tail );
+        _medium.read( halfStart( source ) + mark, &buffer[ 0 ], tail );
+        size_t tailStart = offset;
+        flush();
+        bool clean;
+        replay( target, tailStart, offset, index, live, clean );
+    }
+    writeHeader( target, _generation + 1 );
+
+    _active = target;
+    _generation++;
+    _index = std::move( index );
+    _liveBytes = live;
+    _writeOffset = offset;
+}
+
+KvStore::Usage KvStore::usage() {
+    std::scoped_lock _( _mutex );
+    return { _writeOffset, _liveBytes, _halfSize, _generation };
+}
+
+bool KvStore::readHeader( int half, uint32_t& generation ) {
+    unsigned char header[ HEADER_SIZE ];
+    _medium.read( halfStart( half ), header, HEADER_SIZE );
+    if ( get32( header ) != MAGIC )
+        return false;
+    if ( get32( header + 12 ) != jac::utility::crc32( header, 12 ) )
+        return false;
+    generation = get32( header + 4 );
+    return true;
+}
+
+void KvStore::writeHeader( int half, uint32_t generation ) {
+    unsigned char header[ HEADER_SIZE ];
+    put32( header, MAGIC );
+    put32( header + 4, generation );
+    put32( header + 8, 0xFFFFFFFF );
+    put32( header + 12, jac::utility::crc32( header, 12 ) );
+    _medium.write( halfStart( half ), header, HEADER_SIZE );
+}
+
+void KvStore::format() {
+    _medium.erase( halfStart( 0 ), _halfSize );
+    writeHeader( 0, 1 );
+    _active = 0;
+    _generation = 1;
+    _writeOffset = HEADER_SIZE;
+    _liveBytes = 0;
+    _index.clear();
+}
+
+void KvStore::load() {
+    uint32_t generations[ 2 ];
+    bool valid[ 2 ] = { readHeader( 0, generations[ 0 ] ), readHeader( 1, generations[ 1 ] ) };
+    if ( !valid[ 0 ] && !valid[ 1 ] ) {
+        format();
+        return;
+    }
+    // The generation only grows; a wrap-around would take billions of
+    // compactions
+    if ( valid[ 0 ] && valid[ 1 ] )
+        _active = generations[ 1 ] > generations[ 0 ] ? 1 : 0;
+    else
+        _active = valid[ 1 ] ? 1 : 0;
+    _generation = generations[ _active ];
+
+    bool clean;
+    _writeOffset = replay( _active, HEADER_SIZE, _halfSize, _index, _liveBytes, clean );
+    // There is garbage after the last batch. We cannot append after it, so
+    // we let the next commit compact the store.
+    if ( !clean )
+        _writeOffset = _halfSize;
+}
+
+size_t KvStore::replay( int half, size_t from, size_t to, Index& index, size_t& live, bool& clean ) {
+    struct Pending {
+        std::string key;
+        Entry entry;
+        bool deletion;
+    };
+    std::vector< Pending > pending;
+    std::unique_ptr< unsigned char[] > record;
+    size_t recordCapacity = 0;
+
+    size_t offset = from;
+    size_t committed = from;
+    clean = false;
+    while ( offset + RECORD_HEADER_SIZE <= to ) {
+        unsigned char header[ RECORD_HEADER_SIZE ];
+        _medium.read( halfStart( half ) + offset, header, RECORD_HEADER_SIZE );
+        if ( header[ 0 ] == ERASED ) {
+            clean = pending.empty();
+            return committed;
+        }
+        size_t size = recordSize( header );
+        if ( header[ 1 ] == 0 || offset + size > to )
+            return committed;
+        if ( size > recordCapacity ) {
+            record.reset( new unsigned char[ size ] );
+            recordCapacity = size;
+        }
+        _medium.read( halfStart( half ) + offset, record.get(), size );
+        size_t length = RECORD_HEADER_SIZE + record[ 1 ] + ( record[ 2 ] | record[ 3 ] << 8 );
+        if ( get32( record.get() + 4 ) != recordCrc( record.get(), length ) )
+            return committed;
+
+        std::string key( reinterpret_cast< char * >( record.get() ) + RECORD_HEADER_SIZE, record[ 1 ] );
+        pending.push_back( { std::move( key ), { uint32_t( offset ), uint32_t( size ) },
+            bool( record[ 0 ] & FLAG_DELETE ) } );
+        offset += size;
+        if ( !( record[ 0 ] & FLAG_END ) )
+            continue;
+
+        for ( auto& change : pending ) {
+            auto it = index.find( change.key );
+            if ( it != index.end() ) {
+                live -= it->second.size;
+                index.erase( it );
+            }
+            if ( !change.deletion ) {
+                live += change.entry.size;
+                index[ std::move( change.key ) ] = change.entry;
+            }
+        }
+        pending.clear();
+        committed = offset;
+    }
+    clean = pending.empty();
+    return committed;
+}
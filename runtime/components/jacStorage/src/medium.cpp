@@ -0,0 +1,78 @@
+#include <medium.hpp>
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace jac::storage;
+
+namespace {
+
+std::string errnoMessage( const std::string& what ) {
+    return what + ": " + std::strerror( errno );
+}
+
+} // namespace
+
+FileMedium::FileMedium( const std::string& path, size_t size, size_t sectorSize )
+    : _path( path ), _size( size ), _sectorSize( sectorSize )
+{
+    if ( size == 0 || size % sectorSize != 0 )
+        throw std::runtime_error( "Medium size has to be a multiple of the sector size" );
+    _fd = open( path.c_str(), O_RDWR );
+    if ( _fd >= 0 ) {
+        struct stat fileStat;
+        if ( fstat( _fd, &fileStat ) == 0 && size_t( fileStat.st_size ) == size )
+            return;
+        // The file does not match the medium, start from scratch
+        close( _fd );
+    }
+    _fd = open( path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666 );
+    if ( _fd < 0 )
+        throw std::runtime_error( errnoMessage( "Cannot open " + path ) );
+    erase( 0, size );
+}
+
+FileMedium::~FileMedium() {
+    if ( _fd >= 0 )
+        close( _fd );
+}
+
+void FileMedium::read( size_t offset, void *data, size_t size ) {
+    checkRange( offset, size );
+    if ( pread( _fd, data, size, offset ) != ssize_t( size ) )
+        throw std::runtime_error( errnoMessage( "Cannot read " + _path ) );
+}
+
+void FileMedium::write( size_t offset, const void *data, size_t size ) {
+    checkRange( offset, size );
+    // A write can only clear bits, just like on a real flash
+    std::unique_ptr< unsigned char[] > content( new unsigned char[ size ] );
+    read( offset, content.get(), size );
+    const unsigned char *bytes = static_cast< const unsigned char * >( data );
+    for ( size_t i = 0; i != size; i++ )
+        content[ i ] &= bytes[ i ];
+    if ( pwrite( _fd, content.get(), size, offset ) != ssize_t( size ) )
+        throw std::runtime_error( errnoMessage( "Cannot write " + _path ) );
+}
+
+void FileMedium::erase( size_t offset, size_t size ) {
+    checkRange( offset, size );
+    if ( offset % _sectorSize != 0 || size % _sectorSize != 0 )
+        throw std::runtime_error( "Unaligned erase" );
+    std::unique_ptr< unsigned char[] > erased( new unsigned char[ _sectorSize ] );
+    std::memset( erased.get(), 0xFF, _sectorSize );
+    for ( size_t sector = offset; sector != offset + size; sector += _sectorSize ) {
+        if ( pwrite( _fd, erased.get(), _sectorSize, sector ) != ssize_t( _sectorSize ) )
+            throw std::runtime_error( errnoMessage( "Cannot erase " + _path ) );
+    }
+}
+
+void FileMedium::checkRange( size_t offset, size_t size ) const {
+    if ( offset > _size || size > _size - offset )
+        throw std::runtime_error( "Access out of the medium" );
+}
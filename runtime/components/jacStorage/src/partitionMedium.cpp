@@ -0,0 +1,35 @@
+#include <partitionMedium.hpp>
+
+#include <string>
+#include <stdexcept>
+
+using namespace jac::storage;
+
+namespace {
+
+void checkEsp( esp_err_t result, const char *what ) {
+    if ( result != ESP_OK )
+        throw std::runtime_error( std::string( what ) + " failed: " + std::to_string( result ) );
+}
+
+} // namespace
+
+PartitionMedium::PartitionMedium( const char *label )
+    : _partition( esp_partition_find_first( ESP_PARTITION_TYPE_DATA,
+        ESP_PARTITION_SUBTYPE_ANY, label ) )
+{
+    if ( !_partition )
+        throw std::runtime_error( std::string( "No partition " ) + label );
+}
+
+void PartitionMedium::read( size_t offset, void *data, size_t size ) {
+    checkEsp( esp_partition_read( _partition, offset, data, size ), "Partition read" );
+}
+
+void PartitionMedium::write( size_t offset, const void *data, size_t size ) {
+    checkEsp( esp_partition_write( _partition, offset, data, size ), "Partition write" );
+}
+
+void PartitionMedium::erase( size_t offset, size_t size ) {
+    checkEsp( esp_partition_erase_range( _partition, offset, size ), "Partition erase" );
+}
@@ -0,0 +1,80 @@
+#include <sectorWriter.hpp>
+
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include <unistd.h>
+#include <esp_timer.h>
+#include <sdkconfig.h>
+
+using namespace jac::storage;
+
+namespace {
+
+SectorWriter::Statistics stats;
+
+// Measure the duration of a filesystem operation
+template < typename F >
+auto measured( F f ) {
+    auto start = esp_timer_get_time();
+    auto result = f();
+    stats.timeUs += esp_timer_get_time() - start;
+    return result;
+}
+
+} // namespace
+
+void SectorWriter::attach( int fd ) {
+    _fd = fd;
+    _size = 0;
+    if ( !_buffer )
+        _buffer.reset( new unsigned char[ CONFIG_WL_SECTOR_SIZE ] );
+}
+
+void SectorWriter::write( const unsigned char *data, int size ) {
+    while ( size > 0 ) {
+        // Bypass the buffer if there is a whole sector available
+        if ( _size == 0 && size >= CONFIG_WL_SECTOR_SIZE ) {
+            int toWrite = size - size % CONFIG_WL_SECTOR_SIZE;
+            int written = measured( [&] { return ::write( _fd, data, toWrite ); } );
+            stats.writeCalls++;
+            if ( written != toWrite )
+                throw std::runtime_error( std::string( "Cannot write: " ) + std::strerror( errno ) );
+            stats.bytesWritten += written;
+            data += toWrite;
+            size -= toWrite;
+            continue;
+        }
+        int toCopy = std::min( size, CONFIG_WL_SECTOR_SIZE - _size );
+        std::memcpy( _buffer.get() + _size, data, toCopy );
+        _size += toCopy;
+        data += toCopy;
+        size -= toCopy;
+        if ( _size == CONFIG_WL_SECTOR_SIZE )
+            flush();
+    }
+}
+
+void SectorWriter::finish() {
+    flush();
+    int res = measured( [&] { return fsync( _fd ); } );
+    stats.syncCalls++;
+    if ( res < 0 )
+        throw std::runtime_error( std::string( "Cannot sync: " ) + std::strerror( errno ) );
+}
+
+const SectorWriter::Statistics& SectorWriter::statistics() {
+    return stats;
+}
+
+void SectorWriter::flush() {
+    if ( _size == 0 )
+        return;
+    int written = measured( [&] { return ::write( _fd, _buffer.get(), _size ); } );
+    stats.writeCalls++;
+    if ( written != _size )
+        throw std::runtime_error( std::string( "Cannot write: " ) + std::strerror( errno ) );
+    stats.bytesWritten += written;
+    _size = 0;
+}
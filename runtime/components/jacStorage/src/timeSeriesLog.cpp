@@ -0,0 +1,310 @@
+#include <timeSeriesLog.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include <jacUtility.hpp>
+
+using namespace jac::storage;
+
+namespace {
+
+const uint32_t MAGIC = 0x3153544A; // "JTS1"
+const size_t HEADER_SIZE = 24;
+const size_t TIMESTAMP_SIZE = 8;
+const size_t CRC_SIZE = 4;
+// Number of records read from the medium at once during a query
+const uint32_t QUERY_CHUNK = 16;
+
+void put16( unsigned char *p, uint16_t v ) {
+    p[ 0 ] = v;
+    p[ 1 ] = v >> 8;
+}
+
+void put32( unsigned char *p, uint32_t v ) {
+    put16( p, v );
+    put16( p + 2, v >> 16 );
+}
+
+void put64( unsigned char *p, uint64_t v ) {
+    put32( p, v );
+    put32( p + 4, v >> 32 );
+}
+
+uint16_t get16( const unsigned char *p ) {
+    return p[ 0 ] | p[ 1 ] << 8;
+}
+
+uint32_t get32( const unsigned char *p ) {
+    return get16( p ) | uint32_t( get16( p + 2 ) ) << 16;
+}
+
+uint64_t get64( const unsigned char *p ) {
+    return get32( p ) | uint64_t( get32( p + 4 ) ) << 32;
+}
+
+bool isErased( const unsigned char *p, size_t size ) {
+    return std::all_of( p, p + size, []( unsigned char c ) { return c == 0xFF; } );
+}
+
+} // namespace
+
+TimeSeriesLog::TimeSeriesLog( Medium& medium, int fieldCount, int batchSize )
+    : _medium( medium ),
+      _fieldCount( fieldCount ),
+      _recordSize( TIMESTAMP_SIZE + fieldCount * sizeof( float ) + CRC_SIZE ),
+      _slotsPerSector( 0 ),
+      _batchSize( batchSize )
+{
+    if ( fieldCount <= 0 || fieldCount > 0xFFFF || batchSize <= 0 )
+        throw std::runtime_error( "Invalid time series log format" );
+    if ( medium.sectorSize() < HEADER_SIZE + _recordSize )
+        throw std::runtime_error( "Record does not fit a sector" );
+    _slotsPerSector = ( medium.sectorSize() - HEADER_SIZE ) / _recordSize;
+    _sectors.resize( medium.size() / medium.sectorSize() );
+    if ( _sectors.size() < 2 )
+        throw std::runtime_error( "The medium is too small for a time series log" );
+    _batch.reserve( _batchSize * _recordSize );
+    load();
+}
+
+void TimeSeriesLog::append( int64_t timestamp, const float *fields ) {
+    if ( timestamp < _lastTimestamp )
+        throw std::runtime_error( "Timestamps have to be non-decreasing" );
+    size_t start = _batch.size();
+    _batch.resize( start + _recordSize );
+    encodeRecord( &_batch[ start ], timestamp, fields );
+    _lastTimestamp = timestamp;
+    if ( ++_batchCount >= _batchSize )
+        flush();
+}
+
+void TimeSeriesLog::flush() {
+    size_t done = 0;
+    while ( done != size_t( _batchCount ) ) {
+        const unsigned char *record = &_batch[ done * _recordSize ];
+        if ( _order.empty() || _sectors[ _order.back() ].closed )
+            startSector( int64_t( get64( record ) ) );
+        int head = _order.back();
+        Sector& sector = _sectors[ head ];
+        uint32_t count = std::min< uint32_t >( _slotsPerSector - sector.count, _batchCount - done );
+        try {
+            _medium.write( slotOffset( head, sector.count ), record, count * _recordSize );
+        }
+        catch ( ... ) {
+            // Do not write to a sector that might contain a torn record
+            sector.closed = true;
+            _batch.erase( _batch.begin(), _batch.begin() + done * _recordSize );
+            _batchCount -= done;
+            throw;
+        }
+        sector.count += count;
+        sector.closed = sector.count == _slotsPerSector;
+        done += count;
+    }
+    _batch.clear();
+    _batchCount = 0;
+}
+
+size_t TimeSeriesLog::query( int64_t from, int64_t to, size_t limit,
+    std::vector< int64_t >& timestamps, std::vector< float >& fields )
+{
+    size_t found = 0;
+    std::unique_ptr< float[] > recordFields( new float[ _fieldCount ] );
+    auto take = [&]( int64_t timestamp ) {
+        timestamps.push_back( timestamp );
+        fields.insert( fields.end(), recordFields.get(), recordFields.get() + _fieldCount );
+        found++;
+    };
+
+    // The first timestamps of the sectors are sorted, find the last sector
+    // that starts strictly before the range. Records with timestamp equal to
+    // from can end a sector and also start the next ones.
+    auto start = std::lower_bound( _order.begin(), _order.end(), from,
+        [&]( int sector, int64_t t ) { return _sectors[ sector ].firstTimestamp < t; } );
+    if ( start != _order.begin() )
+        start--;
+
+    std::unique_ptr< unsigned char[] > chunk( new unsigned char[ QUERY_CHUNK * _recordSize ] );
+    bool first = true;
+    for ( auto it = start; it != _order.end() && found < limit; it++ ) {
+        int index = *it;
+        const Sector& sector = _sectors[ index ];
+        if ( sector.firstTimestamp > to )
+            return found;
+        uint32_t slot = first ? findSlot( index, from ) : 0;
+        first = false;
+        while ( slot < sector.count && found < limit ) {
+            uint32_t count = std::min( QUERY_CHUNK, sector.count - slot );
+            _medium.read( slotOffset( index, slot ), chunk.get(), count * _recordSize );
+            for ( uint32_t i = 0; i != count && found < limit; i++ ) {
+                int64_t timestamp;
+                if ( !decodeRecord( chunk.get() + i * _recordSize, timestamp, recordFields.get() ) )
+                    continue;
+                if ( timestamp > to )
+                    return found;
+                if ( timestamp >= from )
+                    take( timestamp );
+            }
+            slot += count;
+        }
+    }
+
+    // The pending records are the newest ones
+    for ( int i = 0; i != _batchCount && found < limit; i++ ) {
+        int64_t timestamp;
+        decodeRecord( &_batch[ i * _recordSize ], timestamp, recordFields.get() );
+        if ( timestamp > to )
+            break;
+        if ( timestamp >= from )
+            take( timestamp );
+    }
+    return found;
+}
+
+void TimeSeriesLog::clear() {
+    _batch.clear();
+    _batchCount = 0;
+    _medium.erase( 0, _sectors.size() * _medium.sectorSize() );
+    std::fill( _sectors.begin(), _sectors.end(), Sector() );
+    _order.clear();
+    _lastTimestamp = INT64_MIN;
+}
+
+TimeSeriesLog::Statistics TimeSeriesLog::statistics() const {
+    Statistics stats{};
+    for ( int index : _order )
+        stats.records += _sectors[ index ].count;
+    stats.records += _batchCount;
+    stats.pending = _batchCount;
+    stats.capacity = _sectors.size() * _slotsPerSector;
+    stats.oldest = _order.empty() ? _lastTimestamp : _sectors[ _order.front() ].firstTimestamp;
+    stats.newest = _lastTimestamp;
+    return stats;
+}
+
+size_t TimeSeriesLog::slotOffset( int sector, uint32_t slot ) const {
+    return sectorOffset( sector ) + HEADER_SIZE + slot * _recordSize;
+}
+
+void TimeSeriesLog::load() {
+    unsigned char header[ HEADER_SIZE ];
+    for ( size_t i = 0; i != _sectors.size(); i++ ) {
+        _medium.read( sectorOffset( i ), header, HEADER_SIZE );
+        if ( get32( header ) != MAGIC || get32( header + 20 ) != jac::utility::crc32( header, 20 ) )
+            continue;
+        uint32_t seq = get32( header + 4 );
+        // Keep the sequence growing even over sectors of another format
+        _nextSeq = std::max( _nextSeq, seq + 1 );
+        if ( get16( header + 8 ) != _recordSize || get16( header + 10 ) != _fieldCount )
+            continue;
+        Sector& sector = _sectors[ i ];
+        sector.valid = true;
+        sector.seq = seq;
+        sector.firstTimestamp = int64_t( get64( header + 12 ) );
+        _order.push_back( i );
+    }
+    std::sort( _order.begin(), _order.end(), [&]( int a, int b ) {
+        return _sectors[ a ].seq < _sectors[ b ].seq;
+    } );
+
+    // Records are written sequentially, so the used slots form a prefix
+    std::unique_ptr< unsigned char[] > record( new unsigned char[ _recordSize ] );
+    std::unique_ptr< float[] > fields( new float[ _fieldCount ] );
+    for ( int index : _order ) {
+        Sector& sector = _sectors[ index ];
+        uint32_t low = 0, high = _slotsPerSector;
+        while ( low < high ) {
+            uint32_t mid = ( low + high ) / 2;
+            unsigned char timestamp[ TIMESTAMP_SIZE ];
+            _medium.read( slotOffset( index, mid ), timestamp, TIMESTAMP_SIZE );
+            if ( isErased( timestamp, TIMESTAMP_SIZE ) )
+                high = mid;
+            else
+                low = mid + 1;
+        }
+        sector.count = low;
+        sector.closed = low == _slotsPerSector;
+        if ( low == 0 )
+            continue;
+        int64_t timestamp;
+        _medium.read( slotOffset( index, low - 1 ), record.get(), _recordSize );
+        if ( !decodeRecord( record.get(), timestamp, fields.get() ) ) {
+            // A torn record; drop it and never append after it
+            sector.count--;
+            sector.closed = true;
+        }
+    }
+    if ( !_order.empty() ) {
+        const Sector& head = _sectors[ _order.back() ];
+        _lastTimestamp = head.count == 0
+            ? head.firstTimestamp
+            : readTimestamp( _order.back(), head.count - 1 );
+    }
+}
+
+void TimeSeriesLog::startSector( int64_t firstTimestamp ) {
+    int next = _order.empty() ? 0 : ( _order.back() + 1 ) % _sectors.size();
+    // The ring is full; drop the oldest data
+    _order.erase( std::remove( _order.begin(), _order.end(), next ), _order.end() );
+    _sectors[ next ] = Sector();
+
+    _medium.erase( sectorOffset( next ), _medium.sectorSize() );
+    unsigned char header[ HEADER_SIZE ];
+    put32( header, MAGIC );
+    put32( header + 4, _nextSeq );
+    put16( header + 8, _recordSize );
+    put16( header + 10, _fieldCount );
+    put64( header + 12, firstTimestamp );
+    put32( header + 20, jac::utility::crc32( header, 20 ) );
+    _medium.write( sectorOffset( next ), header, HEADER_SIZE );
+
+    Sector& sector = _sectors[ next ];
+    sector.valid = true;
+    sector.seq = _nextSeq++;
+    sector.firstTimestamp = firstTimestamp;
+    _order.push_back( next );
+}
+
+int64_t TimeSeriesLog::readTimestamp( int sector, uint32_t slot ) {
+    unsigned char timestamp[ TIMESTAMP_SIZE ];
+    _medium.read( slotOffset( sector, slot ), timestamp, TIMESTAMP_SIZE );
+    return int64_t( get64( timestamp ) );
+}
+
+uint32_t TimeSeriesLog::findSlot( int sector, int64_t from ) {
+    uint32_t low = 0, high = _sectors[ sector ].count;
+    while ( low < high ) {
+        uint32_t mid = ( low + high ) / 2;
+        if ( readTimestamp( sector, mid ) < from )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+void TimeSeriesLog::encodeRecord( unsigned char *record, int64_t timestamp, const float *fields ) const {
+    put64( record, timestamp );
+    for ( int i = 0; i != _fieldCount; i++ ) {
+        uint32_t bits;
+        std::memcpy( &bits, &fields[ i ], sizeof( bits ) );
+        put32( record + TIMESTAMP_SIZE + i * sizeof( float ), bits );
+    }
+    size_t length = _recordSize - CRC_SIZE;
+    put32( record + length, jac::utility::crc32( record, length ) );
+}
+
+bool TimeSeriesLog::decodeRecord( const unsigned char *record, int64_t& timestamp, float *fields ) const {
+    size_t length = _recordSize - CRC_SIZE;
+    if ( get32( record + length ) != jac::utility::crc32( record, length ) )
+        return false;
+    timestamp = int64_t( get64( record ) );
+    for ( int i = 0; i != _fieldCount; i++ ) {
+        uint32_t bits = get32( record + TIMESTAMP_SIZE + i * sizeof( float ) );
+        std::memcpy( &fields[ i ], &bits, sizeof( bits ) );
+    }
+    return true;
+}
@@ -2,12 +2,24 @@
 #include <freertos/task.h>
 
 #include <uploader.hpp>
+#include <bundle.hpp>
 #include <uploaderFeatures/commandImplementation.hpp>
 #include <uploaderFeatures/commandInterpreter.hpp>
 #include <uploaderFeatures/stdinReader.hpp>
 #include <uploaderFeatures/stdoutReporter.hpp>
+#include <uploaderFeatures/socketReader.hpp>
+#include <uploaderFeatures/socketReporter.hpp>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <map>
+#include <mutex>
 
 #include <jacUtility.hpp>
+#include <log.hpp>
+
+JAC_LOG_MODULE( uploader, ::jac::log::Level::Info )
 
 using namespace jac;
 using namespace jac::storage;
@@ -16,6 +28,10 @@ using namespace jac::utility;
 namespace {
     TaskHandle_t uploaderTask;
     const char* basePath = nullptr;
+    // Serial and network sessions share the working files
+    std::mutex sessionLock;
+    std::mutex dumpSourcesLock;
+    std::map< std::string, DumpSource > dumpSources;
 }
 
 using UploaderInterface = Mixin<
@@ -24,30 +40,84 @@ using UploaderInterface = Mixin<
     CommandInterpreter,
     CommandImplementation >;
 
+using NetworkUploaderInterface = Mixin<
+    SocketReader,
+    SocketReporter,
+    CommandInterpreter,
+    CommandImplementation >;
+
 void discardBufferedStdin() {
     std::cin.ignore( std::cin.rdbuf()->in_avail() );
 }
 
 void uploaderRoutine( void * ) {
-    std::cout << "Uploader started\n";
+    JAC_LOG( log::Level::Info, uploader, "Uploader started" );
     while ( true ) {
         ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
         discardBufferedStdin();
 
+        std::lock_guard< std::mutex > _( sessionLock );
+        // The log would interleave with the responses on stdout
+        log::holdOutput( true );
         UploaderInterface interface;
         do {
             interface.interpretCommand();
         } while ( !interface.finished() );
+        log::holdOutput( false );
 
     }
 }
 
+void networkUploaderRoutine( void *arg ) {
+    int port = reinterpret_cast< intptr_t >( arg );
+    int server = socket( AF_INET, SOCK_STREAM, 0 );
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons( port );
+    if ( server < 0
+        || bind( server, reinterpret_cast< sockaddr * >( &addr ), sizeof( addr ) ) < 0
+        || listen( server, 1 ) < 0 )
+    {
+        JAC_LOG( log::Level::Error, uploader, "Network uploader failed: ", std::strerror( errno ) );
+        vTaskDelete( nullptr );
+        return;
+    }
+    JAC_LOG( log::Level::Info, uploader, "Network uploader listening on port ", port );
+    while ( true ) {
+        int client = accept( server, nullptr, nullptr );
+        if ( client < 0 )
+            continue;
+        {
+            std::lock_guard< std::mutex > _( sessionLock );
+            NetworkUploaderInterface interface;
+            interface.attachSocket( client );
+            do {
+                interface.interpretCommand();
+                interface.output().flush();
+            } while ( !interface.finished() && !interface.disconnected() );
+        }
+        close( client );
+    }
+}
+
 void jac::storage::initializeUploader( const char *path ) {
     assert( uploaderTask == nullptr );
     basePath = path;
+    try {
+        recoverBundle( basePath );
+    }
+    catch ( const std::runtime_error& e ) {
+        JAC_LOG( log::Level::Error, uploader, "Bundle recovery failed: ", e.what() );
+    }
     xTaskCreate( uploaderRoutine, "uploader", 3584, nullptr, 1, &uploaderTask );
 }
 
+void jac::storage::initializeNetworkUploader( int port ) {
+    xTaskCreate( networkUploaderRoutine, "netUploader", 4096,
+        reinterpret_cast< void * >( intptr_t( port ) ), 1, nullptr );
+}
+
 void jac::storage::enterUploader() {
     if ( xPortInIsrContext() )
         vTaskNotifyGiveFromISR( uploaderTask, nullptr );
@@ -58,3 +128,21 @@ void jac::storage::enterUploader() {
 const char* jac::storage::getStoragePrefix() {
     return basePath;
 }
+
+void jac::storage::registerDumpSource( const std::string& name, DumpSource source ) {
+    std::lock_guard< std::mutex > _( dumpSourcesLock );
+    dumpSources[ name ] = std::move( source );
+}
+
+void jac::storage::unregisterDumpSource( const std::string& name ) {
+    std::lock_guard< std::mutex > _( dumpSourcesLock );
+    dumpSources.erase( name );
+}
+
+DumpSource jac::storage::findDumpSource( const std::string& name ) {
+    std::lock_guard< std::mutex > _( dumpSourcesLock );
+    auto source = dumpSources.find( name );
+    if ( source == dumpSources.end() )
+        return {};
+    return source->second;
+}
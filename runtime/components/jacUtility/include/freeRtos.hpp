@@ -5,58 +5,61 @@
 #include <freertos/timers.h>
 #include <freertos/task.h>
 
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+
 namespace jac::freertos {
 
-class IsrDeferrer {
+// Execute jobs on a dedicated task in FIFO order. Useful for offloading
+// blocking operations (e.g., flash I/O) from the JavaScript task.
+//
+// The queue is unbounded, so posting never blocks. The jobs typically finish
+// by scheduling a job to the event loop, which waits for the global lock; if
+// the event loop could block in post(), they would wait for each other.
+class Worker {
 public:
-    using Arg = void*;
-    using Handler = void (*)( Arg );
-
-    IsrDeferrer( int size )
-        : _q( xQueueCreate( size, sizeof( Handler ) + sizeof( Arg ) ) )
-    {
-        if ( !_q )
-            throw std::runtime_error( "Cannot allocate queue" );
-        auto res = xTaskCreate( _run, "IsrDeferrer", 2048, this, 15, nullptr );
+    using Job = std::function< void() >;
+
+    Worker( const char *name, int stackSize, int priority, BaseType_t core = tskNO_AFFINITY ) {
+        auto res = xTaskCreatePinnedToCore( _run, name, stackSize, this, priority, &_task, core );
         if ( res != pdPASS )
             throw std::runtime_error( "Cannot allocate task" );
     }
-    IsrDeferrer( const IsrDeferrer& ) = delete;
-    IsrDeferrer& operator=( const IsrDeferrer& ) = delete;
-    IsrDeferrer( IsrDeferrer&& o ) : _q( o._q ) { o._q = nullptr; }
-    IsrDeferrer& operator=( IsrDeferrer&& o ) { swap( o ); return *this; }
-
-    ~IsrDeferrer() {
-        if ( _q )
-            vQueueDelete( _q );
-    }
+    Worker( const Worker& ) = delete;
+    Worker& operator=( const Worker& ) = delete;
 
-    void swap( IsrDeferrer& o ) {
-        using std::swap;
-        swap( _q, o._q );
+    // Enqueue a job; never blocks
+    void post( Job job ) {
+        {
+            std::lock_guard< std::mutex > _( _lock );
+            _jobs.push_back( std::move( job ) );
+        }
+        xTaskNotifyGive( _task );
     }
 
-    void IRAM_ATTR isr( Handler h, Arg a ) {
-        uint8_t data[ sizeof( Handler ) + sizeof( Arg ) ];
-        *reinterpret_cast< Arg* >( data ) = a;
-        *reinterpret_cast< Handler* >( data + sizeof( Arg ) ) = h;
-        portBASE_TYPE higherPriorityTaskWoken = pdFALSE;
-        xQueueSendToBackFromISR( _q, data, &higherPriorityTaskWoken );
-        if( higherPriorityTaskWoken )
-            portYIELD_FROM_ISR();
-    }
 private:
-    static void _run(void* arg ) {
-        auto* self = reinterpret_cast< IsrDeferrer* >( arg );
+    static void _run( void *arg ) {
+        auto* self = reinterpret_cast< Worker* >( arg );
         while ( true ) {
-            uint8_t data[ sizeof( Handler ) + sizeof( Arg ) ];
-            xQueueReceive( self->_q, data, portMAX_DELAY );
-            Arg& a = *reinterpret_cast< Arg* >( data );
-            Handler& h = *reinterpret_cast< Handler* >( data + sizeof( Arg ) );
-            (*h)( a );
+            ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+            while ( true ) {
+                Job j;
+                {
+                    std::lock_guard< std::mutex > _( self->_lock );
+                    if ( self->_jobs.empty() )
+                        break;
+                    j = std::move( self->_jobs.front() );
+                    self->_jobs.pop_front();
+                }
+                j();
+            }
         }
     }
-    QueueHandle_t _q;
+    TaskHandle_t _task = nullptr;
+    std::mutex _lock;
+    std::deque< Job > _jobs;
 };
 
-} // namespace jac::freertos
\ No newline at end of file
+} // namespace jac::freertos
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <string>
+#include <array>
+#include <cstdint>
+#include <cstddef>
 
 namespace jac::utility {
 
@@ -18,4 +21,31 @@ inline bool startswith( const std::string& what, const std::string& with ) {
     return true;
 }
 
+namespace detail {
+
+constexpr std::array< uint32_t, 256 > crc32Table() {
+    std::array< uint32_t, 256 > table{};
+    for ( uint32_t i = 0; i != 256; i++ ) {
+        uint32_t c = i;
+        for ( int k = 0; k != 8; k++ )
+            c = c & 1 ? 0xEDB88320 ^ ( c >> 1 ) : c >> 1;
+        table[ i ] = c;
+    }
+    return table;
+}
+
+inline constexpr auto CRC32_TABLE = crc32Table();
+
+} // namespace detail
+
+// Compute CRC-32 (IEEE 802.3) of the data. Pass the previous result as crc to
+// continue the computation over multiple buffers.
+inline uint32_t crc32( const void *data, size_t size, uint32_t crc = 0 ) {
+    const uint8_t *bytes = static_cast< const uint8_t * >( data );
+    crc = ~crc;
+    for ( size_t i = 0; i != size; i++ )
+        crc = detail::CRC32_TABLE[ ( crc ^ bytes[ i ] ) & 0xFF ] ^ ( crc >> 8 );
+    return ~crc;
+}
+
 } // namespace jac::utility
\ No newline at end of file
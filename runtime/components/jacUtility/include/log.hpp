@@ -0,0 +1,296 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <logRing.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Asynchronous logging
+//
+// Messages are formatted by the caller into a line and stored in a lock-free
+// in-RAM ring; a low-priority task drains the ring to stdout. Therefore, a
+// slow UART does not block the caller. When the ring is full, the message is
+// dropped and counted; the drain task reports the count.
+//
+// Native code logs via JAC_LOG( level, module, args... ) where the module is
+// declared by JAC_LOG_MODULE( module, threshold ). Messages below the module
+// threshold or below JAC_LOG_LEVEL are compiled out, including the evaluation
+// of their arguments. The arguments are strings, numbers, booleans and
+// characters; they are concatenated.
+//
+// Until startDrain() is called, the messages are written synchronously.
+// The ring can hold JAC_LOG_SLOTS slots of 64 bytes. A line is limited to the
+// largest message of the ring (Line) or, for native messages formatted on
+// small task stacks, to 256 bytes (ShortLine); a truncated line ends with
+// "[...]". writeText() stores a text of any length as multiple lines.
+
+#ifndef JAC_LOG_LEVEL
+    #define JAC_LOG_LEVEL ::jac::log::Level::Debug
+#endif
+
+#ifndef JAC_LOG_SLOTS
+    #define JAC_LOG_SLOTS 128
+#endif
+
+#define JAC_LOG_MODULE( name, threshold )                                      \
+    namespace jac::log::modules {                                              \
+        struct name {                                                          \
+            static constexpr ::jac::log::Level level = threshold;              \
+            static constexpr const char *tag = #name;                          \
+        };                                                                     \
+    }
+
+#define JAC_LOG( lvl, module, ... )                                            \
+    do {                                                                       \
+        if constexpr ( ( lvl ) >= ::jac::log::modules::module::level           \
+            && ( lvl ) >= JAC_LOG_LEVEL )                                      \
+        {                                                                      \
+            ::jac::log::write( lvl, ::jac::log::modules::module::tag,          \
+                __VA_ARGS__ );                                                 \
+        }                                                                      \
+    } while ( 0 )
+
+namespace jac::log {
+
+enum class Level : uint8_t { Debug, Info, Warn, Error, Off };
+
+inline constexpr char levelMark( Level level ) {
+    return "DIWE-"[ static_cast< int >( level ) ];
+}
+
+using Ring = utility::LogRing< JAC_LOG_SLOTS >;
+
+// A line of a fixed capacity; longer lines are truncated and marked
+template < size_t Capacity >
+class BasicLine {
+public:
+    static constexpr size_t CAPACITY = Capacity;
+    static constexpr std::string_view TRUNCATION_MARK = "[...]";
+    static_assert( CAPACITY > TRUNCATION_MARK.size() );
+
+    BasicLine& append( std::string_view s ) {
+        size_t count = std::min( s.size(), CAPACITY - _size );
+        std::memcpy( _data + _size, s.data(), count );
+        _size += count;
+        _truncated |= count != s.size();
+        return *this;
+    }
+
+    BasicLine& append( const char *s ) {
+        return append( std::string_view( s ) );
+    }
+
+    BasicLine& append( const std::string& s ) {
+        return append( std::string_view( s ) );
+    }
+
+    BasicLine& append( char c ) {
+        if ( _size < CAPACITY )
+            _data[ _size++ ] = c;
+        else
+            _truncated = true;
+        return *this;
+    }
+
+    BasicLine& append( bool b ) {
+        return append( b ? "true" : "false" );
+    }
+
+    template < typename T, std::enable_if_t< std::is_integral_v< T >, int > = 0 >
+    BasicLine& append( T value ) {
+        char buffer[ 24 ];
+        char *end = buffer + sizeof( buffer );
+        char *p = end;
+        using U = std::make_unsigned_t< T >;
+        U magnitude = value < 0 ? U( 0 ) - U( value ) : U( value );
+        do {
+            *--p = '0' + magnitude % 10;
+            magnitude /= 10;
+        } while ( magnitude );
+        if ( value < 0 )
+            *--p = '-';
+        return append( std::string_view( p, end - p ) );
+    }
+
+    // Integral values take the integer path, the rest is formatted with
+    // 6 significant digits
+    BasicLine& append( double value ) {
+        if ( std::isfinite( value ) && std::trunc( value ) == value && std::fabs( value ) < 1e15 )
+            return append( static_cast< int64_t >( value ) );
+        char buffer[ 32 ];
+        int size = std::snprintf( buffer, sizeof( buffer ), "%g", value );
+        return append( std::string_view( buffer, size ) );
+    }
+
+    BasicLine& append( float value ) {
+        return append( double( value ) );
+    }
+
+    // Append the truncation mark if needed and the newline; there is always
+    // room for it
+    void terminate() {
+        if ( _truncated ) {
+            _size = std::min( _size, CAPACITY - TRUNCATION_MARK.size() );
+            std::memcpy( _data + _size, TRUNCATION_MARK.data(), TRUNCATION_MARK.size() );
+            _size += TRUNCATION_MARK.size();
+        }
+        _data[ _size++ ] = '\n';
+    }
+
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+private:
+    char _data[ CAPACITY + 1 ];
+    size_t _size = 0;
+    bool _truncated = false;
+};
+
+// A line filling the largest message of the ring, including the newline
+using Line = BasicLine< Ring::MAX_MESSAGE_SIZE - 1 >;
+using ShortLine = BasicLine< 256 >;
+
+struct Statistics {
+    uint32_t written;
+    uint32_t dropped;
+};
+
+namespace detail {
+
+struct State {
+    Ring ring;
+    std::atomic< uint32_t > written{ 0 };
+    std::atomic< uint32_t > dropped{ 0 };
+    std::atomic< uint32_t > unreported{ 0 };
+    std::atomic< bool > held{ false };
+    std::atomic< bool > draining{ false };
+    std::mutex consumer;
+    std::string pending; // Message being reassembled by the consumer
+};
+
+inline State& state() {
+    static State s;
+    return s;
+}
+
+// Write everything in the ring to stdout; has to be called with the consumer
+// lock
+inline void drainLocked( State& s ) {
+    while ( s.ring.pop( [&]( uint8_t, const char *data, size_t size, bool more ) {
+        s.pending.append( data, size );
+        if ( more )
+            return;
+        std::fwrite( s.pending.data(), 1, s.pending.size(), stdout );
+        s.pending.clear();
+    } ) );
+    if ( uint32_t dropped = s.unreported.exchange( 0 ) )
+        std::printf( "[log] %" PRIu32 " messages dropped\n", dropped );
+    std::fflush( stdout );
+}
+
+inline void drainTask( void * ) {
+    State& s = state();
+    while ( true ) {
+        if ( !s.held ) {
+            std::lock_guard< std::mutex > _( s.consumer );
+            drainLocked( s );
+        }
+        vTaskDelay( pdMS_TO_TICKS( 10 ) );
+    }
+}
+
+} // namespace detail
+
+// Store a message terminated by a newline; it fits a message of the ring
+inline void writeMessage( Level level, const char *data, size_t size ) {
+    detail::State& s = detail::state();
+    if ( !s.draining && !s.held ) {
+        std::lock_guard< std::mutex > _( s.consumer );
+        std::fwrite( data, 1, size, stdout );
+        s.written++;
+        return;
+    }
+    if ( s.ring.push( static_cast< uint8_t >( level ), data, size ) ) {
+        s.written++;
+    }
+    else {
+        s.dropped++;
+        s.unreported++;
+    }
+}
+
+// Store a formatted line; the newline is appended
+template < size_t Capacity >
+void writeLine( Level level, BasicLine< Capacity >& line ) {
+    line.terminate();
+    writeMessage( level, line.data(), line.size() );
+}
+
+// Store a text of any length, e.g., an error with a stack trace. Each of its
+// lines is stored as a message with the header of the module; lines too long
+// for the ring are split.
+inline void writeText( Level level, const char *module, std::string_view text ) {
+    std::string header = std::string( "[" ) + levelMark( level ) + " " + module + "] ";
+    const size_t room = Ring::MAX_MESSAGE_SIZE - 1 - header.size();
+    std::string message;
+    do {
+        size_t end = std::min( { text.find( '\n' ), text.size(), room } );
+        message.assign( header ).append( text.substr( 0, end ) ).push_back( '\n' );
+        writeMessage( level, message.data(), message.size() );
+        text.remove_prefix( end );
+        if ( !text.empty() && text.front() == '\n' )
+            text.remove_prefix( 1 );
+    } while ( !text.empty() );
+}
+
+// Format the arguments and store the line; prefer JAC_LOG
+template < typename... Args >
+void write( Level level, const char *module, const Args&... args ) {
+    ShortLine line;
+    line.append( '[' ).append( levelMark( level ) ).append( ' ' )
+        .append( module ).append( "] " );
+    ( line.append( args ), ... );
+    writeLine( level, line );
+}
+
+// Start the task writing the messages to stdout
+inline void startDrain( int priority = 1 ) {
+    detail::State& s = detail::state();
+    if ( s.draining.exchange( true ) )
+        return;
+    xTaskCreate( detail::drainTask, "logDrain", 2560, nullptr, priority, nullptr );
+}
+
+// Write all stored messages synchronously, e.g., before a restart
+inline void flush() {
+    detail::State& s = detail::state();
+    std::lock_guard< std::mutex > _( s.consumer );
+    detail::drainLocked( s );
+}
+
+// Stop or resume the output, e.g., while stdout carries the uploader
+// protocol. Messages are stored meanwhile.
+inline void holdOutput( bool hold ) {
+    detail::state().held = hold;
+    if ( !hold )
+        flush();
+}
+
+inline Statistics statistics() {
+    detail::State& s = detail::state();
+    return { s.written, s.dropped };
+}
+
+} // namespace jac::log
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+namespace jac::utility {
+
+// Lock-free ring of messages with multiple producers and a single consumer.
+//
+// The ring consists of fixed-size slots, each with a sequence number (the
+// bounded queue by D. Vyukov). A message longer than a single slot occupies
+// consecutive slots that are claimed at once, so messages of concurrent
+// producers do not interleave. When there is not enough free slots, push fails
+// immediately instead of waiting for the consumer.
+//
+// The consumer pops the slots one by one; all but the last slot of a message
+// are marked by more.
+template < size_t SlotCount, size_t SlotSize = 64 >
+class LogRing {
+    static_assert( ( SlotCount & ( SlotCount - 1 ) ) == 0, "SlotCount has to be a power of two" );
+
+    struct Slot {
+        std::atomic< uint32_t > sequence;
+        uint8_t size;
+        uint8_t tag;
+        bool more;
+        char data[ SlotSize - sizeof( std::atomic< uint32_t > ) - 3 ];
+    };
+    static_assert( sizeof( Slot ) == SlotSize, "Unexpected slot padding" );
+
+public:
+    static constexpr size_t PAYLOAD_SIZE = sizeof( Slot::data );
+    static constexpr size_t MAX_MESSAGE_SIZE = PAYLOAD_SIZE * ( SlotCount / 4 );
+
+    LogRing() {
+        for ( size_t i = 0; i != SlotCount; i++ )
+            _slots[ i ].sequence.store( i, std::memory_order_relaxed );
+    }
+
+    LogRing( const LogRing& ) = delete;
+    LogRing& operator=( const LogRing& ) = delete;
+
+    // Store the message with a user tag. Messages longer than MAX_MESSAGE_SIZE
+    // are truncated. Return false if there is no room. Can be called from
+    // multiple tasks at once.
+    bool push( uint8_t tag, const char *data, size_t size ) {
+        size = std::min( size, MAX_MESSAGE_SIZE );
+        uint32_t count = std::max< size_t >( 1, ( size + PAYLOAD_SIZE - 1 ) / PAYLOAD_SIZE );
+        uint32_t position = _head.load( std::memory_order_relaxed );
+        while ( true ) {
+            bool available = true;
+            for ( uint32_t i = 0; i != count && available; i++ ) {
+                uint32_t sequence = slot( position + i ).sequence.load( std::memory_order_acquire );
+                int32_t diff = int32_t( sequence - ( position + i ) );
+                if ( diff < 0 )
+                    return false; // The consumer has not freed the slot yet
+                available = diff == 0;
+            }
+            // On failure, the position is updated and the claim is retried
+            if ( available && _head.compare_exchange_weak( position, position + count,
+                    std::memory_order_relaxed ) )
+            {
+                break;
+            }
+            if ( !available )
+                position = _head.load( std::memory_order_relaxed );
+        }
+
+        for ( uint32_t i = 0; i != count; i++ ) {
+            Slot& s = slot( position + i );
+            size_t chunk = std::min( size, PAYLOAD_SIZE );
+            std::memcpy( s.data, data, chunk );
+            s.size = chunk;
+            s.tag = tag;
+            s.more = i + 1 != count;
+            data += chunk;
+            size -= chunk;
+            s.sequence.store( position + i + 1, std::memory_order_release );
+        }
+        return true;
+    }
+
+    // Pop a single slot; f( tag, data, size, more ) is invoked with its
+    // content. Return false if the ring is empty. Only a single task can pop.
+    template < typename F >
+    bool pop( F f ) {
+        Slot& s = slot( _tail );
+        uint32_t sequence = s.sequence.load( std::memory_order_acquire );
+        if ( int32_t( sequence - ( _tail + 1 ) ) < 0 )
+            return false;
+        f( s.tag, s.data, s.size, s.more );
+        s.sequence.store( _tail + SlotCount, std::memory_order_release );
+        _tail++;
+        return true;
+    }
+
+private:
+    Slot& slot( uint32_t position ) {
+        return _slots[ position & ( SlotCount - 1 ) ];
+    }
+
+    Slot _slots[ SlotCount ];
+    std::atomic< uint32_t > _head{ 0 };
+    uint32_t _tail = 0;
+};
+
+} // namespace jac::utility
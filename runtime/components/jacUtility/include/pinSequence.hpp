@@ -0,0 +1,220 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace jac::utility {
+
+// Precompiled program of pin writes, delays and reads that is executed without
+// any interaction with the event loop.
+//
+// A program is a sequence of 32-bit words. Each instruction starts with a word
+// op << 28 | arg, some instructions are followed by operand words:
+// - SET pin, CLEAR pin: drive the pin high or low
+// - WRITE bank, mask, value: set all masked pins of the bank (pins 0-31 or
+//   32-63) at once
+// - DELAY us: wait the given number of microseconds
+// - READ pin: sample the pin level (0 or 1)
+// - READ_PORT bank, mask: sample masked levels of the bank
+// - LOOP count ... END_LOOP: repeat the body the given number of times
+// - WAIT pin | level << 8, timeout: wait until the pin reaches the level and
+//   sample the number of microseconds it took or TIMEOUT
+//
+// Delays are measured from a common time base, not from the end of the
+// previous instruction, so the time spent by writes and reads does not
+// accumulate. WAIT restarts the time base.
+//
+// The program is validated once when the sequence is created, so the execution
+// does not perform any checks. The number of samples is known in advance. The
+// execution busy-waits, so the validation also bounds the number of executed
+// instructions and the worst-case duration (the sum of all delays and wait
+// timeouts).
+//
+// The hardware is accessed via Backend that provides:
+// - void write( int bank, uint32_t mask, uint32_t value )
+// - uint32_t read( int bank )
+// - int64_t now(): time in microseconds
+class PinSequence {
+public:
+    enum Op : uint32_t {
+        SET = 1, CLEAR, WRITE, DELAY, READ, READ_PORT, LOOP, END_LOOP, WAIT
+    };
+
+    static inline constexpr uint32_t TIMEOUT = 0xFFFFFFFF;
+    static inline constexpr int MAX_PIN = 63;
+    static inline constexpr int MAX_LOOP_DEPTH = 4;
+    static inline constexpr size_t MAX_SAMPLES = 16384;
+    static inline constexpr uint64_t MAX_STEPS = 1'000'000;
+    static inline constexpr uint64_t MAX_DURATION = 1'000'000; // Microseconds
+
+    static constexpr uint32_t encode( Op op, uint32_t arg ) {
+        return op << 28 | ( arg & 0x0FFFFFFF );
+    }
+
+    // Validate the program, throws std::runtime_error if it is not valid
+    PinSequence( std::vector< uint32_t > program )
+        : _program( std::move( program ) )
+    {
+        // Multipliers are clamped, so they cannot overflow; each limit is
+        // exceeded by a single step of the clamped value
+        const uint64_t MAX_MULTIPLIER = std::max( { uint64_t( MAX_SAMPLES ), MAX_STEPS, MAX_DURATION } ) + 1;
+        uint64_t multiplier[ MAX_LOOP_DEPTH + 1 ] = { 1 };
+        uint64_t steps = 0;
+        int depth = 0;
+        for ( size_t i = 0; i != _program.size(); i++ ) {
+            uint32_t arg = _program[ i ] & 0x0FFFFFFF;
+            auto fail = [&]( const char *message ) {
+                throw std::runtime_error( std::string( message ) + " at word " + std::to_string( i ) );
+            };
+            auto operands = [&]( size_t count ) {
+                if ( _program.size() - i - 1 < count )
+                    fail( "Missing operand" );
+                i += count;
+            };
+            auto sample = [&] {
+                _sampleCount += multiplier[ depth ];
+                if ( _sampleCount > MAX_SAMPLES )
+                    fail( "Too many samples" );
+            };
+            auto wait = [&]( uint32_t us ) {
+                _maxDuration += multiplier[ depth ] * us;
+                if ( _maxDuration > MAX_DURATION )
+                    fail( "The sequence takes too long" );
+            };
+            steps += multiplier[ depth ];
+            if ( steps > MAX_STEPS )
+                fail( "Too many steps" );
+            switch ( _program[ i ] >> 28 ) {
+            case SET:
+            case CLEAR:
+                if ( arg > MAX_PIN )
+                    fail( "Invalid pin" );
+                break;
+            case WRITE:
+                if ( arg > 1 )
+                    fail( "Invalid bank" );
+                operands( 2 );
+                break;
+            case DELAY:
+                wait( arg );
+                break;
+            case READ:
+                if ( arg > MAX_PIN )
+                    fail( "Invalid pin" );
+                sample();
+                break;
+            case READ_PORT:
+                if ( arg > 1 )
+                    fail( "Invalid bank" );
+                operands( 1 );
+                sample();
+                break;
+            case LOOP:
+                if ( depth == MAX_LOOP_DEPTH )
+                    fail( "Loops nested too deep" );
+                if ( arg == 0 )
+                    fail( "Empty loop" );
+                depth++;
+                multiplier[ depth ] = std::min( multiplier[ depth - 1 ] * arg, MAX_MULTIPLIER );
+                break;
+            case END_LOOP:
+                if ( depth == 0 )
+                    fail( "Unmatched END_LOOP" );
+                depth--;
+                break;
+            case WAIT:
+                if ( ( arg & 0xFF ) > MAX_PIN || ( arg >> 8 ) > 1 )
+                    fail( "Invalid wait" );
+                operands( 1 );
+                wait( _program[ i ] );
+                sample();
+                break;
+            default:
+                fail( "Invalid instruction" );
+            }
+        }
+        if ( depth != 0 )
+            throw std::runtime_error( "Unterminated LOOP" );
+    }
+
+    size_t sampleCount() const { return _sampleCount; }
+    // Upper bound of the execution time in microseconds
+    uint64_t maxDuration() const { return _maxDuration; }
+
+    // Execute the program and store sampleCount() samples
+    template < typename Backend >
+    void run( Backend& backend, uint32_t *samples ) const {
+        struct Frame {
+            size_t start;
+            uint32_t remaining;
+        };
+        Frame loops[ MAX_LOOP_DEPTH ];
+        int depth = 0;
+        int64_t timeBase = backend.now();
+        const uint32_t *program = _program.data();
+        size_t size = _program.size();
+        for ( size_t i = 0; i != size; i++ ) {
+            uint32_t arg = program[ i ] & 0x0FFFFFFF;
+            switch ( program[ i ] >> 28 ) {
+            case SET:
+                backend.write( arg >> 5, 1u << ( arg & 31 ), 0xFFFFFFFF );
+                break;
+            case CLEAR:
+                backend.write( arg >> 5, 1u << ( arg & 31 ), 0 );
+                break;
+            case WRITE:
+                backend.write( arg, program[ i + 1 ], program[ i + 2 ] );
+                i += 2;
+                break;
+            case DELAY:
+                timeBase += arg;
+                while ( backend.now() < timeBase );
+                break;
+            case READ:
+                *samples++ = ( backend.read( arg >> 5 ) >> ( arg & 31 ) ) & 1;
+                break;
+            case READ_PORT:
+                *samples++ = backend.read( arg ) & program[ i + 1 ];
+                i += 1;
+                break;
+            case LOOP:
+                loops[ depth++ ] = { i, arg };
+                break;
+            case END_LOOP:
+                if ( --loops[ depth - 1 ].remaining != 0 )
+                    i = loops[ depth - 1 ].start;
+                else
+                    depth--;
+                break;
+            case WAIT: {
+                int pin = arg & 0xFF;
+                uint32_t level = arg >> 8;
+                int64_t start = backend.now();
+                int64_t deadline = start + program[ i + 1 ];
+                int64_t now = start;
+                bool reached;
+                while ( !( reached = ( ( backend.read( pin >> 5 ) >> ( pin & 31 ) ) & 1 ) == level )
+                    && now < deadline )
+                {
+                    now = backend.now();
+                }
+                *samples++ = reached ? uint32_t( now - start ) : TIMEOUT;
+                timeBase = now;
+                i += 1;
+                break;
+            }
+            }
+        }
+    }
+
+private:
+    std::vector< uint32_t > _program;
+    size_t _sampleCount = 0;
+    uint64_t _maxDuration = 0;
+};
+
+} // namespace jac::utility
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <esp_attr.h>
+
+namespace jac::utility {
+
+// Lock-free ring buffer for a single producer and a single consumer. The
+// producer can be an ISR. Size has to be a power of two.
+template < typename T, size_t Size >
+class SpscRing {
+    static_assert( Size > 0 && ( Size & ( Size - 1 ) ) == 0, "Size has to be a power of two" );
+public:
+    // Called by the producer. Return false if the ring is full.
+    bool IRAM_ATTR push( const T& item ) {
+        uint32_t head = _head.load( std::memory_order_relaxed );
+        if ( head - _tail.load( std::memory_order_acquire ) == Size )
+            return false;
+        _items[ head % Size ] = item;
+        _head.store( head + 1, std::memory_order_release );
+        return true;
+    }
+
+    // Called by the consumer. Return false if the ring is empty.
+    bool pop( T& item ) {
+        uint32_t tail = _tail.load( std::memory_order_relaxed );
+        if ( tail == _head.load( std::memory_order_acquire ) )
+            return false;
+        item = _items[ tail % Size ];
+        _tail.store( tail + 1, std::memory_order_release );
+        return true;
+    }
+
+    bool empty() const {
+        return _tail.load( std::memory_order_acquire ) == _head.load( std::memory_order_acquire );
+    }
+
+    // Drop all items; the producer must not be running
+    void reset() {
+        _head.store( 0, std::memory_order_relaxed );
+        _tail.store( 0, std::memory_order_release );
+    }
+
+private:
+    T _items[ Size ];
+    std::atomic< uint32_t > _head{ 0 };
+    std::atomic< uint32_t > _tail{ 0 };
+};
+
+} // namespace jac::utility
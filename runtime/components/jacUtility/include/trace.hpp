@@ -0,0 +1,206 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <string>
+
+// Timeline tracing
+//
+// Trace points record compact events into a fixed-size ring in RAM; when the
+// ring is full, the oldest events are overwritten, so the ring always holds
+// the most recent history. The ring is dumped in the Chrome trace-event
+// format (JSON), which can be opened in chrome://tracing or Perfetto.
+//
+// Trace points are written via JAC_TRACE_BEGIN( name ), JAC_TRACE_END( name ),
+// JAC_TRACE_SCOPE( name ), JAC_TRACE_INSTANT( name, arg ) and
+// JAC_TRACE_COUNTER( name, value ). The names have to be string literals, as
+// only the pointer is stored. Trace points can be used from ISRs.
+//
+// While tracing is not started, a trace point costs a single branch. Defining
+// JAC_TRACING to 0 removes the trace points completely. The ring has
+// JAC_TRACE_EVENTS events and it is allocated when tracing starts.
+
+#ifndef JAC_TRACING
+    #define JAC_TRACING 1
+#endif
+
+#ifndef JAC_TRACE_EVENTS
+    #define JAC_TRACE_EVENTS 1024
+#endif
+
+#define JAC_TRACE( phase, name, arg )                                          \
+    do {                                                                       \
+        if constexpr ( JAC_TRACING ) {                                         \
+            if ( ::jac::trace::enabled() )                                     \
+                ::jac::trace::record( phase, name, arg );                      \
+        }                                                                      \
+    } while ( 0 )
+
+#define JAC_TRACE_BEGIN( name ) JAC_TRACE( ::jac::trace::Phase::Begin, name, 0 )
+#define JAC_TRACE_END( name ) JAC_TRACE( ::jac::trace::Phase::End, name, 0 )
+#define JAC_TRACE_INSTANT( name, arg ) JAC_TRACE( ::jac::trace::Phase::Instant, name, arg )
+#define JAC_TRACE_COUNTER( name, value ) JAC_TRACE( ::jac::trace::Phase::Counter, name, value )
+
+#define JAC_TRACE_CONCAT_( a, b ) a##b
+#define JAC_TRACE_CONCAT( a, b ) JAC_TRACE_CONCAT_( a, b )
+#define JAC_TRACE_SCOPE( name )                                                \
+    ::jac::trace::Scope JAC_TRACE_CONCAT( _traceScope, __LINE__ )( name )
+
+namespace jac::trace {
+
+enum class Phase : uint8_t { Begin = 'B', End = 'E', Instant = 'i', Counter = 'C' };
+
+struct Event {
+    std::atomic< uint32_t > sequence; // Index of the event + 1 once written
+    uint32_t time; // Microseconds, wraps around
+    const char *name;
+    uint32_t arg;
+    uint32_t task; // 0 for ISRs
+    Phase phase;
+};
+
+namespace detail {
+
+static_assert( ( JAC_TRACE_EVENTS & ( JAC_TRACE_EVENTS - 1 ) ) == 0,
+    "JAC_TRACE_EVENTS has to be a power of two" );
+
+struct State {
+    std::atomic< bool > enabled{ false };
+    std::atomic< uint32_t > head{ 0 };
+    std::unique_ptr< Event[] > events;
+};
+
+// Constant-initialized, so there is no guard and ISRs can access it
+inline State globalState;
+
+inline State& state() {
+    return globalState;
+}
+
+} // namespace detail
+
+inline bool enabled() {
+    return detail::state().enabled.load( std::memory_order_relaxed );
+}
+
+// Store an event; prefer the JAC_TRACE_* macros
+inline void record( Phase phase, const char *name, uint32_t arg ) {
+    detail::State& s = detail::state();
+    uint32_t index = s.head.fetch_add( 1, std::memory_order_relaxed );
+    Event& e = s.events[ index & ( JAC_TRACE_EVENTS - 1 ) ];
+    e.time = esp_timer_get_time();
+    e.name = name;
+    e.arg = arg;
+    e.task = xPortInIsrContext()
+        ? 0 : uint32_t( reinterpret_cast< uintptr_t >( xTaskGetCurrentTaskHandle() ) );
+    e.phase = phase;
+    e.sequence.store( index + 1, std::memory_order_release );
+}
+
+// Record events of a scope
+class Scope {
+public:
+    Scope( const char *name ): _name( name ) {
+        JAC_TRACE_BEGIN( _name );
+    }
+
+    ~Scope() {
+        JAC_TRACE_END( _name );
+    }
+
+    Scope( const Scope& ) = delete;
+    Scope& operator=( const Scope& ) = delete;
+
+private:
+    const char *_name;
+};
+
+// Start recording; the ring is allocated on the first start and the previous
+// events are kept
+inline void start() {
+    detail::State& s = detail::state();
+    if ( !s.events ) {
+        s.events.reset( new Event[ JAC_TRACE_EVENTS ] );
+        for ( int i = 0; i != JAC_TRACE_EVENTS; i++ )
+            s.events[ i ].sequence.store( 0, std::memory_order_relaxed );
+    }
+    s.enabled = true;
+}
+
+inline void stop() {
+    detail::state().enabled = false;
+}
+
+// Write the recorded events as a Chrome trace-event JSON via
+// sink( const char *data, size_t size ). The recording is paused meanwhile.
+template < typename Sink >
+void writeChromeJson( Sink sink ) {
+    detail::State& s = detail::state();
+    bool wasEnabled = s.enabled.exchange( false );
+    auto write = [&]( const std::string& str ) { sink( str.data(), str.size() ); };
+
+    write( "{\"traceEvents\":[\n"
+           "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"ISR\"}}" );
+    if ( s.events ) {
+        // Events being written by preempted tasks are not published yet
+        vTaskDelay( 1 );
+        uint32_t head = s.head.load( std::memory_order_acquire );
+        uint32_t first = head > JAC_TRACE_EVENTS ? head - JAC_TRACE_EVENTS : 0;
+        std::set< uint32_t > tasks;
+        int64_t time = 0;
+        uint32_t lastTime = 0;
+        bool any = false;
+        for ( uint32_t index = first; index != head; index++ ) {
+            const Event& e = s.events[ index & ( JAC_TRACE_EVENTS - 1 ) ];
+            if ( e.sequence.load( std::memory_order_acquire ) != index + 1 )
+                continue;
+            // Unwrap the time; the events of different tasks might be slightly
+            // out of order
+            time = any ? time + int32_t( e.time - lastTime ) : e.time;
+            lastTime = e.time;
+            any = true;
+            if ( e.task )
+                tasks.insert( e.task );
+
+            char buffer[ 96 ];
+            int size = std::snprintf( buffer, sizeof( buffer ),
+                ",\n{\"ph\":\"%c\",\"ts\":%" PRId64 ",\"pid\":0,\"tid\":%" PRIu32 ",\"name\":\"",
+                char( e.phase ), time, e.task );
+            sink( buffer, size );
+            sink( e.name, std::strlen( e.name ) );
+            switch ( e.phase ) {
+            case Phase::Instant:
+                size = std::snprintf( buffer, sizeof( buffer ),
+                    "\",\"s\":\"t\",\"args\":{\"arg\":%" PRIu32 "}}", e.arg );
+                break;
+            case Phase::Counter:
+                size = std::snprintf( buffer, sizeof( buffer ),
+                    "\",\"args\":{\"value\":%" PRIu32 "}}", e.arg );
+                break;
+            default:
+                size = std::snprintf( buffer, sizeof( buffer ), "\"}" );
+            }
+            sink( buffer, size );
+        }
+        for ( uint32_t task : tasks ) {
+            char buffer[ 96 ];
+            int size = std::snprintf( buffer, sizeof( buffer ),
+                ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%" PRIu32
+                ",\"args\":{\"name\":\"task %08" PRIx32 "\"}}", task, task );
+            sink( buffer, size );
+        }
+    }
+    write( "\n]}\n" );
+    s.enabled = wasEnabled;
+}
+
+} // namespace jac::trace
@@ -11,15 +11,26 @@ extern "C" {
 #include <driver/uart.h>
 #include <iostream>
 
-#include <duk_console.h>
 #include <jsmachine.hpp>
 #include <features/cMemoryAllocator.hpp>
 #include <features/nodeModules.hpp>
 #include <features/socketDebugger.hpp>
 #include <features/stdoutErrorHandler.hpp>
+#include <features/asyncConsole.hpp>
 #include <features/rtosTimers.hpp>
+#include <features/idleGc.hpp>
+#include <features/heapSnapshot.hpp>
+#include <features/performance.hpp>
+#include <features/traceRecorder.hpp>
 #include <features/promise.hpp>
+#include <features/asyncFs.hpp>
+#include <features/keyValueStore.hpp>
+#include <features/timeSeriesLogger.hpp>
+#include <features/net.hpp>
+#include <features/remoteRepl.hpp>
 #include <features/platform/esp32/gpio.hpp>
+#include <features/platform/esp32/serial.hpp>
+#include <features/platform/esp32/hrTimers.hpp>
 
 #include <storage.hpp>
 #include <uploader.hpp>
@@ -29,10 +40,42 @@ extern "C" {
 // Uncomment the following line to enable the proof-of-concept debugger
 // #define ENABLE_TEMPORARY_DEBUGGER
 
-#ifdef ENABLE_TEMPORARY_DEBUGGER
+// Uncomment the following line to enable the uploader and the REPL over Wi-Fi
+// #define ENABLE_NETWORK_ACCESS
+
+// Uncomment the following line to include the interrupt latency benchmark
+// (module "latencyProbe", see tests/javascript/latency_benchmark)
+// #define ENABLE_LATENCY_PROBE
+
+// Uncomment the following line to include the benchmark of generated bindings
+// (module "bindingBenchmark", see tests/javascript/binding_benchmark)
+// #define ENABLE_BINDING_BENCHMARK
+
+// Scheduling policy of the event loop: FifoScheduling, PriorityScheduling or
+// DeadlineScheduling (see scheduling.hpp)
+#define SCHEDULING_POLICY FifoScheduling
+
+#if defined( ENABLE_TEMPORARY_DEBUGGER ) || defined( ENABLE_NETWORK_ACCESS )
+    #define ENABLE_WIFI
     #include "credentials.hpp"
 #endif
 
+#ifdef ENABLE_LATENCY_PROBE
+    #include <features/platform/esp32/latencyProbe.hpp>
+    #define LATENCY_PROBE_FEATURE , LatencyProbe
+#else
+    #define LATENCY_PROBE_FEATURE
+#endif
+
+#ifdef ENABLE_BINDING_BENCHMARK
+    #include <features/bindingBenchmark.hpp>
+    #define BINDING_BENCHMARK_FEATURE , BindingBenchmark
+#else
+    #define BINDING_BENCHMARK_FEATURE
+#endif
+
+const int NETWORK_UPLOADER_PORT = 2222;
+
 void gpioIntr(void *arg) {
     jac::storage::enterUploader();
 }
@@ -69,23 +112,39 @@ extern "C" void app_main() {
     using namespace jac;
 
     // Define javascript machines capabilities
-    using JsMachine = JsMachineBase<
+    using JsMachine = BasicJsMachine<
+            SCHEDULING_POLICY,
             StdoutErrorHandler,
+            AsyncConsole,
             CMemoryAllocator,
             RtosTimers,
+            HrTimers,
+            IdleGc,
+            HeapSnapshot,
+            PerformanceTimeline,
+            TraceRecorder,
             NodeModuleLoader,
             SocketDebugger,
             Promise,
-            GpioDriver
+            AsyncFilesystem,
+            KeyValueStore,
+            TimeSeriesLogger,
+            GpioDriver,
+            SerialPort,
+            NetSockets,
+            RemoteRepl
+            LATENCY_PROBE_FEATURE
+            BINDING_BENCHMARK_FEATURE
         >;
 
     setupUartDriver(); // Without UART drive stdio is non-blocking
+    log::startDrain();
     setupGpio();
     storage::initializeFatFs( "/spiflash" );
     storage::initializeUploader( "/spiflash" );
     initNvs();
 
-    #ifdef ENABLE_TEMPORARY_DEBUGGER
+    #ifdef ENABLE_WIFI
         WiFiConnector connector;
         if ( !connector.sync().connect( SSID, password ) ) {
             std::cout << "WiFi connection failed\n";
@@ -94,19 +153,21 @@ extern "C" void app_main() {
             std::cout << "IP address: " << connector.ipAddrStr() << "\n";
         }
     #endif
+    #ifdef ENABLE_NETWORK_ACCESS
+        storage::initializeNetworkUploader( NETWORK_UPLOADER_PORT );
+    #endif
 
     try {
         JsMachine::Configuration cfg;
         cfg.basePath = "/spiflash";
         JsMachine machine( cfg );
 
-        machine.extend( []( JsMachine* machine, duk_context* ctx) {
-            duk_console_init( ctx, 0 );
-        });
-
         #ifdef ENABLE_TEMPORARY_DEBUGGER
             machine.waitForDebugger();
         #endif
+        #ifdef ENABLE_NETWORK_ACCESS
+            machine.startRemoteRepl();
+        #endif
 
         // The following code makes stacktraces richer
         // TBA: Refactor into a separate machine feature
@@ -129,11 +190,14 @@ extern "C" void app_main() {
         machine.runEventLoop();
     }
     catch( const std::runtime_error& e ) {
+        log::flush();
         std::cerr << "FAILED with runtime error: " << e.what() << "\n";
     }
     catch( const std::exception& e ) {
+        log::flush();
         std::cerr << "FAILED: " << e.what() << "\n";
     }
 
+    log::flush();
     esp_restart();
 }
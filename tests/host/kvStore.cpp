@@ -0,0 +1,178 @@
+#include <catch2/catch.hpp>
+
+#include <kvStore.hpp>
+
+#include "memoryMedium.hpp"
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+using namespace jac::storage;
+
+namespace {
+
+const size_t SECTOR_SIZE = 512;
+const size_t MEDIUM_SIZE = 4 * SECTOR_SIZE;
+
+// Keys of 4 characters and values of 40 characters give records of 52 bytes
+// with no padding, so a record cut anywhere is damaged
+std::string key( int i ) {
+    return "key" + std::to_string( i );
+}
+
+std::string value( int seed ) {
+    std::string v = "value-" + std::to_string( seed );
+    v.resize( 40, '.' );
+    return v;
+}
+
+KvStore::Change put( const std::string& key, const std::string& value ) {
+    return { key, KvStore::Value{ KvStore::ValueType::String, value } };
+}
+
+KvStore::Change deletion( const std::string& key ) {
+    return { key, std::nullopt };
+}
+
+using Contents = std::map< std::string, std::string >;
+
+Contents contents( KvStore& store ) {
+    Contents result;
+    for ( const auto& k : store.keys() )
+        result[ k ] = store.get( k )->data;
+    return result;
+}
+
+} // namespace
+
+TEST_CASE( "KvStore stores, deletes and reloads values" ) {
+    MemoryMedium medium( MEDIUM_SIZE, SECTOR_SIZE );
+    {
+        KvStore store( medium );
+        CHECK( store.keys().empty() );
+        CHECK( store.usage().generation == 1 );
+        store.commit( { put( "a", "1" ), put( "b", "2" ) } );
+        store.commit( { { "c", KvStore::Value{ KvStore::ValueType::Json, "{}" } } } );
+        store.commit( { deletion( "a" ), put( "b", "3" ) } );
+
+        CHECK( !store.get( "a" ) );
+        CHECK( store.get( "b" )->data == "3" );
+        CHECK( store.get( "c" )->type == KvStore::ValueType::Json );
+    }
+    KvStore store( medium );
+    CHECK( contents( store ) == Contents{ { "b", "3" }, { "c", "{}" } } );
+    CHECK( store.get( "c" )->type == KvStore::ValueType::Json );
+}
+
+TEST_CASE( "KvStore compacts within a commit" ) {
+    MemoryMedium medium( MEDIUM_SIZE, SECTOR_SIZE );
+    KvStore store( medium );
+    Contents expected;
+    int compactions = 0;
+    for ( int i = 0; i != 200; i++ ) {
+        uint32_t generation = store.usage().generation;
+        // Batches of various sizes, so they cross the end of a half at
+        // different places
+        std::vector< KvStore::Change > batch;
+        for ( int j = 0; j <= i % 4; j++ ) {
+            int k = ( i + j ) % 6;
+            batch.push_back( put( key( k ), value( i ) ) );
+            expected[ key( k ) ] = value( i );
+        }
+        if ( i % 7 == 0 ) {
+            batch.push_back( deletion( key( i % 6 ) ) );
+            expected.erase( key( i % 6 ) );
+        }
+        store.commit( batch );
+
+        if ( store.usage().generation != generation ) {
+            compactions++;
+            CHECK( store.usage().generation == generation + 1 );
+        }
+        REQUIRE( contents( store ) == expected );
+        KvStore reloaded( medium );
+        REQUIRE( contents( reloaded ) == expected );
+        REQUIRE( reloaded.usage().generation == store.usage().generation );
+    }
+    CHECK( compactions > 5 );
+}
+
+TEST_CASE( "KvStore ignores a torn last batch" ) {
+    MemoryMedium medium( MEDIUM_SIZE, SECTOR_SIZE );
+    {
+        KvStore store( medium );
+        store.commit( { put( key( 0 ), value( 0 ) ), put( key( 1 ), value( 1 ) ) } );
+    }
+    std::vector< KvStore::Change > batch = {
+        put( key( 1 ), value( 11 ) ), put( key( 2 ), value( 12 ) ), deletion( key( 0 ) ) };
+    // Two values and a deletion of a key
+    const size_t batchSize = 2 * 52 + 12;
+
+    for ( size_t cut = 0; cut != batchSize; cut++ ) {
+        CAPTURE( cut );
+        MemoryMedium torn = medium;
+        {
+            KvStore store( torn );
+            torn.writeBudget = cut;
+            CHECK_THROWS_AS( store.commit( batch ), MemoryMedium::PowerLoss );
+        }
+        torn.writeBudget = std::numeric_limits< size_t >::max();
+
+        KvStore store( torn );
+        REQUIRE( contents( store ) == Contents{ { key( 0 ), value( 0 ) }, { key( 1 ), value( 1 ) } } );
+        // The store cannot append after the damaged record, the next commit
+        // has to compact it first
+        store.commit( { put( key( 3 ), value( 3 ) ) } );
+        KvStore reloaded( torn );
+        REQUIRE( contents( reloaded ) == Contents{ { key( 0 ), value( 0 ) },
+            { key( 1 ), value( 1 ) }, { key( 3 ), value( 3 ) } } );
+    }
+
+    KvStore store( medium );
+    store.commit( batch );
+    KvStore reloaded( medium );
+    CHECK( contents( reloaded ) == Contents{ { key( 1 ), value( 11 ) }, { key( 2 ), value( 12 ) } } );
+}
+
+TEST_CASE( "KvStore reloads the half of the higher generation" ) {
+    MemoryMedium medium( MEDIUM_SIZE, SECTOR_SIZE );
+    KvStore store( medium );
+    store.commit( { put( key( 0 ), value( 0 ) ) } );
+
+    SECTION( "after complete compactions" ) {
+        // Both halves keep a valid header, the stale one with the older
+        // contents. The active half alternates.
+        for ( int i = 1; i != 4; i++ ) {
+            store.commit( { put( key( 0 ), value( i ) ) } );
+            store.compact();
+            KvStore reloaded( medium );
+            CHECK( reloaded.usage().generation == uint32_t( i + 1 ) );
+            CHECK( contents( reloaded ) == Contents{ { key( 0 ), value( i ) } } );
+        }
+    }
+
+    SECTION( "after an interrupted compaction" ) {
+        store.commit( { put( key( 1 ), value( 1 ) ) } );
+        // Measure how much the compaction writes; the header goes last
+        MemoryMedium probe = medium;
+        {
+            KvStore probeStore( probe );
+            probe.written = 0;
+            probeStore.compact();
+        }
+        for ( size_t cut : { size_t( 0 ), probe.written / 2, probe.written - 16, probe.written - 1 } ) {
+            CAPTURE( cut );
+            MemoryMedium interrupted = medium;
+            {
+                KvStore s( interrupted );
+                interrupted.writeBudget = cut;
+                CHECK_THROWS_AS( s.compact(), MemoryMedium::PowerLoss );
+            }
+            interrupted.writeBudget = std::numeric_limits< size_t >::max();
+            KvStore reloaded( interrupted );
+            CHECK( reloaded.usage().generation == 1 );
+            CHECK( contents( reloaded ) == Contents{ { key( 0 ), value( 0 ) }, { key( 1 ), value( 1 ) } } );
+        }
+    }
+}
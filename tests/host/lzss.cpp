@@ -0,0 +1,136 @@
+#include <catch2/catch.hpp>
+
+#include <lzss.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace jac::storage;
+
+using Bytes = std::vector< unsigned char >;
+
+static Bytes compress( const Bytes& data, int chunkSize ) {
+    Bytes out;
+    lzss::Encoder encoder( [&]( const unsigned char *d, int size ) {
+        out.insert( out.end(), d, d + size );
+    } );
+    for ( size_t i = 0; i < data.size(); i += chunkSize ) {
+        int size = std::min< size_t >( chunkSize, data.size() - i );
+        encoder.feed( data.data() + i, size );
+    }
+    encoder.finish();
+    return out;
+}
+
+static Bytes decompress( const Bytes& data, int chunkSize, bool *complete = nullptr ) {
+    Bytes out;
+    lzss::Decoder decoder( [&]( const unsigned char *d, int size ) {
+        out.insert( out.end(), d, d + size );
+    } );
+    for ( size_t i = 0; i < data.size(); i += chunkSize ) {
+        int size = std::min< size_t >( chunkSize, data.size() - i );
+        decoder.feed( data.data() + i, size );
+    }
+    bool finished = decoder.finish();
+    if ( complete )
+        *complete = finished;
+    return out;
+}
+
+static Bytes pseudoRandom( size_t size, uint32_t seed ) {
+    Bytes data( size );
+    for ( auto& b : data ) {
+        seed = seed * 1664525 + 1013904223;
+        b = seed >> 24;
+    }
+    return data;
+}
+
+static void checkRoundTrip( const Bytes& data ) {
+    for ( int chunkSize : { 1, 7, 64, 1000, 5000 } ) {
+        Bytes compressed = compress( data, chunkSize );
+        // A group of 8 literals takes 9 bytes
+        CHECK( compressed.size() <= data.size() + ( data.size() + 7 ) / 8 );
+        bool complete = false;
+        CHECK( decompress( compressed, chunkSize, &complete ) == data );
+        CHECK( complete );
+    }
+}
+
+TEST_CASE( "LZSS round trip" ) {
+    SECTION( "empty input" ) {
+        Bytes compressed = compress( {}, 1 );
+        CHECK( compressed.empty() );
+        bool complete = false;
+        CHECK( decompress( compressed, 1, &complete ).empty() );
+        CHECK( complete );
+    }
+
+    SECTION( "incompressible input" ) {
+        Bytes data = pseudoRandom( 5000, 42 );
+        checkRoundTrip( data );
+        CHECK( compress( data, 5000 ).size() == data.size() + ( data.size() + 7 ) / 8 );
+    }
+
+    SECTION( "all-repeated input" ) {
+        Bytes data( 10000, 'a' );
+        checkRoundTrip( data );
+        // A literal and then back-references of the maximal length
+        CHECK( compress( data, 5000 ).size() < data.size() / lzss::MAX_MATCH * 3 );
+    }
+
+    SECTION( "matches at the window boundary" ) {
+        // The block repeats exactly WINDOW_SIZE bytes back, i.e., at the
+        // largest offset that can be encoded
+        Bytes block = pseudoRandom( lzss::WINDOW_SIZE, 7 );
+        Bytes data = block;
+        data.insert( data.end(), block.begin(), block.end() );
+        data.insert( data.end(), block.begin(), block.end() );
+        checkRoundTrip( data );
+        CHECK( compress( data, 5000 ).size() < 2 * block.size() );
+
+        // One byte further back is out of reach of the window
+        Bytes shifted = pseudoRandom( lzss::WINDOW_SIZE + 1, 9 );
+        Bytes farData = shifted;
+        farData.insert( farData.end(), shifted.begin(), shifted.end() );
+        checkRoundTrip( farData );
+    }
+
+    SECTION( "sizes around the encoder buffer" ) {
+        for ( int size : { 2 * lzss::WINDOW_SIZE - 1, 2 * lzss::WINDOW_SIZE,
+                2 * lzss::WINDOW_SIZE + 1, 2 * lzss::WINDOW_SIZE + lzss::MAX_MATCH } )
+        {
+            Bytes data = pseudoRandom( size, size );
+            for ( int i = 0; i < size; i += 100 )
+                data[ i ] = data[ i / 2 ];
+            checkRoundTrip( data );
+        }
+    }
+}
+
+TEST_CASE( "LZSS decoder detects a truncated back-reference" ) {
+    Bytes data( 100, 'x' );
+    Bytes compressed = compress( data, 100 );
+    REQUIRE( compressed.back() != 0 );
+    compressed.pop_back();
+    bool complete = true;
+    decompress( compressed, 100, &complete );
+    CHECK( !complete );
+}
+
+// The stream produced by lzssCompress in tools/transfer.py; the firmware and
+// the host tool have to agree on the format
+TEST_CASE( "LZSS matches transfer.py" ) {
+    std::string text = "Jaculus runs JavaScript on ESP32. Jaculus runs JavaScript on ESP32! "
+        + std::string( 40, 'a' ) + "xyzxyzxyz";
+    Bytes data( text.begin(), text.end() );
+    Bytes expected = {
+        0xff, 0x4a, 0x61, 0x63, 0x75, 0x6c, 0x75, 0x73, 0x20, 0xff, 0x72, 0x75,
+        0x6e, 0x73, 0x20, 0x4a, 0x61, 0x76, 0xff, 0x61, 0x53, 0x63, 0x72, 0x69,
+        0x70, 0x74, 0x20, 0xff, 0x6f, 0x6e, 0x20, 0x45, 0x53, 0x50, 0x33, 0x32,
+        0xb9, 0x2e, 0x05, 0x00, 0x08, 0x5b, 0x21, 0x20, 0x61, 0x00, 0x24, 0x78,
+        0x03, 0x79, 0x7a, 0x00, 0x83 };
+    CHECK( decompress( expected, 5 ) == data );
+    CHECK( compress( data, 5 ) == expected );
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <medium.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+// In-memory medium with the semantics of a NOR flash. It can simulate a power
+// loss: once the write budget is exhausted, the write is cut short and throws.
+class MemoryMedium: public jac::storage::Medium {
+public:
+    struct PowerLoss: std::runtime_error {
+        PowerLoss(): std::runtime_error( "Power loss" ) {}
+    };
+
+    MemoryMedium( size_t size, size_t sectorSize )
+        : _data( size, 0xFF ), _sectorSize( sectorSize )
+    {}
+
+    size_t size() const override { return _data.size(); }
+    size_t sectorSize() const override { return _sectorSize; }
+
+    void read( size_t offset, void *data, size_t size ) override {
+        checkRange( offset, size );
+        std::memcpy( data, _data.data() + offset, size );
+    }
+
+    void write( size_t offset, const void *data, size_t size ) override {
+        checkRange( offset, size );
+        size_t allowed = std::min( size, writeBudget );
+        const auto *bytes = static_cast< const unsigned char * >( data );
+        for ( size_t i = 0; i != allowed; i++ )
+            _data[ offset + i ] &= bytes[ i ];
+        writeBudget -= allowed;
+        written += allowed;
+        if ( allowed != size )
+            throw PowerLoss();
+    }
+
+    void erase( size_t offset, size_t size ) override {
+        checkRange( offset, size );
+        if ( offset % _sectorSize != 0 || size % _sectorSize != 0 )
+            throw std::runtime_error( "Unaligned erase" );
+        std::fill_n( _data.begin() + offset, size, 0xFF );
+    }
+
+    // Bytes that can be written before a simulated power loss
+    size_t writeBudget = std::numeric_limits< size_t >::max();
+    // Bytes written so far
+    size_t written = 0;
+
+private:
+    void checkRange( size_t offset, size_t size ) const {
+        if ( offset > _data.size() || size > _data.size() - offset )
+            throw std::runtime_error( "Access out of the medium" );
+    }
+
+    std::vector< unsigned char > _data;
+    size_t _sectorSize;
+};
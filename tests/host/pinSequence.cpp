@@ -0,0 +1,200 @@
+#include <catch2/catch.hpp>
+
+#include <pinSequence.hpp>
+
+#include <functional>
+#include <vector>
+
+using jac::utility::PinSequence;
+using Op = PinSequence::Op;
+
+namespace {
+
+// Backend with a simulated clock that advances by a microsecond on every
+// reading, so busy waits terminate. Writes are recorded with their time,
+// inputs are given as a function of time.
+struct MockBackend {
+    struct Write {
+        int64_t time;
+        int bank;
+        uint32_t mask;
+        uint32_t value;
+    };
+
+    int64_t time = 1000;
+    std::vector< Write > writes;
+    std::function< uint32_t( int bank, int64_t time ) > input =
+        []( int, int64_t ) { return 0u; };
+
+    void write( int bank, uint32_t mask, uint32_t value ) {
+        writes.push_back( { time, bank, mask, value } );
+    }
+
+    uint32_t read( int bank ) {
+        return input( bank, time );
+    }
+
+    int64_t now() {
+        return time++;
+    }
+};
+
+uint32_t op( Op o, uint32_t arg = 0 ) {
+    return PinSequence::encode( o, arg );
+}
+
+std::vector< uint32_t > run( const PinSequence& sequence, MockBackend& backend ) {
+    std::vector< uint32_t > samples( sequence.sampleCount() );
+    sequence.run( backend, samples.data() );
+    return samples;
+}
+
+} // namespace
+
+TEST_CASE( "PinSequence validates the program" ) {
+    SECTION( "sample count" ) {
+        PinSequence sequence( {
+            op( Op::READ, 3 ),
+            op( Op::LOOP, 4 ),
+                op( Op::READ_PORT, 1 ), 0xFF,
+                op( Op::LOOP, 3 ),
+                    op( Op::WAIT, 5 | 1 << 8 ), 100,
+                op( Op::END_LOOP ),
+            op( Op::END_LOOP ),
+            op( Op::SET, 63 ),
+        } );
+        CHECK( sequence.sampleCount() == 1 + 4 * ( 1 + 3 ) );
+    }
+
+    SECTION( "invalid programs" ) {
+        auto invalid = []( std::vector< uint32_t > program ) {
+            CHECK_THROWS_AS( PinSequence( std::move( program ) ), std::runtime_error );
+        };
+        invalid( { op( Op::SET, 64 ) } );
+        invalid( { op( Op::READ, 64 ) } );
+        invalid( { op( Op::WRITE, 2 ), 1, 1 } );
+        invalid( { op( Op::WRITE, 0 ), 1 } );
+        invalid( { op( Op::READ_PORT, 0 ) } );
+        invalid( { op( Op::WAIT, 1 | 2 << 8 ), 10 } );
+        invalid( { op( Op::LOOP, 0 ), op( Op::END_LOOP ) } );
+        invalid( { op( Op::LOOP, 2 ) } );
+        invalid( { op( Op::END_LOOP ) } );
+        invalid( { 0 } );
+        invalid( { 0xF0000000 } );
+
+        std::vector< uint32_t > deep;
+        for ( int i = 0; i <= PinSequence::MAX_LOOP_DEPTH; i++ )
+            deep.push_back( op( Op::LOOP, 2 ) );
+        for ( int i = 0; i <= PinSequence::MAX_LOOP_DEPTH; i++ )
+            deep.push_back( op( Op::END_LOOP ) );
+        invalid( deep );
+
+        invalid( { op( Op::LOOP, PinSequence::MAX_SAMPLES ), op( Op::READ, 0 ),
+            op( Op::READ, 0 ), op( Op::END_LOOP ) } );
+    }
+
+    SECTION( "duration" ) {
+        auto invalid = []( std::vector< uint32_t > program ) {
+            CHECK_THROWS_AS( PinSequence( std::move( program ) ), std::runtime_error );
+        };
+        PinSequence sequence( {
+            op( Op::DELAY, 1000 ),
+            op( Op::LOOP, 10 ),
+                op( Op::WAIT, 3 ), 500,
+                op( Op::DELAY, 100 ),
+            op( Op::END_LOOP ),
+        } );
+        CHECK( sequence.maxDuration() == 1000 + 10 * ( 500 + 100 ) );
+
+        CHECK_NOTHROW( PinSequence( { op( Op::DELAY, PinSequence::MAX_DURATION ) } ) );
+        invalid( { op( Op::DELAY, PinSequence::MAX_DURATION + 1 ) } );
+        invalid( { op( Op::WAIT, 3 ), PinSequence::MAX_DURATION + 1 } );
+        invalid( { op( Op::DELAY, 0x0FFFFFFF ) } );
+        // Loops multiply the duration; the multiplier cannot overflow
+        invalid( { op( Op::LOOP, 0x0FFFFFFF ), op( Op::LOOP, 0x0FFFFFFF ),
+            op( Op::DELAY, 1 ), op( Op::END_LOOP ), op( Op::END_LOOP ) } );
+        invalid( { op( Op::LOOP, 1000 ), op( Op::WAIT, 3 ), 1001, op( Op::END_LOOP ) } );
+        // Even a loop without delays cannot run indefinitely
+        invalid( { op( Op::LOOP, 0x0FFFFFFF ), op( Op::LOOP, 0x0FFFFFFF ),
+            op( Op::SET, 1 ), op( Op::END_LOOP ), op( Op::END_LOOP ) } );
+        CHECK_NOTHROW( PinSequence( { op( Op::LOOP, 1000 ), op( Op::SET, 1 ),
+            op( Op::CLEAR, 1 ), op( Op::END_LOOP ) } ) );
+    }
+}
+
+TEST_CASE( "PinSequence drives the pins on a common time base" ) {
+    PinSequence sequence( {
+        op( Op::LOOP, 3 ),
+            op( Op::SET, 33 ),
+            op( Op::DELAY, 10 ),
+            op( Op::CLEAR, 33 ),
+            op( Op::DELAY, 20 ),
+        op( Op::END_LOOP ),
+        op( Op::WRITE, 0 ), 0x0F, 0x05,
+    } );
+    CHECK( sequence.sampleCount() == 0 );
+
+    MockBackend backend;
+    int64_t start = backend.time;
+    run( sequence, backend );
+
+    REQUIRE( backend.writes.size() == 7 );
+    for ( int i = 0; i != 3; i++ ) {
+        const auto& set = backend.writes[ 2 * i ];
+        const auto& clear = backend.writes[ 2 * i + 1 ];
+        CHECK( set.bank == 1 );
+        CHECK( set.mask == 1u << 1 );
+        CHECK( set.value == 0xFFFFFFFF );
+        CHECK( clear.bank == 1 );
+        CHECK( clear.mask == 1u << 1 );
+        CHECK( clear.value == 0 );
+        // The time spent in the writes does not accumulate
+        CHECK( clear.time - start - 30 * i - 10 <= 1 );
+        CHECK( clear.time - start - 30 * i - 10 >= 0 );
+    }
+    const auto& write = backend.writes.back();
+    CHECK( write.bank == 0 );
+    CHECK( write.mask == 0x0F );
+    CHECK( write.value == 0x05 );
+    CHECK( write.time - start - 90 <= 1 );
+}
+
+TEST_CASE( "PinSequence samples the inputs" ) {
+    MockBackend backend;
+    int64_t start = backend.time;
+    // Pin 2 toggles every 5 microseconds, pin 40 goes high after 100
+    backend.input = [&]( int bank, int64_t time ) -> uint32_t {
+        int64_t elapsed = time - start;
+        if ( bank == 0 )
+            return ( elapsed / 5 % 2 ) << 2 | 0xF0;
+        return elapsed >= 100 ? 1u << 8 : 0u;
+    };
+
+    PinSequence sequence( {
+        op( Op::LOOP, 4 ),
+            op( Op::DELAY, 5 ),
+            op( Op::READ, 2 ),
+        op( Op::END_LOOP ),
+        op( Op::READ_PORT, 0 ), 0x3C,
+        op( Op::WAIT, 40 | 1 << 8 ), 1000,
+        op( Op::WAIT, 40 ), 50,
+        op( Op::DELAY, 7 ),
+        op( Op::READ, 40 ),
+    } );
+    std::vector< uint32_t > samples = run( sequence, backend );
+    REQUIRE( samples.size() == 8 );
+
+    CHECK( samples[ 0 ] == 1 );
+    CHECK( samples[ 1 ] == 0 );
+    CHECK( samples[ 2 ] == 1 );
+    CHECK( samples[ 3 ] == 0 );
+    CHECK( ( samples[ 4 ] & ~0x04u ) == 0x30 );
+    // The first wait starts at about 21 us and ends at 100 us
+    CHECK( samples[ 5 ] >= 77 );
+    CHECK( samples[ 5 ] <= 81 );
+    CHECK( samples[ 6 ] == PinSequence::TIMEOUT );
+    CHECK( samples[ 7 ] == 1 );
+    // The wait restarts the time base
+    CHECK( backend.time - start >= 100 + 50 + 7 );
+    CHECK( backend.time - start <= 100 + 50 + 7 + 4 );
+}
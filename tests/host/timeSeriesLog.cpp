@@ -0,0 +1,187 @@
+#include <catch2/catch.hpp>
+
+#include <timeSeriesLog.hpp>
+
+#include "memoryMedium.hpp"
+
+#include <utility>
+#include <vector>
+
+using namespace jac::storage;
+
+namespace {
+
+// With a single field, a record takes 16 bytes and a sector holds 14 of them
+const size_t SECTOR_SIZE = 256;
+const size_t SECTOR_COUNT = 4;
+const size_t RECORD_SIZE = 16;
+const uint32_t SLOTS = 14;
+
+using Records = std::vector< std::pair< int64_t, float > >;
+
+Records query( TimeSeriesLog& log, int64_t from, int64_t to, size_t limit = SIZE_MAX ) {
+    std::vector< int64_t > timestamps;
+    std::vector< float > fields;
+    size_t found = log.query( from, to, limit, timestamps, fields );
+    REQUIRE( found == timestamps.size() );
+    REQUIRE( found == fields.size() );
+    Records result;
+    for ( size_t i = 0; i != found; i++ )
+        result.emplace_back( timestamps[ i ], fields[ i ] );
+    return result;
+}
+
+Records all( TimeSeriesLog& log ) {
+    return query( log, INT64_MIN, INT64_MAX );
+}
+
+Records append( TimeSeriesLog& log, int64_t from, int count ) {
+    Records appended;
+    for ( int i = 0; i != count; i++ ) {
+        float value = float( from + i ) / 2;
+        log.append( 100 * ( from + i ), &value );
+        appended.emplace_back( 100 * ( from + i ), value );
+    }
+    return appended;
+}
+
+Records concat( Records a, const Records& b ) {
+    a.insert( a.end(), b.begin(), b.end() );
+    return a;
+}
+
+} // namespace
+
+TEST_CASE( "TimeSeriesLog keeps pending records until flushed" ) {
+    MemoryMedium medium( SECTOR_COUNT * SECTOR_SIZE, SECTOR_SIZE );
+    Records flushed;
+    {
+        TimeSeriesLog log( medium, 1, 8 );
+        flushed = append( log, 0, 8 );
+        Records pending = append( log, 8, 3 );
+        CHECK( log.statistics().pending == 3 );
+        CHECK( all( log ) == concat( flushed, pending ) );
+        CHECK_THROWS( append( log, 0, 1 ) );
+    }
+    TimeSeriesLog log( medium, 1, 8 );
+    CHECK( all( log ) == flushed );
+    CHECK( log.statistics().newest == flushed.back().first );
+
+    // A log of another format does not see the records
+    TimeSeriesLog other( medium, 2, 8 );
+    CHECK( other.statistics().records == 0 );
+}
+
+TEST_CASE( "TimeSeriesLog wraps around the ring" ) {
+    MemoryMedium medium( SECTOR_COUNT * SECTOR_SIZE, SECTOR_SIZE );
+    TimeSeriesLog log( medium, 1, 5 );
+    Records appended;
+    for ( int i = 0; i != 200; i += 10 ) {
+        appended = concat( appended, append( log, i, 10 ) );
+        log.flush();
+
+        // The oldest sector is dropped as a whole
+        auto stats = log.statistics();
+        CHECK( stats.capacity == SECTOR_COUNT * SLOTS );
+        if ( appended.size() <= stats.capacity )
+            CHECK( stats.records == appended.size() );
+        else
+            CHECK( stats.records > stats.capacity - SLOTS );
+        Records kept( appended.end() - std::min( appended.size(), stats.records ), appended.end() );
+        CHECK( stats.oldest == kept.front().first );
+        CHECK( all( log ) == kept );
+
+        TimeSeriesLog reloaded( medium, 1, 5 );
+        CHECK( all( reloaded ) == kept );
+    }
+}
+
+TEST_CASE( "TimeSeriesLog recovers the used slots of a sector" ) {
+    for ( int count = 0; count <= int( 2 * SLOTS ); count++ ) {
+        CAPTURE( count );
+        MemoryMedium medium( SECTOR_COUNT * SECTOR_SIZE, SECTOR_SIZE );
+        Records appended;
+        {
+            TimeSeriesLog log( medium, 1, 64 );
+            appended = append( log, 0, count );
+            log.flush();
+        }
+        TimeSeriesLog log( medium, 1, 64 );
+        REQUIRE( log.statistics().records == size_t( count ) );
+        REQUIRE( all( log ) == appended );
+
+        // Appending continues after the last used slot
+        appended = concat( appended, append( log, count, 3 ) );
+        log.flush();
+        TimeSeriesLog reloaded( medium, 1, 64 );
+        REQUIRE( all( reloaded ) == appended );
+    }
+}
+
+TEST_CASE( "TimeSeriesLog drops a torn record" ) {
+    MemoryMedium medium( SECTOR_COUNT * SECTOR_SIZE, SECTOR_SIZE );
+    Records stored;
+    {
+        TimeSeriesLog log( medium, 1, 64 );
+        stored = append( log, 0, 4 );
+        log.flush();
+    }
+    // The batch fits the first sector
+    const int batch = 6;
+    for ( size_t cut = 0; cut != batch * RECORD_SIZE; cut++ ) {
+        CAPTURE( cut );
+        MemoryMedium torn = medium;
+        Records appended;
+        {
+            TimeSeriesLog log( torn, 1, 64 );
+            appended = append( log, 4, batch );
+            torn.writeBudget = cut;
+            CHECK_THROWS_AS( log.flush(), MemoryMedium::PowerLoss );
+        }
+        torn.writeBudget = SIZE_MAX;
+
+        TimeSeriesLog log( torn, 1, 64 );
+        Records complete = concat( stored, Records( appended.begin(),
+            appended.begin() + cut / RECORD_SIZE ) );
+        REQUIRE( all( log ) == complete );
+
+        // The following records go after the complete ones
+        complete = concat( complete, append( log, 4 + batch, 3 ) );
+        log.flush();
+        TimeSeriesLog reloaded( torn, 1, 64 );
+        REQUIRE( all( reloaded ) == complete );
+    }
+}
+
+TEST_CASE( "TimeSeriesLog queries across sectors" ) {
+    MemoryMedium medium( SECTOR_COUNT * SECTOR_SIZE, SECTOR_SIZE );
+    TimeSeriesLog log( medium, 1, 4 );
+    // Runs of equal timestamps cross the sector boundaries
+    Records appended;
+    for ( int i = 0; i != 3 * int( SLOTS ) + 5; i++ ) {
+        float value = i;
+        log.append( 10 * ( i / 3 ), &value );
+        appended.emplace_back( 10 * ( i / 3 ), value );
+    }
+
+    auto expected = [&]( int64_t from, int64_t to, size_t limit ) {
+        Records result;
+        for ( const auto& record : appended ) {
+            if ( record.first >= from && record.first <= to && result.size() < limit )
+                result.push_back( record );
+        }
+        return result;
+    };
+
+    int64_t last = appended.back().first;
+    for ( int64_t from = -5; from <= last + 5; from += 5 ) {
+        for ( int64_t to = from; to <= last + 5; to += 5 ) {
+            for ( size_t limit : { size_t( 1 ), size_t( 7 ), SIZE_MAX } ) {
+                CAPTURE( from, to, limit );
+                REQUIRE( query( log, from, to, limit ) == expected( from, to, limit ) );
+            }
+        }
+    }
+    CHECK( query( log, last + 1, INT64_MAX ).empty() );
+    CHECK( query( log, 20, 10 ).empty() );
+}
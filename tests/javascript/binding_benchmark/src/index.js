@@ -0,0 +1,31 @@
+const bench = require("bindingBenchmark");
+
+// Compare the call overhead of handwritten bindings with the generated ones.
+// Each result is printed as a single JSON line. The benchmark has to be enabled
+// by ENABLE_BINDING_BENCHMARK in main.cpp.
+const ITERATIONS = 20000;
+
+function measure(name, fn) {
+    // Subtract the cost of the loop itself
+    var start = millis();
+    for (var i = 0; i < ITERATIONS; i++);
+    var empty = millis() - start;
+
+    start = millis();
+    for (var i = 0; i < ITERATIONS; i++)
+        fn(i);
+    var elapsed = millis() - start - empty;
+    console.log(JSON.stringify({
+        name: name,
+        iterations: ITERATIONS,
+        ms: elapsed,
+        usPerCall: elapsed * 1000 / ITERATIONS
+    }));
+}
+
+measure("hand.noop", function() { bench.handNoop(); });
+measure("bound.noop", function() { bench.boundNoop(); });
+measure("hand.add", function(i) { bench.handAdd(i, 1); });
+measure("bound.add", function(i) { bench.boundAdd(i, 1); });
+measure("hand.mode", function() { bench.handMode("input"); });
+measure("bound.mode", function() { bench.boundMode("input"); });
@@ -0,0 +1,35 @@
+const fs = require("fs");
+
+function delay(time) {
+    return new Promise(function (resolve, reject) {
+        createTimer(time, true, function() { resolve(time); });
+    });
+};
+
+async function main() {
+    // The timer keeps ticking while the file operations are in progress
+    var ticks = 0;
+    createTimer(10, false, function() { ticks++; });
+
+    await fs.writeFile("data/hello.txt", "Hello ");
+    await fs.appendFile("data/hello.txt", "world!");
+    console.log(await fs.readFile("data/hello.txt", "utf8"));
+
+    var content = await fs.readFile("data/hello.txt");
+    console.log("Read " + content.byteLength + " bytes");
+
+    var info = await fs.stat("data/hello.txt");
+    console.log("Size: " + info.size + ", file: " + info.isFile);
+    console.log("Entries: " + (await fs.readdir("data")).join(", "));
+
+    await fs.unlink("data/hello.txt");
+    try {
+        await fs.stat("data/hello.txt");
+    }
+    catch (e) {
+        console.log("Removed: " + e.message);
+    }
+    console.log("Ticks during the test: " + ticks);
+}
+
+main();
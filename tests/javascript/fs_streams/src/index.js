@@ -0,0 +1,70 @@
+const fs = require("fs");
+
+// Write a file larger than the free heap piece by piece respecting the
+// backpressure, then copy it using streams and check the copy.
+const LINE = "0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstu\n";
+const LINE_COUNT = 50000;
+
+function writeData(path) {
+    return new Promise(function (resolve, reject) {
+        var out = fs.createWriteStream(path, { highWaterMark: 4096 });
+        var written = 0;
+        out.on("error", reject);
+        out.on("finish", resolve);
+        function writeMore() {
+            while (written < LINE_COUNT) {
+                written++;
+                if (!out.write(LINE))
+                    return; // Wait for drain
+            }
+            out.end();
+        }
+        out.on("drain", writeMore);
+        writeMore();
+    });
+}
+
+function copy(from, to) {
+    return new Promise(function (resolve, reject) {
+        var input = fs.createReadStream(from, { highWaterMark: 4096 });
+        var output = fs.createWriteStream(to, { highWaterMark: 4096 });
+        input.on("error", reject);
+        output.on("error", reject);
+        output.on("finish", resolve);
+        output.on("drain", function() { input.resume(); });
+        input.on("end", function() { output.end(); });
+        input.on("data", function(chunk) {
+            // The chunk is reused after the listener returns, write copies it
+            if (!output.write(chunk))
+                input.pause();
+        });
+    });
+}
+
+function count(path) {
+    return new Promise(function (resolve, reject) {
+        var size = 0;
+        var input = fs.createReadStream(path);
+        input.on("error", reject);
+        input.on("data", function(chunk) { size += chunk.length; });
+        input.on("end", function() { resolve(size); });
+    });
+}
+
+async function main() {
+    var start = Date.now();
+    await writeData("data/big.txt");
+    console.log("Written in " + (Date.now() - start) + " ms");
+
+    start = Date.now();
+    await copy("data/big.txt", "data/copy.txt");
+    console.log("Copied in " + (Date.now() - start) + " ms");
+
+    var size = await count("data/copy.txt");
+    console.log("Copy size: " + size + ", expected: " + LINE.length * LINE_COUNT);
+
+    await fs.unlink("data/big.txt");
+    await fs.unlink("data/copy.txt");
+}
+
+main();
@@ -0,0 +1,22 @@
+const gc = require("gc");
+
+// Produce garbage in bursts separated by idle gaps; the collections should
+// happen in the gaps, so the burst timer is not delayed by them
+var last = Date.now();
+var worst = 0;
+setInterval(function() {
+    const now = Date.now();
+    worst = Math.max(worst, now - last - 100);
+    last = now;
+
+    var garbage = [];
+    for (var i = 0; i < 200; i++)
+        garbage.push({ index: i, text: "item " + i, list: [i, i + 1] });
+}, 100);
+
+setInterval(function() {
+    const stats = gc.stats();
+    console.log("worst timer delay", worst, "ms, collections", stats.collections,
+        "idle", stats.idleCollections, "max pause", stats.maxPauseUs, "us");
+    worst = 0;
+}, 2000);
\ No newline at end of file
@@ -5,6 +5,13 @@ outputPin.setMode("output");
 
 var inputPin = new gpio.Gpio(16);
 inputPin.setMode("input");
-inputPin.onChange(function(pin, level) {
-    console.log(pin, level);
-});
+// Ignore bounces within 2 ms after an edge
+var handle = inputPin.onChange(function(pin, level, edges) {
+    console.log(pin, level, edges.length, edges.dropped || 0);
+    for (var i = 0; i < edges.length; i++)
+        console.log("  ", edges[i].level, edges[i].time);
+}, 2000);
+
+setTimeout(function() {
+    inputPin.clearInterrupt(handle);
+}, 60000);
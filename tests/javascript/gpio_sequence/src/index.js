@@ -0,0 +1,37 @@
+const gpio = require("gpio");
+
+// Shift in a byte from a 74HC165 shift register
+const LATCH = 5, CLOCK = 18, DATA = 19;
+
+new gpio.Gpio(LATCH).setMode("output");
+new gpio.Gpio(CLOCK).setMode("output");
+new gpio.Gpio(DATA).setMode("input");
+
+function op(code, arg) {
+    return ((code << 28) | arg) >>> 0;
+}
+
+const Op = gpio.Op;
+const readByte = gpio.compileSequence([
+    op(Op.CLEAR, LATCH), op(Op.DELAY, 1), op(Op.SET, LATCH),
+    op(Op.LOOP, 8),
+        op(Op.READ, DATA),
+        op(Op.SET, CLOCK), op(Op.DELAY, 1),
+        op(Op.CLEAR, CLOCK), op(Op.DELAY, 1),
+    op(Op.END_LOOP, 0)
+]);
+
+async function main() {
+    // Both pins are changed by a single register write
+    gpio.writePort((1 << LATCH) | (1 << CLOCK), 1 << LATCH);
+    while (true) {
+        const bits = await readByte.run();
+        var value = 0;
+        for (var i = 0; i < bits.length; i++)
+            value = (value << 1) | bits[i];
+        console.log("Value:", value, "port:", gpio.readPort(1 << DATA));
+        await delay(500);
+    }
+}
+
+main();
@@ -0,0 +1,25 @@
+const heapsnapshot = require("heapsnapshot");
+
+// Leak a few objects per second and store snapshots before and after; compare
+// them on host by
+//   tools/transfer.py pull heap_before.jhs before.jhs
+//   tools/transfer.py pull heap_after.jhs after.jhs
+//   tools/heapsnapshot.py diff before.jhs after.jhs
+// A snapshot of the running program can be taken by
+//   tools/heapsnapshot.py pull now.jhs
+function Listener(id) {
+    this.id = id;
+    this.buffer = new Uint8Array(64);
+}
+
+var listeners = [];
+console.log("before", JSON.stringify(heapsnapshot.write("heap_before.jhs")));
+
+var counter = 0;
+setInterval(function() {
+    listeners.push(new Listener(counter++));
+}, 100);
+
+setTimeout(function() {
+    console.log("after", JSON.stringify(heapsnapshot.write("heap_after.jhs")));
+}, 5000);
\ No newline at end of file
@@ -0,0 +1,20 @@
+// Poll at 500 us and report the jitter of the callbacks against the ideal
+// schedule; the periodic timer does not drift, so the error stays bounded
+const PERIOD = 500;
+
+var start = hrtime();
+var ticks = 0;
+var worst = 0;
+var sum = 0;
+var timer = setIntervalMicros(function() {
+    ticks++;
+    const error = hrtime() - start - ticks * PERIOD;
+    worst = Math.max(worst, error);
+    sum += error;
+}, PERIOD);
+
+setTimeoutMicros(function(label) {
+    clearIntervalMicros(timer);
+    console.log(label, "ticks", ticks, "mean delay", (sum / ticks).toFixed(1),
+        "us, worst", worst.toFixed(1), "us, millis()", millis());
+}, 2000000, "done:");
\ No newline at end of file
@@ -0,0 +1,24 @@
+const kv = require("kv");
+
+// Count the boots of the device and remember the last configuration
+var boots = kv.get("boots") || 0;
+kv.set("boots", boots + 1);
+console.log("Boot number " + (boots + 1));
+
+var config = kv.get("config");
+if (config === undefined) {
+    // Both keys are written or none of them
+    kv.commit({
+        config: { period: 1000, name: "sensor" },
+        installed: new Date().toISOString()
+    });
+    config = kv.get("config");
+}
+console.log("Config: " + JSON.stringify(config) + ", keys: " + kv.keys().join(", "));
+
+// Stress the store to exercise the compaction
+var start = Date.now();
+for (var i = 0; i < 2000; i++)
+    kv.set("counter", i);
+console.log("2000 writes took " + (Date.now() - start) + " ms, counter: " + kv.get("counter"));
+kv.delete("counter");
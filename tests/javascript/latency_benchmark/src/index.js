@@ -0,0 +1,73 @@
+const probe = require("latencyProbe");
+
+// Measure GPIO edge to JavaScript latency under different background loads.
+// Each result is printed as a single JSON line, so the output can be collected
+// and compared between builds, e.g., with different SCHEDULING_POLICY in
+// main.cpp; the policy is included in the result. The probe has to be enabled
+// by ENABLE_LATENCY_PROBE in main.cpp. Set IN_PIN to use an external loopback
+// wire from PIN to IN_PIN instead of the internal one.
+const PIN = 4;
+const IN_PIN = undefined;
+const COUNT = 2000;
+const INTERVAL = 1000;
+
+const profiles = {
+    idle: function() {
+        return function() {};
+    },
+    timers: function() {
+        var timers = [];
+        for (var i = 0; i < 16; i++)
+            timers.push(setInterval(function() {}, 1 + i % 4));
+        return function() {
+            timers.forEach(clearInterval);
+        };
+    },
+    promises: function() {
+        var running = true;
+        function spin(n) {
+            if (running)
+                Promise.resolve(n + 1).then(spin);
+        }
+        for (var i = 0; i < 4; i++)
+            spin(0);
+        return function() {
+            running = false;
+        };
+    },
+    allocations: function() {
+        var garbage = [];
+        var timer = setInterval(function() {
+            for (var i = 0; i < 200; i++)
+                garbage.push({ index: i, text: "item" + i });
+            if (garbage.length > 2000)
+                garbage = [];
+        }, 2);
+        return function() {
+            clearInterval(timer);
+        };
+    }
+};
+
+async function main() {
+    for (var name in profiles) {
+        for (var pass = 0; pass < 2; pass++) {
+            const handler = pass == 1;
+            const stop = profiles[name]();
+            const result = await probe.run({
+                pin: PIN,
+                inPin: IN_PIN,
+                count: COUNT,
+                interval: INTERVAL,
+                callback: handler ? function(latency) {} : undefined
+            });
+            stop();
+            result.profile = name;
+            result.handler = handler;
+            console.log(JSON.stringify(result));
+            await delay(100);
+        }
+    }
+}
+
+main();
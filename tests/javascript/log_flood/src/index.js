@@ -0,0 +1,29 @@
+const log = require("log");
+
+// Log heavily while a timer measures its own jitter; with the asynchronous
+// console the timer is not stalled by the UART, excess lines are dropped
+const flood = log.logger("flood");
+log.setLevel("flood", log.INFO);
+
+var last = Date.now();
+var worst = 0;
+setInterval(function() {
+    const now = Date.now();
+    worst = Math.max(worst, now - last - 10);
+    last = now;
+}, 10);
+
+var counter = 0;
+setInterval(function() {
+    for (var i = 0; i < 50; i++) {
+        flood.debug("compiled into a level check only", i);
+        flood.info("line", counter++, { value: i / 3, ok: true });
+    }
+}, 20);
+
+setInterval(function() {
+    const stats = log.stats();
+    console.warn("worst timer delay", worst, "ms, written", stats.written,
+        "dropped", stats.dropped);
+    worst = 0;
+}, 1000);
@@ -0,0 +1,39 @@
+const net = require("net");
+const dgram = require("dgram");
+
+// TCP echo server on port 7 and UDP echo on port 7; the loopback client
+// checks both once the servers are up
+var clients = 0;
+
+const server = net.listen(7);
+server.on("connection", function(socket) {
+    clients++;
+    socket.on("data", function(data) {
+        // The view is valid only during the listener, write a copy
+        socket.write(new Uint8Array(data));
+    });
+    socket.on("close", function() {
+        clients--;
+    });
+});
+
+const udp = dgram.createSocket(7);
+udp.on("message", function(data, from) {
+    udp.send(new Uint8Array(data), from.port, from.address);
+});
+
+const client = net.connect(7, "127.0.0.1");
+client.on("connect", async function() {
+    await client.write("hello over tcp");
+});
+client.on("data", function(data) {
+    console.log("TCP echo: " + data.length + " bytes, clients: " + clients);
+    client.end();
+});
+
+const probe = dgram.createSocket();
+probe.on("message", function(data, from) {
+    console.log("UDP echo: " + data.length + " bytes from " + from.address + ":" + from.port);
+    probe.close();
+});
+probe.send("hello over udp", 7, "127.0.0.1");
@@ -0,0 +1,26 @@
+// Instrument a hot path with user timing; the entries can be downloaded by
+//   tools/transfer.py dump perf entries.tsv
+function work(n) {
+    var sum = 0;
+    for (var i = 0; i < n; i++)
+        sum += Math.sqrt(i);
+    return sum;
+}
+
+var round = 0;
+setInterval(function() {
+    performance.mark("work-start");
+    work(1000 * (1 + round % 5));
+    performance.mark("work-end");
+    performance.measure("work", "work-start", "work-end");
+
+    if (++round % 10 != 0)
+        return;
+    const measures = performance.getEntriesByName("work", "measure");
+    var total = 0;
+    for (var i = 0; i < measures.length; i++)
+        total += measures[i].duration;
+    console.log("work", measures.length, "runs, mean",
+        (total / measures.length).toFixed(3), "ms at", performance.now().toFixed(3));
+    performance.clearMeasures("work");
+}, 50);
\ No newline at end of file
@@ -0,0 +1,28 @@
+const serial = require("serial");
+
+// Echo everything received on UART 1 (TX 17, RX 16) with a line counter
+const port = new serial.Serial(1, 115200, 17, 16);
+
+var received = 0;
+var lines = 0;
+
+port.on("data", function(data) {
+    // The view is valid only during the listener; copy what has to be kept
+    received += data.length;
+    for (var i = 0; i < data.length; i++) {
+        if (data[i] === 10)
+            lines++;
+    }
+    port.write(new Uint8Array(data));
+});
+
+port.on("close", function() {
+    console.log("Port closed after " + received + " bytes");
+});
+
+async function report() {
+    await port.write("Lines: " + lines + "\n");
+    setTimeout(report, 5000);
+}
+
+report();
@@ -0,0 +1,24 @@
+// Record a timeline of timers, promises and garbage collection; open the
+// result in chrome://tracing or https://ui.perfetto.dev after downloading it by
+//   tools/transfer.py dump trace trace.json
+const trace = require("trace");
+const gc = require("gc");
+
+trace.start();
+
+var ticks = 0;
+const interval = setInterval(function() {
+    var garbage = [];
+    for (var i = 0; i < 200; i++)
+        garbage.push({ index: i });
+    Promise.resolve(ticks).then(function(value) {
+        if (value % 5 == 0)
+            gc.collect();
+    });
+    if (++ticks < 20)
+        return;
+    clearInterval(interval);
+    trace.stop();
+    trace.write("trace.json");
+    console.log("Trace written to trace.json");
+}, 10);
\ No newline at end of file
@@ -0,0 +1,31 @@
+const tslog = require("tslog");
+
+// Measure the write and query throughput of the time series log
+const RECORDS = 20000;
+const QUERIES = 200;
+
+tslog.open(3, 64);
+tslog.clear();
+
+var start = Date.now();
+for (var i = 0; i < RECORDS; i++)
+    tslog.append([i, Math.sin(i / 100), 25.5], i * 10);
+tslog.flush();
+var elapsed = Date.now() - start;
+var stats = tslog.stats();
+console.log("Write: " + Math.round(RECORDS * 1000 / elapsed) + " records/s");
+console.log("Stored " + stats.records + " of " + stats.capacity + " records, "
+    + stats.oldest + " - " + stats.newest);
+
+start = Date.now();
+var found = 0;
+for (var q = 0; q < QUERIES; q++) {
+    var from = stats.oldest + (q * 7919) % (stats.newest - stats.oldest);
+    var result = tslog.query(from, from + 500);
+    found += result.timestamps.length;
+    if (result.values.length !== 3 * result.timestamps.length)
+        console.log("Unexpected result shape");
+}
+elapsed = Date.now() - start;
+console.log("Query: " + Math.round(QUERIES * 1000 / elapsed) + " queries/s, "
+    + found + " records in total");
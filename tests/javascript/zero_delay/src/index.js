@@ -0,0 +1,60 @@
+// Yield to the event loop via zero-delay timers, setImmediate and
+// queueMicrotask; none of them creates a FreeRTOS timer. The test checks that
+// every callback runs exactly once and cancelled ones do not run; it prints
+// PASS or throws.
+const YIELDS = 10000;
+
+function check(condition, message) {
+    if (!condition)
+        throw new Error("FAIL: " + message);
+}
+
+// The callbacks of a broken implementation would never run
+const watchdog = setTimeout(function() {
+    throw new Error("FAIL: zero-delay callbacks did not run in time");
+}, 30000);
+
+function measure(name, yieldFn, done) {
+    var remaining = YIELDS;
+    var calls = 0;
+    const start = millis();
+    function step() {
+        calls++;
+        if (--remaining > 0) {
+            yieldFn(step);
+            return;
+        }
+        const elapsed = millis() - start;
+        check(calls == YIELDS, name + " ran " + calls + " callbacks");
+        console.log(name, (elapsed * 1000 / YIELDS).toFixed(2), "us per yield");
+        done();
+    }
+    yieldFn(step);
+}
+
+function checkCancellation() {
+    var fired = [];
+    const timeout = setTimeout(function() { fired.push("timeout"); }, 0);
+    const immediate = setImmediate(function(a, b) { fired.push("immediate " + (a + b)); }, 1, 2);
+    const cancelled = setImmediate(function() { fired.push("cancelled"); });
+    clearImmediate(cancelled);
+    const cancelledTimeout = setTimeout(function() { fired.push("cancelled timeout"); }, 0);
+    clearTimeout(cancelledTimeout);
+    queueMicrotask(function() { fired.push("microtask"); });
+    setTimeout(function() {
+        // The order depends on the scheduling policy
+        fired.sort();
+        check(fired.join(", ") == "immediate 3, microtask, timeout",
+            "fired " + fired.join(", "));
+        clearTimeout(timeout); // Clearing a fired timer is a no-op
+        clearTimeout(immediate);
+        clearTimeout(watchdog);
+        console.log("PASS");
+    }, 10);
+}
+
+measure("setTimeout(0)", function(f) { setTimeout(f, 0); }, function() {
+    measure("setImmediate", setImmediate, function() {
+        measure("queueMicrotask", queueMicrotask, checkCancellation);
+    });
+});
\ No newline at end of file
@@ -0,0 +1,401 @@
+#!/usr/bin/env python3
+
+import click
+import json
+import struct
+from collections import deque
+from dataclasses import dataclass, field
+
+from transfer import acceptsSerialPort, acceptsCompression, openPort, \
+    jumpIntoUploader, exitUploader, pullDump
+
+# Object classes of Duktape (DUK_HOBJECT_CLASS_*)
+DUKTAPE_CLASSES = ["Object", "Object", "Array", "Function", "Arguments",
+    "Boolean", "Date", "Error", "JSON", "Math", "Number", "RegExp", "String",
+    "global", "Symbol", "ObjEnv", "DecEnv", "Pointer", "Thread", "ArrayBuffer",
+    "DataView", "Int8Array", "Uint8Array", "Uint8ClampedArray", "Int16Array",
+    "Uint16Array", "Int32Array", "Uint32Array", "Float32Array", "Float64Array"]
+
+KIND_OBJECT, KIND_STRING, KIND_BUFFER = 0, 1, 2
+EDGE_PROPERTY, EDGE_GETTER, EDGE_SETTER, EDGE_PROTOTYPE = 0, 1, 2, 3
+
+@dataclass
+class Node:
+    address: int
+    kind: int
+    dukClass: int
+    size: int
+    content: bytes
+    edges: list = field(default_factory=list) # (type, name address, to address)
+    name: str = ""
+    retained: int = 0
+    dominator: int = None
+
+@dataclass
+class Snapshot:
+    uptime: int
+    nodes: dict # address -> Node
+    roots: list # (name, address)
+
+    def string(self, address):
+        node = self.nodes.get(address)
+        if node is None or node.kind != KIND_STRING:
+            return "?"
+        return node.content.decode("utf-8", errors="replace")
+
+    def edgeName(self, type, name):
+        if type == EDGE_PROTOTYPE:
+            return "__proto__"
+        prefix = {EDGE_PROPERTY: "", EDGE_GETTER: "get ", EDGE_SETTER: "set "}[type]
+        return prefix + self.string(name)
+
+def parseSnapshot(data):
+    """
+    Parse the binary snapshot produced by the HeapSnapshot feature (see
+    runtime/components/jacMachine/include/features/heapSnapshot.hpp)
+    """
+    if data[:4] != b"JHS\x01":
+        raise RuntimeError("Not a heap snapshot")
+    uptime, = struct.unpack_from("<I", data, 4)
+    pos = 8
+    nodes, edges, roots = {}, [], []
+    while True:
+        record = data[pos]
+        pos += 1
+        if record == 0x00:
+            nodeCount, edgeCount = struct.unpack_from("<II", data, pos)
+            break
+        if record == 0x01:
+            address, kind, dukClass, size, length = struct.unpack_from("<IBBIB", data, pos)
+            pos += 11
+            nodes[address] = Node(address, kind, dukClass, size, bytes(data[pos:pos + length]))
+            pos += length
+        elif record == 0x02:
+            source, type, name, target = struct.unpack_from("<IBII", data, pos)
+            pos += 13
+            edges.append((source, type, name, target))
+        elif record == 0x03:
+            address, length = struct.unpack_from("<IB", data, pos)
+            pos += 5
+            roots.append((data[pos:pos + length].decode("utf-8"), address))
+            pos += length
+        else:
+            raise RuntimeError(f"Unknown record {record} at offset {pos - 1}")
+    if nodeCount != len(nodes) or edgeCount != len(edges):
+        raise RuntimeError("Truncated snapshot")
+    for source, type, name, target in edges:
+        nodes[source].edges.append((type, name, target))
+    snapshot = Snapshot(uptime, nodes, roots)
+    nameNodes(snapshot)
+    computeRetainedSizes(snapshot)
+    return snapshot
+
+def nameNodes(snapshot):
+    """
+    Name objects by their constructor like the Chrome DevTools do; functions
+    by their name
+    """
+    def property(node, key):
+        for type, name, target in node.edges:
+            if type == EDGE_PROPERTY and snapshot.string(name) == key:
+                return snapshot.nodes.get(target)
+        return None
+
+    def prototype(node):
+        for type, _, target in node.edges:
+            if type == EDGE_PROTOTYPE:
+                return snapshot.nodes.get(target)
+        return None
+
+    for node in snapshot.nodes.values():
+        if node.kind == KIND_STRING:
+            node.name = "(string)"
+            continue
+        if node.kind == KIND_BUFFER:
+            node.name = "(buffer)"
+            continue
+        className = DUKTAPE_CLASSES[node.dukClass] \
+            if node.dukClass < len(DUKTAPE_CLASSES) else "Object"
+        node.name = className
+        if className == "Function":
+            name = property(node, "name")
+            if name is not None and name.kind == KIND_STRING and name.content:
+                node.name = snapshot.string(name.address) + "()"
+            continue
+        proto = prototype(node)
+        constructor = property(proto, "constructor") if proto else None
+        name = property(constructor, "name") if constructor else None
+        if name is not None and name.kind == KIND_STRING and name.content:
+            node.name = snapshot.string(name.address)
+
+def reachableOrder(snapshot):
+    """
+    Return the nodes reachable from the roots in DFS postorder together with
+    their predecessors. None stands for the synthetic root.
+    """
+    predecessors = {None: []}
+    order = []
+    visited = set()
+    successors = lambda address: [target for _, _, target in snapshot.nodes[address].edges]
+    stack = [(None, iter([address for _, address in snapshot.roots]))]
+    while stack:
+        parent, children = stack[-1]
+        child = next(children, None)
+        if child is None:
+            order.append(parent)
+            stack.pop()
+            continue
+        if child not in snapshot.nodes:
+            continue
+        predecessors.setdefault(child, []).append(parent)
+        if child not in visited:
+            visited.add(child)
+            stack.append((child, iter(successors(child))))
+    return order, predecessors
+
+def computeRetainedSizes(snapshot):
+    """
+    Compute the retained sizes via the dominator tree (Cooper, Harvey and
+    Kennedy: A Simple, Fast Dominance Algorithm)
+    """
+    order, predecessors = reachableOrder(snapshot)
+    index = {address: i for i, address in enumerate(order)}
+    dominator = {None: None}
+
+    def intersect(a, b):
+        while a != b:
+            while index[a] < index[b]:
+                a = dominator[a]
+            while index[b] < index[a]:
+                b = dominator[b]
+        return a
+
+    changed = True
+    while changed:
+        changed = False
+        for address in reversed(order[:-1]):
+            processed = [p for p in predecessors[address] if p in dominator]
+            candidate = processed[0]
+            for p in processed[1:]:
+                candidate = intersect(p, candidate)
+            if dominator.get(address, 0) != candidate:
+                dominator[address] = candidate
+                changed = True
+
+    for address in order[:-1]:
+        snapshot.nodes[address].retained += snapshot.nodes[address].size
+        parent = dominator[address]
+        snapshot.nodes[address].dominator = parent
+        if parent is not None:
+            snapshot.nodes[parent].retained += snapshot.nodes[address].retained
+
+def retainingPaths(snapshot):
+    """
+    Return the shortest path from a root for every reachable node
+    """
+    paths = {}
+    queue = deque()
+    for name, address in snapshot.roots:
+        if address in snapshot.nodes and address not in paths:
+            paths[address] = name
+            queue.append(address)
+    while queue:
+        address = queue.popleft()
+        for type, name, target in snapshot.nodes[address].edges:
+            if target in paths or target not in snapshot.nodes:
+                continue
+            paths[target] = f"{paths[address]}.{snapshot.edgeName(type, name)}"
+            queue.append(target)
+    return paths
+
+def summarize(snapshot, reachable):
+    """
+    Return name -> [count, self size] of the reachable nodes
+    """
+    summary = {}
+    for address in reachable:
+        node = snapshot.nodes[address]
+        entry = summary.setdefault(node.name, [0, 0])
+        entry[0] += 1
+        entry[1] += node.size
+    return summary
+
+def toChrome(snapshot):
+    """
+    Return the snapshot in the Chrome DevTools heap snapshot format
+    """
+    strings, stringIndex = [], {}
+    def string(s):
+        if s not in stringIndex:
+            stringIndex[s] = len(strings)
+            strings.append(s)
+        return stringIndex[s]
+
+    nodeTypes = ["hidden", "array", "string", "object", "code", "closure",
+        "regexp", "number", "native", "synthetic", "concatenated string",
+        "sliced string", "symbol", "bigint"]
+    edgeTypes = ["context", "element", "property", "internal", "hidden",
+        "shortcut", "weak"]
+    nodeFields = ["type", "name", "id", "self_size", "edge_count",
+        "trace_node_id", "detachedness"]
+
+    # Strings used only as property names are not referenced by any edge
+    referenced = {target for node in snapshot.nodes.values() for _, _, target in node.edges}
+    referenced.update(address for _, address in snapshot.roots)
+    names = [a for a in snapshot.nodes if a not in referenced]
+
+    ordered = list(snapshot.nodes.values())
+    position = {node.address: (i + 2) * len(nodeFields) for i, node in enumerate(ordered)}
+    nodes, edges = [], []
+
+    def addNode(type, name, id, size, edgeCount):
+        nodes.extend([nodeTypes.index(type), string(name), id, size, edgeCount, 0, 0])
+
+    addNode("synthetic", "", 1, 0, len(snapshot.roots) + 1)
+    for i, (name, address) in enumerate(snapshot.roots):
+        edges.extend([edgeTypes.index("shortcut"), string(name), position[address]])
+    edges.extend([edgeTypes.index("element"), 0, len(nodeFields)])
+    addNode("synthetic", "(property names)", 3, 0, len(names))
+    for i, address in enumerate(names):
+        edges.extend([edgeTypes.index("element"), i, position[address]])
+
+    for node in ordered:
+        if node.kind == KIND_STRING:
+            type, name = "string", node.content.decode("utf-8", errors="replace")
+        elif node.kind == KIND_BUFFER:
+            type, name = "native", node.name
+        elif node.dukClass == 3:
+            type, name = "closure", node.name
+        else:
+            type, name = "object", node.name
+        # Chrome uses even ids for the heap objects
+        addNode(type, name, node.address * 2, node.size, len(node.edges))
+        for edgeType, edgeName, target in node.edges:
+            edges.extend([edgeTypes.index("property"),
+                string(snapshot.edgeName(edgeType, edgeName)), position[target]])
+
+    return {
+        "snapshot": {
+            "meta": {
+                "node_fields": nodeFields,
+                "node_types": [nodeTypes, "string", "number", "number", "number", "number", "number"],
+                "edge_fields": ["type", "name_or_index", "to_node"],
+                "edge_types": [edgeTypes, "string_or_number", "node"],
+                "trace_function_info_fields": [],
+                "trace_node_fields": [],
+                "sample_fields": [],
+                "location_fields": []
+            },
+            "node_count": len(nodes) // len(nodeFields),
+            "edge_count": len(edges) // 3,
+            "trace_function_count": 0
+        },
+        "nodes": nodes,
+        "edges": edges,
+        "trace_function_infos": [],
+        "trace_tree": [],
+        "samples": [],
+        "locations": [],
+        "strings": strings
+    }
+
+def printTable(rows, header):
+    widths = [max(len(str(x)) for x in column) for column in zip(header, *rows)]
+    for row in [header] + rows:
+        print("  ".join(str(x).rjust(w) if i else str(x).ljust(w)
+            for i, (x, w) in enumerate(zip(row, widths))))
+
+@click.command()
+@acceptsSerialPort
+@acceptsCompression
+@click.argument("target", type=click.File("wb"))
+def pull(port, baudrate, compress, target):
+    """
+    Take a heap snapshot of the running program
+    """
+    with openPort(port, baudrate) as s:
+        jumpIntoUploader(s)
+        target.write(pullDump(s, "heap", compress))
+        exitUploader(s)
+
+@click.command()
+@click.argument("source", type=click.File("rb"))
+@click.argument("target", type=click.File("w"))
+def convert(source, target):
+    """
+    Convert the snapshot to the Chrome heap snapshot (.heapsnapshot)
+    """
+    json.dump(toChrome(parseSnapshot(source.read())), target)
+
+@click.command()
+@click.argument("source", type=click.File("rb"))
+@click.option("--limit", type=int, default=20, help="Number of rows to show")
+def summary(source, limit):
+    """
+    Show the biggest object groups and retainers
+    """
+    snapshot = parseSnapshot(source.read())
+    paths = retainingPaths(snapshot)
+    groups = summarize(snapshot, paths.keys())
+    total = sum(size for _, size in groups.values())
+    print(f"{len(paths)} reachable values, {total} B, uptime {snapshot.uptime} ms\n")
+    rows = sorted(groups.items(), key=lambda x: -x[1][1])[:limit]
+    printTable([[name, count, size] for name, (count, size) in rows],
+        ["Name", "Count", "Size"])
+    print()
+    biggest = sorted(paths.keys(), key=lambda a: -snapshot.nodes[a].retained)
+    biggest = [a for a in biggest if snapshot.nodes[a].kind == KIND_OBJECT][:limit]
+    printTable([[paths[a], snapshot.nodes[a].name, snapshot.nodes[a].retained] for a in biggest],
+        ["Path", "Name", "Retained"])
+
+@click.command()
+@click.argument("before", type=click.File("rb"))
+@click.argument("after", type=click.File("rb"))
+@click.option("--limit", type=int, default=20, help="Number of rows to show")
+def diff(before, after, limit):
+    """
+    Compare two snapshots; show the groups that grew and the new objects that
+    retain the most memory
+    """
+    a = parseSnapshot(before.read())
+    b = parseSnapshot(after.read())
+    pathsA, pathsB = retainingPaths(a), retainingPaths(b)
+    groupsA, groupsB = summarize(a, pathsA.keys()), summarize(b, pathsB.keys())
+    rows = []
+    for name in groupsA.keys() | groupsB.keys():
+        countA, sizeA = groupsA.get(name, [0, 0])
+        countB, sizeB = groupsB.get(name, [0, 0])
+        if countA != countB or sizeA != sizeB:
+            rows.append([name, countB - countA, sizeB - sizeA, countB, sizeB])
+    rows.sort(key=lambda r: -r[2])
+    totalA = sum(size for _, size in groupsA.values())
+    totalB = sum(size for _, size in groupsB.values())
+    print(f"Reachable size {totalA} B -> {totalB} B ({totalB - totalA:+d} B) "
+          f"in {b.uptime - a.uptime} ms\n")
+    printTable([[r[0], f"{r[1]:+d}", f"{r[2]:+d}", r[3], r[4]] for r in rows[:limit]],
+        ["Name", "+Count", "+Size", "Count", "Size"])
+    print()
+
+    # An address reused by an object of a different kind counts as new
+    def isNew(address):
+        old = a.nodes.get(address)
+        return address not in pathsA or old.name != b.nodes[address].name
+    new = {x for x in pathsB if isNew(x)}
+    # Show only the new objects not dominated by other new ones
+    tops = [x for x in new if b.nodes[x].kind == KIND_OBJECT
+        and b.nodes[x].dominator not in new]
+    tops.sort(key=lambda x: -b.nodes[x].retained)
+    printTable([[pathsB[x], b.nodes[x].name, b.nodes[x].retained] for x in tops[:limit]],
+        ["New object", "Name", "Retained"])
+
+@click.group()
+def cli():
+    pass
+
+cli.add_command(pull)
+cli.add_command(convert)
+cli.add_command(summary)
+cli.add_command(diff)
+
+if __name__ == "__main__":
+    cli()
@@ -4,10 +4,12 @@ import click
 import serial
 import serial.tools.list_ports
 import base64
+import hashlib
 import time
 from dataclasses import dataclass
 from enum import Enum
 import os
+import socket
 
 class FileType(Enum):
     File = 1
@@ -18,6 +20,74 @@ class FsEntry:
     name: str
     type: FileType
 
+# Parameters of the LZSS codec, they have to match runtime's lzss.hpp
+LZSS_WINDOW_BITS = 10
+LZSS_LENGTH_BITS = 6
+LZSS_MIN_MATCH = 3
+LZSS_MAX_MATCH = LZSS_MIN_MATCH + (1 << LZSS_LENGTH_BITS) - 1
+
+def lzssCompress(data):
+    """
+    Compress data with the small-window LZSS codec understood by the uploader
+    (see runtime/components/jacStorage/include/lzss.hpp for the format)
+    """
+    window = 1 << LZSS_WINDOW_BITS
+    out = bytearray()
+    positions = {} # 3-byte prefix -> list of positions
+    pos = 0
+    tokens = []
+    while pos < len(data):
+        bestLength, bestOffset = 0, 0
+        maxLength = min(LZSS_MAX_MATCH, len(data) - pos)
+        if maxLength >= LZSS_MIN_MATCH:
+            for candidate in reversed(positions.get(data[pos:pos + LZSS_MIN_MATCH], [])):
+                if pos - candidate > window:
+                    break
+                length = LZSS_MIN_MATCH
+                while length < maxLength and data[candidate + length] == data[pos + length]:
+                    length += 1
+                if length > bestLength:
+                    bestLength, bestOffset = length, pos - candidate
+                    if length == maxLength:
+                        break
+        step = bestLength if bestLength >= LZSS_MIN_MATCH else 1
+        for i in range(pos, pos + step):
+            positions.setdefault(data[i:i + LZSS_MIN_MATCH], []).append(i)
+        if bestLength >= LZSS_MIN_MATCH:
+            word = (bestOffset - 1) << LZSS_LENGTH_BITS | (bestLength - LZSS_MIN_MATCH)
+            tokens.append(bytes([word >> 8, word & 0xFF]))
+        else:
+            tokens.append(bytes([data[pos]]))
+        pos += step
+    for i in range(0, len(tokens), 8):
+        group = tokens[i:i + 8]
+        flags = sum(1 << j for j, t in enumerate(group) if len(t) == 1)
+        out.append(flags)
+        for t in group:
+            out += t
+    return bytes(out)
+
+def lzssDecompress(data):
+    out = bytearray()
+    pos = 0
+    while pos < len(data):
+        flags = data[pos]
+        pos += 1
+        for i in range(8):
+            if pos >= len(data):
+                break
+            if flags & (1 << i):
+                out.append(data[pos])
+                pos += 1
+            else:
+                word = data[pos] << 8 | data[pos + 1]
+                pos += 2
+                offset = (word >> LZSS_LENGTH_BITS) + 1
+                length = (word & ((1 << LZSS_LENGTH_BITS) - 1)) + LZSS_MIN_MATCH
+                for _ in range(length):
+                    out.append(out[-offset])
+    return bytes(out)
+
 def getPortPath(userSpec):
     if userSpec is not None:
         return userSpec
@@ -28,9 +98,70 @@ def getPortPath(userSpec):
         raise RuntimeError("Multiple devices available, please choose one")
     return ports[0].device
 
+class TcpPort:
+    """
+    Connection to the network uploader (see initializeNetworkUploader) with the
+    subset of the serial.Serial interface used by this tool
+    """
+    def __init__(self, address):
+        host, _, port = address.rpartition(":")
+        self.sock = socket.create_connection((host, int(port)))
+        self.buffer = bytearray()
+        self.timeout = None
+        self.rts = True # There is no reset line
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.sock.close()
+
+    def write(self, data):
+        self.sock.sendall(data)
+
+    def receive(self, condition):
+        self.sock.settimeout(self.timeout)
+        try:
+            while not condition():
+                chunk = self.sock.recv(64 * 1024)
+                if not chunk:
+                    break
+                self.buffer += chunk
+        except socket.timeout:
+            pass
+
+    def read(self, size):
+        self.receive(lambda: len(self.buffer) >= size)
+        data = bytes(self.buffer[:size])
+        del self.buffer[:size]
+        return data
+
+    def readline(self):
+        self.receive(lambda: b"\n" in self.buffer)
+        end = self.buffer.find(b"\n") + 1 or len(self.buffer)
+        return self.read(end)
+
+def openPort(port, baudrate):
+    """
+    Open the serial port or the network uploader given as tcp://host:port
+    """
+    if port is not None and port.startswith("tcp://"):
+        return TcpPort(port[len("tcp://"):])
+    return serial.Serial(getPortPath(port), baudrate)
+
+def pacing(port, delay):
+    """
+    Return the delay between chunks; only the UART needs pacing
+    """
+    return 0 if isinstance(port, TcpPort) else delay
+
+def acceptsCompression(function):
+    return click.option("--compress/--no-compress", default=True,
+        help="Transfer files compressed")(function)
+
 def acceptsSerialPort(function):
     function = click.option("-p", "--port", type=str, default=None,
-        help="Serial port")(function)
+        help="Serial port or tcp://host:port of the network uploader")(function)
     function = click.option("-b", "--baudrate", type=int, default=921600,
         help="Baudrate")(function)
     return function
@@ -65,6 +196,23 @@ def listTargetEntries(port):
         res.append(FsEntry(l[1], type))
     return res
 
+def readManifest(port):
+    """
+    Return a dictionary mapping target file names (relative to the storage
+    root) to a tuple (size, sha256 hex digest)
+    """
+    port.write("MANIFEST\n".encode("utf-8"))
+    res = {}
+    while True:
+        l = port.readline().decode("utf-8").strip()
+        if len(l) == 0:
+            break
+        if l.startswith("ERROR"):
+            raise RuntimeError(l)
+        _, size, digest, name = l.split(" ", 3)
+        res[name.lstrip("/")] = (int(size), digest)
+    return res
+
 def delete(port, entry):
     port.write(f"REMOVE {entry}\n".encode("utf-8"))
     print(port.readline())
@@ -76,34 +224,53 @@ def isHiddenFile(path):
     path = os.path.normpath(path)
     return any([x[0] == "." and x != "." and x != ".." for x in path.split(os.sep)])
 
+def pushFile(port, name, content, chunkSize, delay, compress=False):
+    command = "PUSH"
+    if compress:
+        command = "PUSHZ"
+        content = lzssCompress(content)
+    content = base64.b64encode(content).decode("utf-8")
+    message = f"{command} {name} {content}\n".encode("utf-8")
+    for chunk in [message[i:i + chunkSize] for i in range(0, len(message), chunkSize)]:
+        port.write(chunk)
+        time.sleep(pacing(port, delay))
+    return port.readline()
+
 @click.command()
 @acceptsSerialPort
 @click.option("-d", "--dir", type=click.Path(file_okay=False, dir_okay=True, exists=True), default=None)
-def sync(port, baudrate, dir):
-    toUpload = []
+@click.option("--full", is_flag=True, default=False,
+    help="Remove everything from the target and upload all files")
+@acceptsCompression
+def sync(port, baudrate, dir, full, compress):
+    local = {}
     for root, dirs, files in os.walk(dir):
         files = [f for f in files if not isHiddenFile(os.path.join(root, f))]
         for f in files:
             with open(os.path.join(root, f), "rb") as file:
-                content = base64.b64encode(file.read()).decode("utf-8")
+                content = file.read()
             name = os.path.join(root, f)
-            name = os.path.relpath(name, dir)
-            toUpload.append((name, content))
-    with serial.Serial(getPortPath(port), baudrate) as s:
+            name = os.path.relpath(name, dir).replace(os.sep, "/")
+            local[name] = content
+    with openPort(port, baudrate) as s:
         # Windows restarts ESP32, so there will be bootloader message
         time.sleep(1)
         clearPort(s)
         jumpIntoUploader(s)
-        for entry in listTargetEntries(s):
-            delete(s, entry.name)
-        for f, content in toUpload:
-            message = f"PUSH {f} {content}\n".encode("utf-8")
-            print(message)
-            CHUNK_SIZE = 256
-            for chunk in [message[i:i + CHUNK_SIZE] for i in range(0, len(message), CHUNK_SIZE)]:
-                s.write(chunk)
-                time.sleep(0.2)
-            print(s.readline())
+        if full:
+            for entry in listTargetEntries(s):
+                delete(s, entry.name)
+            toUpload = list(local.keys())
+        else:
+            remote = readManifest(s)
+            for name in remote.keys() - local.keys():
+                delete(s, name)
+            toUpload = [name for name, content in local.items()
+                if remote.get(name) != (len(content), hashlib.sha256(content).hexdigest())]
+            print(f"{len(toUpload)} of {len(local)} files changed")
+        for name in toUpload:
+            print(f"Pushing {name}")
+            print(pushFile(s, name, local[name], 256, 0.2, compress))
         exitUploader(s)
 
 @click.command()
@@ -112,37 +279,199 @@ def sync(port, baudrate, dir):
 def read(port, dir):
     pass
 
+def readIoStats(port):
+    """
+    Return cumulative write statistics of the device: bytes written, write
+    calls, sync calls and time spent in them in microseconds
+    """
+    port.write("IOSTATS\n".encode("utf-8"))
+    return [int(x) for x in port.readline().split()]
+
+def pullFile(port, source, compress=False):
+    command = "PULLZ" if compress else "PULL"
+    port.write(f"{command} {source}\n".encode("utf-8"))
+    content = base64.b64decode(port.readline().strip())
+    if compress:
+        content = lzssDecompress(content)
+    return content
+
+def pullDump(port, name, compress=False):
+    """
+    Return the data of a dump source of the device, e.g., "heap"
+    """
+    command = "DUMPZ" if compress else "DUMP"
+    port.write(f"{command} {name}\n".encode("utf-8"))
+    line = port.readline().strip()
+    if line.startswith(b"ERROR"):
+        raise RuntimeError(line.decode("utf-8"))
+    content = base64.b64decode(line)
+    if compress:
+        content = lzssDecompress(content)
+    return content
+
 @click.command()
 @acceptsSerialPort
+@acceptsCompression
 @click.argument("source", type=click.Path(exists=True, file_okay=True, dir_okay=False))
 @click.argument("target", type=str)
-def push(port, baudrate, source, target):
-    with serial.Serial(getPortPath(port), baudrate) as s:
+def push(port, baudrate, compress, source, target):
+    with openPort(port, baudrate) as s:
         jumpIntoUploader(s)
-        content = base64.b64encode(open(source, "rb").read()).decode("utf-8")
-        message = f"PUSH {target} {content}\n".encode("utf-8")
-        CHUNK_SIZE = 1024
-        for chunk in [message[i:i + CHUNK_SIZE] for i in range(0, len(message), CHUNK_SIZE)]:
-            s.write(chunk)
-            time.sleep(0.1)
-        print(s.readline())
+        print(pushFile(s, target, open(source, "rb").read(), 1024, 0.1, compress))
         print(exitUploader(s))
 
 @click.command()
 @acceptsSerialPort
+@acceptsCompression
 @click.argument("source", type=str)
 @click.argument("target", type=click.File("wb"))
-def pull(port, baudrate, source, target):
-    with serial.Serial(getPortPath(port), baudrate) as s:
+def pull(port, baudrate, compress, source, target):
+    with openPort(port, baudrate) as s:
         jumpIntoUploader(s)
-        s.write(f"PULL {source}\n".encode("utf-8"))
-        content = s.readline()[:-2]
-        target.write(base64.b64decode(content))
+        target.write(pullFile(s, source, compress))
+
+@click.command()
+@acceptsSerialPort
+@acceptsCompression
+@click.argument("name", type=str)
+@click.argument("target", type=click.File("wb"))
+def dump(port, baudrate, compress, name, target):
+    """
+    Download the data of a dump source of the device, e.g., "heap"
+    """
+    with openPort(port, baudrate) as s:
+        jumpIntoUploader(s)
+        target.write(pullDump(s, name, compress))
+        exitUploader(s)
+
+@click.command()
+@acceptsSerialPort
+@click.argument("source", type=click.Path(exists=True, file_okay=True, dir_okay=False))
+@click.option("--target", type=str, default="__benchmark.bin",
+    help="Name of the temporary file on the target")
+def benchmark(port, baudrate, source, target):
+    """
+    Measure end-to-end transfer time of a file with and without compression
+    """
+    content = open(source, "rb").read()
+    compressedSize = len(lzssCompress(content))
+    print(f"File size: {len(content)} B, compressed: {compressedSize} B "
+          f"(ratio {len(content) / max(compressedSize, 1):.2f})")
+    with openPort(port, baudrate) as s:
+        jumpIntoUploader(s)
+        for compress in [False, True]:
+            statsBefore = readIoStats(s)
+            start = time.time()
+            response = pushFile(s, target, content, 1024, 0, compress)
+            pushTime = time.time() - start
+            written, writeCalls, syncCalls, writeUs = \
+                [a - b for a, b in zip(readIoStats(s), statsBefore)]
+            start = time.time()
+            pulled = pullFile(s, target, compress)
+            pullTime = time.time() - start
+            if pulled != content:
+                raise RuntimeError(f"Content mismatch, push response: {response}")
+            label = "compressed" if compress else "plain"
+            print(f"{label:>10}: push {pushTime:.3f} s, pull {pullTime:.3f} s")
+            print(f"{'':>10}  flash: {writeCalls} writes, {syncCalls} syncs, "
+                  f"{writeUs / max(written / 1024, 1):.0f} us/kB")
+        delete(s, target)
+        exitUploader(s)
+
+def buildBundle(files):
+    """
+    Serialize a dictionary name -> content into a bundle understood by the
+    uploader (see runtime/components/jacStorage/include/bundle.hpp)
+    """
+    out = bytearray()
+    for name, content in files.items():
+        name = name.encode("utf-8")
+        out += len(name).to_bytes(2, "big") + name
+        out += len(content).to_bytes(4, "big") + content
+    out += (0).to_bytes(2, "big")
+    return bytes(out)
+
+def parseBundle(data):
+    files = {}
+    pos = 0
+    while True:
+        nameLen = int.from_bytes(data[pos:pos + 2], "big")
+        pos += 2
+        if nameLen == 0:
+            return files
+        name = data[pos:pos + nameLen].decode("utf-8")
+        pos += nameLen
+        size = int.from_bytes(data[pos:pos + 4], "big")
+        pos += 4
+        if pos + size > len(data):
+            raise RuntimeError("Truncated bundle")
+        files[name] = data[pos:pos + size]
+        pos += size
+
+@click.command()
+@acceptsSerialPort
+@acceptsCompression
+@click.option("-d", "--dir", type=click.Path(file_okay=False, dir_okay=True, exists=True), default=None)
+def deploy(port, baudrate, compress, dir):
+    """
+    Replace the whole content of the target storage with the directory in a
+    single atomic operation
+    """
+    local = {}
+    for root, dirs, files in os.walk(dir):
+        for f in files:
+            path = os.path.join(root, f)
+            if isHiddenFile(path):
+                continue
+            name = os.path.relpath(path, dir).replace(os.sep, "/")
+            local[name] = open(path, "rb").read()
+    bundle = buildBundle(local)
+    command = "DEPLOY"
+    if compress:
+        command = "DEPLOYZ"
+        bundle = lzssCompress(bundle)
+    message = f"{command} {base64.b64encode(bundle).decode('utf-8')}\n".encode("utf-8")
+    print(f"Deploying {len(local)} files in {len(message)} B")
+    with openPort(port, baudrate) as s:
+        time.sleep(1)
+        clearPort(s)
+        jumpIntoUploader(s)
+        CHUNK_SIZE = 1024
+        for chunk in [message[i:i + CHUNK_SIZE] for i in range(0, len(message), CHUNK_SIZE)]:
+            s.write(chunk)
+            time.sleep(pacing(s, 0.1))
+        print(s.readline())
+        exitUploader(s)
+
+@click.command("export")
+@acceptsSerialPort
+@acceptsCompression
+@click.option("--prefix", type=str, default="/",
+    help="Export only the given subtree")
+@click.argument("target", type=click.Path(file_okay=False, dir_okay=True))
+def exportTree(port, baudrate, compress, prefix, target):
+    """
+    Download the content of the target storage into a directory
+    """
+    with openPort(port, baudrate) as s:
+        jumpIntoUploader(s)
+        command = "EXPORTZ" if compress else "EXPORT"
+        s.write(f"{command} {prefix}\n".encode("utf-8"))
+        content = base64.b64decode(s.readline().strip())
+        if compress:
+            content = lzssDecompress(content)
+        for name, data in parseBundle(content).items():
+            path = os.path.join(target, *name.split("/"))
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, "wb") as f:
+                f.write(data)
+            print(name)
+        exitUploader(s)
 
 @click.command("list")
 @acceptsSerialPort
 def listContent(port, baudrate):
-    with serial.Serial(getPortPath(port), baudrate) as s:
+    with openPort(port, baudrate) as s:
         for l in listTargetEntries(s):
             if l.type == FileType.File:
                 print(l.name)
@@ -156,6 +485,10 @@ cli.add_command(read)
 cli.add_command(push)
 cli.add_command(pull)
 cli.add_command(listContent)
+cli.add_command(benchmark)
+cli.add_command(deploy)
+cli.add_command(exportTree)
+cli.add_command(dump)
 
 if __name__ == "__main__":
     cli()
\ No newline at end of file